@@ -0,0 +1,268 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_containers.cpp
+
+    @brief Node-based container throughput using each memory resource, versus
+           a malloc-backed allocator.
+
+    A binary search tree keyed by random integers stands in for a map: every
+    insert allocates a node and every erase frees one, through the
+    container's allocator.  The tree is filled to BENCH_NODES entries, then
+    churned with random inserts and erases.  The malloc-backed allocator is
+    used directly (as std::allocator would be), while the resources are used
+    through Allocator<T>, including its type-erased dispatch.  Results are
+    printed as CSV:
+
+    resource,ops,ops_per_sec,failures
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mark3.h"
+#include "memory_resource.h"
+#include "bench_util.h"
+
+#define BENCH_STACK_SIZE (2048)
+#define BENCH_NODES (1024)
+#define BENCH_CHURN_OPS (200000)
+#define BENCH_NODE_SIZE (32)
+#define BENCH_HEAP_SIZE (131072)
+
+#define BENCH_SLAB_PAGE_SIZE (1024)
+#define BENCH_SLAB_PAGES (BENCH_HEAP_SIZE / BENCH_SLAB_PAGE_SIZE)
+
+using namespace Mark3;
+
+namespace
+{
+//---------------------------------------------------------------------------
+// Allocator with the same interface as Allocator<T>, calling malloc/free
+// directly - the reference point for the resources.
+template <typename T>
+class MallocAllocator
+{
+public:
+    typedef T value_type;
+
+    T*   allocate(size_t uCount_) { return static_cast<T*>(malloc(uCount_ * sizeof(T))); }
+    void deallocate(T* pclData_, size_t /*uCount_*/) { free(pclData_); }
+};
+
+//---------------------------------------------------------------------------
+typedef struct BenchNode {
+    uint32_t          u32Key;
+    uint32_t          u32Value;
+    struct BenchNode* pstLeft;
+    struct BenchNode* pstRight;
+} bench_node_t;
+
+//---------------------------------------------------------------------------
+// Unbalanced binary search tree, allocating its nodes from Alloc
+template <typename Alloc>
+class BenchMap
+{
+public:
+    BenchMap(const Alloc& clAlloc_) : m_clAlloc(clAlloc_), m_pstRoot(nullptr), m_u32Size(0) {}
+
+    bool Insert(uint32_t u32Key_, uint32_t u32Value_)
+    {
+        auto** ppstLink = &m_pstRoot;
+        while (*ppstLink) {
+            if ((*ppstLink)->u32Key == u32Key_) {
+                (*ppstLink)->u32Value = u32Value_;
+                return true;
+            }
+            ppstLink = (u32Key_ < (*ppstLink)->u32Key) ? &(*ppstLink)->pstLeft : &(*ppstLink)->pstRight;
+        }
+        auto* pstNode = m_clAlloc.allocate(1);
+        if (pstNode == nullptr) {
+            return false;
+        }
+        pstNode->u32Key   = u32Key_;
+        pstNode->u32Value = u32Value_;
+        pstNode->pstLeft  = nullptr;
+        pstNode->pstRight = nullptr;
+        *ppstLink         = pstNode;
+        m_u32Size++;
+        return true;
+    }
+
+    bool Erase(uint32_t u32Key_)
+    {
+        auto** ppstLink = &m_pstRoot;
+        while (*ppstLink && ((*ppstLink)->u32Key != u32Key_)) {
+            ppstLink = (u32Key_ < (*ppstLink)->u32Key) ? &(*ppstLink)->pstLeft : &(*ppstLink)->pstRight;
+        }
+        auto* pstNode = *ppstLink;
+        if (pstNode == nullptr) {
+            return false;
+        }
+
+        if (pstNode->pstLeft && pstNode->pstRight) {
+            // Replace with the in-order successor
+            auto** ppstSucc = &pstNode->pstRight;
+            while ((*ppstSucc)->pstLeft) {
+                ppstSucc = &(*ppstSucc)->pstLeft;
+            }
+            auto* pstSucc     = *ppstSucc;
+            *ppstSucc         = pstSucc->pstRight;
+            pstSucc->pstLeft  = pstNode->pstLeft;
+            pstSucc->pstRight = pstNode->pstRight;
+            *ppstLink         = pstSucc;
+        } else {
+            *ppstLink = pstNode->pstLeft ? pstNode->pstLeft : pstNode->pstRight;
+        }
+        m_clAlloc.deallocate(pstNode, 1);
+        m_u32Size--;
+        return true;
+    }
+
+    void Clear(void)
+    {
+        while (m_pstRoot) {
+            Erase(m_pstRoot->u32Key);
+        }
+    }
+
+    uint32_t GetSize(void) { return m_u32Size; }
+
+private:
+    Alloc         m_clAlloc;
+    bench_node_t* m_pstRoot;
+    uint32_t      m_u32Size;
+};
+
+//---------------------------------------------------------------------------
+// Heap storage, shared by each resource in turn
+K_WORD awHeap[BENCH_HEAP_SIZE / sizeof(K_WORD)];
+
+Arena         clArena;
+K_ADDR        auArenaSizes[] = { sizeof(bench_node_t), 64, 256, 1024 }; // Freed nodes return to the first list
+ArenaResource clArenaResource;
+
+FixedHeap         clFixedHeap;
+HeapConfig        aclFixedConfig[] = { { .m_uBlockSize = BENCH_NODE_SIZE, .m_uBlockCount = BENCH_NODES + 64 },
+                                       { .m_uBlockSize = 0 } };
+FixedHeapResource clFixedResource;
+
+Slab         clSlab;
+bool         abSlabPageUsed[BENCH_SLAB_PAGES];
+SlabResource clSlabResource;
+
+BitmapAllocator clBitmap;
+BitmapResource  clBitmapResource;
+
+Thread clAppThread;
+K_WORD awAppStack[BENCH_STACK_SIZE / sizeof(K_WORD)];
+
+uint32_t u32Random;
+
+//---------------------------------------------------------------------------
+void* SlabPageAlloc(uint32_t* pu32PageSize_)
+{
+    for (int i = 0; i < BENCH_SLAB_PAGES; i++) {
+        if (!abSlabPageUsed[i]) {
+            abSlabPageUsed[i] = true;
+            *pu32PageSize_    = BENCH_SLAB_PAGE_SIZE;
+            return reinterpret_cast<void*>((K_ADDR)awHeap + (i * BENCH_SLAB_PAGE_SIZE));
+        }
+    }
+    return nullptr;
+}
+
+void SlabPageFree(void* pvPage_)
+{
+    abSlabPageUsed[((K_ADDR)pvPage_ - (K_ADDR)awHeap) / BENCH_SLAB_PAGE_SIZE] = false;
+}
+
+//---------------------------------------------------------------------------
+template <typename Alloc>
+void RunBenchmark(const char* szName_, const Alloc& clAlloc_)
+{
+    BenchMap<Alloc> clMap(clAlloc_);
+    u32Random = 0x2545F491;
+
+    uint32_t u32Ops      = 0;
+    uint32_t u32Failures = 0;
+    auto     u32StartMs  = Kernel::GetTicks();
+
+    // Fill, then churn around the same number of entries
+    while (clMap.GetSize() < BENCH_NODES) {
+        if (!clMap.Insert(NextRandom(&u32Random) % (BENCH_NODES * 2), u32Ops)) {
+            u32Failures++;
+            break;
+        }
+        u32Ops++;
+    }
+    for (uint32_t i = 0; i < BENCH_CHURN_OPS; i++) {
+        auto u32Key = NextRandom(&u32Random) % (BENCH_NODES * 2);
+        if (clMap.GetSize() >= BENCH_NODES) {
+            clMap.Erase(u32Key);
+        } else if (!clMap.Insert(u32Key, i)) {
+            u32Failures++;
+        }
+        u32Ops++;
+    }
+    clMap.Clear();
+
+    auto u32ElapsedMs = Kernel::GetTicks() - u32StartMs;
+    if (u32ElapsedMs == 0) {
+        u32ElapsedMs = 1;
+    }
+    printf("%s,%lu,%lu,%lu\n",
+           szName_,
+           (unsigned long)u32Ops,
+           (unsigned long)(((uint64_t)u32Ops * 1000) / u32ElapsedMs),
+           (unsigned long)u32Failures);
+}
+
+//---------------------------------------------------------------------------
+void AppMain(void* /*pvArg_*/)
+{
+    printf("resource,ops,ops_per_sec,failures\n");
+
+    RunBenchmark("malloc", MallocAllocator<bench_node_t>());
+
+    clArena.Init(awHeap, sizeof(awHeap), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+    clArenaResource.Init(&clArena);
+    RunBenchmark("Arena", Allocator<bench_node_t>(&clArenaResource));
+
+    clFixedHeap.Create(awHeap, aclFixedConfig);
+    clFixedResource.Init(&clFixedHeap);
+    RunBenchmark("FixedHeap", Allocator<bench_node_t>(&clFixedResource));
+
+    clSlab.Init(BENCH_NODE_SIZE, SlabPageAlloc, SlabPageFree);
+    clSlabResource.Init(&clSlab, 1);
+    RunBenchmark("Slab", Allocator<bench_node_t>(&clSlabResource));
+
+    clBitmap.Init(awHeap, sizeof(awHeap), BENCH_NODE_SIZE);
+    clBitmapResource.Init(&clBitmap, BENCH_NODE_SIZE);
+    RunBenchmark("BitmapAllocator", Allocator<bench_node_t>(&clBitmapResource));
+
+    while (1) { Thread::Sleep(1000); }
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+int main(void)
+{
+    Kernel::Init();
+
+    clAppThread.Init(awAppStack, sizeof(awAppStack), 1, AppMain, 0);
+    clAppThread.Start();
+
+    Kernel::Start();
+    return 0;
+}
@@ -0,0 +1,351 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_heap.cpp
+
+    @brief Single-threaded micro-benchmarks for each of the heap allocators,
+           and the toolchain's malloc/free for reference.
+
+    Each allocator is run through a set of workloads:
+
+    - lifo:     allocate a batch of fixed-size objects, free them in reverse
+    - fifo:     producer/consumer queue - objects are freed in the order in
+                which they were allocated
+    - random:   random sizes, freed in random order
+    - fragment: interleaved small/large objects, with the small objects freed
+                and medium-sized objects allocated into the gaps
+
+    Allocators limited to a single object size (BitmapAllocator, Slab) only
+    run the fixed-size workloads.  The cost of each allocate/free is measured
+    in cycles (or the finest timer available on the target), and summarized
+    as a log-linear histogram.  Results are printed as CSV:
+
+    allocator,workload,ops,ops_per_sec,p50,p99,p999,max,failures
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mark3.h"
+#include "arena.h"
+#include "bitmap_allocator.h"
+#include "fixed_heap.h"
+#include "slab.h"
+#include "bench_util.h"
+
+#define BENCH_STACK_SIZE (2048)
+#define BENCH_ROUNDS (1000)
+#define BENCH_BATCH (256)
+#define BENCH_FIXED_SIZE (32)
+#define BENCH_MIN_SIZE (8)
+#define BENCH_MAX_SIZE (256)
+#define BENCH_HEAP_SIZE (65536)
+
+#define BENCH_SLAB_PAGE_SIZE (1024)
+#define BENCH_SLAB_PAGES (BENCH_HEAP_SIZE / BENCH_SLAB_PAGE_SIZE)
+
+using namespace Mark3;
+
+namespace
+{
+//---------------------------------------------------------------------------
+// Interface used to run the same workloads against each allocator
+typedef void (*bench_init_function_t)(void);
+typedef void* (*bench_alloc_function_t)(size_t uSize_);
+typedef void (*bench_free_function_t)(void* pvData_);
+
+typedef struct {
+    const char*            szName;
+    bench_init_function_t  pfInit;
+    bench_alloc_function_t pfAlloc;
+    bench_free_function_t  pfFree;
+    bool                   bFixedSize; //!< Only supports BENCH_FIXED_SIZE allocations
+} bench_allocator_t;
+
+typedef void (*bench_workload_function_t)(const bench_allocator_t* pstAlloc_);
+
+typedef struct {
+    const char*               szName;
+    bench_workload_function_t pfRun;
+    bool                      bFixedSize; //!< Only uses BENCH_FIXED_SIZE allocations
+} bench_workload_t;
+
+//---------------------------------------------------------------------------
+// Heap storage, shared by each allocator in turn
+K_WORD awHeap[BENCH_HEAP_SIZE / sizeof(K_WORD)];
+
+Arena  clArena;
+K_ADDR auArenaSizes[] = { 16, 32, 64, 128, 256, 512, 1024 };
+
+FixedHeap  clFixedHeap;
+HeapConfig aclFixedConfig[] = {
+    { .m_uBlockSize = 16, .m_uBlockCount = 256 },  { .m_uBlockSize = 32, .m_uBlockCount = 256 },
+    { .m_uBlockSize = 64, .m_uBlockCount = 128 },  { .m_uBlockSize = 128, .m_uBlockCount = 96 },
+    { .m_uBlockSize = 256, .m_uBlockCount = 64 },  { .m_uBlockSize = 0 },
+};
+
+BitmapAllocator clBitmap;
+
+Slab    clSlab;
+bool    abSlabPageUsed[BENCH_SLAB_PAGES];
+
+Thread clAppThread;
+K_WORD awAppStack[BENCH_STACK_SIZE / sizeof(K_WORD)];
+
+void*             apvLive[BENCH_BATCH];
+bench_histogram_t stHist;
+uint32_t          u32Failures;
+uint32_t          u32Random;
+
+//---------------------------------------------------------------------------
+inline size_t RandomSize(void)
+{
+    return BENCH_MIN_SIZE + (NextRandom(&u32Random) % (BENCH_MAX_SIZE - BENCH_MIN_SIZE + 1));
+}
+
+//---------------------------------------------------------------------------
+inline void* TimedAlloc(const bench_allocator_t* pstAlloc_, size_t uSize_)
+{
+    auto  u32Start = ReadCycles();
+    auto* pvData   = pstAlloc_->pfAlloc(uSize_);
+    HistRecord(&stHist, ReadCycles() - u32Start);
+    if (pvData == nullptr) {
+        u32Failures++;
+    }
+    return pvData;
+}
+
+//---------------------------------------------------------------------------
+inline void TimedFree(const bench_allocator_t* pstAlloc_, void* pvData_)
+{
+    if (pvData_ == nullptr) {
+        return;
+    }
+    auto u32Start = ReadCycles();
+    pstAlloc_->pfFree(pvData_);
+    HistRecord(&stHist, ReadCycles() - u32Start);
+}
+
+//---------------------------------------------------------------------------
+// Allocator adapters
+void ArenaInit(void)
+{
+    clArena.Init(awHeap, sizeof(awHeap), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+}
+void* ArenaAlloc(size_t uSize_)
+{
+    return clArena.Allocate(uSize_);
+}
+void ArenaFree(void* pvData_)
+{
+    clArena.Free(pvData_);
+}
+
+void FixedInit(void)
+{
+    clFixedHeap.Create(awHeap, aclFixedConfig);
+}
+void* FixedAlloc(size_t uSize_)
+{
+    return clFixedHeap.Allocate(uSize_);
+}
+void FixedFree(void* pvData_)
+{
+    clFixedHeap.Free(pvData_);
+}
+
+void BitmapInit(void)
+{
+    clBitmap.Init(awHeap, sizeof(awHeap) / 2, BENCH_FIXED_SIZE);
+}
+void* BitmapAlloc(size_t /*uSize_*/)
+{
+    return clBitmap.Allocate(nullptr);
+}
+void BitmapFree(void* pvData_)
+{
+    clBitmap.Free(pvData_);
+}
+
+void* SlabPageAlloc(uint32_t* pu32PageSize_)
+{
+    for (int i = 0; i < BENCH_SLAB_PAGES; i++) {
+        if (!abSlabPageUsed[i]) {
+            abSlabPageUsed[i] = true;
+            *pu32PageSize_    = BENCH_SLAB_PAGE_SIZE;
+            return reinterpret_cast<void*>((K_ADDR)awHeap + (i * BENCH_SLAB_PAGE_SIZE));
+        }
+    }
+    return nullptr;
+}
+void SlabPageFree(void* pvPage_)
+{
+    abSlabPageUsed[((K_ADDR)pvPage_ - (K_ADDR)awHeap) / BENCH_SLAB_PAGE_SIZE] = false;
+}
+void SlabInit(void)
+{
+    for (auto& bUsed : abSlabPageUsed) {
+        bUsed = false;
+    }
+    clSlab.Init(BENCH_FIXED_SIZE, SlabPageAlloc, SlabPageFree);
+}
+void* SlabAlloc(size_t /*uSize_*/)
+{
+    return clSlab.Alloc();
+}
+void SlabFree(void* pvData_)
+{
+    clSlab.Free(pvData_);
+}
+
+void MallocInit(void) {}
+void* MallocAlloc(size_t uSize_)
+{
+    return malloc(uSize_);
+}
+void MallocFree(void* pvData_)
+{
+    free(pvData_);
+}
+
+const bench_allocator_t astAllocators[] = {
+    { "Arena", ArenaInit, ArenaAlloc, ArenaFree, false },
+    { "FixedHeap", FixedInit, FixedAlloc, FixedFree, false },
+    { "BitmapAllocator", BitmapInit, BitmapAlloc, BitmapFree, true },
+    { "Slab", SlabInit, SlabAlloc, SlabFree, true },
+    { "malloc", MallocInit, MallocAlloc, MallocFree, false },
+};
+
+//---------------------------------------------------------------------------
+// Workloads
+void RunLifo(const bench_allocator_t* pstAlloc_)
+{
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < BENCH_BATCH; i++) { apvLive[i] = TimedAlloc(pstAlloc_, BENCH_FIXED_SIZE); }
+        for (int i = BENCH_BATCH - 1; i >= 0; i--) { TimedFree(pstAlloc_, apvLive[i]); }
+    }
+}
+
+void RunFifo(const bench_allocator_t* pstAlloc_)
+{
+    // Keep the queue half-full, freeing from the tail as the head advances
+    for (int i = 0; i < BENCH_BATCH; i++) { apvLive[i] = nullptr; }
+    int iHead = 0;
+    for (int r = 0; r < BENCH_ROUNDS * BENCH_BATCH; r++) {
+        apvLive[iHead] = TimedAlloc(pstAlloc_, BENCH_FIXED_SIZE);
+        auto iTail     = (iHead + (BENCH_BATCH / 2)) % BENCH_BATCH;
+        TimedFree(pstAlloc_, apvLive[iTail]);
+        apvLive[iTail] = nullptr;
+        iHead          = (iHead + 1) % BENCH_BATCH;
+    }
+    for (auto& pvLive : apvLive) {
+        TimedFree(pstAlloc_, pvLive);
+    }
+}
+
+void RunRandom(const bench_allocator_t* pstAlloc_)
+{
+    for (int i = 0; i < BENCH_BATCH; i++) { apvLive[i] = nullptr; }
+    for (int r = 0; r < BENCH_ROUNDS * BENCH_BATCH; r++) {
+        auto u32Slot = NextRandom(&u32Random) % BENCH_BATCH;
+        if (apvLive[u32Slot]) {
+            TimedFree(pstAlloc_, apvLive[u32Slot]);
+            apvLive[u32Slot] = nullptr;
+        } else {
+            apvLive[u32Slot] = TimedAlloc(pstAlloc_, RandomSize());
+        }
+    }
+    for (auto& pvLive : apvLive) {
+        TimedFree(pstAlloc_, pvLive);
+    }
+}
+
+void RunFragment(const bench_allocator_t* pstAlloc_)
+{
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        // Interleave small and large objects, free the small ones, then
+        // allocate objects slightly too large for the gaps left behind.
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            apvLive[i] = TimedAlloc(pstAlloc_, (i & 1) ? BENCH_MAX_SIZE : BENCH_MIN_SIZE);
+        }
+        for (int i = 0; i < BENCH_BATCH; i += 2) {
+            TimedFree(pstAlloc_, apvLive[i]);
+            apvLive[i] = TimedAlloc(pstAlloc_, BENCH_MIN_SIZE * 3);
+        }
+        for (int i = 0; i < BENCH_BATCH; i++) { TimedFree(pstAlloc_, apvLive[i]); }
+    }
+}
+
+const bench_workload_t astWorkloads[] = {
+    { "lifo", RunLifo, true },
+    { "fifo", RunFifo, true },
+    { "random", RunRandom, false },
+    { "fragment", RunFragment, false },
+};
+
+//---------------------------------------------------------------------------
+void RunBenchmark(const bench_allocator_t* pstAlloc_, const bench_workload_t* pstWorkload_)
+{
+    HistReset(&stHist);
+    u32Failures = 0;
+    u32Random   = 0x2545F491;
+
+    pstAlloc_->pfInit();
+    auto u32StartMs = Kernel::GetTicks();
+    pstWorkload_->pfRun(pstAlloc_);
+    auto u32ElapsedMs = Kernel::GetTicks() - u32StartMs;
+    if (u32ElapsedMs == 0) {
+        u32ElapsedMs = 1;
+    }
+
+    printf("%s,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+           pstAlloc_->szName,
+           pstWorkload_->szName,
+           (unsigned long)stHist.u32Count,
+           (unsigned long)(((uint64_t)stHist.u32Count * 1000) / u32ElapsedMs),
+           (unsigned long)HistPercentile(&stHist, 500),
+           (unsigned long)HistPercentile(&stHist, 990),
+           (unsigned long)HistPercentile(&stHist, 999),
+           (unsigned long)stHist.u32Max,
+           (unsigned long)u32Failures);
+}
+
+//---------------------------------------------------------------------------
+void AppMain(void* /*pvArg_*/)
+{
+    InitCycles();
+    printf("allocator,workload,ops,ops_per_sec,p50,p99,p999,max,failures\n");
+    for (auto& stWorkload : astWorkloads) {
+        for (auto& stAlloc : astAllocators) {
+            if (stAlloc.bFixedSize && !stWorkload.bFixedSize) {
+                continue;
+            }
+            RunBenchmark(&stAlloc, &stWorkload);
+        }
+    }
+
+    while (1) { Thread::Sleep(1000); }
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+int main(void)
+{
+    Kernel::Init();
+
+    clAppThread.Init(awAppStack, sizeof(awAppStack), 1, AppMain, 0);
+    clAppThread.Start();
+
+    Kernel::Start();
+    return 0;
+}
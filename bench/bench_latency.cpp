@@ -0,0 +1,482 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_latency.cpp
+
+    @brief Worst-case latency harness for the heap allocators.
+
+    Where bench_heap measures typical throughput, this drives each allocator
+    with adversarial patterns intended to expose the longest operations:
+
+    - fragment:      fill the heap with alternating small and large objects,
+                     free the small ones, then request objects that fit none
+                     of the gaps before freeing everything
+    - exhaust:       run the heap out of memory, then keep issuing requests
+                     against the exhausted heap while randomly freeing and
+                     reallocating individual objects
+    - splitcoalesce: allocate runs of random-sized objects, free every other
+                     object, then free the remainder so each free coalesces
+                     with both of its neighbours
+
+    Every allocate/free is timed in cycles (or the finest timer available on
+    the target) and added to a log-linear histogram.  The slowest operation
+    is reported along with its index in the run, the number of live objects
+    and bytes, and a summary of the allocator's state immediately after it
+    completed.  All random choices come from a generator seeded with
+    LATENCY_SEED, so a run - and the index of its worst operation - can be
+    reproduced exactly.  Results are printed as CSV:
+
+    allocator,workload,seed,ops,p50,p99,p999,max,failures,worst_op,worst_size,
+    worst_index,live_objs,live_bytes,state
+*/
+
+#include <stdio.h>
+#include "mark3.h"
+#include "arena.h"
+#include "bitmap_allocator.h"
+#include "fixed_heap.h"
+#include "slab.h"
+#include "bench_util.h"
+
+#ifndef LATENCY_SEED
+#define LATENCY_SEED (0x2545F491)
+#endif
+
+#define LATENCY_STACK_SIZE (2048)
+#define LATENCY_ROUNDS (200)
+#define LATENCY_EXHAUST_OPS (50000)
+#define LATENCY_RUN_LENGTH (64)
+#define LATENCY_MAX_LIVE (1024)
+#define LATENCY_FIXED_SIZE (32)
+#define LATENCY_MIN_SIZE (8)
+#define LATENCY_MAX_SIZE (256)
+#define LATENCY_HEAP_SIZE (16384)
+#define LATENCY_STATE_SIZE (128)
+
+#define LATENCY_SLAB_PAGE_SIZE (1024)
+#define LATENCY_SLAB_PAGES (LATENCY_HEAP_SIZE / LATENCY_SLAB_PAGE_SIZE)
+
+using namespace Mark3;
+
+namespace
+{
+//---------------------------------------------------------------------------
+// Interface used to run the same workloads against each allocator
+typedef void (*latency_init_function_t)(void);
+typedef void* (*latency_alloc_function_t)(size_t uSize_);
+typedef void (*latency_free_function_t)(void* pvData_);
+typedef void (*latency_state_function_t)(char* szState_, size_t uLen_);
+
+typedef struct {
+    const char*              szName;
+    latency_init_function_t  pfInit;
+    latency_alloc_function_t pfAlloc;
+    latency_free_function_t  pfFree;
+    latency_state_function_t pfState; //!< Summarize the allocator's state
+    bool                     bFixedSize; //!< Only supports LATENCY_FIXED_SIZE allocations
+} latency_allocator_t;
+
+typedef void (*latency_workload_function_t)(const latency_allocator_t* pstAlloc_);
+
+typedef struct {
+    const char*                 szName;
+    latency_workload_function_t pfRun;
+    bool                        bFixedSize; //!< Only uses LATENCY_FIXED_SIZE allocations
+} latency_workload_t;
+
+//---------------------------------------------------------------------------
+// The slowest operation seen in a run, and the state it left the heap in
+typedef struct {
+    uint32_t u32Cycles;
+    bool     bFree;
+    size_t   uSize;
+    uint32_t u32Index;
+    uint16_t u16Live;
+    size_t   uLiveBytes;
+    char     szState[LATENCY_STATE_SIZE];
+} latency_worst_t;
+
+//---------------------------------------------------------------------------
+// Heap storage, shared by each allocator in turn
+K_WORD awHeap[LATENCY_HEAP_SIZE / sizeof(K_WORD)];
+
+Arena  clArena;
+K_ADDR auArenaSizes[] = { 16, 32, 64, 128, 256, 512, 1024 };
+
+FixedHeap  clFixedHeap;
+HeapConfig aclFixedConfig[] = {
+    { .m_uBlockSize = 16, .m_uBlockCount = 64 },  { .m_uBlockSize = 32, .m_uBlockCount = 64 },
+    { .m_uBlockSize = 64, .m_uBlockCount = 32 },  { .m_uBlockSize = 128, .m_uBlockCount = 24 },
+    { .m_uBlockSize = 256, .m_uBlockCount = 16 }, { .m_uBlockSize = 0 },
+};
+
+BitmapAllocator clBitmap;
+
+Slab clSlab;
+bool abSlabPageUsed[LATENCY_SLAB_PAGES];
+
+Thread clAppThread;
+K_WORD awAppStack[LATENCY_STACK_SIZE / sizeof(K_WORD)];
+
+void*    apvLive[LATENCY_MAX_LIVE];
+size_t   auLiveSize[LATENCY_MAX_LIVE];
+uint16_t au16Order[LATENCY_MAX_LIVE];
+uint16_t u16Live;
+size_t   uLiveBytes;
+
+bench_histogram_t stHist;
+latency_worst_t   stWorst;
+uint32_t          u32Failures;
+uint32_t          u32Random;
+
+const latency_allocator_t* pstCurrent;
+
+//---------------------------------------------------------------------------
+inline size_t RandomSize(void)
+{
+    return LATENCY_MIN_SIZE + (NextRandom(&u32Random) % (LATENCY_MAX_SIZE - LATENCY_MIN_SIZE + 1));
+}
+
+//---------------------------------------------------------------------------
+void RecordOp(uint32_t u32Cycles_, bool bFree_, size_t uSize_)
+{
+    auto u32Index = stHist.u32Count;
+    HistRecord(&stHist, u32Cycles_);
+    if ((u32Index != 0) && (u32Cycles_ <= stWorst.u32Cycles)) {
+        return;
+    }
+
+    // Only the first op and new worst cases pay for a state snapshot
+    stWorst.u32Cycles  = u32Cycles_;
+    stWorst.bFree      = bFree_;
+    stWorst.uSize      = uSize_;
+    stWorst.u32Index   = u32Index;
+    stWorst.u16Live    = u16Live;
+    stWorst.uLiveBytes = uLiveBytes;
+    pstCurrent->pfState(stWorst.szState, sizeof(stWorst.szState));
+}
+
+//---------------------------------------------------------------------------
+// Allocate an object into the next live slot - returns false on failure
+bool TimedAlloc(size_t uSize_)
+{
+    if (pstCurrent->bFixedSize) {
+        uSize_ = LATENCY_FIXED_SIZE;
+    }
+    if (u16Live == LATENCY_MAX_LIVE) {
+        return false;
+    }
+
+    auto  u32Start = ReadCycles();
+    auto* pvData   = pstCurrent->pfAlloc(uSize_);
+    auto  u32End   = ReadCycles();
+    if (pvData == nullptr) {
+        u32Failures++;
+    } else {
+        apvLive[u16Live]    = pvData;
+        auLiveSize[u16Live] = uSize_;
+        u16Live++;
+        uLiveBytes += uSize_;
+    }
+    RecordOp(u32End - u32Start, false, uSize_);
+    return (pvData != nullptr);
+}
+
+//---------------------------------------------------------------------------
+// Free the object in a live slot, moving the last live object into its place
+void TimedFree(uint16_t u16Slot_)
+{
+    auto* pvData = apvLive[u16Slot_];
+    auto  uSize  = auLiveSize[u16Slot_];
+
+    u16Live--;
+    uLiveBytes -= uSize;
+    apvLive[u16Slot_]    = apvLive[u16Live];
+    auLiveSize[u16Slot_] = auLiveSize[u16Live];
+
+    auto u32Start = ReadCycles();
+    pstCurrent->pfFree(pvData);
+    RecordOp(ReadCycles() - u32Start, true, uSize);
+}
+
+//---------------------------------------------------------------------------
+void FreeAll(void)
+{
+    while (u16Live) {
+        TimedFree(NextRandom(&u32Random) % u16Live);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Fill au16Order with a seeded random permutation of [0, u16Count_)
+void Shuffle(uint16_t u16Count_)
+{
+    for (uint16_t i = 0; i < u16Count_; i++) {
+        au16Order[i] = i;
+    }
+    for (uint16_t i = u16Count_; i > 1; i--) {
+        auto u16Swap       = NextRandom(&u32Random) % i;
+        auto u16Temp       = au16Order[i - 1];
+        au16Order[i - 1]   = au16Order[u16Swap];
+        au16Order[u16Swap] = u16Temp;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Allocator adapters
+void ArenaInit(void)
+{
+    clArena.Init(awHeap, sizeof(awHeap), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+}
+void* ArenaAlloc(size_t uSize_)
+{
+    return clArena.Allocate(uSize_);
+}
+void ArenaFree(void* pvData_)
+{
+    clArena.Free(pvData_);
+}
+void ArenaState(char* szState_, size_t uLen_)
+{
+    // Free block count of each list
+    size_t uOffset = snprintf(szState_, uLen_, "free blocks");
+    for (uint8_t i = 0; (i < clArena.GetListCount()) && (uOffset < uLen_); i++) {
+        uint32_t u32Size;
+        uint32_t u32Count;
+        clArena.GetListInfo(i, &u32Size, &u32Count);
+        uOffset += snprintf(&szState_[uOffset], uLen_ - uOffset, " %lu:%lu", (unsigned long)u32Size, (unsigned long)u32Count);
+    }
+}
+
+void FixedInit(void)
+{
+    clFixedHeap.Create(awHeap, aclFixedConfig);
+}
+void* FixedAlloc(size_t uSize_)
+{
+    return clFixedHeap.Allocate(uSize_);
+}
+void FixedFree(void* pvData_)
+{
+    clFixedHeap.Free(pvData_);
+}
+void FixedState(char* szState_, size_t uLen_)
+{
+    // Which bins have free blocks left
+    size_t uOffset = snprintf(szState_, uLen_, "bins with free");
+    for (uint8_t i = 0; (aclFixedConfig[i].m_uBlockSize != 0) && (uOffset < uLen_); i++) {
+        if (aclFixedConfig[i].m_clHeap.IsFree()) {
+            uOffset += snprintf(&szState_[uOffset], uLen_ - uOffset, " %lu", (unsigned long)aclFixedConfig[i].m_uBlockSize);
+        }
+    }
+}
+
+void BitmapInit(void)
+{
+    clBitmap.Init(awHeap, sizeof(awHeap) / 2, LATENCY_FIXED_SIZE);
+}
+void* BitmapAlloc(size_t /*uSize_*/)
+{
+    return clBitmap.Allocate(nullptr);
+}
+void BitmapFree(void* pvData_)
+{
+    clBitmap.Free(pvData_);
+}
+void BitmapState(char* szState_, size_t uLen_)
+{
+    snprintf(szState_, uLen_, "free elements %lu", (unsigned long)clBitmap.GetNumFree());
+}
+
+void* SlabPageAlloc(uint32_t* pu32PageSize_)
+{
+    for (int i = 0; i < LATENCY_SLAB_PAGES; i++) {
+        if (!abSlabPageUsed[i]) {
+            abSlabPageUsed[i] = true;
+            *pu32PageSize_    = LATENCY_SLAB_PAGE_SIZE;
+            return reinterpret_cast<void*>((K_ADDR)awHeap + (i * LATENCY_SLAB_PAGE_SIZE));
+        }
+    }
+    return nullptr;
+}
+void SlabPageFree(void* pvPage_)
+{
+    abSlabPageUsed[((K_ADDR)pvPage_ - (K_ADDR)awHeap) / LATENCY_SLAB_PAGE_SIZE] = false;
+}
+void SlabInit(void)
+{
+    for (auto& bUsed : abSlabPageUsed) {
+        bUsed = false;
+    }
+    clSlab.Init(LATENCY_FIXED_SIZE, SlabPageAlloc, SlabPageFree);
+}
+void* SlabAlloc(size_t /*uSize_*/)
+{
+    return clSlab.Alloc();
+}
+void SlabFree(void* pvData_)
+{
+    clSlab.Free(pvData_);
+}
+void SlabState(char* szState_, size_t uLen_)
+{
+    snprintf(szState_,
+             uLen_,
+             "full pages %lu free pages %lu",
+             (unsigned long)clSlab.GetFullPageCount(),
+             (unsigned long)clSlab.GetFreePageCount());
+}
+
+const latency_allocator_t astAllocators[] = {
+    { "Arena", ArenaInit, ArenaAlloc, ArenaFree, ArenaState, false },
+    { "FixedHeap", FixedInit, FixedAlloc, FixedFree, FixedState, false },
+    { "BitmapAllocator", BitmapInit, BitmapAlloc, BitmapFree, BitmapState, true },
+    { "Slab", SlabInit, SlabAlloc, SlabFree, SlabState, true },
+};
+
+//---------------------------------------------------------------------------
+// Workloads
+void RunFragment(const latency_allocator_t* /*pstAlloc_*/)
+{
+    for (int r = 0; r < LATENCY_ROUNDS; r++) {
+        // Fill the heap with alternating small and large objects
+        while (TimedAlloc((u16Live & 1) ? LATENCY_MAX_SIZE : LATENCY_MIN_SIZE)) {}
+
+        // Free the small objects in random order, leaving small gaps
+        // between the large ones.  Each free moves the last live object
+        // into the freed slot, so repeat until no small objects remain.
+        bool bFreed;
+        do {
+            bFreed        = false;
+            auto u16Count = u16Live;
+            Shuffle(u16Count);
+            for (uint16_t i = 0; i < u16Count; i++) {
+                auto u16Slot = au16Order[i];
+                if ((u16Slot < u16Live) && (auLiveSize[u16Slot] == LATENCY_MIN_SIZE)) {
+                    TimedFree(u16Slot);
+                    bFreed = true;
+                }
+            }
+        } while (bFreed);
+
+        // Requests too large for the gaps, until the heap gives up
+        while (TimedAlloc(LATENCY_MIN_SIZE * 3)) {}
+        for (int i = 0; i < LATENCY_RUN_LENGTH; i++) {
+            TimedAlloc(LATENCY_MIN_SIZE * 3);
+        }
+        FreeAll();
+    }
+}
+
+void RunExhaust(const latency_allocator_t* /*pstAlloc_*/)
+{
+    while (TimedAlloc(RandomSize())) {}
+    for (int i = 0; i < LATENCY_EXHAUST_OPS; i++) {
+        // Request against the exhausted heap, then churn one object
+        TimedAlloc(RandomSize());
+        if (u16Live) {
+            TimedFree(NextRandom(&u32Random) % u16Live);
+        }
+        TimedAlloc(RandomSize());
+    }
+    FreeAll();
+}
+
+void RunSplitCoalesce(const latency_allocator_t* /*pstAlloc_*/)
+{
+    for (int r = 0; r < LATENCY_ROUNDS; r++) {
+        // Each large block is split into a run of neighbouring objects
+        for (int i = 0; i < LATENCY_RUN_LENGTH; i++) {
+            if (!TimedAlloc(RandomSize())) {
+                break;
+            }
+        }
+
+        // Free every other object, then the rest - each of the second set
+        // of frees has free blocks on both sides to coalesce with.
+        for (int16_t i = (int16_t)(u16Live & ~1) - 2; i >= 0; i -= 2) {
+            TimedFree(i);
+        }
+        FreeAll();
+    }
+}
+
+const latency_workload_t astWorkloads[] = {
+    { "fragment", RunFragment, false },
+    { "exhaust", RunExhaust, true },
+    { "splitcoalesce", RunSplitCoalesce, false },
+};
+
+//---------------------------------------------------------------------------
+void RunLatency(const latency_allocator_t* pstAlloc_, const latency_workload_t* pstWorkload_)
+{
+    HistReset(&stHist);
+    stWorst.u32Cycles = 0;
+    u32Failures       = 0;
+    u32Random         = LATENCY_SEED;
+    u16Live           = 0;
+    uLiveBytes        = 0;
+    pstCurrent        = pstAlloc_;
+
+    pstAlloc_->pfInit();
+    pstWorkload_->pfRun(pstAlloc_);
+
+    printf("%s,%s,0x%08lX,%lu,%lu,%lu,%lu,%lu,%lu,%s,%lu,%lu,%u,%lu,%s\n",
+           pstAlloc_->szName,
+           pstWorkload_->szName,
+           (unsigned long)LATENCY_SEED,
+           (unsigned long)stHist.u32Count,
+           (unsigned long)HistPercentile(&stHist, 500),
+           (unsigned long)HistPercentile(&stHist, 990),
+           (unsigned long)HistPercentile(&stHist, 999),
+           (unsigned long)stHist.u32Max,
+           (unsigned long)u32Failures,
+           stWorst.bFree ? "free" : "alloc",
+           (unsigned long)stWorst.uSize,
+           (unsigned long)stWorst.u32Index,
+           stWorst.u16Live,
+           (unsigned long)stWorst.uLiveBytes,
+           stWorst.szState);
+}
+
+//---------------------------------------------------------------------------
+void AppMain(void* /*pvArg_*/)
+{
+    InitCycles();
+    printf("allocator,workload,seed,ops,p50,p99,p999,max,failures,worst_op,worst_size,worst_index,live_objs,live_"
+           "bytes,state\n");
+    for (auto& stWorkload : astWorkloads) {
+        for (auto& stAlloc : astAllocators) {
+            if (stAlloc.bFixedSize && !stWorkload.bFixedSize) {
+                continue;
+            }
+            RunLatency(&stAlloc, &stWorkload);
+        }
+    }
+
+    while (1) { Thread::Sleep(1000); }
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+int main(void)
+{
+    Kernel::Init();
+
+    clAppThread.Init(awAppStack, sizeof(awAppStack), 1, AppMain, 0);
+    clAppThread.Start();
+
+    Kernel::Start();
+    return 0;
+}
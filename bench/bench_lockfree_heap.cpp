@@ -0,0 +1,145 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_lockfree_heap.cpp
+
+    @brief Throughput of LockFreeBlockHeap versus a critical-section guarded
+           BlockHeap, with an increasing number of threads contending for
+           the same heap.  Results are printed as CSV:
+
+           heap,threads,ops_per_sec
+*/
+
+#include <stdio.h>
+#include "mark3.h"
+#include "fixed_heap.h"
+#include "lockfree_block_heap.h"
+
+#define BENCH_BLOCK_SIZE (32)
+#define BENCH_BLOCK_COUNT (64)
+#define BENCH_MAX_THREADS (4)
+#define BENCH_STACK_SIZE (384)
+#define BENCH_WINDOW_MS (1000)
+
+using namespace Mark3;
+
+namespace
+{
+K_WORD awHeap[(BENCH_BLOCK_COUNT * (BENCH_BLOCK_SIZE + (3 * sizeof(K_ADDR)))) / sizeof(K_WORD)];
+
+BlockHeap         clLockedHeap;
+LockFreeBlockHeap clLockFreeHeap;
+
+Thread clAppThread;
+K_WORD awAppStack[BENCH_STACK_SIZE / sizeof(K_WORD)];
+
+Thread    aclWorkers[BENCH_MAX_THREADS];
+K_WORD    awWorkerStacks[BENCH_MAX_THREADS][BENCH_STACK_SIZE / sizeof(K_WORD)];
+uint32_t  au32Ops[BENCH_MAX_THREADS];
+Semaphore clWorkersDone;
+
+volatile bool bStop;
+
+//---------------------------------------------------------------------------
+void LockedWorker(void* pvArg_)
+{
+    auto u8Id = static_cast<uint8_t>(reinterpret_cast<K_ADDR>(pvArg_));
+    while (!bStop) {
+        void* pvBlock;
+        {
+            CriticalGuard clGuard;
+            pvBlock = clLockedHeap.Allocate();
+        }
+        if (pvBlock) {
+            CriticalGuard clGuard;
+            clLockedHeap.Free(pvBlock);
+        }
+        au32Ops[u8Id]++;
+    }
+    clWorkersDone.Post();
+    Scheduler::GetCurrentThread()->Exit();
+}
+
+//---------------------------------------------------------------------------
+void LockFreeWorker(void* pvArg_)
+{
+    auto u8Id = static_cast<uint8_t>(reinterpret_cast<K_ADDR>(pvArg_));
+    while (!bStop) {
+        auto* pvBlock = clLockFreeHeap.Allocate();
+        if (pvBlock) {
+            clLockFreeHeap.Free(pvBlock);
+        }
+        au32Ops[u8Id]++;
+    }
+    clWorkersDone.Post();
+    Scheduler::GetCurrentThread()->Exit();
+}
+
+//---------------------------------------------------------------------------
+uint32_t RunWorkers(ThreadEntryFunc pfWorker_, uint8_t u8Threads_)
+{
+    bStop = false;
+    clWorkersDone.Init(0, BENCH_MAX_THREADS);
+    for (uint8_t i = 0; i < u8Threads_; i++) {
+        au32Ops[i] = 0;
+        aclWorkers[i].Init(awWorkerStacks[i],
+                           sizeof(awWorkerStacks[i]),
+                           1,
+                           pfWorker_,
+                           reinterpret_cast<void*>(static_cast<K_ADDR>(i)));
+        aclWorkers[i].Start();
+    }
+
+    // Workers run at a lower priority than this thread - let them run for
+    // the measurement window, then stop them.
+    Thread::Sleep(BENCH_WINDOW_MS);
+    bStop = true;
+
+    uint32_t u32Total = 0;
+    for (uint8_t i = 0; i < u8Threads_; i++) {
+        clWorkersDone.Pend();
+    }
+    for (uint8_t i = 0; i < u8Threads_; i++) {
+        u32Total += au32Ops[i];
+    }
+    return (uint32_t)(((uint64_t)u32Total * 1000) / BENCH_WINDOW_MS);
+}
+
+//---------------------------------------------------------------------------
+void AppMain(void* /*pvArg_*/)
+{
+    printf("heap,threads,ops_per_sec\n");
+    for (uint8_t u8Threads = 1; u8Threads <= BENCH_MAX_THREADS; u8Threads++) {
+        clLockedHeap.Create(awHeap, sizeof(awHeap), BENCH_BLOCK_SIZE);
+        printf("BlockHeap+CriticalGuard,%d,%lu\n", u8Threads, (unsigned long)RunWorkers(LockedWorker, u8Threads));
+
+        clLockFreeHeap.Create(awHeap, sizeof(awHeap), BENCH_BLOCK_SIZE);
+        printf("LockFreeBlockHeap,%d,%lu\n", u8Threads, (unsigned long)RunWorkers(LockFreeWorker, u8Threads));
+    }
+
+    while (1) { Thread::Sleep(1000); }
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+int main(void)
+{
+    Kernel::Init();
+
+    clAppThread.Init(awAppStack, sizeof(awAppStack), 2, AppMain, 0);
+    clAppThread.Start();
+
+    Kernel::Start();
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_util.h
+
+    @brief Cycle counter access, random numbers and latency histograms shared
+           by the heap benchmarks.
+*/
+#pragma once
+
+#include "mark3.h"
+
+//---------------------------------------------------------------------------
+// Log-linear histogram - 8 linear sub-buckets per power of two
+#define HIST_SUB_SHIFT (3)
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_SHIFT)
+#define HIST_BUCKETS (HIST_SUB_BUCKETS * 30)
+
+//---------------------------------------------------------------------------
+#if defined(ARM) && (defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__))
+#define BENCH_DWT_CYCCNT (1)
+#endif
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+typedef struct {
+    uint32_t au32Buckets[HIST_BUCKETS];
+    uint32_t u32Count; //!< Number of samples recorded
+    uint32_t u32Max;   //!< Largest sample recorded
+} bench_histogram_t;
+
+//---------------------------------------------------------------------------
+inline void InitCycles(void)
+{
+#if BENCH_DWT_CYCCNT
+    *reinterpret_cast<volatile uint32_t*>(0xE000EDFC) |= (1UL << 24); // CoreDebug->DEMCR |= TRCENA
+    *reinterpret_cast<volatile uint32_t*>(0xE0001000) |= 1;           // DWT->CTRL |= CYCCNTENA
+#endif
+}
+
+//---------------------------------------------------------------------------
+inline uint32_t ReadCycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__builtin_ia32_rdtsc();
+#elif BENCH_DWT_CYCCNT
+    return *reinterpret_cast<volatile uint32_t*>(0xE0001004); // DWT->CYCCNT
+#else
+    return Kernel::GetTicks();
+#endif
+}
+
+//---------------------------------------------------------------------------
+inline uint32_t NextRandom(uint32_t* pu32State_)
+{
+    // xorshift32
+    auto u32Random = *pu32State_;
+    u32Random ^= u32Random << 13;
+    u32Random ^= u32Random >> 17;
+    u32Random ^= u32Random << 5;
+    *pu32State_ = u32Random;
+    return u32Random;
+}
+
+//---------------------------------------------------------------------------
+inline uint16_t HistBucket(uint32_t u32Value_)
+{
+    if (u32Value_ < HIST_SUB_BUCKETS) {
+        return u32Value_;
+    }
+    uint8_t u8Msb     = 31 - __builtin_clz(u32Value_);
+    auto    u8Sub     = (u32Value_ >> (u8Msb - HIST_SUB_SHIFT)) & (HIST_SUB_BUCKETS - 1);
+    auto    u16Bucket = ((u8Msb - HIST_SUB_SHIFT + 1) * HIST_SUB_BUCKETS) + u8Sub;
+    return (u16Bucket < HIST_BUCKETS) ? u16Bucket : (HIST_BUCKETS - 1);
+}
+
+//---------------------------------------------------------------------------
+inline uint32_t HistUpperBound(uint16_t u16Bucket_)
+{
+    if (u16Bucket_ < HIST_SUB_BUCKETS) {
+        return u16Bucket_;
+    }
+    uint8_t u8Msb = (u16Bucket_ / HIST_SUB_BUCKETS) + HIST_SUB_SHIFT - 1;
+    auto    u8Sub = u16Bucket_ & (HIST_SUB_BUCKETS - 1);
+    return ((uint32_t)(HIST_SUB_BUCKETS + u8Sub + 1) << (u8Msb - HIST_SUB_SHIFT)) - 1;
+}
+
+//---------------------------------------------------------------------------
+inline void HistReset(bench_histogram_t* pstHist_)
+{
+    for (auto& u32Count : pstHist_->au32Buckets) {
+        u32Count = 0;
+    }
+    pstHist_->u32Count = 0;
+    pstHist_->u32Max   = 0;
+}
+
+//---------------------------------------------------------------------------
+inline void HistRecord(bench_histogram_t* pstHist_, uint32_t u32Value_)
+{
+    pstHist_->au32Buckets[HistBucket(u32Value_)]++;
+    if (u32Value_ > pstHist_->u32Max) {
+        pstHist_->u32Max = u32Value_;
+    }
+    pstHist_->u32Count++;
+}
+
+//---------------------------------------------------------------------------
+inline uint32_t HistPercentile(const bench_histogram_t* pstHist_, uint32_t u32PerThousand_)
+{
+    auto     u64Target = (((uint64_t)pstHist_->u32Count * u32PerThousand_) + 999) / 1000;
+    uint64_t u64Count  = 0;
+    for (uint16_t i = 0; i < HIST_BUCKETS; i++) {
+        u64Count += pstHist_->au32Buckets[i];
+        if (u64Count >= u64Target) {
+            auto u32Bound = HistUpperBound(i);
+            return (u32Bound < pstHist_->u32Max) ? u32Bound : pstHist_->u32Max;
+        }
+    }
+    return pstHist_->u32Max;
+}
+} // namespace Mark3
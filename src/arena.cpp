@@ -41,6 +41,9 @@ void Arena::Init(void* pvBuffer_, K_ADDR u32Size_, K_ADDR* au32Sizes_, uint8_t u
     auto* pclList   = reinterpret_cast<ArenaList*>(pvBuffer_);
     m_aclBlockList  = reinterpret_cast<ArenaList*>(pvBuffer_);
     m_u8LargestList = u8NumSizes_ - 1;
+    InitHooks();
+    m_pclHandles = nullptr;
+    ArenaLock::Init();
 
     DEBUG_PRINT("Initializing Arena @ 0x%X, %d bytes long\n", pvBuffer_, u32Size_);
     for (uint8_t i = 0; i < u8NumSizes_; i++) {
@@ -58,6 +61,8 @@ void Arena::Init(void* pvBuffer_, K_ADDR u32Size_, K_ADDR* au32Sizes_, uint8_t u
     // accounted for.
     uint32_t u32SizeRemain = u32Size_ - u32MetaSize;
     auto     uPtr          = reinterpret_cast<K_ADDR>((K_ADDR)pvBuffer_ + (K_ADDR)u32MetaSize);
+    m_pvData               = reinterpret_cast<void*>(uPtr);
+    m_pclCompact           = reinterpret_cast<HeapBlock*>(uPtr);
     while (u32SizeRemain >= (sizeof(HeapBlock) + au32Sizes_[0])) {
         auto* pclBlock = new ((void*)uPtr) HeapBlock();
 
@@ -87,27 +92,58 @@ void Arena::Init(void* pvBuffer_, K_ADDR u32Size_, K_ADDR* au32Sizes_, uint8_t u
         u32SizeRemain -= pclBlock->GetBlockSize();
         uPtr += pclBlock->GetBlockSize();
     }
+    m_uDataEnd = uPtr;
 }
 
 //---------------------------------------------------------------------------
 void* Arena::Allocate(K_ADDR usize_)
+{
+    HeapLockGuard<ArenaLock> clGuard(this);
+    return AllocateLocked(usize_);
+}
+
+//---------------------------------------------------------------------------
+void* Arena::TryAllocate(K_ADDR usize_, bool* pbBusy_)
+{
+    *pbBusy_ = !ArenaLock::TryLock();
+    if (*pbBusy_) {
+        return nullptr;
+    }
+    auto* pvData = AllocateLocked(usize_);
+    ArenaLock::Unlock();
+    return pvData;
+}
+
+//---------------------------------------------------------------------------
+void* Arena::AllocateLocked(K_ADDR usize_)
 {
     // Figure out which list to grab the buffer from.
     DEBUG_PRINT("Request to allocate %d bytes\n", usize_);
-    HeapBlock* pclRet;
+    auto  uList    = ListToSatisfy(usize_);
+    auto* pclBlock = AllocateFromList(usize_, uList);
+    auto* pvData   = (pclBlock != nullptr) ? pclBlock->GetDataPointer() : nullptr;
+
+    if (HasHooks()) {
+        HookAllocate(usize_, pvData, (pvData != nullptr) && (uList != ListForSize(usize_)));
+    }
+    return pvData;
+}
 
-    auto uList = ListToSatisfy(usize_);
+//---------------------------------------------------------------------------
+HeapBlock* Arena::AllocateFromList(K_ADDR usize_, uint8_t uList_)
+{
+    HeapBlock* pclRet;
 
-    if ((uList == ARENA_EXHAUSTED) || (uList == ARENA_FULL)) {
+    if ((uList_ == ARENA_EXHAUSTED) || (uList_ == ARENA_FULL)) {
         DEBUG_PRINT(" Arena Exhausted, bailing\n");
-        return 0;
+        return nullptr;
     }
     if (usize_ < m_aclBlockList[0].GetBlockSize()) {
         usize_ = m_aclBlockList[0].GetBlockSize();
     }
 
     // Pop the first block from the arena list
-    pclRet = m_aclBlockList[uList].PopBlock();
+    pclRet = m_aclBlockList[uList_].PopBlock();
 
     DEBUG_PRINT(" Returned block: 0x%X, size %d\n", pclRet, pclRet ? pclRet->GetDataSize() : 0);
 
@@ -120,21 +156,12 @@ void* Arena::Allocate(K_ADDR usize_)
                     pclRet->GetDataSize(),
                     m_aclBlockList[0].GetBlockSize());
         auto* pclNew = pclRet->Split(usize_);
-
-        uList = ListForSize(pclNew->GetDataSize());
-
-        // If the block is full, don't bother...
-        if (uList != ARENA_FULL) {
-            pclNew->SetArenaIndex(uList);
-            m_aclBlockList[uList].PushBlock(pclNew);
-        }
+        ListBlock(pclNew);
     }
 
-    // Mark this block as allocated and return a pointer to the block's data
-    // pointer.
+    // Mark this block as allocated
     pclRet->SetCookie(HEAP_COOKIE_ALLOCATED);
-
-    return pclRet->GetDataPointer();
+    return pclRet;
 }
 
 //---------------------------------------------------------------------------
@@ -146,25 +173,34 @@ void Arena::Free(void* pvBlock_)
     auto       uBlockAddr = reinterpret_cast<K_ADDR>((K_ADDR)pvBlock_ - sizeof(HeapBlock));
     auto*      pclBlock   = reinterpret_cast<HeapBlock*>(uBlockAddr);
 
+    HeapLockGuard<ArenaLock> clGuard(this);
     if (pclBlock->GetCookie() == HEAP_COOKIE_FREE) {
         return;
     }
+    HookFree(pvBlock_);
+    FreeBlock(pclBlock);
+}
 
+//---------------------------------------------------------------------------
+void Arena::FreeBlock(HeapBlock* pclBlock_)
+{
+    auto*      pclBlock   = pclBlock_;
     auto*      pclRight   = pclBlock->GetRightSibling();
     HeapBlock* pclTemp;
 
-    uint8_t uArenaIndex;
-
     // Block coalescing
     //   Merge right, absorb into current-node
 
     pclTemp = pclRight;
-    DEBUG_PRINT(" Data Pointer: 0x%X, Object 0x%X, Cookie %08X\n", pvBlock_, pclBlock, pclBlock->GetCookie());
+    DEBUG_PRINT(" Object 0x%X, Cookie %08X\n", pclBlock, pclBlock->GetCookie());
     while ((pclTemp != 0) && (pclTemp->GetCookie() == HEAP_COOKIE_FREE)) {
         // Remove this free block from its currently allocated arena
-        uArenaIndex = pclTemp->GetArenaIndex();
-        m_aclBlockList[uArenaIndex].RemoveBlock(pclTemp);
+        UnlistBlock(pclTemp);
 
+        // Don't leave the compaction cursor pointing into the merged block
+        if (m_pclCompact == pclTemp) {
+            m_pclCompact = pclBlock;
+        }
         pclBlock->Coalesce();
 
         // Check out the next object in the list, and rebuild the sibling-node connections
@@ -175,9 +211,11 @@ void Arena::Free(void* pvBlock_)
     pclTemp = pclBlock->GetLeftSibling();
     while ((pclTemp != 0) && (pclTemp->GetCookie() == HEAP_COOKIE_FREE)) {
         // Remove this free block from its currently allocated arena
-        uArenaIndex = pclTemp->GetArenaIndex();
-        m_aclBlockList[uArenaIndex].RemoveBlock(pclTemp);
+        UnlistBlock(pclTemp);
 
+        if (m_pclCompact == pclBlock) {
+            m_pclCompact = pclTemp;
+        }
         pclTemp->Coalesce();
 
         pclBlock = pclTemp;
@@ -188,12 +226,182 @@ void Arena::Free(void* pvBlock_)
 
     // Now that all adjacent blocks have been coalesced, add the single block
     // back to the correct arena, and we're done!
-    uArenaIndex = ListForSize(pclBlock->GetDataSize());
-    if (uArenaIndex == ARENA_EXHAUSTED) {
-        // Big error...
+    ListBlock(pclBlock);
+}
+
+//---------------------------------------------------------------------------
+void Arena::ListBlock(HeapBlock* pclBlock_)
+{
+    auto uList = ListForSize(pclBlock_->GetDataSize());
+    pclBlock_->SetArenaIndex(uList);
+
+    // If the block is full, don't bother...
+    if (uList != ARENA_FULL) {
+        m_aclBlockList[uList].PushBlock(pclBlock_);
+    }
+}
+
+//---------------------------------------------------------------------------
+void Arena::UnlistBlock(HeapBlock* pclBlock_)
+{
+    auto uList = pclBlock_->GetArenaIndex();
+    if (uList != ARENA_FULL) {
+        m_aclBlockList[uList].RemoveBlock(pclBlock_);
+    }
+}
+
+//---------------------------------------------------------------------------
+pool_handle_t Arena::AllocateMovable(K_ADDR usize_)
+{
+    if (m_pclHandles == nullptr) {
+        return HANDLE_POOL_INVALID_HANDLE;
+    }
+    HeapLockGuard<ArenaLock> clGuard(this);
+
+    auto uHandle = m_pclHandles->Allocate();
+    if (uHandle == HANDLE_POOL_INVALID_HANDLE) {
+        return HANDLE_POOL_INVALID_HANDLE;
+    }
+
+    // The block's handle is stored ahead of the data, so the handle table
+    // entry can be found when the block is moved
+    auto  uBlockSize = usize_ + ROUND_UP(sizeof(pool_handle_t));
+    auto* pclBlock   = AllocateFromList(uBlockSize, ListToSatisfy(uBlockSize));
+    if (pclBlock == nullptr) {
+        m_pclHandles->Free(uHandle);
+        return HANDLE_POOL_INVALID_HANDLE;
+    }
+    pclBlock->SetCookie(HEAP_COOKIE_MOVABLE);
+    *static_cast<pool_handle_t*>(pclBlock->GetDataPointer()) = uHandle;
+
+    auto* pstMovable     = static_cast<arena_movable_t*>(m_pclHandles->Get(uHandle));
+    pstMovable->pclBlock = pclBlock;
+    pstMovable->u16Pins  = 0;
+    return uHandle;
+}
+
+//---------------------------------------------------------------------------
+void Arena::FreeMovable(pool_handle_t uHandle_)
+{
+    if (m_pclHandles == nullptr) {
+        return;
+    }
+    HeapLockGuard<ArenaLock> clGuard(this);
+
+    auto* pstMovable = static_cast<arena_movable_t*>(m_pclHandles->Get(uHandle_));
+    if (pstMovable == nullptr) {
+        return;
+    }
+    FreeBlock(pstMovable->pclBlock);
+    m_pclHandles->Free(uHandle_);
+}
+
+//---------------------------------------------------------------------------
+void* Arena::Pin(pool_handle_t uHandle_)
+{
+    if (m_pclHandles == nullptr) {
+        return nullptr;
+    }
+    HeapLockGuard<ArenaLock> clGuard(this);
+
+    auto* pstMovable = static_cast<arena_movable_t*>(m_pclHandles->Get(uHandle_));
+    if (pstMovable == nullptr) {
+        return nullptr;
+    }
+    pstMovable->u16Pins++;
+    return reinterpret_cast<void*>((K_ADDR)pstMovable->pclBlock->GetDataPointer() + ROUND_UP(sizeof(pool_handle_t)));
+}
+
+//---------------------------------------------------------------------------
+void Arena::Unpin(pool_handle_t uHandle_)
+{
+    if (m_pclHandles == nullptr) {
+        return;
+    }
+    HeapLockGuard<ArenaLock> clGuard(this);
+
+    auto* pstMovable = static_cast<arena_movable_t*>(m_pclHandles->Get(uHandle_));
+    if ((pstMovable != nullptr) && (pstMovable->u16Pins != 0)) {
+        pstMovable->u16Pins--;
+    }
+}
+
+//---------------------------------------------------------------------------
+K_ADDR Arena::Compact(K_ADDR uBudget_)
+{
+    K_ADDR uMoved = 0;
+    K_ADDR uWork  = 0;
+    if (m_pclHandles == nullptr) {
+        return 0;
+    }
+
+    // The lock is only held for one block at a time.  Other operations may
+    // run between blocks, so the cursor is kept in m_pclCompact, which
+    // FreeBlock() keeps valid as blocks are coalesced.
+    while (uWork < uBudget_) {
+        HeapLockGuard<ArenaLock> clGuard(this);
+
+        auto* pclBlock = m_pclCompact;
+        if ((K_ADDR)pclBlock >= m_uDataEnd) {
+            m_pclCompact = reinterpret_cast<HeapBlock*>(m_pvData);
+            break;
+        }
+
+        // Slide the block to the right into this one if it's free to move.
+        // This block then becomes the space vacated, so a run of movable
+        // blocks is slid along one after another.
+        auto* pclRight = pclBlock->GetRightSibling();
+        if ((pclBlock->GetCookie() == HEAP_COOKIE_FREE) && (pclRight != nullptr)
+            && (pclRight->GetCookie() == HEAP_COOKIE_MOVABLE) && (GetMovable(pclRight)->u16Pins == 0)) {
+            auto uSize = pclRight->GetDataSize();
+            SlideLeft(pclBlock, pclRight);
+            uMoved += uSize;
+            uWork += uSize;
+            m_pclCompact = pclBlock->GetRightSibling();
+            continue;
+        }
+
+        // Blocks are contiguous, including from one root block to the next
+        uWork += sizeof(HeapBlock);
+        m_pclCompact = reinterpret_cast<HeapBlock*>((K_ADDR)pclBlock + pclBlock->GetBlockSize());
+    }
+    return uMoved;
+}
+
+//---------------------------------------------------------------------------
+arena_movable_t* Arena::GetMovable(HeapBlock* pclBlock_)
+{
+    auto uHandle = *static_cast<pool_handle_t*>(pclBlock_->GetDataPointer());
+    return static_cast<arena_movable_t*>(m_pclHandles->Get(uHandle));
+}
+
+//---------------------------------------------------------------------------
+void Arena::SlideLeft(HeapBlock* pclFree_, HeapBlock* pclMovable_)
+{
+    auto* pstMovable = GetMovable(pclMovable_);
+    auto  uDataSize  = pclMovable_->GetDataSize();
+    auto* puSrc      = static_cast<K_ADDR*>(pclMovable_->GetDataPointer());
+
+    // Absorb the movable block into the free one, copy the data down, and
+    // split the free space back off the end.
+    UnlistBlock(pclFree_);
+    pclFree_->Coalesce();
+
+    auto* puDst = static_cast<K_ADDR*>(pclFree_->GetDataPointer());
+    for (K_ADDR i = 0; i < (uDataSize / sizeof(K_ADDR)); i++) {
+        puDst[i] = puSrc[i];
+    }
+    auto* pclVacated = pclFree_->Split(uDataSize);
+    pclFree_->SetCookie(HEAP_COOKIE_MOVABLE);
+    pstMovable->pclBlock = pclFree_;
+
+    // Merge the vacated space with the next free block, if any
+    auto* pclNext = pclVacated->GetRightSibling();
+    if ((pclNext != nullptr) && (pclNext->GetCookie() == HEAP_COOKIE_FREE)) {
+        UnlistBlock(pclNext);
+        pclVacated->Coalesce();
     }
-    pclBlock->SetArenaIndex(uArenaIndex);
-    m_aclBlockList[uArenaIndex].PushBlock(pclBlock);
+    ListBlock(pclVacated);
 }
 
 //---------------------------------------------------------------------------
@@ -243,6 +451,7 @@ bool Arena::GetListInfo(uint8_t u8ListIdx_, uint32_t* pu32BlockSize_, uint32_t*
     if (u8ListIdx_ > m_u8LargestList) {
         return false;
     }
+    HeapLockGuard<ArenaLock> clGuard(this);
     *pu32BlockCount_ = m_aclBlockList[u8ListIdx_].GetBlockCount();
     *pu32BlockSize_  = m_aclBlockList[u8ListIdx_].GetBlockSize();
     return true;
@@ -21,16 +21,14 @@ See license.txt for more information
 namespace Mark3
 {
 //---------------------------------------------------------------------------
-void BitmapAllocator::Init(void* pvMemBlock_, uint32_t u32BlockSize_, uint32_t u32ElementSize)
+void BitmapAllocatorCore::Init(void* pvMemBlock_, uint32_t u32BlockSize_, uint32_t u32ElementSize)
 {
-    // Add allocator metadata to the size of the element
-    u32ElementSize += sizeof(bitmap_alloc_t) - sizeof(K_WORD);
-    m_u32ObjSize = u32ElementSize;
+    // Compute the number of elements that fit alongside the bitmap metadata
+    auto u32MaxAllocs    = GetCapacity(u32BlockSize_, u32ElementSize, true);
+    auto u32MetaDataSize = GetMapSize(u32MaxAllocs);
 
-    // Compute the amount of the memory block used for metadata
-    auto u32AllocableBytes = u32BlockSize_;
-    auto u32MaxAllocs      = u32AllocableBytes / u32ElementSize;
-    auto u32MetaDataSize   = UINT32_ROUND_UP(u32MaxAllocs) * sizeof(uint32_t);
+    // Add allocator metadata to the size of the element
+    m_u32ObjSize = u32ElementSize + sizeof(bitmap_alloc_t) - sizeof(K_WORD);
 
     // Set metadata address from block
     m_pu32MapL2 = static_cast<uint32_t*>(pvMemBlock_);
@@ -38,56 +36,123 @@ void BitmapAllocator::Init(void* pvMemBlock_, uint32_t u32BlockSize_, uint32_t u
     // Set address of first allocable chunk (after metadata)
     m_pvMemBlock = reinterpret_cast<void*>((K_ADDR)pvMemBlock_ + u32MetaDataSize);
 
-    // Get true number of allocable elements.
-    m_u32NumElements = u32AllocableBytes / u32ElementSize;
-    m_u32NumFree     = m_u32NumElements;
-    // Clear the bitmap allocator's metadata
-    m_u32MapL1 = 0;
-    for (uint32_t i = 0; i < UINT32_ROUND_UP(m_u32NumElements); i++) { m_pu32MapL2[i] = 0; }
+    m_u32NumElements = u32MaxAllocs;
+    InitMap();
+}
 
-    for (uint32_t i = 0; i < m_u32NumElements; i++) { SetFree(i); }
+//---------------------------------------------------------------------------
+void BitmapAllocatorCore::Init(void* pvMemBlock_, uint32_t u32BlockSize_, uint32_t u32ElementSize, uint32_t* pu32Map_)
+{
+    m_u32ObjSize     = u32ElementSize + sizeof(bitmap_alloc_t) - sizeof(K_WORD);
+    m_pu32MapL2      = pu32Map_;
+    m_pvMemBlock     = pvMemBlock_;
+    m_u32NumElements = GetCapacity(u32BlockSize_, u32ElementSize, false);
+    InitMap();
 }
 
 //---------------------------------------------------------------------------
-void* BitmapAllocator::Allocate(void* pvTag_)
+uint32_t BitmapAllocatorCore::GetCapacity(uint32_t u32BlockSize_, uint32_t u32ElementSize_, bool bMapInBlock_)
+{
+    auto u32ObjSize    = u32ElementSize_ + sizeof(bitmap_alloc_t) - sizeof(K_WORD);
+    auto u32NumObjects = u32BlockSize_ / u32ObjSize;
+    if (u32NumObjects > BITMAP_ALLOCATOR_MAX_ELEMENTS) {
+        u32NumObjects = BITMAP_ALLOCATOR_MAX_ELEMENTS;
+    }
+    if (!bMapInBlock_) {
+        return u32NumObjects;
+    }
+
+    // Give up elements until both the elements and the bitmap fit in the block
+    while (u32NumObjects && ((u32NumObjects * u32ObjSize) + GetMapSize(u32NumObjects) > u32BlockSize_)) {
+        u32NumObjects--;
+    }
+    return u32NumObjects;
+}
+
+//---------------------------------------------------------------------------
+void BitmapAllocatorCore::InitMap(void)
+{
+    m_u32NumFree = m_u32NumElements;
+
+    // Elements at or above the unused index are implicitly free, and their
+    // bitmap words are only cleared as they are first allocated - so the
+    // bitmap isn't walked here, regardless of the number of elements.
+    m_u32MapL1     = 0;
+    m_u32NumUnused = 0;
+}
+
+//---------------------------------------------------------------------------
+void* BitmapAllocatorCore::Allocate(void* pvTag_)
+{
+    return InitElement(AllocateIndex(), pvTag_);
+}
+
+//---------------------------------------------------------------------------
+uint32_t BitmapAllocatorCore::AllocateIndex(void)
 {
     if (!m_u32NumFree) {
-        return nullptr;
+        return m_u32NumElements;
     }
 
     m_u32NumFree--;
 
-    auto u32Index = NextFreeIndex();
-    SetAllocated(u32Index);
+    // Reuse previously-freed elements first, only carving never-used
+    // elements off the end of the block when there are none.
+    uint32_t u32Index;
+    if (m_u32MapL1) {
+        u32Index = NextFreeIndex();
+        SetAllocated(u32Index);
+    } else {
+        u32Index = m_u32NumUnused++;
+        if (!(u32Index & (UINT32_BITS - 1))) {
+            m_pu32MapL2[u32Index >> UINT32_SHIFT] = 0;
+        }
+    }
+    return u32Index;
+}
+
+//---------------------------------------------------------------------------
+void* BitmapAllocatorCore::InitElement(uint32_t u32Index_, void* pvTag_)
+{
+    if (u32Index_ == m_u32NumElements) {
+        return nullptr;
+    }
 
-    auto* pstAllocData = reinterpret_cast<bitmap_alloc_t*>((K_ADDR)m_pvMemBlock + (m_u32ObjSize * u32Index));
+    auto* pstAllocData = reinterpret_cast<bitmap_alloc_t*>((K_ADDR)m_pvMemBlock + (m_u32ObjSize * u32Index_));
 
     pstAllocData->pclSource = this;
     pstAllocData->pvTag     = pvTag_;
-    pstAllocData->u32Index  = u32Index;
-
+    pstAllocData->u32Index  = u32Index_;
     return (void*)pstAllocData->data;
 }
 
 //---------------------------------------------------------------------------
-void BitmapAllocator::Free(void* alloc)
+bool BitmapAllocatorCore::Free(void* alloc)
 {
-    auto* pstAlloc = reinterpret_cast<bitmap_alloc_t*>((K_ADDR)alloc - (sizeof(bitmap_alloc_t) - sizeof(K_WORD)));    
+    auto* pstAlloc = reinterpret_cast<bitmap_alloc_t*>((K_ADDR)alloc - (sizeof(bitmap_alloc_t) - sizeof(K_WORD)));
 
-    if (pstAlloc->pclSource->IsAllocated(pstAlloc->u32Index)) {
-        pstAlloc->pclSource->SetFree(pstAlloc->u32Index);
-        m_u32NumFree++;
+    if (!pstAlloc->pclSource->IsAllocated(pstAlloc->u32Index)) {
+        return false;
     }
+    pstAlloc->pclSource->SetFree(pstAlloc->u32Index);
+    m_u32NumFree++;
+    return true;
 }
 
 //---------------------------------------------------------------------------
-uint32_t BitmapAllocator::GetNumFree(void)
+uint32_t BitmapAllocatorCore::GetNumFree(void)
 {
     return m_u32NumFree;
 }
 
 //---------------------------------------------------------------------------
-bool BitmapAllocator::IsEmpty(void)
+uint32_t BitmapAllocatorCore::GetElementSize(void)
+{
+    return m_u32ObjSize - (sizeof(bitmap_alloc_t) - sizeof(K_WORD));
+}
+
+//---------------------------------------------------------------------------
+bool BitmapAllocatorCore::IsEmpty(void)
 {
     if (m_u32NumElements == m_u32NumFree) {
         return true;
@@ -96,7 +161,7 @@ bool BitmapAllocator::IsEmpty(void)
 }
 
 //---------------------------------------------------------------------------
-bool BitmapAllocator::IsFull(void)
+bool BitmapAllocatorCore::IsFull(void)
 {
     if (!m_u32NumFree) {
         return true;
@@ -105,7 +170,7 @@ bool BitmapAllocator::IsFull(void)
 }
 
 //---------------------------------------------------------------------------
-uint8_t BitmapAllocator::CountLeadingZeros(uint32_t u32Value_)
+uint8_t BitmapAllocatorCore::CountLeadingZeros(uint32_t u32Value_)
 {
     uint32_t u32Mask = 0x80000000;
     uint8_t  u8Zeros = 0;
@@ -122,7 +187,7 @@ uint8_t BitmapAllocator::CountLeadingZeros(uint32_t u32Value_)
 }
 
 //---------------------------------------------------------------------------
-uint32_t BitmapAllocator::NextFreeIndex(void)
+uint32_t BitmapAllocatorCore::NextFreeIndex(void)
 {
     auto u32WordIndex = CountLeadingZeros(m_u32MapL1);
     auto u32BitIndex  = CountLeadingZeros(m_pu32MapL2[u32WordIndex]);
@@ -131,7 +196,7 @@ uint32_t BitmapAllocator::NextFreeIndex(void)
 }
 
 //---------------------------------------------------------------------------
-void BitmapAllocator::SetFree(uint32_t u32Index_)
+void BitmapAllocatorCore::SetFree(uint32_t u32Index_)
 {
     auto u32WordIndex = u32Index_ >> UINT32_SHIFT;
     auto u32BitIndex  = u32Index_ & (UINT32_BITS - 1);
@@ -141,7 +206,7 @@ void BitmapAllocator::SetFree(uint32_t u32Index_)
 }
 
 //---------------------------------------------------------------------------
-void BitmapAllocator::SetAllocated(uint32_t u32Index_)
+void BitmapAllocatorCore::SetAllocated(uint32_t u32Index_)
 {
     auto u32WordIndex = u32Index_ >> UINT32_SHIFT;
     auto u32BitIndex  = u32Index_ & (UINT32_BITS - 1);
@@ -153,8 +218,12 @@ void BitmapAllocator::SetAllocated(uint32_t u32Index_)
 }
 
 //---------------------------------------------------------------------------
-bool BitmapAllocator::IsAllocated(uint32_t u32Index_)
+bool BitmapAllocatorCore::IsAllocated(uint32_t u32Index_)
 {
+    if (u32Index_ >= m_u32NumUnused) {
+        return false;
+    }
+
     auto u32WordIndex = u32Index_ >> UINT32_SHIFT;
     auto u32BitIndex  = u32Index_ & (UINT32_BITS - 1);
 
@@ -163,4 +232,46 @@ bool BitmapAllocator::IsAllocated(uint32_t u32Index_)
     }
     return true;
 }
+
+//---------------------------------------------------------------------------
+void BitmapAllocator::Init(void* pvMemBlock_, uint32_t u32BlockSize_, uint32_t u32ElementSize)
+{
+    BitmapAllocatorCore::Init(pvMemBlock_, u32BlockSize_, u32ElementSize);
+    InitHooks();
+    BitmapAllocatorLock::Init();
+}
+
+//---------------------------------------------------------------------------
+void BitmapAllocator::Init(void* pvMemBlock_, uint32_t u32BlockSize_, uint32_t u32ElementSize, uint32_t* pu32Map_)
+{
+    BitmapAllocatorCore::Init(pvMemBlock_, u32BlockSize_, u32ElementSize, pu32Map_);
+    InitHooks();
+    BitmapAllocatorLock::Init();
+}
+
+//---------------------------------------------------------------------------
+void* BitmapAllocator::Allocate(void* pvTag_)
+{
+    uint32_t u32Index;
+    {
+        HeapLockGuard<BitmapAllocatorLock> clGuard(this);
+        u32Index = AllocateIndex();
+    }
+    // The element belongs to the caller from here on
+    auto* pvData = InitElement(u32Index, pvTag_);
+    if (HasHooks()) {
+        HeapLockGuard<BitmapAllocatorLock> clGuard(this);
+        HookAllocate(GetElementSize(), pvData);
+    }
+    return pvData;
+}
+
+//---------------------------------------------------------------------------
+void BitmapAllocator::Free(void* alloc)
+{
+    HeapLockGuard<BitmapAllocatorLock> clGuard(this);
+    if (BitmapAllocatorCore::Free(alloc)) {
+        HookFree(alloc);
+    }
+}
 } // namespace Mark3
@@ -0,0 +1,206 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file buddy_allocator.cpp
+
+    @brief Binary buddy allocator, handing out naturally-aligned power-of-two
+           blocks - usable directly, or as a page provider for slabs.
+*/
+
+#include "buddy_allocator.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+void BuddyAllocator::Init(void* pvMem_, K_ADDR uSize_, uint32_t u32MinBlockSize_, uint8_t u8NumOrders_)
+{
+    if (u8NumOrders_ > BUDDY_MAX_ORDERS) {
+        u8NumOrders_ = BUDDY_MAX_ORDERS;
+    }
+    if (u8NumOrders_ == 0) {
+        u8NumOrders_ = 1;
+    }
+
+    // Each free block must hold its free-list node
+    if (u32MinBlockSize_ < sizeof(buddy_block_t)) {
+        u32MinBlockSize_ = sizeof(buddy_block_t);
+    }
+    m_u8MinShift = 0;
+    while (((K_ADDR)1 << m_u8MinShift) < u32MinBlockSize_) {
+        m_u8MinShift++;
+    }
+    m_u8NumOrders = u8NumOrders_;
+    m_uFreeBytes  = 0;
+
+    auto uMinMask = GetBlockSize(0) - 1;
+    auto uTopMask = GetBlockSize(m_u8NumOrders - 1) - 1;
+    auto adStart  = ((K_ADDR)pvMem_ + uMinMask) & ~uMinMask;
+    auto adEnd    = (K_ADDR)pvMem_ + uSize_;
+
+    // Bitmaps are indexed from the top-order boundary below the first block,
+    // so a block's bit position follows directly from its address.  Size the
+    // maps for the full range, then carve them from the end of it.
+    m_adBase            = adStart & ~uTopMask;
+    uint32_t u32MapBits = 0;
+    for (uint8_t i = 0; i < m_u8NumOrders; i++) {
+        m_au32MapOffset[i] = u32MapBits;
+        m_apstFree[i]      = nullptr;
+        if (i < (m_u8NumOrders - 1)) {
+            auto uPairSize = GetBlockSize(i + 1);
+            u32MapBits += (uint32_t)((adEnd - m_adBase + uPairSize - 1) / uPairSize);
+        }
+    }
+    auto uMapBytes = (K_ADDR)((u32MapBits + 31) / 32) * sizeof(uint32_t);
+
+    if ((adStart > adEnd) || ((adEnd - adStart) < (uMapBytes + GetBlockSize(0)))) {
+        m_pu32Map = nullptr;
+        m_adEnd   = adStart;
+        return;
+    }
+    auto adMap = (adEnd - uMapBytes) & ~(K_ADDR)(sizeof(uint32_t) - 1);
+    m_pu32Map  = reinterpret_cast<uint32_t*>(adMap);
+    m_adEnd    = adMap & ~uMinMask;
+    for (K_ADDR i = 0; i < (uMapBytes / sizeof(uint32_t)); i++) {
+        m_pu32Map[i] = 0;
+    }
+
+    // With every pair bit clear, all blocks are nominally allocated - free the
+    // largest naturally-aligned blocks that tile the usable range.
+    auto adBlock = adStart;
+    while (adBlock < m_adEnd) {
+        uint8_t u8Order = m_u8NumOrders - 1;
+        while ((u8Order > 0)
+               && (((adBlock & (GetBlockSize(u8Order) - 1)) != 0) || ((m_adEnd - adBlock) < GetBlockSize(u8Order)))) {
+            u8Order--;
+        }
+        Free(reinterpret_cast<void*>(adBlock), u8Order);
+        adBlock += GetBlockSize(u8Order);
+    }
+}
+
+//---------------------------------------------------------------------------
+void* BuddyAllocator::Allocate(uint8_t u8Order_)
+{
+    if (u8Order_ >= m_u8NumOrders) {
+        return nullptr;
+    }
+
+    auto u8Order = u8Order_;
+    while ((u8Order < m_u8NumOrders) && (m_apstFree[u8Order] == nullptr)) {
+        u8Order++;
+    }
+    if (u8Order == m_u8NumOrders) {
+        return nullptr;
+    }
+
+    auto* pstBlock = m_apstFree[u8Order];
+    RemoveFree(pstBlock, u8Order);
+    TogglePair((K_ADDR)pstBlock, u8Order);
+
+    // Split down to the requested order, freeing the upper half each time
+    while (u8Order > u8Order_) {
+        u8Order--;
+        auto* pstUpper = reinterpret_cast<buddy_block_t*>((K_ADDR)pstBlock + GetBlockSize(u8Order));
+        PushFree(pstUpper, u8Order);
+        TogglePair((K_ADDR)pstBlock, u8Order);
+    }
+
+    m_uFreeBytes -= GetBlockSize(u8Order_);
+    return pstBlock;
+}
+
+//---------------------------------------------------------------------------
+void BuddyAllocator::Free(void* pvBlock_, uint8_t u8Order_)
+{
+    if ((pvBlock_ == nullptr) || (u8Order_ >= m_u8NumOrders)) {
+        return;
+    }
+    m_uFreeBytes += GetBlockSize(u8Order_);
+
+    // Merge with the buddy for as long as it is also free
+    auto adBlock = (K_ADDR)pvBlock_;
+    auto u8Order = u8Order_;
+    while ((u8Order < (m_u8NumOrders - 1)) && TogglePair(adBlock, u8Order)) {
+        auto adBuddy = m_adBase + ((adBlock - m_adBase) ^ GetBlockSize(u8Order));
+        RemoveFree(reinterpret_cast<buddy_block_t*>(adBuddy), u8Order);
+        if (adBuddy < adBlock) {
+            adBlock = adBuddy;
+        }
+        u8Order++;
+    }
+    PushFree(reinterpret_cast<buddy_block_t*>(adBlock), u8Order);
+}
+
+//---------------------------------------------------------------------------
+uint8_t BuddyAllocator::GetOrderForSize(K_ADDR uSize_)
+{
+    for (uint8_t i = 0; i < m_u8NumOrders; i++) {
+        if (uSize_ <= GetBlockSize(i)) {
+            return i;
+        }
+    }
+    return BUDDY_NO_ORDER;
+}
+
+//---------------------------------------------------------------------------
+uint32_t BuddyAllocator::GetFreeBlockCount(uint8_t u8Order_)
+{
+    if (u8Order_ >= m_u8NumOrders) {
+        return 0;
+    }
+    uint32_t u32Count = 0;
+    for (auto* pstBlock = m_apstFree[u8Order_]; pstBlock != nullptr; pstBlock = pstBlock->pstNext) {
+        u32Count++;
+    }
+    return u32Count;
+}
+
+//---------------------------------------------------------------------------
+bool BuddyAllocator::TogglePair(K_ADDR adBlock_, uint8_t u8Order_)
+{
+    if (u8Order_ >= (m_u8NumOrders - 1)) {
+        return false;
+    }
+    auto u32Bit  = m_au32MapOffset[u8Order_] + (uint32_t)((adBlock_ - m_adBase) >> (m_u8MinShift + u8Order_ + 1));
+    auto u32Mask = (uint32_t)1 << (u32Bit & 31);
+    m_pu32Map[u32Bit >> 5] ^= u32Mask;
+
+    // A clear bit means both halves are in the same state
+    return (m_pu32Map[u32Bit >> 5] & u32Mask) == 0;
+}
+
+//---------------------------------------------------------------------------
+void BuddyAllocator::PushFree(buddy_block_t* pstBlock_, uint8_t u8Order_)
+{
+    pstBlock_->pstPrev = nullptr;
+    pstBlock_->pstNext = m_apstFree[u8Order_];
+    if (m_apstFree[u8Order_] != nullptr) {
+        m_apstFree[u8Order_]->pstPrev = pstBlock_;
+    }
+    m_apstFree[u8Order_] = pstBlock_;
+}
+
+//---------------------------------------------------------------------------
+void BuddyAllocator::RemoveFree(buddy_block_t* pstBlock_, uint8_t u8Order_)
+{
+    if (pstBlock_->pstPrev != nullptr) {
+        pstBlock_->pstPrev->pstNext = pstBlock_->pstNext;
+    } else {
+        m_apstFree[u8Order_] = pstBlock_->pstNext;
+    }
+    if (pstBlock_->pstNext != nullptr) {
+        pstBlock_->pstNext->pstPrev = pstBlock_->pstPrev;
+    }
+}
+} // namespace Mark3
@@ -18,14 +18,32 @@ See license.txt for more information
     containing multiple lists, each list containing a linked-list of blocks
     that are each the same size.  As a result of the linked-list format,
     these heaps are very fast - requiring only a linked list pop/push to
-    allocated/free memory.  Array traversal is required to allow for the optimal
-    heap to be used.  Blocks are chosen from the first heap with free blocks
-    large enough to fulfill the request.
+    allocated/free memory.  Blocks are chosen from the first heap with free
+    blocks large enough to fulfill the request.
+
+    Heap selection is constant-time: the smallest bin for a given size is
+    found from a lookup table built when the heap is created, and the first
+    bin at or above it with free blocks is found with a single bit-scan of
+    a bitmap of non-empty bins.
+
+    Heap memory is initialized lazily - blocks are carved from the untouched
+    end of each heap only once all previously-freed blocks have been reused,
+    so creating a heap takes constant time regardless of its size, and
+    memory that is never allocated is never written.
 
     Only simple malloc/free functionlality is supported in this implementation,
     no complex vector-allocate or reallocation functions are supported.
 
-    Heaps are protected by critical section, and are thus thread-safe.
+    Bins can optionally grow beyond their configured size, by adding chunks
+    of blocks carved from pages supplied by a user-provided page allocator,
+    up to a per-bin limit.  Chunks are returned to the page allocator once
+    all of their blocks have been freed.
+
+    Heaps are synchronized using the locking policy selected at compile time
+    (see heap_lock.h) - by default, no locking is performed, and callers
+    sharing a heap between threads must provide their own.  Where a single
+    block size is sufficient, the LockFreeBlockHeap class provides a
+    lock-free, interrupt-safe alternative to BlockHeap.
 
     When creating a heap, a user supplies an array of heap configuration objects,
     which determines how many objects of what size are available.
@@ -45,52 +63,95 @@ See license.txt for more information
 #include "threadport.h"
 namespace Mark3
 {
+namespace
+{
 //---------------------------------------------------------------------------
-class BlockHeapNode : public LinkListNode
+// Index of the lowest set bit in a non-zero value
+inline uint8_t FirstSetBit(uint32_t u32Value_)
 {
-    friend class BlockHeap;
-    friend class FixedHeap;
+#if defined(__GNUC__)
+    return __builtin_ctz(u32Value_);
+#else
+    uint8_t u8Bit = 0;
+    while (!(u32Value_ & 1)) {
+        u32Value_ >>= 1;
+        u8Bit++;
+    }
+    return u8Bit;
+#endif
+}
 
-protected:
-    BlockHeap* m_clHeap;
-};
+//---------------------------------------------------------------------------
+// Smallest n, such that 2^n >= uValue_
+inline uint8_t Log2Ceil(size_t uValue_)
+{
+    if (uValue_ <= 1) {
+        return 0;
+    }
+#if defined(__GNUC__)
+    return (sizeof(unsigned long) * 8) - __builtin_clzl((unsigned long)(uValue_ - 1));
+#else
+    uint8_t u8Log = 0;
+    while (((size_t)1 << u8Log) < uValue_) {
+        u8Log++;
+        if (u8Log == (sizeof(size_t) * 8)) {
+            break;
+        }
+    }
+    return u8Log;
+#endif
+}
+} // anonymous namespace
 
 //---------------------------------------------------------------------------
 void* BlockHeap::Create(void* pvHeap_, size_t uSize_, size_t uBlockSize_)
 {
-    size_t uNodeCount = uSize_ / (sizeof(BlockHeapNode) + uBlockSize_);
+    auto   uStride    = GetBlockStride(uBlockSize_);
+    size_t uNodeCount = uSize_ / uStride;
 
-    auto adNode    = reinterpret_cast<K_ADDR>(pvHeap_);
-    auto adMaxNode = reinterpret_cast<K_ADDR>((K_ADDR)pvHeap_ + (K_ADDR)uSize_);
+#if BLOCK_HEAP_INTRUSIVE_FREE_LIST
+    m_pvFreeHead = nullptr;
+#else
     m_clList.Init();
+#endif
+    m_pclOwner     = nullptr;
+    m_pclNextChunk = nullptr;
+    m_u8Bin        = 0;
+    m_u8Chunks     = 0;
+    m_u8MaxChunks  = 0;
+    m_uStride      = uStride;
+    BlockHeapLock::Init();
 
-    // Create a heap (linked-list nodes + byte pool) in the middle of
-    // the data blob
-    for (size_t i = 0; i < uNodeCount; i++) {
-        // Create a pointer back to the source list.
-        auto* pclTemp     = reinterpret_cast<BlockHeapNode*>(adNode);
-        pclTemp->m_clHeap = this;
-
-        // Add the node to the block list
-        m_clList.Add((LinkListNode*)pclTemp);
-
-        // Move the pointer in the pool to point to the next block to allocate
-        adNode += (sizeof(BlockHeapNode) + uBlockSize_);
-
-        // Bail if we would be going past the end of the allocated space...
-        if (adNode >= adMaxNode) {
-            break;
-        }
-    }
+    // Blocks are carved from the untouched tail of the heap on demand, so
+    // creating a heap is constant-time, and doesn't touch the heap memory.
+    m_adStart     = reinterpret_cast<K_ADDR>(pvHeap_);
+    m_adEnd       = m_adStart + (uNodeCount * uStride);
+    m_adUnused    = m_adStart;
     m_uBlocksFree = uNodeCount;
 
     // Return pointer to end of heap (usedd for heap-chaining)
-    return (void*)adNode;
+    return (void*)m_adEnd;
 }
 
 //---------------------------------------------------------------------------
 void* BlockHeap::Allocate()
 {
+    HeapLockGuard<BlockHeapLock> clGuard(this);
+    return AllocateLocked();
+}
+
+//---------------------------------------------------------------------------
+void* BlockHeap::AllocateLocked()
+{
+#if BLOCK_HEAP_INTRUSIVE_FREE_LIST
+    // Pop the first block from the free list - its data holds the next link
+    auto* pvData = m_pvFreeHead;
+    if (pvData != 0) {
+        m_pvFreeHead = *reinterpret_cast<void**>(pvData);
+        m_uBlocksFree--;
+        return pvData;
+    }
+#else
     auto* pclNode = m_clList.GetHead();
 
     // Return the first node from the head of the list
@@ -99,70 +160,416 @@ void* BlockHeap::Allocate()
         m_uBlocksFree--;
 
         // Account for block-management metadata
-        return reinterpret_cast<void*>((K_ADDR)pclNode + sizeof(BlockHeapNode));
+        return reinterpret_cast<void*>((K_ADDR)pclNode + BLOCK_HEAP_NODE_SIZE);
+    }
+#endif
+
+    // No previously-freed blocks - carve a new one from the untouched tail
+    // of the heap, or return null if the heap is empty.
+    if (m_adUnused >= m_adEnd) {
+        return 0;
     }
+    auto adNode = m_adUnused;
+    m_adUnused += m_uStride;
+    m_uBlocksFree--;
 
-    // Or null, if the heap is empty.
-    return 0;
+#if !FIXED_HEAP_HEADERLESS
+    // Create a pointer back to the source list.
+    auto* pclTemp     = reinterpret_cast<BlockHeapNode*>(adNode);
+    pclTemp->m_clHeap = this;
+#endif
+    return reinterpret_cast<void*>(adNode + BLOCK_HEAP_NODE_SIZE);
 }
 
 //---------------------------------------------------------------------------
 void BlockHeap::Free(void* pvData_)
 {
+    HeapLockGuard<BlockHeapLock> clGuard(this);
+    FreeLocked(pvData_);
+}
+
+//---------------------------------------------------------------------------
+void BlockHeap::FreeLocked(void* pvData_)
+{
+#if BLOCK_HEAP_INTRUSIVE_FREE_LIST
+    // Push the block onto the free list, storing the link in its data
+    *reinterpret_cast<void**>(pvData_) = m_pvFreeHead;
+    m_pvFreeHead                       = pvData_;
+#else
     // Compute the address of the original object (class metadata included)
-    auto* pclNode = reinterpret_cast<LinkListNode*>((K_ADDR)pvData_ - sizeof(BlockHeapNode));
+    auto* pclNode = reinterpret_cast<LinkListNode*>((K_ADDR)pvData_ - BLOCK_HEAP_NODE_SIZE);
 
     // Add the object back to the block data pool
     m_clList.Add(pclNode);
+#endif
     m_uBlocksFree++;
 }
 
 //---------------------------------------------------------------------------
-void FixedHeap::Create(void* pvHeap_, HeapConfig* pclHeapConfig_)
+bool BlockHeap::Contains(void* pvData_)
 {
-    int i      = 0;
-    void*    pvTemp = pvHeap_;
-    while (pclHeapConfig_[i].m_uBlockSize != 0) {
+    auto adNode = reinterpret_cast<K_ADDR>(pvData_) - BLOCK_HEAP_NODE_SIZE;
+    if ((adNode < m_adStart) || (adNode >= m_adEnd)) {
+        return false;
+    }
+    return ((adNode - m_adStart) % m_uStride) == 0;
+}
+
+//---------------------------------------------------------------------------
+bool FixedHeap::Create(void* pvHeap_, HeapConfig* pclHeapConfig_)
+{
+    int   i      = 0;
+    void* pvTemp = pvHeap_;
+
+    // Refuse configurations with more bins than can be tracked, rather than
+    // silently dropping the largest blocks
+    int iNumBins = 0;
+    while (pclHeapConfig_[iNumBins].m_uBlockSize != 0) {
+        iNumBins++;
+    }
+    auto bValid = (iNumBins <= FIXED_HEAP_MAX_BINS);
+    if (!bValid) {
+        iNumBins = 0;
+    }
+
+    m_u32NonEmpty = 0;
+    m_u8LutShift  = FIXED_HEAP_LUT_MAX_SHIFT;
+    m_pfPageAlloc = nullptr;
+    m_pfPageFree  = nullptr;
+    InitHooks();
+    FixedHeapLock::Init();
+    while (i < iNumBins) {
         pvTemp = pclHeapConfig_[i].m_clHeap.Create(
             pvTemp,
-            ((pclHeapConfig_[i].m_uBlockSize + sizeof(BlockHeapNode)) * pclHeapConfig_[i].m_uBlockCount),
+            (BlockHeap::GetBlockStride(pclHeapConfig_[i].m_uBlockSize) * pclHeapConfig_[i].m_uBlockCount),
             pclHeapConfig_[i].m_uBlockSize);
+        pclHeapConfig_[i].m_clHeap.m_pclOwner = this;
+        pclHeapConfig_[i].m_clHeap.m_u8Bin    = i;
+        if (pclHeapConfig_[i].m_clHeap.IsFree()) {
+            m_u32NonEmpty |= (1UL << i);
+        }
+
+        // The lookup granule must evenly divide every block size
+        while (pclHeapConfig_[i].m_uBlockSize & ((1 << m_u8LutShift) - 1)) {
+            m_u8LutShift--;
+        }
         i++;
     }
     m_paclHeaps = pclHeapConfig_;
+    m_u8NumBins = i;
+
+    // Direct lookup: smallest bin with blocks of at least (n * granule) bytes
+    uint8_t u8Bin = 0;
+    for (i = 0; i <= FIXED_HEAP_LUT_ENTRIES; i++) {
+        while ((u8Bin < m_u8NumBins) && (m_paclHeaps[u8Bin].m_uBlockSize < ((size_t)i << m_u8LutShift))) {
+            u8Bin++;
+        }
+        m_au8SizeLut[i] = (u8Bin < m_u8NumBins) ? u8Bin : FIXED_HEAP_NO_BIN;
+    }
+
+    // log2 lookup: smallest bin with blocks larger than 2^(n-1) bytes
+    u8Bin = 0;
+    for (i = 0; i <= (int)(sizeof(size_t) * 8); i++) {
+        auto uMinSize = (i == 0) ? 0 : (((size_t)1 << (i - 1)) + 1);
+        while ((u8Bin < m_u8NumBins) && (m_paclHeaps[u8Bin].m_uBlockSize < uMinSize)) {
+            u8Bin++;
+        }
+        m_au8Log2Lut[i] = (u8Bin < m_u8NumBins) ? u8Bin : FIXED_HEAP_NO_BIN;
+    }
+    return bValid;
+}
+
+//---------------------------------------------------------------------------
+uint8_t FixedHeap::BinForSize(size_t uSize_)
+{
+    // Small sizes resolve directly from the lookup table
+    if (uSize_ <= ((size_t)FIXED_HEAP_LUT_ENTRIES << m_u8LutShift)) {
+        return m_au8SizeLut[(uSize_ + ((1 << m_u8LutShift) - 1)) >> m_u8LutShift];
+    }
+
+    // Larger sizes start from the first bin in the size's power-of-two
+    // range, and only have to step over bins within that range.
+    auto u8Bin = m_au8Log2Lut[Log2Ceil(uSize_)];
+    while ((u8Bin < m_u8NumBins) && (m_paclHeaps[u8Bin].m_uBlockSize < uSize_)) {
+        u8Bin++;
+    }
+    return (u8Bin < m_u8NumBins) ? u8Bin : FIXED_HEAP_NO_BIN;
 }
 
 //---------------------------------------------------------------------------
 void* FixedHeap::Allocate(size_t uSize_)
 {
-    void*    pvRet = 0;
-    int i     = 0;
+    auto  u8Bin  = BinForSize(uSize_);
+    void* pvRet  = nullptr;
+    auto  u8Used = u8Bin;
+    if (u8Bin != FIXED_HEAP_NO_BIN) {
+        pvRet = AllocateFromBin(u8Bin, &u8Used);
+    }
+    if (HasHooks()) {
+        HeapLockGuard<FixedHeapLock> clGuard(this);
+        HookAllocate(uSize_, pvRet, (pvRet != nullptr) && (u8Used != u8Bin));
+    }
+    return pvRet;
+}
 
-    // Go through all heaps, trying to find the smallest one that
-    // has a free item to satisfy the allocation
-    while (m_paclHeaps[i].m_uBlockSize != 0) {
-        if ((m_paclHeaps[i].m_uBlockSize >= uSize_) && m_paclHeaps[i].m_clHeap.IsFree()) {
-            // Found a match
-            pvRet = m_paclHeaps[i].m_clHeap.Allocate();
+//---------------------------------------------------------------------------
+void* FixedHeap::AllocateFromBin(uint8_t u8Bin_)
+{
+    // Pop directly from the bin's own heap while it has free blocks - the
+    // non-empty bitmap, chunks, growth and spilling are only consulted once
+    // it is exhausted.
+    {
+        HeapLockGuard<FixedHeapLock> clGuard(this);
+        auto* pclHeap = &m_paclHeaps[u8Bin_].m_clHeap;
+        if (pclHeap->IsFree()) {
+            auto* pvRet = pclHeap->AllocateLocked();
+            if (!pclHeap->IsFree() && !BinHasFree(u8Bin_)) {
+                m_u32NonEmpty &= ~(1UL << u8Bin_);
+            }
+            return pvRet;
         }
+    }
 
-        // Return an object if found
-        if (pvRet != 0) {
-            return pvRet;
+    uint8_t u8Used;
+    return AllocateFromBin(u8Bin_, &u8Used);
+}
+
+//---------------------------------------------------------------------------
+void* FixedHeap::AllocateFromBin(uint8_t u8Bin_, uint8_t* pu8Bin_)
+{
+    {
+        HeapLockGuard<FixedHeapLock> clGuard(this);
+        if (!CanGrowBin(u8Bin_)) {
+            return AllocateFromBinLocked(u8Bin_, pu8Bin_);
         }
-        i++;
     }
 
-    // Or null on no-match
+    // Grow the requested bin, rather than spilling over into a larger one.
+    // The page is requested without holding the lock, so the bin may have
+    // been grown (or had blocks freed to it) in the meantime.
+    uint32_t u32PageSize = 0;
+    auto*    pvPage      = m_pfPageAlloc(&u32PageSize);
+    void*    pvRet;
+    {
+        HeapLockGuard<FixedHeapLock> clGuard(this);
+        if ((pvPage != nullptr) && CanGrowBin(u8Bin_) && AddChunk(u8Bin_, pvPage, u32PageSize)) {
+            pvPage = nullptr;
+        }
+        pvRet = AllocateFromBinLocked(u8Bin_, pu8Bin_);
+    }
+    if (pvPage != nullptr) {
+        m_pfPageFree(pvPage);
+    }
     return pvRet;
 }
 
 //---------------------------------------------------------------------------
+void* FixedHeap::AllocateFromBinLocked(uint8_t u8Bin_, uint8_t* pu8Bin_)
+{
+    // Find the smallest bin large enough to satisfy the allocation that
+    // has a free item, using the bitmap of non-empty bins.
+    auto u32Candidates = m_u32NonEmpty & ~((1UL << u8Bin_) - 1);
+    if (!u32Candidates) {
+        return 0;
+    }
+    auto u8Bin = FirstSetBit(u32Candidates);
+    *pu8Bin_   = u8Bin;
+
+    // The bin's own heap is used first, followed by any chunks added to it
+    auto* pclHeap = &m_paclHeaps[u8Bin].m_clHeap;
+    while (!pclHeap->IsFree()) {
+        pclHeap = pclHeap->m_pclNextChunk;
+    }
+    auto* pvRet = pclHeap->AllocateLocked();
+    if (!pclHeap->IsFree() && !BinHasFree(u8Bin)) {
+        m_u32NonEmpty &= ~(1UL << u8Bin);
+    }
+    return pvRet;
+}
+
+//---------------------------------------------------------------------------
+void FixedHeap::SetPageProvider(fixed_heap_alloc_page_function_t pfAlloc_, fixed_heap_free_page_function_t pfFree_)
+{
+    m_pfPageAlloc = pfAlloc_;
+    m_pfPageFree  = pfFree_;
+}
+
+//---------------------------------------------------------------------------
+void FixedHeap::SetBinChunkLimit(uint8_t u8Bin_, uint8_t u8MaxChunks_)
+{
+    if (u8Bin_ >= m_u8NumBins) {
+        return;
+    }
+    HeapLockGuard<FixedHeapLock> clGuard(this);
+    m_paclHeaps[u8Bin_].m_clHeap.m_u8MaxChunks = u8MaxChunks_;
+}
+
+//---------------------------------------------------------------------------
+bool FixedHeap::CanGrowBin(uint8_t u8Bin_)
+{
+    auto* pclBin = &m_paclHeaps[u8Bin_].m_clHeap;
+    return !(m_u32NonEmpty & (1UL << u8Bin_)) && (m_pfPageAlloc != nullptr)
+           && (pclBin->m_u8Chunks < pclBin->m_u8MaxChunks);
+}
+
+//---------------------------------------------------------------------------
+bool FixedHeap::AddChunk(uint8_t u8Bin_, void* pvPage_, uint32_t u32PageSize_)
+{
+    // Each chunk is managed by a BlockHeap at the start of its page, with
+    // the rest of the page carved into blocks.
+    auto uHeaderSize = (sizeof(BlockHeap) + (sizeof(void*) - 1)) & ~(sizeof(void*) - 1);
+    auto uBlockSize  = m_paclHeaps[u8Bin_].m_uBlockSize;
+    if (u32PageSize_ < (uHeaderSize + BlockHeap::GetBlockStride(uBlockSize))) {
+        return false;
+    }
+
+    auto* pclBin   = &m_paclHeaps[u8Bin_].m_clHeap;
+    auto* pclChunk = new (pvPage_) BlockHeap();
+    pclChunk->Create(reinterpret_cast<void*>((K_ADDR)pvPage_ + uHeaderSize), u32PageSize_ - uHeaderSize, uBlockSize);
+    pclChunk->m_pclOwner = this;
+    pclChunk->m_u8Bin    = u8Bin_;
+
+    pclChunk->m_pclNextChunk = pclBin->m_pclNextChunk;
+    pclBin->m_pclNextChunk   = pclChunk;
+    pclBin->m_u8Chunks++;
+
+    m_u32NonEmpty |= (1UL << u8Bin_);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void* FixedHeap::BlockFreed(BlockHeap* pclHeap_)
+{
+    auto  u8Bin  = pclHeap_->m_u8Bin;
+    auto* pclBin = &m_paclHeaps[u8Bin].m_clHeap;
+    m_u32NonEmpty |= (1UL << u8Bin);
+
+    // Give chunks back to the page provider as soon as they are unused
+    if ((pclHeap_ == pclBin) || !pclHeap_->IsUnused()) {
+        return nullptr;
+    }
+
+    auto* pclPrev = pclBin;
+    while (pclPrev->m_pclNextChunk != pclHeap_) {
+        pclPrev = pclPrev->m_pclNextChunk;
+    }
+    pclPrev->m_pclNextChunk = pclHeap_->m_pclNextChunk;
+    pclBin->m_u8Chunks--;
+
+    if (!BinHasFree(u8Bin)) {
+        m_u32NonEmpty &= ~(1UL << u8Bin);
+    }
+    pclHeap_->~BlockHeap();
+    return reinterpret_cast<void*>(pclHeap_);
+}
+
+//---------------------------------------------------------------------------
+bool FixedHeap::BinHasFree(uint8_t u8Bin_)
+{
+    auto* pclHeap = &m_paclHeaps[u8Bin_].m_clHeap;
+    while (pclHeap != nullptr) {
+        if (pclHeap->IsFree()) {
+            return true;
+        }
+        pclHeap = pclHeap->m_pclNextChunk;
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+size_t FixedHeap::GetUsableSize(void* pvNode_)
+{
+#if FIXED_HEAP_HEADERLESS
+    HeapLockGuard<FixedHeapLock> clGuard(this);
+    auto* pclHeap = HeapForAddress(pvNode_);
+    if (pclHeap == nullptr) {
+        return 0;
+    }
+#else
+    auto* pclHeap = reinterpret_cast<BlockHeapNode*>((K_ADDR)pvNode_ - sizeof(BlockHeapNode))->m_clHeap;
+#endif
+    // Padding added to keep blocks aligned is usable too
+    return pclHeap->m_uStride - BLOCK_HEAP_NODE_SIZE;
+}
+
+//---------------------------------------------------------------------------
+#if FIXED_HEAP_HEADERLESS
+BlockHeap* FixedHeap::HeapForAddress(void* pvNode_)
+{
+    // Bins are carved from the heap in order, so their address ranges are
+    // sorted - find the first bin ending after the block.
+    auto    adNode = reinterpret_cast<K_ADDR>(pvNode_);
+    uint8_t u8Low  = 0;
+    uint8_t u8High = m_u8NumBins;
+    while (u8Low < u8High) {
+        uint8_t u8Mid = (u8Low + u8High) >> 1;
+        if (adNode < m_paclHeaps[u8Mid].m_clHeap.m_adEnd) {
+            u8High = u8Mid;
+        } else {
+            u8Low = u8Mid + 1;
+        }
+    }
+    if ((u8Low < m_u8NumBins) && m_paclHeaps[u8Low].m_clHeap.Contains(pvNode_)) {
+        return &m_paclHeaps[u8Low].m_clHeap;
+    }
+
+    // Chunks added to bins live outside of the heap - search them
+    for (uint8_t i = 0; i < m_u8NumBins; i++) {
+        auto* pclChunk = m_paclHeaps[i].m_clHeap.m_pclNextChunk;
+        while (pclChunk != nullptr) {
+            if (pclChunk->Contains(pvNode_)) {
+                return pclChunk;
+            }
+            pclChunk = pclChunk->m_pclNextChunk;
+        }
+    }
+    return nullptr;
+}
+
+//---------------------------------------------------------------------------
+void FixedHeap::Free(void* pvNode_)
+{
+    void* pvPage;
+    {
+        HeapLockGuard<FixedHeapLock> clGuard(this);
+
+        // Find the heap from the block's address; ignore foreign pointers
+        auto* pclHeap = HeapForAddress(pvNode_);
+        if (pclHeap == nullptr) {
+            return;
+        }
+        HookFree(pvNode_);
+        pclHeap->FreeLocked(pvNode_);
+        pvPage = BlockFreed(pclHeap);
+    }
+    if (pvPage != nullptr) {
+        m_pfPageFree(pvPage);
+    }
+}
+#else
 void FixedHeap::Free(void* pvNode_)
 {
     // Compute the pointer to the block-heap this block belongs to, and
     // return it.
-    auto* pclNode = reinterpret_cast<BlockHeapNode*>((K_ADDR)pvNode_ - sizeof(BlockHeapNode));
-    pclNode->m_clHeap->Free(pvNode_);
+    auto* pclNode  = reinterpret_cast<BlockHeapNode*>((K_ADDR)pvNode_ - sizeof(BlockHeapNode));
+    auto* pclHeap  = pclNode->m_clHeap;
+    auto* pclOwner = pclHeap->m_pclOwner;
+    if (pclOwner == nullptr) {
+        pclHeap->Free(pvNode_);
+        return;
+    }
+
+    // Flag the bin as having free blocks in its owner
+    void* pvPage;
+    {
+        HeapLockGuard<FixedHeapLock> clGuard(pclOwner);
+        pclHeap->FreeLocked(pvNode_);
+        pclOwner->HookFree(pvNode_);
+        pvPage = pclOwner->BlockFreed(pclHeap);
+    }
+    if (pvPage != nullptr) {
+        pclOwner->m_pfPageFree(pvPage);
+    }
 }
+#endif
 } // namespace Mark3
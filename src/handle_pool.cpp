@@ -0,0 +1,160 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file handle_pool.cpp
+
+    @brief Object pool addressed by generational handles, with objects kept
+           densely packed for iteration.
+*/
+
+#include "handle_pool.h"
+
+namespace Mark3
+{
+namespace
+{
+//---------------------------------------------------------------------------
+inline pool_index_t HandleIndex(pool_handle_t uHandle_)
+{
+    return (pool_index_t)uHandle_;
+}
+
+//---------------------------------------------------------------------------
+inline pool_generation_t HandleGeneration(pool_handle_t uHandle_)
+{
+    return (pool_generation_t)(uHandle_ >> HANDLE_POOL_INDEX_BITS);
+}
+
+//---------------------------------------------------------------------------
+inline pool_handle_t MakeHandle(pool_index_t uIndex_, pool_generation_t uGeneration_)
+{
+    return ((pool_handle_t)uGeneration_ << HANDLE_POOL_INDEX_BITS) | uIndex_;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+void HandlePool::Init(void*               pvObjects_,
+                      handle_pool_slot_t* pstSlots_,
+                      pool_index_t*       puSlotIndex_,
+                      pool_index_t        uCapacity_,
+                      uint32_t            u32ObjSize_)
+{
+    m_pvObjects   = pvObjects_;
+    m_pstSlots    = pstSlots_;
+    m_puSlotIndex = puSlotIndex_;
+    m_uCapacity   = uCapacity_;
+    m_uCount      = 0;
+    m_uFreeSlot   = HANDLE_POOL_NO_INDEX;
+    m_uUnusedSlot = 0;
+    m_u32ObjSize  = u32ObjSize_;
+    m_bWordCopy   = ((((K_ADDR)pvObjects_) | u32ObjSize_) & (sizeof(K_WORD) - 1)) == 0;
+}
+
+//---------------------------------------------------------------------------
+pool_handle_t HandlePool::Allocate(void)
+{
+    if (m_uCount == m_uCapacity) {
+        return HANDLE_POOL_INVALID_HANDLE;
+    }
+
+    // Reuse a recycled slot if possible, otherwise take one never used before
+    pool_index_t uSlot;
+    if (m_uFreeSlot != HANDLE_POOL_NO_INDEX) {
+        uSlot       = m_uFreeSlot;
+        m_uFreeSlot = m_pstSlots[uSlot].uIndex;
+    } else {
+        uSlot                         = m_uUnusedSlot++;
+        m_pstSlots[uSlot].uGeneration = 1;
+    }
+
+    m_pstSlots[uSlot].uIndex = m_uCount;
+    m_puSlotIndex[m_uCount]  = uSlot;
+    m_uCount++;
+    return MakeHandle(uSlot, m_pstSlots[uSlot].uGeneration);
+}
+
+//---------------------------------------------------------------------------
+bool HandlePool::Free(pool_handle_t uHandle_)
+{
+    auto* pstSlot = GetSlot(uHandle_);
+    if (pstSlot == nullptr) {
+        return false;
+    }
+
+    // Move the last object into the hole, and point its slot at the new position
+    auto uIndex = pstSlot->uIndex;
+    auto uLast  = (pool_index_t)(m_uCount - 1);
+    if (uIndex != uLast) {
+        if (m_bWordCopy) {
+            auto* pwDst = static_cast<K_WORD*>(ObjectAt(uIndex));
+            auto* pwSrc = static_cast<K_WORD*>(ObjectAt(uLast));
+            for (uint32_t i = 0; i < (m_u32ObjSize / sizeof(K_WORD)); i++) {
+                pwDst[i] = pwSrc[i];
+            }
+        } else {
+            auto* pu8Dst = static_cast<uint8_t*>(ObjectAt(uIndex));
+            auto* pu8Src = static_cast<uint8_t*>(ObjectAt(uLast));
+            for (uint32_t i = 0; i < m_u32ObjSize; i++) {
+                pu8Dst[i] = pu8Src[i];
+            }
+        }
+        m_puSlotIndex[uIndex]                    = m_puSlotIndex[uLast];
+        m_pstSlots[m_puSlotIndex[uIndex]].uIndex = uIndex;
+    }
+    m_uCount--;
+
+    // Retire the handle - generation 0 is never used, so no handle is 0
+    pstSlot->uGeneration++;
+    if (pstSlot->uGeneration == 0) {
+        pstSlot->uGeneration = 1;
+    }
+    pstSlot->uIndex = m_uFreeSlot;
+    m_uFreeSlot     = HandleIndex(uHandle_);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void* HandlePool::Get(pool_handle_t uHandle_)
+{
+    auto* pstSlot = GetSlot(uHandle_);
+    if (pstSlot == nullptr) {
+        return nullptr;
+    }
+    return ObjectAt(pstSlot->uIndex);
+}
+
+//---------------------------------------------------------------------------
+pool_handle_t HandlePool::GetHandle(pool_index_t uIndex_)
+{
+    if (uIndex_ >= m_uCount) {
+        return HANDLE_POOL_INVALID_HANDLE;
+    }
+    auto uSlot = m_puSlotIndex[uIndex_];
+    return MakeHandle(uSlot, m_pstSlots[uSlot].uGeneration);
+}
+
+//---------------------------------------------------------------------------
+handle_pool_slot_t* HandlePool::GetSlot(pool_handle_t uHandle_)
+{
+    auto uSlot = HandleIndex(uHandle_);
+    if (uSlot >= m_uUnusedSlot) {
+        return nullptr;
+    }
+    auto* pstSlot = &m_pstSlots[uSlot];
+    if (pstSlot->uGeneration != HandleGeneration(uHandle_)) {
+        return nullptr;
+    }
+    return pstSlot;
+}
+} // namespace Mark3
@@ -0,0 +1,203 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+
+    @file   heap_accounting.cpp
+
+    @brief  Per-subsystem (tagged) memory accounting and quotas
+*/
+
+#include "mark3.h"
+#include "heap_accounting.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+void HeapAccounting::Init(void)
+{
+    HeapAccountingLock::Init();
+    for (uint8_t i = 0; i < HEAP_ACCOUNTING_MAX_TAGS; i++) {
+        auto* pstStats            = &m_astTags[i];
+        pstStats->u32LiveBytes    = 0;
+        pstStats->u32LiveObjects  = 0;
+        pstStats->u32PeakBytes    = 0;
+        pstStats->u32SoftQuota    = HEAP_QUOTA_NONE;
+        pstStats->u32HardQuota    = HEAP_QUOTA_NONE;
+        pstStats->u32SoftOverruns = 0;
+        pstStats->u32Rejected     = 0;
+        pstStats->u32Failures     = 0;
+    }
+    m_u32OverSoft        = 0;
+    m_pfSoftQuotaHandler = nullptr;
+    m_pvSoftQuotaContext = nullptr;
+}
+
+//---------------------------------------------------------------------------
+void HeapAccounting::SetQuota(heap_tag_t uTag_, uint32_t u32SoftQuota_, uint32_t u32HardQuota_)
+{
+    if (uTag_ >= HEAP_ACCOUNTING_MAX_TAGS) {
+        return;
+    }
+    HeapLockGuard<HeapAccountingLock> clGuard(this);
+    m_astTags[uTag_].u32SoftQuota = u32SoftQuota_;
+    m_astTags[uTag_].u32HardQuota = u32HardQuota_;
+}
+
+//---------------------------------------------------------------------------
+void HeapAccounting::SetSoftQuotaHandler(heap_quota_function_t pfHandler_, void* pvContext_)
+{
+    HeapLockGuard<HeapAccountingLock> clGuard(this);
+    m_pfSoftQuotaHandler = pfHandler_;
+    m_pvSoftQuotaContext = pvContext_;
+}
+
+//---------------------------------------------------------------------------
+bool HeapAccounting::Charge(heap_tag_t uTag_, size_t uSize_)
+{
+    if (uTag_ >= HEAP_ACCOUNTING_MAX_TAGS) {
+        return false;
+    }
+
+    heap_quota_function_t pfHandler = nullptr;
+    void*                 pvContext = nullptr;
+    uint32_t              u32Live;
+    {
+        HeapLockGuard<HeapAccountingLock> clGuard(this);
+        auto* pstStats = &m_astTags[uTag_];
+
+        // Refuse anything that would take the tag over its hard quota (or
+        // overflow the counters) before the allocator is involved.
+        if ((uSize_ > (0xFFFFFFFF - pstStats->u32LiveBytes))
+            || ((pstStats->u32HardQuota != HEAP_QUOTA_NONE)
+                && ((pstStats->u32LiveBytes + uSize_) > pstStats->u32HardQuota))) {
+            pstStats->u32Rejected++;
+            return false;
+        }
+
+        pstStats->u32LiveBytes += uSize_;
+        pstStats->u32LiveObjects++;
+        if (pstStats->u32LiveBytes > pstStats->u32PeakBytes) {
+            pstStats->u32PeakBytes = pstStats->u32LiveBytes;
+        }
+
+        if ((pstStats->u32SoftQuota != HEAP_QUOTA_NONE) && (pstStats->u32LiveBytes > pstStats->u32SoftQuota)) {
+            pstStats->u32SoftOverruns++;
+            auto u32Mask = (1UL << uTag_);
+            if ((m_u32OverSoft & u32Mask) == 0) {
+                m_u32OverSoft |= u32Mask;
+                pfHandler = m_pfSoftQuotaHandler;
+                pvContext = m_pvSoftQuotaContext;
+            }
+        }
+        u32Live = pstStats->u32LiveBytes;
+    }
+
+    // Notify outside of the lock, so the handler can free memory
+    if (pfHandler != nullptr) {
+        pfHandler(pvContext, uTag_, u32Live);
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void HeapAccounting::Credit(heap_tag_t uTag_, size_t uSize_)
+{
+    if (uTag_ >= HEAP_ACCOUNTING_MAX_TAGS) {
+        return;
+    }
+    HeapLockGuard<HeapAccountingLock> clGuard(this);
+    Release(&m_astTags[uTag_], uSize_);
+}
+
+//---------------------------------------------------------------------------
+void HeapAccounting::Cancel(heap_tag_t uTag_, size_t uSize_)
+{
+    if (uTag_ >= HEAP_ACCOUNTING_MAX_TAGS) {
+        return;
+    }
+    HeapLockGuard<HeapAccountingLock> clGuard(this);
+    Release(&m_astTags[uTag_], uSize_);
+    m_astTags[uTag_].u32Failures++;
+}
+
+//---------------------------------------------------------------------------
+bool HeapAccounting::GetStats(heap_tag_t uTag_, heap_tag_stats_t* pstStats_)
+{
+    if (uTag_ >= HEAP_ACCOUNTING_MAX_TAGS) {
+        return false;
+    }
+    HeapLockGuard<HeapAccountingLock> clGuard(this);
+    *pstStats_ = m_astTags[uTag_];
+    return true;
+}
+
+//---------------------------------------------------------------------------
+uint32_t HeapAccounting::GetTotalLiveBytes(void)
+{
+    HeapLockGuard<HeapAccountingLock> clGuard(this);
+    uint32_t u32Total = 0;
+    for (uint8_t i = 0; i < HEAP_ACCOUNTING_MAX_TAGS; i++) {
+        u32Total += m_astTags[i].u32LiveBytes;
+    }
+    return u32Total;
+}
+
+//---------------------------------------------------------------------------
+void HeapAccounting::Release(heap_tag_stats_t* pstStats_, size_t uSize_)
+{
+    if (uSize_ > pstStats_->u32LiveBytes) {
+        uSize_ = pstStats_->u32LiveBytes;
+    }
+    pstStats_->u32LiveBytes -= uSize_;
+    if (pstStats_->u32LiveObjects != 0) {
+        pstStats_->u32LiveObjects--;
+    }
+
+    // Re-arm the soft quota handler once the tag is back under its quota
+    if ((pstStats_->u32SoftQuota == HEAP_QUOTA_NONE) || (pstStats_->u32LiveBytes <= pstStats_->u32SoftQuota)) {
+        m_u32OverSoft &= ~(1UL << (pstStats_ - m_astTags));
+    }
+}
+
+//---------------------------------------------------------------------------
+void TaggedResource::Init(MemoryResource* pclParent_, HeapAccounting* pclAccounting_, heap_tag_t uTag_)
+{
+    m_pclParent     = pclParent_;
+    m_pclAccounting = pclAccounting_;
+    m_uTag          = uTag_;
+    MemoryResource::Init(ResourceAlloc, ResourceFree, this);
+}
+
+//---------------------------------------------------------------------------
+void* TaggedResource::ResourceAlloc(void* pvContext_, size_t uSize_)
+{
+    auto* pclResource = static_cast<TaggedResource*>(pvContext_);
+    if (!pclResource->m_pclAccounting->Charge(pclResource->m_uTag, uSize_)) {
+        return nullptr;
+    }
+    auto* pvData = pclResource->m_pclParent->Allocate(uSize_);
+    if (pvData == nullptr) {
+        pclResource->m_pclAccounting->Cancel(pclResource->m_uTag, uSize_);
+    }
+    return pvData;
+}
+
+//---------------------------------------------------------------------------
+void TaggedResource::ResourceFree(void* pvContext_, void* pvData_, size_t uSize_)
+{
+    auto* pclResource = static_cast<TaggedResource*>(pvContext_);
+    pclResource->m_pclParent->Free(pvData_, uSize_);
+    pclResource->m_pclAccounting->Credit(pclResource->m_uTag, uSize_);
+}
+} // namespace Mark3
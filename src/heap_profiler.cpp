@@ -0,0 +1,357 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file heap_profiler.cpp
+
+    @brief Allocation-size profiler, used to derive heap configurations from
+           the allocation patterns of a real workload.
+
+    Live allocations are tracked in a fixed-size, open-addressed hash table
+    (linear probing, with backward-shift deletion), so that each free can be
+    attributed to the size bucket of the original request.
+
+    Size classes are generated by partitioning the recorded (non-empty)
+    buckets into contiguous ranges, each range served by one bin sized for
+    the largest request within it.  The partition minimizing the bytes lost
+    to internal fragmentation at peak usage is found by dynamic programming
+    over the number of bins and the last bucket covered.
+*/
+
+#include "heap_profiler.h"
+#include "fixed_heap.h"
+
+namespace Mark3
+{
+namespace
+{
+//---------------------------------------------------------------------------
+// Number of block size/count slots defined in system_heap_config.h
+constexpr uint8_t s_u8ConfigSlots = 10;
+
+//---------------------------------------------------------------------------
+inline size_t RoundToPointer(size_t uSize_)
+{
+    return (uSize_ + (sizeof(void*) - 1)) & ~(sizeof(void*) - 1);
+}
+
+//---------------------------------------------------------------------------
+inline uint16_t HomeSlot(void* pvData_)
+{
+    return (uint16_t)(((K_ADDR)pvData_ / sizeof(void*)) % HEAP_PROFILER_MAX_LIVE);
+}
+
+//---------------------------------------------------------------------------
+void WriteNumber(heap_profiler_write_function_t pfWrite_, void* pvContext_, size_t uValue_)
+{
+    char  acBuf[(sizeof(size_t) * 3) + 1];
+    char* pcDigit = &acBuf[sizeof(acBuf) - 1];
+    *pcDigit      = '\0';
+    do {
+        *--pcDigit = '0' + (uValue_ % 10);
+        uValue_ /= 10;
+    } while (uValue_);
+    pfWrite_(pvContext_, pcDigit);
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+void HeapProfiler::Init(void)
+{
+    for (uint8_t i = 0; i < HEAP_PROFILER_BUCKETS; i++) {
+        m_astBuckets[i].u32Allocs   = 0;
+        m_astBuckets[i].u32Bytes    = 0;
+        m_astBuckets[i].u32Failures = 0;
+        m_astBuckets[i].u32Spills   = 0;
+        m_astBuckets[i].u16Live     = 0;
+        m_astBuckets[i].u16PeakLive = 0;
+        m_astBuckets[i].uMaxSize    = 0;
+    }
+    for (uint16_t i = 0; i < HEAP_PROFILER_MAX_LIVE; i++) { m_apvLive[i] = nullptr; }
+    m_u16Live      = 0;
+    m_u32PeakLive  = 0;
+    m_u32Untracked = 0;
+}
+
+//---------------------------------------------------------------------------
+uint8_t HeapProfiler::GetBucketForSize(size_t uSize_)
+{
+    auto uBucket = (uSize_ == 0) ? 0 : ((uSize_ - 1) / HEAP_PROFILER_GRANULE);
+    if (uBucket >= HEAP_PROFILER_BUCKETS) {
+        return HEAP_PROFILER_BUCKETS - 1;
+    }
+    return (uint8_t)uBucket;
+}
+
+//---------------------------------------------------------------------------
+void HeapProfiler::RecordAllocate(size_t uSize_, void* pvData_, bool bSpilled_)
+{
+    auto  u8Bucket = GetBucketForSize(uSize_);
+    auto* pstStats = &m_astBuckets[u8Bucket];
+    if (pvData_ == nullptr) {
+        pstStats->u32Failures++;
+        return;
+    }
+
+    pstStats->u32Allocs++;
+    pstStats->u32Bytes += uSize_;
+    if (uSize_ > pstStats->uMaxSize) {
+        pstStats->uMaxSize = uSize_;
+    }
+    if (bSpilled_) {
+        pstStats->u32Spills++;
+    }
+
+    // Always keep one slot free, so probing terminates
+    if (m_u16Live >= (HEAP_PROFILER_MAX_LIVE - 1)) {
+        m_u32Untracked++;
+        return;
+    }
+    auto u16Slot             = SlotForData(pvData_);
+    m_apvLive[u16Slot]       = pvData_;
+    m_au8LiveBucket[u16Slot] = u8Bucket;
+    m_u16Live++;
+
+    if (++pstStats->u16Live > pstStats->u16PeakLive) {
+        pstStats->u16PeakLive = pstStats->u16Live;
+    }
+    if (m_u16Live > m_u32PeakLive) {
+        m_u32PeakLive = m_u16Live;
+    }
+}
+
+//---------------------------------------------------------------------------
+void HeapProfiler::RecordFree(void* pvData_)
+{
+    if (pvData_ == nullptr) {
+        return;
+    }
+    auto u16Slot = SlotForData(pvData_);
+    if (m_apvLive[u16Slot] != pvData_) {
+        return;
+    }
+    m_astBuckets[m_au8LiveBucket[u16Slot]].u16Live--;
+    m_u16Live--;
+
+    // Shift back any entries in the probe sequence that would no longer be
+    // reachable from their home slot once this one is emptied.
+    auto u16Empty = u16Slot;
+    auto u16Next  = u16Slot;
+    while (true) {
+        u16Next = (u16Next + 1) % HEAP_PROFILER_MAX_LIVE;
+        if (m_apvLive[u16Next] == nullptr) {
+            break;
+        }
+        auto u16Home = HomeSlot(m_apvLive[u16Next]);
+        bool bInPlace;
+        if (u16Empty <= u16Next) {
+            bInPlace = (u16Empty < u16Home) && (u16Home <= u16Next);
+        } else {
+            bInPlace = (u16Empty < u16Home) || (u16Home <= u16Next);
+        }
+        if (!bInPlace) {
+            m_apvLive[u16Empty]       = m_apvLive[u16Next];
+            m_au8LiveBucket[u16Empty] = m_au8LiveBucket[u16Next];
+            u16Empty                  = u16Next;
+        }
+    }
+    m_apvLive[u16Empty] = nullptr;
+}
+
+//---------------------------------------------------------------------------
+uint16_t HeapProfiler::SlotForData(void* pvData_)
+{
+    auto u16Slot = HomeSlot(pvData_);
+    while ((m_apvLive[u16Slot] != nullptr) && (m_apvLive[u16Slot] != pvData_)) {
+        u16Slot = (u16Slot + 1) % HEAP_PROFILER_MAX_LIVE;
+    }
+    return u16Slot;
+}
+
+//---------------------------------------------------------------------------
+uint8_t HeapProfiler::GenerateConfig(HeapConfig* pclConfig_, uint8_t u8MaxBins_, size_t uBudget_)
+{
+    // Only buckets that have seen allocations are candidates
+    uint8_t u8NumUsed = 0;
+    for (uint8_t i = 0; i < HEAP_PROFILER_BUCKETS; i++) {
+        if (m_astBuckets[i].u32Allocs != 0) {
+            m_au8Used[u8NumUsed++] = i;
+        }
+    }
+
+    uint8_t u8NumBins = u8MaxBins_;
+    if (u8NumBins > HEAP_PROFILER_MAX_BINS) {
+        u8NumBins = HEAP_PROFILER_MAX_BINS;
+    }
+    if (u8NumBins > u8NumUsed) {
+        u8NumBins = u8NumUsed;
+    }
+    pclConfig_[u8NumBins].m_uBlockSize  = 0;
+    pclConfig_[u8NumBins].m_uBlockCount = 0;
+    if (u8NumBins == 0) {
+        return 0;
+    }
+
+    // Each bucket contributes its peak live count (at least one block), with
+    // each of those blocks wasting the difference between the bin size and
+    // the bucket's average request size.
+    auto Demand = [this](uint8_t u8Used_) -> uint64_t {
+        auto* pstStats = &m_astBuckets[m_au8Used[u8Used_]];
+        return pstStats->u16PeakLive ? pstStats->u16PeakLive : 1;
+    };
+    auto Bytes = [this, &Demand](uint8_t u8Used_) -> uint64_t {
+        auto* pstStats = &m_astBuckets[m_au8Used[u8Used_]];
+        return Demand(u8Used_) * (pstStats->u32Bytes / pstStats->u32Allocs);
+    };
+    auto BinSize = [this](uint8_t u8Used_) -> uint64_t {
+        return RoundToPointer(m_astBuckets[m_au8Used[u8Used_]].uMaxSize);
+    };
+
+    // A single bin covering buckets [0..j]
+    uint64_t u64Demand = 0;
+    uint64_t u64Bytes  = 0;
+    for (uint8_t j = 0; j < u8NumUsed; j++) {
+        u64Demand += Demand(j);
+        u64Bytes += Bytes(j);
+        m_au64Cost[0][j] = (BinSize(j) * u64Demand) - u64Bytes;
+        m_au8Split[0][j] = 0;
+    }
+
+    // k bins covering buckets [0..j], with the last bin covering [i..j]
+    for (uint8_t k = 2; k <= u8NumBins; k++) {
+        auto* pu64Prev = m_au64Cost[k & 1];
+        auto* pu64Curr = m_au64Cost[(k - 1) & 1];
+        for (uint8_t j = k - 1; j < u8NumUsed; j++) {
+            uint64_t u64Best = ~(uint64_t)0;
+            u64Demand        = 0;
+            u64Bytes         = 0;
+            for (uint8_t i = j; i >= k - 1; i--) {
+                u64Demand += Demand(i);
+                u64Bytes += Bytes(i);
+                auto u64Cost = pu64Prev[i - 1] + (BinSize(j) * u64Demand) - u64Bytes;
+                if (u64Cost < u64Best) {
+                    u64Best              = u64Cost;
+                    m_au8Split[k - 1][j] = i;
+                }
+            }
+            pu64Curr[j] = u64Best;
+        }
+    }
+
+    // Walk back through the chosen splits to build the bins, largest first
+    int    j      = u8NumUsed - 1;
+    size_t uTotal = 0;
+    for (int k = u8NumBins; k > 0; k--) {
+        auto u8First = m_au8Split[k - 1][j];
+        u64Demand    = 0;
+        for (int i = u8First; i <= j; i++) { u64Demand += Demand(i); }
+
+        pclConfig_[k - 1].m_uBlockSize  = BinSize(j);
+        pclConfig_[k - 1].m_uBlockCount = u64Demand;
+        uTotal += BlockHeap::GetBlockStride(BinSize(j)) * u64Demand;
+        j = u8First - 1;
+    }
+
+    // Scale the block counts to fill the budget
+    if (uBudget_ != 0) {
+        uint64_t u64Scaled = 0;
+        for (uint8_t i = 0; i < u8NumBins; i++) {
+            auto uCount = (size_t)(((uint64_t)pclConfig_[i].m_uBlockCount * uBudget_) / uTotal);
+            pclConfig_[i].m_uBlockCount = uCount ? uCount : 1;
+            u64Scaled += (uint64_t)BlockHeap::GetBlockStride(pclConfig_[i].m_uBlockSize) * pclConfig_[i].m_uBlockCount;
+        }
+
+        // Bins rounded up to a single block can take the total over budget -
+        // give blocks back from the bins with the most to spare until it
+        // fits (every bin keeps at least one block).
+        while (u64Scaled > uBudget_) {
+            uint8_t u8Trim = u8NumBins;
+            for (uint8_t i = 0; i < u8NumBins; i++) {
+                if ((pclConfig_[i].m_uBlockCount > 1)
+                    && ((u8Trim == u8NumBins) || (pclConfig_[i].m_uBlockCount > pclConfig_[u8Trim].m_uBlockCount))) {
+                    u8Trim = i;
+                }
+            }
+            if (u8Trim == u8NumBins) {
+                break;
+            }
+            pclConfig_[u8Trim].m_uBlockCount--;
+            u64Scaled -= BlockHeap::GetBlockStride(pclConfig_[u8Trim].m_uBlockSize);
+        }
+    }
+    return u8NumBins;
+}
+
+//---------------------------------------------------------------------------
+void HeapProfiler::GenerateArenaSizes(K_ADDR* auSizes_, uint8_t u8NumSizes_)
+{
+    uint64_t u64Total = 0;
+    for (uint8_t i = 0; i < HEAP_PROFILER_BUCKETS; i++) { u64Total += m_astBuckets[i].u32Allocs; }
+
+    // List i starts at the size below which (i / n) of allocations fall
+    K_ADDR   uPrev     = 0;
+    uint64_t u64Cumul  = 0;
+    uint8_t  u8Bucket  = 0;
+    for (uint8_t i = 0; i < u8NumSizes_; i++) {
+        auto   u64Target = (u64Total * i) / u8NumSizes_;
+        K_ADDR uSize     = 0;
+        while (u8Bucket < HEAP_PROFILER_BUCKETS) {
+            auto* pstStats = &m_astBuckets[u8Bucket];
+            if (pstStats->u32Allocs && ((u64Cumul + pstStats->u32Allocs) > u64Target)) {
+                uSize = RoundToPointer(pstStats->uMaxSize);
+                break;
+            }
+            u64Cumul += pstStats->u32Allocs;
+            u8Bucket++;
+        }
+
+        // List sizes must be strictly increasing
+        if (uSize <= uPrev) {
+            uSize = uPrev ? (uPrev * 2) : HEAP_PROFILER_GRANULE;
+        }
+        auSizes_[i] = uSize;
+        uPrev       = uSize;
+    }
+}
+
+//---------------------------------------------------------------------------
+void HeapProfiler::WriteConfig(const HeapConfig*              pclConfig_,
+                               heap_profiler_write_function_t pfWrite_,
+                               void*                          pvContext_)
+{
+    uint8_t u8NumBins = 0;
+    while (pclConfig_[u8NumBins].m_uBlockSize != 0) { u8NumBins++; }
+
+    pfWrite_(pvContext_, "#define HEAP_NUM_SIZES (");
+    WriteNumber(pfWrite_, pvContext_, u8NumBins);
+    pfWrite_(pvContext_, ")\n\n");
+
+    // Every slot must be defined, even if unused
+    auto u8Slots = (u8NumBins > s_u8ConfigSlots) ? u8NumBins : s_u8ConfigSlots;
+    for (uint8_t i = 0; i < u8Slots; i++) {
+        pfWrite_(pvContext_, "#define HEAP_BLOCK_SIZE_");
+        WriteNumber(pfWrite_, pvContext_, i + 1);
+        pfWrite_(pvContext_, " ((uint16_t)");
+        WriteNumber(pfWrite_, pvContext_, (i < u8NumBins) ? pclConfig_[i].m_uBlockSize : 0);
+        pfWrite_(pvContext_, ")\n");
+    }
+    pfWrite_(pvContext_, "\n");
+    for (uint8_t i = 0; i < u8Slots; i++) {
+        pfWrite_(pvContext_, "#define HEAP_BLOCK_COUNT_");
+        WriteNumber(pfWrite_, pvContext_, i + 1);
+        pfWrite_(pvContext_, " ((uint16_t)");
+        WriteNumber(pfWrite_, pvContext_, (i < u8NumBins) ? pclConfig_[i].m_uBlockCount : 0);
+        pfWrite_(pvContext_, ")\n");
+    }
+}
+} // namespace Mark3
@@ -0,0 +1,248 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file heap_trace.cpp
+
+    @brief Allocation trace capture, and replay of captured traces against
+           an arbitrary allocator.
+*/
+
+#include "heap_trace.h"
+
+namespace Mark3
+{
+namespace
+{
+//---------------------------------------------------------------------------
+inline uint16_t HomeSlot(K_ADDR adId_)
+{
+    return (uint16_t)((adId_ / sizeof(void*)) % HEAP_REPLAY_MAX_LIVE);
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+void HeapTrace::Init(heap_trace_flush_function_t pfFlush_, void* pvContext_)
+{
+    m_au16Count[0] = 0;
+    m_au16Count[1] = 0;
+    m_abWriting[0] = false;
+    m_abWriting[1] = false;
+    m_u8Active     = 0;
+    m_u32Dropped   = 0;
+    m_pfFlush      = pfFlush_;
+    m_pvContext    = pvContext_;
+}
+
+//---------------------------------------------------------------------------
+void HeapTrace::Record(uint8_t u8Op_, size_t uSize_, void* pvData_)
+{
+    auto*         pclThread = Scheduler::GetCurrentThread();
+    CriticalGuard clGuard;
+    auto          u8Half = m_u8Active;
+    if (m_abWriting[u8Half] || (m_au16Count[u8Half] == (HEAP_TRACE_BUFFER_RECORDS / 2))) {
+        m_u32Dropped++;
+        return;
+    }
+
+    auto* pstRecord         = &m_astRecords[u8Half][m_au16Count[u8Half]++];
+    pstRecord->u8Op         = u8Op_;
+    pstRecord->u8Thread     = pclThread ? pclThread->GetID() : HEAP_TRACE_NO_THREAD;
+    pstRecord->u32Size      = (uint32_t)uSize_;
+    pstRecord->adId         = reinterpret_cast<K_ADDR>(pvData_);
+    pstRecord->u32Timestamp = Kernel::GetTicks();
+
+    // Switch to the other half once this one is full - it's written out by
+    // the next call to Flush(), never from within the allocator calling us.
+    // If the other half is still waiting to be written, stay on this one so
+    // the inactive half remains the older of the two.
+    if ((m_au16Count[u8Half] == (HEAP_TRACE_BUFFER_RECORDS / 2)) && !m_au16Count[u8Half ^ 1]) {
+        m_u8Active = u8Half ^ 1;
+    }
+}
+
+//---------------------------------------------------------------------------
+void HeapTrace::Flush(void)
+{
+    // The inactive half only holds records if it filled up, so it's older
+    // than the active half and is written out first.
+    for (uint8_t i = 0; i < 2; i++) {
+        uint8_t u8Half;
+        {
+            CriticalGuard clGuard;
+            u8Half = (i == 0) ? (m_u8Active ^ 1) : m_u8Active;
+            if (m_abWriting[u8Half] || !m_au16Count[u8Half]) {
+                continue;
+            }
+            m_abWriting[u8Half] = true;
+            if (u8Half == m_u8Active) {
+                m_u8Active = u8Half ^ 1;
+            }
+        }
+        WriteHalf(u8Half);
+    }
+}
+
+//---------------------------------------------------------------------------
+void HeapTrace::WriteHalf(uint8_t u8Half_)
+{
+    m_pfFlush(m_pvContext, m_astRecords[u8Half_], m_au16Count[u8Half_]);
+
+    CriticalGuard clGuard;
+    m_au16Count[u8Half_] = 0;
+    m_abWriting[u8Half_] = false;
+}
+
+//---------------------------------------------------------------------------
+void HeapReplay::Init(heap_replay_alloc_function_t pfAlloc_, heap_replay_free_function_t pfFree_)
+{
+    for (uint16_t i = 0; i < HEAP_REPLAY_MAX_LIVE; i++) { m_aadLiveId[i] = 0; }
+    m_u16Live    = 0;
+    m_uLiveBytes = 0;
+    m_adLow      = ~(K_ADDR)0;
+    m_adHigh     = 0;
+    m_pfAlloc    = pfAlloc_;
+    m_pfFree     = pfFree_;
+
+    m_stResult.u32Ops           = 0;
+    m_stResult.u32Failures      = 0;
+    m_stResult.u32Untracked     = 0;
+    m_stResult.u32Ticks         = 0;
+    m_stResult.uPeakLive        = 0;
+    m_stResult.uPeakFootprint   = 0;
+    m_stResult.u16Fragmentation = 0;
+}
+
+//---------------------------------------------------------------------------
+void HeapReplay::Replay(const heap_trace_record_t* pastRecords_, uint32_t u32Count_)
+{
+    auto u32Start = Kernel::GetTicks();
+    for (uint32_t i = 0; i < u32Count_; i++) {
+        auto* pstRecord = &pastRecords_[i];
+        m_stResult.u32Ops++;
+
+        if (pstRecord->u8Op == HEAP_TRACE_OP_FREE) {
+            auto u16Slot = SlotForId(pstRecord->adId);
+            if (m_aadLiveId[u16Slot] != 0) {
+                FreeSlot(u16Slot);
+            }
+            continue;
+        }
+
+        auto* pvData = m_pfAlloc(pstRecord->u32Size);
+        if (pvData == nullptr) {
+            m_stResult.u32Failures++;
+            continue;
+        }
+
+        auto adData = reinterpret_cast<K_ADDR>(pvData);
+        if (adData < m_adLow) {
+            m_adLow = adData;
+        }
+        if ((adData + pstRecord->u32Size) > m_adHigh) {
+            m_adHigh = adData + pstRecord->u32Size;
+        }
+
+        // Allocations that failed in the trace aren't tracked
+        if (pstRecord->adId == 0) {
+            m_pfFree(pvData);
+            continue;
+        }
+
+        // An ID still live means its free was lost from the trace
+        auto u16Slot = SlotForId(pstRecord->adId);
+        if (m_aadLiveId[u16Slot] != 0) {
+            FreeSlot(u16Slot);
+            u16Slot = SlotForId(pstRecord->adId);
+        }
+
+        // Always keep one slot free, so probing terminates
+        if (m_u16Live >= (HEAP_REPLAY_MAX_LIVE - 1)) {
+            m_stResult.u32Untracked++;
+            m_pfFree(pvData);
+            continue;
+        }
+        m_aadLiveId[u16Slot] = pstRecord->adId;
+        m_apvLive[u16Slot]    = pvData;
+        m_auLiveSize[u16Slot] = pstRecord->u32Size;
+        m_u16Live++;
+
+        m_uLiveBytes += pstRecord->u32Size;
+        if (m_uLiveBytes > m_stResult.uPeakLive) {
+            m_stResult.uPeakLive = m_uLiveBytes;
+        }
+    }
+    m_stResult.u32Ticks += Kernel::GetTicks() - u32Start;
+}
+
+//---------------------------------------------------------------------------
+const heap_replay_result_t* HeapReplay::Finish(void)
+{
+    for (uint16_t i = 0; i < HEAP_REPLAY_MAX_LIVE; i++) {
+        // Removing an entry can shift another into this slot
+        while (m_aadLiveId[i] != 0) {
+            FreeSlot(i);
+        }
+    }
+
+    if (m_adHigh > m_adLow) {
+        m_stResult.uPeakFootprint = m_adHigh - m_adLow;
+        m_stResult.u16Fragmentation
+            = (uint16_t)(1000 - (((uint64_t)m_stResult.uPeakLive * 1000) / m_stResult.uPeakFootprint));
+    }
+    return &m_stResult;
+}
+
+//---------------------------------------------------------------------------
+uint16_t HeapReplay::SlotForId(K_ADDR adId_)
+{
+    auto u16Slot = HomeSlot(adId_);
+    while ((m_aadLiveId[u16Slot] != 0) && (m_aadLiveId[u16Slot] != adId_)) {
+        u16Slot = (u16Slot + 1) % HEAP_REPLAY_MAX_LIVE;
+    }
+    return u16Slot;
+}
+
+//---------------------------------------------------------------------------
+void HeapReplay::FreeSlot(uint16_t u16Slot_)
+{
+    m_pfFree(m_apvLive[u16Slot_]);
+    m_uLiveBytes -= m_auLiveSize[u16Slot_];
+    m_u16Live--;
+
+    // Shift back any entries in the probe sequence that would no longer be
+    // reachable from their home slot once this one is emptied.
+    auto u16Empty = u16Slot_;
+    auto u16Next  = u16Slot_;
+    while (true) {
+        u16Next = (u16Next + 1) % HEAP_REPLAY_MAX_LIVE;
+        if (m_aadLiveId[u16Next] == 0) {
+            break;
+        }
+        auto u16Home = HomeSlot(m_aadLiveId[u16Next]);
+        bool bInPlace;
+        if (u16Empty <= u16Next) {
+            bInPlace = (u16Empty < u16Home) && (u16Home <= u16Next);
+        } else {
+            bInPlace = (u16Empty < u16Home) || (u16Home <= u16Next);
+        }
+        if (!bInPlace) {
+            m_aadLiveId[u16Empty] = m_aadLiveId[u16Next];
+            m_apvLive[u16Empty]    = m_apvLive[u16Next];
+            m_auLiveSize[u16Empty] = m_auLiveSize[u16Next];
+            u16Empty               = u16Next;
+        }
+    }
+    m_aadLiveId[u16Empty] = 0;
+}
+} // namespace Mark3
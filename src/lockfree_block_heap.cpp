@@ -0,0 +1,179 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file lockfree_block_heap.cpp
+    @brief Lock-free, interrupt-safe single-block-size heap
+*/
+
+#include "mark3.h"
+#include "lockfree_block_heap.h"
+
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_4)
+#define LOCKFREE_NATIVE_CAS (1)
+#else
+#define LOCKFREE_NATIVE_CAS (0)
+#endif
+
+namespace Mark3
+{
+namespace
+{
+//---------------------------------------------------------------------------
+inline lockfree_head_t LoadHead(volatile lockfree_head_t* puHead_)
+{
+#if LOCKFREE_NATIVE_CAS
+    return __atomic_load_n(puHead_, __ATOMIC_ACQUIRE);
+#else
+    CriticalGuard clGuard;
+    return *puHead_;
+#endif
+}
+
+//---------------------------------------------------------------------------
+inline bool CompareExchangeHead(volatile lockfree_head_t* puHead_, lockfree_head_t* puExpected_, lockfree_head_t uDesired_)
+{
+#if LOCKFREE_NATIVE_CAS
+    return __atomic_compare_exchange_n(puHead_, puExpected_, uDesired_, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#else
+    CriticalGuard clGuard;
+    if (*puHead_ == *puExpected_) {
+        *puHead_ = uDesired_;
+        return true;
+    }
+    *puExpected_ = *puHead_;
+    return false;
+#endif
+}
+
+//---------------------------------------------------------------------------
+inline void AddCount(volatile uint32_t* pu32Count_, int32_t i32Delta_)
+{
+#if LOCKFREE_NATIVE_CAS
+    __atomic_fetch_add(pu32Count_, i32Delta_, __ATOMIC_RELAXED);
+#else
+    CriticalGuard clGuard;
+    *pu32Count_ += i32Delta_;
+#endif
+}
+
+//---------------------------------------------------------------------------
+// The link stored in a free block may be read while another context is
+// popping (and writing to) the same block - the value read in that case is
+// discarded when the compare-and-swap fails, but must still be read
+// atomically.
+inline uint32_t LoadLink(uint32_t* pu32Link_)
+{
+#if LOCKFREE_NATIVE_CAS
+    return __atomic_load_n(pu32Link_, __ATOMIC_RELAXED);
+#else
+    return *pu32Link_;
+#endif
+}
+
+//---------------------------------------------------------------------------
+inline void StoreLink(uint32_t* pu32Link_, uint32_t u32Index_)
+{
+#if LOCKFREE_NATIVE_CAS
+    __atomic_store_n(pu32Link_, u32Index_, __ATOMIC_RELAXED);
+#else
+    *pu32Link_ = u32Index_;
+#endif
+}
+
+//---------------------------------------------------------------------------
+inline lockfree_head_t MakeHead(lockfree_head_t uOldHead_, uint32_t u32Index_)
+{
+    // Bump the tag on every update, so a stale head never compares equal
+    auto uTag = (uOldHead_ >> LOCKFREE_INDEX_BITS) + 1;
+    return (uTag << LOCKFREE_INDEX_BITS) | (u32Index_ & LOCKFREE_INDEX_MASK);
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+void* LockFreeBlockHeap::Create(void* pvHeap_, size_t uSize_, size_t uBlockSize_)
+{
+    // Each free block must hold a link, and blocks must stay word-aligned
+    if (uBlockSize_ < sizeof(uint32_t)) {
+        uBlockSize_ = sizeof(uint32_t);
+    }
+    m_uStride = (uBlockSize_ + (sizeof(K_ADDR) - 1)) & ~(sizeof(K_ADDR) - 1);
+    m_uBase   = reinterpret_cast<K_ADDR>(pvHeap_);
+
+    auto uNodeCount = uSize_ / m_uStride;
+    if (uNodeCount >= LOCKFREE_INDEX_NONE) {
+        uNodeCount = LOCKFREE_INDEX_NONE - 1;
+    }
+    m_u32NumBlocks = uNodeCount;
+
+    // Link every block to its right neighbour, with the last block
+    // terminating the list.
+    for (uint32_t i = 0; i < m_u32NumBlocks; i++) {
+        auto* pu32Link = reinterpret_cast<uint32_t*>(m_uBase + (i * m_uStride));
+        *pu32Link      = ((i + 1) < m_u32NumBlocks) ? (i + 1) : LOCKFREE_INDEX_NONE;
+    }
+
+    m_u32NumFree = m_u32NumBlocks;
+    m_uHead      = m_u32NumBlocks ? 0 : LOCKFREE_INDEX_NONE;
+
+    // Return pointer to end of heap (used for heap-chaining)
+    return reinterpret_cast<void*>(m_uBase + (m_u32NumBlocks * m_uStride));
+}
+
+//---------------------------------------------------------------------------
+void* LockFreeBlockHeap::Allocate()
+{
+    auto     uHead = LoadHead(&m_uHead);
+    uint32_t u32Index;
+    do {
+        u32Index = uHead & LOCKFREE_INDEX_MASK;
+        if (u32Index == LOCKFREE_INDEX_NONE) {
+            return 0;
+        }
+        auto* pu32Link = reinterpret_cast<uint32_t*>(m_uBase + (u32Index * m_uStride));
+        auto  uNext    = MakeHead(uHead, LoadLink(pu32Link));
+        if (CompareExchangeHead(&m_uHead, &uHead, uNext)) {
+            break;
+        }
+    } while (true);
+
+    AddCount(&m_u32NumFree, -1);
+    return reinterpret_cast<void*>(m_uBase + (u32Index * m_uStride));
+}
+
+//---------------------------------------------------------------------------
+void LockFreeBlockHeap::Free(void* pvData_)
+{
+    auto  u32Index = static_cast<uint32_t>((reinterpret_cast<K_ADDR>(pvData_) - m_uBase) / m_uStride);
+    auto* pu32Link = static_cast<uint32_t*>(pvData_);
+
+    // Count the block before publishing it, so a concurrent allocation of
+    // the same block can never drive the count below zero.
+    AddCount(&m_u32NumFree, 1);
+
+    auto uHead = LoadHead(&m_uHead);
+    do {
+        StoreLink(pu32Link, uHead & LOCKFREE_INDEX_MASK);
+    } while (!CompareExchangeHead(&m_uHead, &uHead, MakeHead(uHead, u32Index)));
+}
+
+//---------------------------------------------------------------------------
+uint32_t LockFreeBlockHeap::GetNumFree()
+{
+#if LOCKFREE_NATIVE_CAS
+    return __atomic_load_n(&m_u32NumFree, __ATOMIC_RELAXED);
+#else
+    return m_u32NumFree;
+#endif
+}
+} // namespace Mark3
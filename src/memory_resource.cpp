@@ -0,0 +1,166 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file memory_resource.cpp
+
+    @brief Polymorphic memory resources wrapping each of the heap allocators.
+*/
+
+#include "memory_resource.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+void MemoryResource::Init(memory_resource_alloc_function_t pfAlloc_,
+                          memory_resource_free_function_t  pfFree_,
+                          void*                            pvContext_)
+{
+    m_pfAlloc   = pfAlloc_;
+    m_pfFree    = pfFree_;
+    m_pvContext = pvContext_;
+}
+
+//---------------------------------------------------------------------------
+void* MemoryResource::Allocate(size_t uSize_, size_t uAlign_)
+{
+    if (uAlign_ <= MEMORY_RESOURCE_NATURAL_ALIGN) {
+        return m_pfAlloc(m_pvContext, uSize_);
+    }
+
+    // Over-allocate, and keep the raw pointer just below the aligned one
+    auto uPadded = uSize_ + uAlign_ + sizeof(void*);
+    if (uPadded < uSize_) {
+        return nullptr;
+    }
+    auto* pvRaw = m_pfAlloc(m_pvContext, uPadded);
+    if (pvRaw == nullptr) {
+        return nullptr;
+    }
+    auto adData = ((K_ADDR)pvRaw + sizeof(void*) + uAlign_ - 1) & ~((K_ADDR)uAlign_ - 1);
+    reinterpret_cast<void**>(adData)[-1] = pvRaw;
+    return reinterpret_cast<void*>(adData);
+}
+
+//---------------------------------------------------------------------------
+void MemoryResource::Free(void* pvData_, size_t uSize_, size_t uAlign_)
+{
+    if (pvData_ == nullptr) {
+        return;
+    }
+    if (uAlign_ <= MEMORY_RESOURCE_NATURAL_ALIGN) {
+        m_pfFree(m_pvContext, pvData_, uSize_);
+        return;
+    }
+    m_pfFree(m_pvContext, reinterpret_cast<void**>(pvData_)[-1], uSize_ + uAlign_ + sizeof(void*));
+}
+
+//---------------------------------------------------------------------------
+void ArenaResource::Init(Arena* pclArena_)
+{
+    MemoryResource::Init(ResourceAlloc, ResourceFree, pclArena_);
+}
+
+//---------------------------------------------------------------------------
+void* ArenaResource::ResourceAlloc(void* pvContext_, size_t uSize_)
+{
+    return static_cast<Arena*>(pvContext_)->Allocate(uSize_);
+}
+
+//---------------------------------------------------------------------------
+void ArenaResource::ResourceFree(void* pvContext_, void* pvData_, size_t /*uSize_*/)
+{
+    static_cast<Arena*>(pvContext_)->Free(pvData_);
+}
+
+//---------------------------------------------------------------------------
+void FixedHeapResource::Init(FixedHeap* pclHeap_)
+{
+    MemoryResource::Init(ResourceAlloc, ResourceFree, pclHeap_);
+}
+
+//---------------------------------------------------------------------------
+void* FixedHeapResource::ResourceAlloc(void* pvContext_, size_t uSize_)
+{
+    return static_cast<FixedHeap*>(pvContext_)->Allocate(uSize_);
+}
+
+//---------------------------------------------------------------------------
+void FixedHeapResource::ResourceFree(void* pvContext_, void* pvData_, size_t /*uSize_*/)
+{
+    static_cast<FixedHeap*>(pvContext_)->Free(pvData_);
+}
+
+//---------------------------------------------------------------------------
+void SlabResource::Init(Slab* paclSlabs_, uint8_t u8NumSlabs_)
+{
+    m_paclSlabs  = paclSlabs_;
+    m_u8NumSlabs = u8NumSlabs_;
+    MemoryResource::Init(ResourceAlloc, ResourceFree, this);
+}
+
+//---------------------------------------------------------------------------
+Slab* SlabResource::SlabForSize(size_t uSize_)
+{
+    for (uint8_t i = 0; i < m_u8NumSlabs; i++) {
+        if (uSize_ <= m_paclSlabs[i].GetObjSize()) {
+            return &m_paclSlabs[i];
+        }
+    }
+    return nullptr;
+}
+
+//---------------------------------------------------------------------------
+void* SlabResource::ResourceAlloc(void* pvContext_, size_t uSize_)
+{
+    auto* pclSlab = static_cast<SlabResource*>(pvContext_)->SlabForSize(uSize_);
+    if (pclSlab == nullptr) {
+        return nullptr;
+    }
+    return pclSlab->Alloc();
+}
+
+//---------------------------------------------------------------------------
+void SlabResource::ResourceFree(void* pvContext_, void* pvData_, size_t uSize_)
+{
+    // The size the object was allocated with identifies its slab
+    auto* pclSlab = static_cast<SlabResource*>(pvContext_)->SlabForSize(uSize_);
+    if (pclSlab != nullptr) {
+        pclSlab->Free(pvData_);
+    }
+}
+
+//---------------------------------------------------------------------------
+void BitmapResource::Init(BitmapAllocator* pclAllocator_, uint32_t u32ElementSize_)
+{
+    m_pclAllocator   = pclAllocator_;
+    m_u32ElementSize = u32ElementSize_;
+    MemoryResource::Init(ResourceAlloc, ResourceFree, this);
+}
+
+//---------------------------------------------------------------------------
+void* BitmapResource::ResourceAlloc(void* pvContext_, size_t uSize_)
+{
+    auto* pclResource = static_cast<BitmapResource*>(pvContext_);
+    if (uSize_ > pclResource->m_u32ElementSize) {
+        return nullptr;
+    }
+    return pclResource->m_pclAllocator->Allocate(nullptr);
+}
+
+//---------------------------------------------------------------------------
+void BitmapResource::ResourceFree(void* pvContext_, void* pvData_, size_t /*uSize_*/)
+{
+    static_cast<BitmapResource*>(pvContext_)->m_pclAllocator->Free(pvData_);
+}
+} // namespace Mark3
@@ -0,0 +1,142 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file monotonic_region.cpp
+
+    @brief Monotonic (bump-pointer) region allocator, with mark/release of
+           whole groups of allocations.
+*/
+
+#include "monotonic_region.h"
+
+namespace Mark3
+{
+namespace
+{
+//---------------------------------------------------------------------------
+inline K_ADDR AlignUp(K_ADDR uValue_)
+{
+    return (uValue_ + (sizeof(K_ADDR) - 1)) & ~(K_ADDR)(sizeof(K_ADDR) - 1);
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+void MonotonicRegion::Init(void*                                  pvBuffer_,
+                           uint32_t                               u32BufferSize_,
+                           monotonic_region_alloc_page_function_t pfAlloc_,
+                           monotonic_region_free_page_function_t  pfFree_)
+{
+    m_adBufferEnd   = (K_ADDR)pvBuffer_ + u32BufferSize_;
+    m_adBufferStart = AlignUp((K_ADDR)pvBuffer_);
+    if (m_adBufferStart > m_adBufferEnd) {
+        m_adBufferStart = m_adBufferEnd;
+    }
+    m_adNext  = m_adBufferStart;
+    m_adLimit = m_adBufferEnd;
+
+    m_pstPage     = nullptr;
+    m_pstSpare    = nullptr;
+    m_u16Pages    = 0;
+    m_pfPageAlloc = pfAlloc_;
+    m_pfPageFree  = pfFree_;
+}
+
+//---------------------------------------------------------------------------
+void* MonotonicRegion::Allocate(size_t uSize_)
+{
+    auto uAligned = AlignUp(uSize_);
+    if (uAligned < uSize_) {
+        return nullptr;
+    }
+    if ((uAligned > (m_adLimit - m_adNext)) && !AddPage(uAligned)) {
+        return nullptr;
+    }
+    auto adData = m_adNext;
+    m_adNext += uAligned;
+    return reinterpret_cast<void*>(adData);
+}
+
+//---------------------------------------------------------------------------
+void MonotonicRegion::Release(monotonic_region_mark_t stMark_)
+{
+    // Return every page added since the mark was taken
+    while (m_pstPage != stMark_.pstPage) {
+        auto* pstPrev = m_pstPage->pstPrev;
+        ReleasePage(m_pstPage);
+        m_pstPage = pstPrev;
+        m_u16Pages--;
+    }
+
+    m_adNext  = stMark_.adNext;
+    m_adLimit = m_pstPage ? ((K_ADDR)m_pstPage + m_pstPage->u32Size) : m_adBufferEnd;
+}
+
+//---------------------------------------------------------------------------
+void MonotonicRegion::Reset(void)
+{
+    Release({ nullptr, m_adBufferStart });
+    if (m_pstSpare) {
+        m_pfPageFree(m_pstSpare);
+        m_pstSpare = nullptr;
+    }
+}
+
+//---------------------------------------------------------------------------
+bool MonotonicRegion::AddPage(size_t uSize_)
+{
+    auto uHeaderSize = AlignUp(sizeof(monotonic_region_page_t));
+
+    // Use the reserve page if it's large enough, or request a new one
+    monotonic_region_page_t* pstPage = nullptr;
+    if (m_pstSpare && ((m_pstSpare->u32Size - uHeaderSize) >= uSize_)) {
+        pstPage    = m_pstSpare;
+        m_pstSpare = nullptr;
+    } else {
+        if (m_pfPageAlloc == nullptr) {
+            return false;
+        }
+        uint32_t u32PageSize;
+        auto*    pvPage = m_pfPageAlloc(&u32PageSize);
+        if (pvPage == nullptr) {
+            return false;
+        }
+        if ((u32PageSize < uHeaderSize) || ((u32PageSize - uHeaderSize) < uSize_)) {
+            m_pfPageFree(pvPage);
+            return false;
+        }
+        pstPage          = static_cast<monotonic_region_page_t*>(pvPage);
+        pstPage->u32Size = u32PageSize;
+    }
+
+    pstPage->pstPrev = m_pstPage;
+    m_pstPage        = pstPage;
+    m_u16Pages++;
+
+    // The rest of the current page (or initial buffer) is abandoned until
+    // the region is released past this point.
+    m_adNext  = (K_ADDR)pstPage + uHeaderSize;
+    m_adLimit = (K_ADDR)pstPage + pstPage->u32Size;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void MonotonicRegion::ReleasePage(monotonic_region_page_t* pstPage_)
+{
+    if (m_pstSpare == nullptr) {
+        m_pstSpare = pstPage_;
+        return;
+    }
+    m_pfPageFree(pstPage_);
+}
+} // namespace Mark3
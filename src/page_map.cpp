@@ -0,0 +1,270 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+
+    @file   page_map.cpp
+
+    @brief  Global map from memory pages to the allocators that own them,
+            used to free any block without knowing where it came from.
+*/
+
+#include "mark3.h"
+#include "page_map.h"
+
+namespace Mark3
+{
+namespace
+{
+//---------------------------------------------------------------------------
+typedef struct {
+    PageMapRegion* apclEntries[1 << PAGE_MAP_LEAF_BITS];
+} page_map_leaf_t;
+
+typedef struct {
+    page_map_leaf_t* apstLeaves[1 << PAGE_MAP_MID_BITS];
+} page_map_mid_t;
+
+//---------------------------------------------------------------------------
+// Tree nodes, published with release stores and read with acquire loads,
+// so lookups can run concurrently with registration.
+page_map_mid_t* s_apstRoot[1 << PAGE_MAP_ROOT_BITS];
+page_map_mid_t  s_astMidNodes[PAGE_MAP_MAX_MID_NODES];
+page_map_leaf_t s_astLeafNodes[PAGE_MAP_MAX_LEAF_NODES];
+uint16_t        s_u16MidUsed;
+uint16_t        s_u16LeafUsed;
+PageMapLock     s_clLock;
+
+//---------------------------------------------------------------------------
+template <typename T>
+inline T* LoadNode(T** ppclNode_)
+{
+    return __atomic_load_n(ppclNode_, __ATOMIC_ACQUIRE);
+}
+
+//---------------------------------------------------------------------------
+template <typename T>
+inline void StoreNode(T** ppclNode_, T* pclNode_)
+{
+    __atomic_store_n(ppclNode_, pclNode_, __ATOMIC_RELEASE);
+}
+
+//---------------------------------------------------------------------------
+// Compute the range of pages overlapping a range of memory
+bool PageRange(void* pvStart_, size_t uSize_, K_ADDR* puFirst_, K_ADDR* puLast_)
+{
+    auto adStart = reinterpret_cast<K_ADDR>(pvStart_);
+    auto adLast  = adStart + uSize_ - 1;
+    if ((uSize_ == 0) || (adLast < adStart)) {
+        return false;
+    }
+    *puFirst_ = adStart >> PAGE_MAP_PAGE_SHIFT;
+    *puLast_  = adLast >> PAGE_MAP_PAGE_SHIFT;
+    return (*puLast_ >> (PAGE_MAP_ADDRESS_BITS - PAGE_MAP_PAGE_SHIFT)) == 0;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+void PageMapRegion::Init(page_map_free_function_t pfFree_, page_map_size_function_t pfUsableSize_, void* pvOwner_)
+{
+    m_pfFree       = pfFree_;
+    m_pfUsableSize = pfUsableSize_;
+    m_pvOwner      = pvOwner_;
+}
+
+//---------------------------------------------------------------------------
+void ArenaRegion::Init(Arena* pclArena_)
+{
+    PageMapRegion::Init(RegionFree, RegionUsableSize, pclArena_);
+}
+
+//---------------------------------------------------------------------------
+void ArenaRegion::RegionFree(void* pvOwner_, void* pvData_)
+{
+    static_cast<Arena*>(pvOwner_)->Free(pvData_);
+}
+
+//---------------------------------------------------------------------------
+size_t ArenaRegion::RegionUsableSize(void* /*pvOwner_*/, void* pvData_)
+{
+    // Arena blocks always carry their size in their header
+    auto* pclBlock = reinterpret_cast<HeapBlock*>((K_ADDR)pvData_ - sizeof(HeapBlock));
+    return pclBlock->GetDataSize();
+}
+
+//---------------------------------------------------------------------------
+void FixedHeapRegion::Init(FixedHeap* pclHeap_)
+{
+    PageMapRegion::Init(RegionFree, RegionUsableSize, pclHeap_);
+}
+
+//---------------------------------------------------------------------------
+void FixedHeapRegion::RegionFree(void* pvOwner_, void* pvData_)
+{
+    static_cast<FixedHeap*>(pvOwner_)->Free(pvData_);
+}
+
+//---------------------------------------------------------------------------
+size_t FixedHeapRegion::RegionUsableSize(void* pvOwner_, void* pvData_)
+{
+    return static_cast<FixedHeap*>(pvOwner_)->GetUsableSize(pvData_);
+}
+
+//---------------------------------------------------------------------------
+void SlabRegion::Init(Slab* pclSlab_)
+{
+    PageMapRegion::Init(RegionFree, RegionUsableSize, pclSlab_);
+}
+
+//---------------------------------------------------------------------------
+void SlabRegion::RegionFree(void* pvOwner_, void* pvData_)
+{
+    static_cast<Slab*>(pvOwner_)->Free(pvData_);
+}
+
+//---------------------------------------------------------------------------
+size_t SlabRegion::RegionUsableSize(void* pvOwner_, void* /*pvData_*/)
+{
+    return static_cast<Slab*>(pvOwner_)->GetObjSize();
+}
+
+//---------------------------------------------------------------------------
+void PageMap::Init(void)
+{
+    s_clLock.Init();
+    for (uint32_t i = 0; i < (1UL << PAGE_MAP_ROOT_BITS); i++) {
+        s_apstRoot[i] = nullptr;
+    }
+    s_u16MidUsed  = 0;
+    s_u16LeafUsed = 0;
+}
+
+//---------------------------------------------------------------------------
+bool PageMap::Register(void* pvStart_, size_t uSize_, PageMapRegion* pclRegion_)
+{
+    K_ADDR uFirst;
+    K_ADDR uLast;
+    if ((pclRegion_ == nullptr) || !PageRange(pvStart_, uSize_, &uFirst, &uLast)) {
+        return false;
+    }
+
+    HeapLockGuard<PageMapLock> clGuard(&s_clLock);
+
+    // Create the nodes and check for conflicts first, so nothing is
+    // assigned if the registration fails.
+    for (auto uPage = uFirst; uPage <= uLast; uPage++) {
+        auto** ppclEntry = EntryForPage(uPage, true);
+        if (ppclEntry == nullptr) {
+            return false;
+        }
+        auto* pclOwner = LoadNode(ppclEntry);
+        if ((pclOwner != nullptr) && (pclOwner != pclRegion_)) {
+            return false;
+        }
+    }
+    for (auto uPage = uFirst; uPage <= uLast; uPage++) {
+        StoreNode(EntryForPage(uPage, false), pclRegion_);
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void PageMap::Unregister(void* pvStart_, size_t uSize_)
+{
+    K_ADDR uFirst;
+    K_ADDR uLast;
+    if (!PageRange(pvStart_, uSize_, &uFirst, &uLast)) {
+        return;
+    }
+
+    HeapLockGuard<PageMapLock> clGuard(&s_clLock);
+    for (auto uPage = uFirst; uPage <= uLast; uPage++) {
+        auto** ppclEntry = EntryForPage(uPage, false);
+        if (ppclEntry != nullptr) {
+            StoreNode(ppclEntry, static_cast<PageMapRegion*>(nullptr));
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+PageMapRegion* PageMap::Lookup(void* pvData_)
+{
+    auto uPage = reinterpret_cast<K_ADDR>(pvData_) >> PAGE_MAP_PAGE_SHIFT;
+    if ((uPage >> (PAGE_MAP_ADDRESS_BITS - PAGE_MAP_PAGE_SHIFT)) != 0) {
+        return nullptr;
+    }
+    auto** ppclEntry = EntryForPage(uPage, false);
+    if (ppclEntry == nullptr) {
+        return nullptr;
+    }
+    return LoadNode(ppclEntry);
+}
+
+//---------------------------------------------------------------------------
+PageMapRegion** PageMap::EntryForPage(K_ADDR uPage_, bool bCreate_)
+{
+    auto uLeafIndex = uPage_ & ((1UL << PAGE_MAP_LEAF_BITS) - 1);
+    auto uMidIndex  = (uPage_ >> PAGE_MAP_LEAF_BITS) & ((1UL << PAGE_MAP_MID_BITS) - 1);
+    auto uRootIndex = uPage_ >> (PAGE_MAP_LEAF_BITS + PAGE_MAP_MID_BITS);
+
+    auto* pstMid = LoadNode(&s_apstRoot[uRootIndex]);
+    if (pstMid == nullptr) {
+        if (!bCreate_ || (s_u16MidUsed == PAGE_MAP_MAX_MID_NODES)) {
+            return nullptr;
+        }
+        pstMid = &s_astMidNodes[s_u16MidUsed++];
+        for (uint32_t i = 0; i < (1UL << PAGE_MAP_MID_BITS); i++) {
+            pstMid->apstLeaves[i] = nullptr;
+        }
+        StoreNode(&s_apstRoot[uRootIndex], pstMid);
+    }
+
+    auto* pstLeaf = LoadNode(&pstMid->apstLeaves[uMidIndex]);
+    if (pstLeaf == nullptr) {
+        if (!bCreate_ || (s_u16LeafUsed == PAGE_MAP_MAX_LEAF_NODES)) {
+            return nullptr;
+        }
+        pstLeaf = &s_astLeafNodes[s_u16LeafUsed++];
+        for (uint32_t i = 0; i < (1UL << PAGE_MAP_LEAF_BITS); i++) {
+            pstLeaf->apclEntries[i] = nullptr;
+        }
+        StoreNode(&pstMid->apstLeaves[uMidIndex], pstLeaf);
+    }
+    return &pstLeaf->apclEntries[uLeafIndex];
+}
+
+//---------------------------------------------------------------------------
+void Free(void* pvData_)
+{
+    if (pvData_ == nullptr) {
+        return;
+    }
+    auto* pclRegion = PageMap::Lookup(pvData_);
+    if (pclRegion != nullptr) {
+        pclRegion->Free(pvData_);
+    }
+}
+
+//---------------------------------------------------------------------------
+size_t UsableSize(void* pvData_)
+{
+    if (pvData_ == nullptr) {
+        return 0;
+    }
+    auto* pclRegion = PageMap::Lookup(pvData_);
+    if (pclRegion == nullptr) {
+        return 0;
+    }
+    return pclRegion->GetUsableSize(pvData_);
+}
+} // namespace Mark3
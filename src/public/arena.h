@@ -22,13 +22,33 @@ See license.txt for more information
 #include <stdint.h>
 #include "arenalist.h"
 #include "heapblock.h"
+#include "heap_hooks.h"
+#include "handle_pool.h"
+#include "heap_lock.h"
 
 //---------------------------------------------------------------------------
 #define ARENA_EXHAUSTED (255)
 #define ARENA_FULL (254)
 
+//---------------------------------------------------------------------------
+/**
+    Locking policy used by Arena objects (see heap_lock.h)
+*/
+#ifndef ARENA_LOCK_POLICY
+#define ARENA_LOCK_POLICY HEAP_LOCK_POLICY
+#endif
+
 namespace Mark3
 {
+typedef ARENA_LOCK_POLICY ArenaLock;
+
+//---------------------------------------------------------------------------
+// Handle table entry for a movable allocation
+typedef struct {
+    HeapBlock* pclBlock; //!< Block currently holding the allocation
+    uint16_t   u16Pins;  //!< Number of outstanding Pin() calls
+} arena_movable_t;
+
 //---------------------------------------------------------------------------
 /**
  * @brief The Arena class
@@ -40,8 +60,15 @@ namespace Mark3
  * As a general-purpose heap, it offers basic "malloc/free" style dynamic
  * memory allocation, with few bells or whistles.
  *
+ * Optionally, allocations can be made movable - referred to by a handle
+ * rather than a pointer, and only accessed while pinned.  Compact() slides
+ * unpinned movable blocks towards the start of the heap, coalescing the free
+ * space between them into larger blocks.
+ *
+ * The arena is synchronized using the ArenaLock policy.  Compaction only
+ * holds the lock while moving a single block.
  */
-class Arena
+class Arena : private ArenaLock, public HeapHooks
 {
 public:
     /**
@@ -66,6 +93,20 @@ public:
      */
     void* Allocate(K_ADDR usize_);
 
+    /**
+     * @brief TryAllocate
+     *
+     * Allocate a block of dynamic memory from the heap, unless another
+     * context holds the arena's lock.
+     *
+     * @param usize_ Size of object to allocate (in bytes)
+     * @param pbBusy_ [out] true if the arena's lock was held, and no
+     *        allocation was attempted
+     * @return pointer to a chunk of dynamic memory, or 0 on exhaustion (or
+     *         if the arena was busy).
+     */
+    void* TryAllocate(K_ADDR usize_, bool* pbBusy_);
+
     /**
      * @brief Free
      *
@@ -97,7 +138,89 @@ public:
      */
     bool GetListInfo(uint8_t u8ListIdx_, uint32_t* pu32BlockSize_, uint32_t* pu32BlockCount_);
 
+    /**
+     * @brief SetMovableHandles
+     *
+     * Enable movable allocations, using a pool of arena_movable_t objects
+     * (i.e. a StaticHandlePool<arena_movable_t, N>) as the handle table.
+     * The pool's capacity limits the number of movable allocations.
+     *
+     * @param pclHandles_ Initialized, empty handle pool
+     */
+    void SetMovableHandles(HandlePool* pclHandles_) { m_pclHandles = pclHandles_; }
+
+    /**
+     * @brief AllocateMovable
+     *
+     * Allocate a block that the arena may relocate while it is not pinned.
+     * Movable allocations are not reported to the arena's profiler or trace.
+     *
+     * @param usize_ Size of object to allocate (in bytes)
+     * @return Handle to the allocation, or HANDLE_POOL_INVALID_HANDLE on
+     *         exhaustion (of either memory or handles).
+     */
+    pool_handle_t AllocateMovable(K_ADDR usize_);
+
+    /**
+     * @brief FreeMovable
+     *
+     * Free a movable allocation, pinned or not.  The handle becomes stale.
+     *
+     * @param uHandle_ Handle returned by AllocateMovable()
+     */
+    void FreeMovable(pool_handle_t uHandle_);
+
+    /**
+     * @brief Pin
+     *
+     * Prevent a movable allocation from being relocated, and get its current
+     * location.  Pins nest - the allocation may move again once each Pin()
+     * has been matched by an Unpin().
+     *
+     * @param uHandle_ Handle returned by AllocateMovable()
+     * @return Pointer to the allocation's data, or nullptr if the handle is stale
+     */
+    void* Pin(pool_handle_t uHandle_);
+
+    /**
+     * @brief Unpin
+     *
+     * Release a pin, invalidating the pointer returned by Pin() once the
+     * allocation is no longer pinned.
+     *
+     * @param uHandle_ Handle returned by AllocateMovable()
+     */
+    void Unpin(pool_handle_t uHandle_);
+
+    /**
+     * @brief Compact
+     *
+     * Perform a bounded step of incremental compaction.  Starting from where
+     * the last step stopped, each unpinned movable block that follows a free
+     * block is slid into the free block, and the free space behind it merged
+     * with any free block to its right.  Pinned blocks and regular
+     * allocations stay put.  Each step stops at the end of the heap, so that
+     * the next starts a new pass from the beginning.
+     *
+     * @param uBudget_ Amount of work to perform: the number of bytes moved,
+     *        plus the size of a block header for each block visited.  The
+     *        last block may take the step over budget, and a budget of 0
+     *        performs no work.
+     * @return Number of bytes moved
+     */
+    K_ADDR Compact(K_ADDR uBudget_);
+
 private:
+    /**
+     * @brief AllocateLocked
+     *
+     * Allocate a block of dynamic memory, with the arena's lock held.
+     *
+     * @param usize_ Size of object to allocate (in bytes)
+     * @return pointer to a chunk of dynamic memory, or 0 on exhaustion.
+     */
+    void* AllocateLocked(K_ADDR usize_);
+
     /**
      * @brief ListForSize
      *
@@ -120,8 +243,70 @@ private:
      */
     uint8_t ListToSatisfy(K_ADDR usize_);
 
-    uint8_t    m_u8LargestList; //!< Index of the largest arena
-    ArenaList* m_aclBlockList;  //!< Arena linked-list data
-    void*      m_pvData;        //!< Pointer to the raw memory blob managed by this object as a heap.
+    /**
+     * @brief AllocateFromList
+     *
+     * Take a block from an arena list, splitting off and returning any
+     * excess to the arena.
+     *
+     * @param usize_ Size of data to allocate
+     * @param uList_ List to allocate from, as returned by ListToSatisfy()
+     * @return Allocated block, or nullptr if the list is invalid
+     */
+    HeapBlock* AllocateFromList(K_ADDR usize_, uint8_t uList_);
+
+    /**
+     * @brief FreeBlock
+     *
+     * Return an allocated block to the arena, coalescing it with any free
+     * neighbours.
+     *
+     * @param pclBlock_ Block to free
+     */
+    void FreeBlock(HeapBlock* pclBlock_);
+
+    /**
+     * @brief ListBlock
+     *
+     * Add a free block to the arena list for its size.  Blocks smaller than
+     * the smallest list's block size are left unlisted (marked ARENA_FULL)
+     * until they are coalesced with a neighbor.
+     *
+     * @param pclBlock_ Free block to add
+     */
+    void ListBlock(HeapBlock* pclBlock_);
+
+    /**
+     * @brief UnlistBlock
+     *
+     * Remove a free block from its arena list, if it is on one.
+     *
+     * @param pclBlock_ Free block to remove
+     */
+    void UnlistBlock(HeapBlock* pclBlock_);
+
+    /**
+     * @brief GetMovable
+     * @return Handle table entry for a movable block
+     */
+    arena_movable_t* GetMovable(HeapBlock* pclBlock_);
+
+    /**
+     * @brief SlideLeft
+     *
+     * Move an unpinned movable block into the free block to its left, and
+     * return the space it vacates to the arena.
+     *
+     * @param pclFree_ Free block
+     * @param pclMovable_ Movable block immediately to the right of pclFree_
+     */
+    void SlideLeft(HeapBlock* pclFree_, HeapBlock* pclMovable_);
+
+    uint8_t     m_u8LargestList; //!< Index of the largest arena
+    ArenaList*  m_aclBlockList;  //!< Arena linked-list data
+    void*       m_pvData;        //!< Pointer to the raw memory blob managed by this object as a heap.
+    K_ADDR      m_uDataEnd;      //!< End of the last block in the heap
+    HeapBlock*  m_pclCompact;    //!< Block at which the next compaction step starts
+    HandlePool* m_pclHandles;    //!< Handle table for movable allocations (or nullptr)
 };
 } // namespace Mark3
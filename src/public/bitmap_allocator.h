@@ -19,25 +19,47 @@ See license.txt for more information
 #pragma once
 
 #include "mark3.h"
+#include "heap_hooks.h"
+#include "heap_lock.h"
 
 //---------------------------------------------------------------------------
 #define UINT32_SHIFT (5)
 #define UINT32_BITS (32)
 #define UINT32_ROUND_UP(bits) (((uint32_t)(bits) + (UINT32_BITS - 1)) >> UINT32_SHIFT)
 
+//---------------------------------------------------------------------------
+/**
+    Maximum number of elements a bitmap allocator can manage - one bit of the
+    32-bit first level bitmap per word of the second level bitmap.
+*/
+#define BITMAP_ALLOCATOR_MAX_ELEMENTS (UINT32_BITS * UINT32_BITS)
+
+//---------------------------------------------------------------------------
+/**
+    Locking policy used by BitmapAllocator objects (see heap_lock.h)
+*/
+#ifndef BITMAP_ALLOCATOR_LOCK_POLICY
+#define BITMAP_ALLOCATOR_LOCK_POLICY HEAP_LOCK_POLICY
+#endif
+
 namespace Mark3
 {
+typedef BITMAP_ALLOCATOR_LOCK_POLICY BitmapAllocatorLock;
+
 //---------------------------------------------------------------------------
 /**
- * @brief The BitmapAllocator class
+ * @brief The BitmapAllocatorCore class
  *
  * This class implements a 2-level bitmap allocator.  Objects allocated from the
  * alloctor are the same size, and each object's state (available/allocated) is
  * indicated by a single bit in an array of words.  A second level bitmap is used
  * to further identify which words contain free allocations.
  *
+ * The core is not synchronized, and carries no lock - it is used directly
+ * where another lock already protects it (i.e. the pages of a Slab), so that
+ * its metadata stays the same size under every locking policy.
  */
-class BitmapAllocator
+class BitmapAllocatorCore
 {
 public:
     /**
@@ -52,6 +74,43 @@ public:
      */
     void Init(void* pvMemBlock_, uint32_t u32BlockSize_, uint32_t u32ElementSize);
 
+    /**
+     * @brief Init
+     *
+     * Initialize the allocator object with its bitmap stored outside of the
+     * managed block of memory.  The whole block is then available for
+     * allocations, which is useful when the block is sized as an exact
+     * multiple of the element size.
+     *
+     * @param pvMemBlock_ Block of memory to manage with this allocator object
+     * @param u32BlockSize_ Size of the block of memory to manage
+     * @param u32ElementSize Size of the elements allocated from the block
+     * @param pu32Map_ Storage for the allocation bitmap, at least
+     *        GetMapSize(GetCapacity(...)) bytes long.
+     */
+    void Init(void* pvMemBlock_, uint32_t u32BlockSize_, uint32_t u32ElementSize, uint32_t* pu32Map_);
+
+    /**
+     * @brief GetCapacity
+     *
+     * Compute the number of elements an allocator can manage within a block
+     * of memory of a given size, without initializing an allocator.
+     *
+     * @param u32BlockSize_ Size of the block of memory to manage
+     * @param u32ElementSize_ Size of the elements allocated from the block
+     * @param bMapInBlock_ true if the bitmap is stored within the block
+     * @return Number of elements that fit in the block, up to
+     *         BITMAP_ALLOCATOR_MAX_ELEMENTS
+     */
+    static uint32_t GetCapacity(uint32_t u32BlockSize_, uint32_t u32ElementSize_, bool bMapInBlock_);
+
+    /**
+     * @brief GetMapSize
+     * @param u32NumElements_ Number of elements tracked by the bitmap
+     * @return Size (in bytes) of the bitmap required to track the elements
+     */
+    static uint32_t GetMapSize(uint32_t u32NumElements_) { return UINT32_ROUND_UP(u32NumElements_) * sizeof(uint32_t); }
+
     /**
      * @brief Allocate
      *
@@ -68,8 +127,9 @@ public:
      * Return a previously-allocated object back to the allocator
      *
      * @param alloc Previously-allocated block managed by this object
+     * @return true if the object was allocated, and has been freed
      */
-    void Free(void* alloc);
+    bool Free(void* alloc);
 
     /**
      * @brief GetNumFree
@@ -89,7 +149,43 @@ public:
      */
     bool IsFull(void);
 
+protected:
+    /**
+     * @brief AllocateIndex
+     *
+     * Claim a free element in the bitmap.
+     *
+     * @return Index of the element, or m_u32NumElements if none are free
+     */
+    uint32_t AllocateIndex(void);
+
+    /**
+     * @brief InitElement
+     *
+     * Fill in the header of a newly-claimed element.
+     *
+     * @param u32Index_ Index of the element, as returned by AllocateIndex()
+     * @param pvTag_ User-supplied metadata to assign to the allocated object
+     * @return Pointer to the element's data, or nullptr if u32Index_ is invalid
+     */
+    void* InitElement(uint32_t u32Index_, void* pvTag_);
+
+    /**
+     * @brief GetElementSize
+     * @return Size of the elements allocated from the block, excluding metadata
+     */
+    uint32_t GetElementSize(void);
+
 private:
+    /**
+     * @brief InitMap
+     *
+     * Reset the bitmap, marking every element as free.  Elements are
+     * only tracked in the bitmap once they have been allocated, so this
+     * takes constant time.
+     */
+    void InitMap(void);
+
     /**
      * @brief CountLeadingZeros
      *
@@ -133,16 +229,81 @@ private:
     uint32_t* m_pu32MapL2;
     uint32_t  m_u32NumElements;
     uint32_t  m_u32NumFree;
+    uint32_t  m_u32NumUnused; //!< Index of the first never-allocated element
     uint32_t  m_u32ObjSize;
     void*     m_pvMemBlock;
 };
 
+//---------------------------------------------------------------------------
+/**
+ * @brief The BitmapAllocator class
+ *
+ * Bitmap allocator (see BitmapAllocatorCore), synchronized using the
+ * BitmapAllocatorLock policy.  Only the bitmap update is made while holding
+ * the lock - an allocated element's header is filled in once the lock is
+ * released.
+ */
+class BitmapAllocator : private BitmapAllocatorLock, public HeapHooks, private BitmapAllocatorCore
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Initialize the allocator object, and initialize the blob of memory managed
+     * by it.
+     *
+     * @param pvMemBlock_ Block of memory to manage with this allocator object
+     * @param u32BlockSize_ Size of the block of memory to manage
+     * @param u32ElementSize Size of the
+     */
+    void Init(void* pvMemBlock_, uint32_t u32BlockSize_, uint32_t u32ElementSize);
+
+    /**
+     * @brief Init
+     *
+     * Initialize the allocator object with its bitmap stored outside of the
+     * managed block of memory - see BitmapAllocatorCore::Init().
+     *
+     * @param pvMemBlock_ Block of memory to manage with this allocator object
+     * @param u32BlockSize_ Size of the block of memory to manage
+     * @param u32ElementSize Size of the elements allocated from the block
+     * @param pu32Map_ Storage for the allocation bitmap, at least
+     *        GetMapSize(GetCapacity(...)) bytes long.
+     */
+    void Init(void* pvMemBlock_, uint32_t u32BlockSize_, uint32_t u32ElementSize, uint32_t* pu32Map_);
+
+    using BitmapAllocatorCore::GetCapacity;
+    using BitmapAllocatorCore::GetMapSize;
+    using BitmapAllocatorCore::GetNumFree;
+    using BitmapAllocatorCore::IsEmpty;
+    using BitmapAllocatorCore::IsFull;
+
+    /**
+     * @brief Allocate
+     *
+     * Allocate a single fixed-size block from the allocator
+     *
+     * @param pvTag_ User-supplied metadata to assign to the allocated object
+     * @return Pointer to a blob of memory, or nullptr on out-of-memory
+     */
+    void* Allocate(void* pvTag_);
+
+    /**
+     * @brief Free
+     *
+     * Return a previously-allocated object back to the allocator
+     *
+     * @param alloc Previously-allocated block managed by this object
+     */
+    void Free(void* alloc);
+};
+
 //---------------------------------------------------------------------------
 // Metadata structure attached to each allocation.
 typedef struct __attribute__((packed)) {
-    BitmapAllocator* pclSource;
-    void*            pvTag;
-    uint32_t         u32Index;
-    K_WORD           data[1];
+    BitmapAllocatorCore* pclSource;
+    void*                pvTag;
+    uint32_t             u32Index;
+    K_WORD               data[1];
 } bitmap_alloc_t;
 } // namespace Mark3
@@ -0,0 +1,189 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file buddy_allocator.h
+
+    @brief Binary buddy allocator, handing out naturally-aligned power-of-two
+           blocks - usable directly, or as a page provider for slabs.
+*/
+#pragma once
+
+#include "mark3.h"
+#include "slab.h"
+
+//---------------------------------------------------------------------------
+/**
+    Maximum number of block orders supported by a buddy allocator (the
+    largest block is 2^(orders - 1) times the size of the smallest).
+*/
+#ifndef BUDDY_MAX_ORDERS
+#define BUDDY_MAX_ORDERS (16)
+#endif
+
+#define BUDDY_NO_ORDER (0xFF)
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Free-list node stored in each free block
+typedef struct BuddyBlock {
+    struct BuddyBlock* pstNext;
+    struct BuddyBlock* pstPrev;
+} buddy_block_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The BuddyAllocator class
+ *
+ * Manages a block of memory as power-of-two sized blocks, from a minimum
+ * block size up to 2^(orders - 1) times that size.  Allocations split larger
+ * blocks in half until a block of the requested order is produced, and
+ * frees merge a block with its "buddy" (the other half of the block it was
+ * split from) for as long as the buddy is also free - both in O(orders).
+ *
+ * Every block is aligned to its own size in absolute terms, regardless of
+ * the alignment of the memory handed to Init() - memory at the edges of
+ * the range that can't form a complete block of the minimum size is
+ * unused.  Free blocks are held in a list per order, and a bitmap per order
+ * records whether each pair of buddies is in the same state (both free or
+ * both allocated), so the buddy can be checked without searching.
+ *
+ * The allocator itself is not thread-safe.
+ */
+class BuddyAllocator
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Initialize the allocator, carving its bitmaps from the end of the
+     * memory block, and adding the remainder to the free lists.
+     *
+     * @param pvMem_ Block of memory to manage
+     * @param uSize_ Size of the memory block in bytes
+     * @param u32MinBlockSize_ Size of the smallest block, rounded up to a power of two
+     * @param u8NumOrders_ Number of block orders (at most BUDDY_MAX_ORDERS)
+     */
+    void Init(void* pvMem_, K_ADDR uSize_, uint32_t u32MinBlockSize_, uint8_t u8NumOrders_);
+
+    /**
+     * @brief Allocate
+     *
+     * @param u8Order_ Order of the block to allocate
+     * @return Block of GetBlockSize(u8Order_) bytes, aligned to its size, or
+     *         nullptr if no block of that order could be found.
+     */
+    void* Allocate(uint8_t u8Order_);
+
+    /**
+     * @brief Free
+     *
+     * @param pvBlock_ Block previously returned by Allocate()
+     * @param u8Order_ Order the block was allocated with
+     */
+    void Free(void* pvBlock_, uint8_t u8Order_);
+
+    /**
+     * @brief GetOrderForSize
+     *
+     * @param uSize_ Size of an allocation in bytes
+     * @return Smallest order of block that holds the allocation, or
+     *         BUDDY_NO_ORDER if it exceeds the largest block.
+     */
+    uint8_t GetOrderForSize(K_ADDR uSize_);
+
+    /**
+     * @brief GetBlockSize
+     * @param u8Order_ Block order
+     * @return Size of blocks of the given order in bytes
+     */
+    K_ADDR GetBlockSize(uint8_t u8Order_) { return (K_ADDR)1 << (m_u8MinShift + u8Order_); }
+
+    /**
+     * @brief GetFreeBytes
+     * @return Total size of all free blocks
+     */
+    K_ADDR GetFreeBytes(void) { return m_uFreeBytes; }
+
+    /**
+     * @brief GetFreeBlockCount
+     * @param u8Order_ Block order
+     * @return Number of free blocks of the given order
+     */
+    uint32_t GetFreeBlockCount(uint8_t u8Order_);
+
+private:
+    /**
+     * @brief TogglePair
+     *
+     * Flip the bit recording whether a block and its buddy are in the same
+     * state.
+     *
+     * @return true if the pair is now in the same state
+     */
+    bool TogglePair(K_ADDR adBlock_, uint8_t u8Order_);
+
+    void PushFree(buddy_block_t* pstBlock_, uint8_t u8Order_);
+    void RemoveFree(buddy_block_t* pstBlock_, uint8_t u8Order_);
+
+    K_ADDR    m_adBase;     //!< Start of the top-order block containing the first usable block
+    K_ADDR    m_adEnd;      //!< End of usable memory
+    K_ADDR    m_uFreeBytes; //!< Total size of all free blocks
+    uint32_t* m_pu32Map;    //!< Buddy pair bitmaps for all orders
+    uint8_t   m_u8MinShift; //!< log2 of the smallest block size
+    uint8_t   m_u8NumOrders;
+
+    uint32_t       m_au32MapOffset[BUDDY_MAX_ORDERS]; //!< First bit of each order's bitmap
+    buddy_block_t* m_apstFree[BUDDY_MAX_ORDERS];      //!< Free list for each order
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The BuddyPageSource class
+ *
+ * Slab page allocation functions backed by a buddy allocator with static
+ * storage duration.  A slab's order 0 page is a buddy block of BaseOrder;
+ * pages of higher order are correspondingly larger buddy blocks, all aligned
+ * to their size.  i.e.:
+ *
+ *     BuddyAllocator clBuddy;
+ *     typedef BuddyPageSource<&clBuddy, 2> PageSource;
+ *
+ *     clSlab.Init(u32ObjSize, PageSource::AllocPage, PageSource::FreePage);
+ *     clLargeSlab.Init(u32ObjSize, PageSource::GetPageSize(), 25,
+ *                      PageSource::AllocPages, PageSource::FreePages);
+ */
+template <BuddyAllocator* pclBuddy, uint8_t BaseOrder = 0>
+class BuddyPageSource
+{
+public:
+    /**
+     * @brief GetPageSize
+     * @return Size of an order 0 page
+     */
+    static uint32_t GetPageSize(void) { return (uint32_t)pclBuddy->GetBlockSize(BaseOrder); }
+
+    // slab_alloc_page_function_t / slab_free_page_function_t
+    static void* AllocPage(uint32_t* pu32PageSize_) { return AllocPages(0, pu32PageSize_); }
+    static void  FreePage(void* pvPage_) { FreePages(pvPage_, 0); }
+
+    // slab_alloc_pages_function_t / slab_free_pages_function_t
+    static void* AllocPages(uint8_t u8Order_, uint32_t* pu32Size_)
+    {
+        *pu32Size_ = (uint32_t)pclBuddy->GetBlockSize(BaseOrder + u8Order_);
+        return pclBuddy->Allocate(BaseOrder + u8Order_);
+    }
+    static void FreePages(void* pvPages_, uint8_t u8Order_) { pclBuddy->Free(pvPages_, BaseOrder + u8Order_); }
+};
+} // namespace Mark3
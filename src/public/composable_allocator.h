@@ -0,0 +1,462 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file composable_allocator.h
+
+    @brief Compile-time combinators for building composite allocators out of
+           the existing heaps.
+
+    Each building block is an allocator "policy" - a class providing:
+
+        void* Allocate(size_t uSize_);
+        template <size_t Size> void* Allocate();
+        void  Free(void* pvData_, size_t uSize_);
+        bool  Owns(void* pvData_);
+
+    Policies wrap the existing allocators (ArenaPolicy, FixedHeapPolicy,
+    SlabPolicy, BitmapPolicy), and combinators are themselves policies built
+    from other policies, so they nest to any depth:
+
+        // <= 64 bytes from 16-byte-stepped slabs, falling back to the arena,
+        // with larger requests going to the arena directly.
+        typedef Fallback<Bucketizer<SlabPolicy, 0, 64, 16>, ArenaPolicy> SmallPolicy;
+        Segregator<64, SmallPolicy, ArenaPolicy> clHeap;
+
+    The composition is fixed at compile time - there are no virtual calls or
+    function pointers, so dispatch inlines into a few comparisons, which fold
+    away entirely when the size is a compile-time constant:
+
+        auto* pvData = clHeap.Allocate<sizeof(Node)>();
+
+    Allocations must be freed with the size they were allocated with.  The
+    owner queries are based on the range of memory each policy manages.
+*/
+#pragma once
+
+#include "mark3.h"
+#include "arena.h"
+#include "bitmap_allocator.h"
+#include "fixed_heap.h"
+#include "slab.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Tag type used to select between policies at compile time
+template <bool Value>
+struct PolicySelect {
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The AddressRange class
+ *
+ * Range of memory owned by a policy, used to answer owner queries.
+ */
+class AddressRange
+{
+public:
+    void SetRange(void* pvStart_, size_t uSize_)
+    {
+        m_adStart = (K_ADDR)pvStart_;
+        m_adEnd   = m_adStart + uSize_;
+    }
+
+    bool Owns(void* pvData_) { return ((K_ADDR)pvData_ >= m_adStart) && ((K_ADDR)pvData_ < m_adEnd); }
+
+private:
+    K_ADDR m_adStart;
+    K_ADDR m_adEnd;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The NullPolicy class
+ *
+ * Allocator that never allocates, nor owns anything - useful as the final
+ * policy in a chain.
+ */
+class NullPolicy
+{
+public:
+    void* Allocate(size_t /*uSize_*/) { return nullptr; }
+    template <size_t Size>
+    void* Allocate()
+    {
+        return nullptr;
+    }
+    void Free(void* /*pvData_*/, size_t /*uSize_*/) {}
+    bool Owns(void* /*pvData_*/) { return false; }
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The ArenaPolicy class
+ *
+ * Policy allocating from an Arena.
+ */
+class ArenaPolicy
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Initialize the underlying arena - see Arena::Init().
+     */
+    void Init(void* pvBuffer_, K_ADDR uSize_, K_ADDR* auSizes_, uint8_t u8NumSizes_)
+    {
+        m_clArena.Init(pvBuffer_, uSize_, auSizes_, u8NumSizes_);
+        m_clRange.SetRange(pvBuffer_, uSize_);
+    }
+
+    void* Allocate(size_t uSize_) { return m_clArena.Allocate(uSize_); }
+    template <size_t Size>
+    void* Allocate()
+    {
+        return m_clArena.Allocate(Size);
+    }
+    void Free(void* pvData_, size_t /*uSize_*/) { m_clArena.Free(pvData_); }
+    bool Owns(void* pvData_) { return m_clRange.Owns(pvData_); }
+
+    Arena* GetArena() { return &m_clArena; }
+
+private:
+    Arena        m_clArena;
+    AddressRange m_clRange;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The FixedHeapPolicy class
+ *
+ * Policy allocating from a FixedHeap.  Ownership is based on the heap's
+ * initial memory, so the heap must not be given a page provider.
+ */
+class FixedHeapPolicy
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Initialize the underlying heap - see FixedHeap::Create().
+     */
+    void Init(void* pvHeap_, HeapConfig* pclHeapConfig_)
+    {
+        m_clHeap.Create(pvHeap_, pclHeapConfig_);
+
+        size_t uSize = 0;
+        for (auto* pclConfig = pclHeapConfig_; pclConfig->m_uBlockSize != 0; pclConfig++) {
+            uSize += BlockHeap::GetBlockStride(pclConfig->m_uBlockSize) * pclConfig->m_uBlockCount;
+        }
+        m_clRange.SetRange(pvHeap_, uSize);
+    }
+
+    void* Allocate(size_t uSize_) { return m_clHeap.Allocate(uSize_); }
+    template <size_t Size>
+    void* Allocate()
+    {
+        return m_clHeap.Allocate(Size);
+    }
+    void Free(void* pvData_, size_t /*uSize_*/)
+    {
+        if (pvData_ != nullptr) {
+            m_clHeap.Free(pvData_);
+        }
+    }
+    bool Owns(void* pvData_) { return m_clRange.Owns(pvData_); }
+
+    FixedHeap* GetHeap() { return &m_clHeap; }
+
+private:
+    FixedHeap    m_clHeap;
+    AddressRange m_clRange;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The SlabPolicy class
+ *
+ * Policy allocating from a Slab, failing requests larger than the slab's
+ * object size.  Ownership is based on the memory the slab's page allocator
+ * takes its pages from.
+ */
+class SlabPolicy
+{
+public:
+    /**
+     * @brief Init
+     *
+     * @param u32ObjSize_ Size of objects allocated from the slab
+     * @param pfAlloc_ Function to allocate slab pages
+     * @param pfFree_ Function to free previously-allocated slab pages
+     * @param pvPages_ Start of the memory slab pages are allocated from
+     * @param uPagesSize_ Size of the memory slab pages are allocated from
+     */
+    void Init(uint32_t                   u32ObjSize_,
+              slab_alloc_page_function_t pfAlloc_,
+              slab_free_page_function_t  pfFree_,
+              void*                      pvPages_,
+              size_t                     uPagesSize_)
+    {
+        m_clSlab.Init(u32ObjSize_, pfAlloc_, pfFree_);
+        m_clRange.SetRange(pvPages_, uPagesSize_);
+    }
+
+    void* Allocate(size_t uSize_) { return (uSize_ <= m_clSlab.GetObjSize()) ? m_clSlab.Alloc() : nullptr; }
+    template <size_t Size>
+    void* Allocate()
+    {
+        return Allocate(Size);
+    }
+    void Free(void* pvData_, size_t /*uSize_*/) { m_clSlab.Free(pvData_); }
+    bool Owns(void* pvData_) { return m_clRange.Owns(pvData_); }
+
+    Slab* GetSlab() { return &m_clSlab; }
+
+private:
+    Slab         m_clSlab;
+    AddressRange m_clRange;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The BitmapPolicy class
+ *
+ * Policy allocating from a BitmapAllocator, failing requests larger than the
+ * allocator's element size.
+ */
+class BitmapPolicy
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Initialize the underlying allocator - see BitmapAllocator::Init().
+     */
+    void Init(void* pvMemBlock_, uint32_t u32BlockSize_, uint32_t u32ElementSize_)
+    {
+        m_clBitmap.Init(pvMemBlock_, u32BlockSize_, u32ElementSize_);
+        m_clRange.SetRange(pvMemBlock_, u32BlockSize_);
+        m_u32ElementSize = u32ElementSize_;
+    }
+
+    void* Allocate(size_t uSize_) { return (uSize_ <= m_u32ElementSize) ? m_clBitmap.Allocate(nullptr) : nullptr; }
+    template <size_t Size>
+    void* Allocate()
+    {
+        return Allocate(Size);
+    }
+    void Free(void* pvData_, size_t /*uSize_*/)
+    {
+        if (pvData_ != nullptr) {
+            m_clBitmap.Free(pvData_);
+        }
+    }
+    bool Owns(void* pvData_) { return m_clRange.Owns(pvData_); }
+
+    BitmapAllocator* GetAllocator() { return &m_clBitmap; }
+
+private:
+    BitmapAllocator m_clBitmap;
+    AddressRange    m_clRange;
+    uint32_t        m_u32ElementSize;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The Segregator class
+ *
+ * Sends requests of up to Threshold bytes to one policy, and larger requests
+ * to another.
+ *
+ * @tparam Threshold Largest request sent to the Small policy
+ * @tparam Small Policy used for requests of up to Threshold bytes
+ * @tparam Large Policy used for requests larger than Threshold bytes
+ */
+template <size_t Threshold, typename Small, typename Large>
+class Segregator
+{
+public:
+    void* Allocate(size_t uSize_)
+    {
+        return (uSize_ <= Threshold) ? m_clSmall.Allocate(uSize_) : m_clLarge.Allocate(uSize_);
+    }
+
+    template <size_t Size>
+    void* Allocate()
+    {
+        return AllocateFrom<Size>(PolicySelect<(Size <= Threshold)>());
+    }
+
+    void Free(void* pvData_, size_t uSize_)
+    {
+        if (uSize_ <= Threshold) {
+            m_clSmall.Free(pvData_, uSize_);
+        } else {
+            m_clLarge.Free(pvData_, uSize_);
+        }
+    }
+
+    bool Owns(void* pvData_) { return m_clSmall.Owns(pvData_) || m_clLarge.Owns(pvData_); }
+
+    Small& GetSmall() { return m_clSmall; }
+    Large& GetLarge() { return m_clLarge; }
+
+private:
+    // Only the selected policy is instantiated for a compile-time size
+    template <size_t Size>
+    void* AllocateFrom(PolicySelect<true>)
+    {
+        return m_clSmall.template Allocate<Size>();
+    }
+    template <size_t Size>
+    void* AllocateFrom(PolicySelect<false>)
+    {
+        return m_clLarge.template Allocate<Size>();
+    }
+
+    Small m_clSmall;
+    Large m_clLarge;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The Fallback class
+ *
+ * Allocates from a primary policy, and from a secondary policy when the
+ * primary fails.  Frees are routed using the primary's owner query.
+ *
+ * @tparam Primary Policy tried first
+ * @tparam Secondary Policy tried when the primary fails
+ */
+template <typename Primary, typename Secondary>
+class Fallback
+{
+public:
+    void* Allocate(size_t uSize_)
+    {
+        auto* pvData = m_clPrimary.Allocate(uSize_);
+        return (pvData != nullptr) ? pvData : m_clSecondary.Allocate(uSize_);
+    }
+
+    template <size_t Size>
+    void* Allocate()
+    {
+        auto* pvData = m_clPrimary.template Allocate<Size>();
+        return (pvData != nullptr) ? pvData : m_clSecondary.template Allocate<Size>();
+    }
+
+    void Free(void* pvData_, size_t uSize_)
+    {
+        if (m_clPrimary.Owns(pvData_)) {
+            m_clPrimary.Free(pvData_, uSize_);
+        } else {
+            m_clSecondary.Free(pvData_, uSize_);
+        }
+    }
+
+    bool Owns(void* pvData_) { return m_clPrimary.Owns(pvData_) || m_clSecondary.Owns(pvData_); }
+
+    Primary&   GetPrimary() { return m_clPrimary; }
+    Secondary& GetSecondary() { return m_clSecondary; }
+
+private:
+    Primary   m_clPrimary;
+    Secondary m_clSecondary;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The Bucketizer class
+ *
+ * Splits the sizes from Min to Max into buckets Step bytes wide, each served
+ * by its own instance of a policy.  Bucket i serves requests larger than
+ * Min + (i * Step) bytes, up to Min + ((i + 1) * Step) bytes; smaller
+ * requests use the first bucket, and larger requests fail.  Each bucket must
+ * be initialized through GetBucket(), i.e. with a SlabPolicy of
+ * GetBucketSize(i) bytes.
+ *
+ * @tparam Policy Policy used for each bucket
+ * @tparam Min Size below the first bucket
+ * @tparam Max Largest size served
+ * @tparam Step Width of each bucket
+ */
+template <typename Policy, size_t Min, size_t Max, size_t Step>
+class Bucketizer
+{
+public:
+    static_assert(Step != 0, "Bucket step must be non-zero");
+    static_assert((Max > Min) && (((Max - Min) % Step) == 0), "Bucket range must be a multiple of the step");
+
+    static constexpr size_t uBucketCount = (Max - Min) / Step;
+
+    /**
+     * @brief GetBucketSize
+     * @param uBucket_ Bucket index
+     * @return Largest request served by the bucket
+     */
+    static constexpr size_t GetBucketSize(size_t uBucket_) { return Min + ((uBucket_ + 1) * Step); }
+
+    /**
+     * @brief BucketForSize
+     * @param uSize_ Size of a request (no larger than Max)
+     * @return Index of the bucket serving the request
+     */
+    static constexpr size_t BucketForSize(size_t uSize_) { return (uSize_ <= Min) ? 0 : ((uSize_ - Min - 1) / Step); }
+
+    void* Allocate(size_t uSize_)
+    {
+        return (uSize_ <= Max) ? m_aclBuckets[BucketForSize(uSize_)].Allocate(uSize_) : nullptr;
+    }
+
+    template <size_t Size>
+    void* Allocate()
+    {
+        return AllocateFrom<Size>(PolicySelect<(Size <= Max)>());
+    }
+
+    void Free(void* pvData_, size_t uSize_)
+    {
+        if (uSize_ <= Max) {
+            m_aclBuckets[BucketForSize(uSize_)].Free(pvData_, uSize_);
+        }
+    }
+
+    bool Owns(void* pvData_)
+    {
+        for (auto& clBucket : m_aclBuckets) {
+            if (clBucket.Owns(pvData_)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Policy& GetBucket(size_t uBucket_) { return m_aclBuckets[uBucket_]; }
+
+private:
+    template <size_t Size>
+    void* AllocateFrom(PolicySelect<true>)
+    {
+        return m_aclBuckets[BucketForSize(Size)].template Allocate<Size>();
+    }
+    template <size_t Size>
+    void* AllocateFrom(PolicySelect<false>)
+    {
+        return nullptr;
+    }
+
+    Policy m_aclBuckets[uBucketCount];
+};
+} // namespace Mark3
@@ -20,14 +20,115 @@ See license.txt for more information
 
 #include "kerneltypes.h"
 #include "ll.h"
+#include "heap_lock.h"
+#include "heap_hooks.h"
+
+//---------------------------------------------------------------------------
+/**
+    Maximum number of block sizes (bins) supported by a FixedHeap
+*/
+#define FIXED_HEAP_MAX_BINS (32)
+
+//---------------------------------------------------------------------------
+/**
+    Number of entries in the direct size->bin lookup table.  Each entry
+    covers a "granule" of sizes - the largest power-of-two (up to
+    2^FIXED_HEAP_LUT_MAX_SHIFT) that evenly divides every block size in the
+    heap.  Larger sizes are resolved using a log2-indexed table.
+*/
+#define FIXED_HEAP_LUT_ENTRIES (64)
+#define FIXED_HEAP_LUT_MAX_SHIFT (4)
+
+//---------------------------------------------------------------------------
+#define FIXED_HEAP_NO_BIN (0xFF)
+
+//---------------------------------------------------------------------------
+/**
+    Set this to "1" to remove all per-block metadata from FixedHeap blocks.
+    Instead of reading an owner pointer stored in front of each block,
+    FixedHeap::Free() finds the owning bin from the block's address, as each
+    bin occupies a contiguous range of the heap.  This mode requires the
+    intrusive free list, and blocks can only be freed through the heap they
+    were allocated from - FixedHeap::Free() is a non-static member, rather
+    than the static function of the default (headered) build.
+*/
+#ifndef FIXED_HEAP_HEADERLESS
+#define FIXED_HEAP_HEADERLESS (0)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Set this to "1" to have BlockHeap keep its free blocks on an intrusive,
+    singly-linked list, with each free block storing the link to the next in
+    its own data.  Per-block metadata is then reduced to the pointer to the
+    owning heap.  When set to "0", each block carries a doubly-linked list
+    node in addition to the owner pointer.
+*/
+#ifndef BLOCK_HEAP_INTRUSIVE_FREE_LIST
+#define BLOCK_HEAP_INTRUSIVE_FREE_LIST (FIXED_HEAP_HEADERLESS)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Locking policies used by FixedHeap and BlockHeap objects (see
+    heap_lock.h).  The bins of a FixedHeap are protected by the FixedHeap's
+    lock - the BlockHeap policy only applies to standalone BlockHeaps.
+*/
+#ifndef FIXED_HEAP_LOCK_POLICY
+#define FIXED_HEAP_LOCK_POLICY HEAP_LOCK_POLICY
+#endif
+
+#ifndef BLOCK_HEAP_LOCK_POLICY
+#define BLOCK_HEAP_LOCK_POLICY HEAP_LOCK_POLICY
+#endif
+
+#if FIXED_HEAP_HEADERLESS && !BLOCK_HEAP_INTRUSIVE_FREE_LIST
+#error "FIXED_HEAP_HEADERLESS requires BLOCK_HEAP_INTRUSIVE_FREE_LIST"
+#endif
 
 namespace Mark3
 {
+class BlockHeap;
+class FixedHeap;
+
+//---------------------------------------------------------------------------
+// Page allocation functions, used to grow FixedHeap bins on demand
+typedef void* (*fixed_heap_alloc_page_function_t)(uint32_t* pu32PageSize_);
+typedef void (*fixed_heap_free_page_function_t)(void* pvPage_);
+
+typedef FIXED_HEAP_LOCK_POLICY FixedHeapLock;
+typedef BLOCK_HEAP_LOCK_POLICY BlockHeapLock;
+
+//---------------------------------------------------------------------------
+/**
+ *  Metadata stored in front of each block in a BlockHeap
+ */
+#if BLOCK_HEAP_INTRUSIVE_FREE_LIST
+class BlockHeapNode
+#else
+class BlockHeapNode : public LinkListNode
+#endif
+{
+    friend class BlockHeap;
+    friend class FixedHeap;
+
+protected:
+    BlockHeap* m_clHeap;
+};
+
+//---------------------------------------------------------------------------
+#if FIXED_HEAP_HEADERLESS
+// No per-block metadata at all
+#define BLOCK_HEAP_NODE_SIZE (0)
+#else
+#define BLOCK_HEAP_NODE_SIZE (sizeof(BlockHeapNode))
+#endif
+
 //---------------------------------------------------------------------------
 /**
- *  Single-block-size heap
+ *  Single-block-size heap, synchronized using the BlockHeapLock policy
  */
-class BlockHeap
+class BlockHeap : private BlockHeapLock
 {
 public:
     /**
@@ -35,7 +136,9 @@ public:
      *
      *  Create a single list heap in the blob of memory provided, with the
      *  selected heap size, and the selected number of blocks.  Will create
-     *  as many blocks as will fit in the uSize_ parameter
+     *  as many blocks as will fit in the uSize_ parameter.  Blocks are
+     *  initialized as they are first allocated, so the heap memory is not
+     *  touched by this call.
      *
      *  @param pvHeap_ Pointer to the heap data to initialize
      *  @param uSize_ Size of the heap range in bytes
@@ -73,14 +176,89 @@ public:
      */
     bool IsFree() { return m_uBlocksFree != 0; }
 
+    /**
+     *  @brief GetBlockStride
+     *
+     *  Return the amount of heap memory consumed by each block of a given
+     *  size, including the block's metadata.
+     *
+     *  @param uBlockSize_ Size of each heap block in bytes
+     *  @return Bytes of heap memory used per block
+     */
+    static constexpr size_t GetBlockStride(size_t uBlockSize_)
+    {
+#if BLOCK_HEAP_INTRUSIVE_FREE_LIST
+        // Free blocks must be able to hold the free-list link, and blocks must
+        // stay pointer-aligned so the link and owner can be accessed directly.
+        return (BLOCK_HEAP_NODE_SIZE + ((uBlockSize_ < sizeof(void*)) ? sizeof(void*) : uBlockSize_)
+                + (sizeof(void*) - 1))
+               & ~(sizeof(void*) - 1);
+#else
+        return BLOCK_HEAP_NODE_SIZE + uBlockSize_;
+#endif
+    }
+
+    /**
+     *  @brief Contains
+     *
+     *  Check whether or not a pointer is the start of a block in this heap
+     *
+     *  @param pvData_ Pointer to check
+     *  @return true if the pointer refers to a block within this heap
+     */
+    bool Contains(void* pvData_);
+
 protected:
     int m_uBlocksFree; //!< Number of blocks free in the heap
 
 private:
+    friend class FixedHeap;
+
+    // Chunks are constructed in place, at the start of their page
+    void* operator new(size_t sz, void* pv) { return (BlockHeap*)pv; };
+
+    /**
+     *  @brief AllocateLocked
+     *
+     *  Allocate a block, with the heap's lock (or the lock of the FixedHeap
+     *  it is a bin of) held.
+     *
+     *  @return pointer to a block of memory, or 0 on failure
+     */
+    void* AllocateLocked();
+
+    /**
+     *  @brief FreeLocked
+     *
+     *  Free a block, with the heap's lock (or the lock of the FixedHeap it
+     *  is a bin of) held.
+     *
+     *  @param pvData_ Pointer to a block of data previously allocated off
+     *         the heap.
+     */
+    void FreeLocked(void* pvData_);
+
+#if BLOCK_HEAP_INTRUSIVE_FREE_LIST
+    void* m_pvFreeHead; //!< First free block - each free block holds a pointer to the next
+#else
     DoubleLinkList m_clList; //!< Linked list used to manage the blocks
-};
+#endif
+    /**
+     *  @brief IsUnused
+     *  @return true if every block in the heap is free
+     */
+    bool IsUnused() { return (size_t)m_uBlocksFree == ((m_adEnd - m_adStart) / m_uStride); }
 
-class FixedHeap;
+    FixedHeap* m_pclOwner;     //!< FixedHeap this heap is a bin of (or nullptr)
+    BlockHeap* m_pclNextChunk; //!< Next chunk of additional blocks for the bin
+    uint8_t    m_u8Bin;        //!< Index of this heap's bin within the owner
+    uint8_t    m_u8Chunks;     //!< Number of chunks added to the bin (bin's first heap only)
+    uint8_t    m_u8MaxChunks;  //!< Limit on the number of chunks added to the bin (bin's first heap only)
+    K_ADDR     m_adStart;  //!< Address of the first block in the heap
+    K_ADDR     m_adEnd;    //!< Address immediately following the last block
+    K_ADDR     m_adUnused; //!< Address of the first block never allocated from the heap
+    size_t     m_uStride;  //!< Distance between blocks, in bytes
+};
 
 //---------------------------------------------------------------------------
 /**
@@ -95,9 +273,12 @@ struct HeapConfig
 
 //---------------------------------------------------------------------------
 /**
-    Fixed-size-block heap allocator with multiple block sizes.
+    Fixed-size-block heap allocator with multiple block sizes, synchronized
+    using the FixedHeapLock policy.  Pages used to grow the heap's bins are
+    allocated from, and released to, the page provider without holding the
+    lock.
  */
-class FixedHeap
+class FixedHeap : private FixedHeapLock, public HeapHooks
 {
 public:
     /**
@@ -114,15 +295,19 @@ public:
      *         array must be initialized, starting from smallest block-size
      *         to largest, with the final entry in the table have a
      *         0-block size, indicating end-of-configuration.
+     *
+     *  @return true on success, false if the configuration has more than
+     *          FIXED_HEAP_MAX_BINS entries (the heap is left empty)
      */
-    void Create(void* pvHeap_, HeapConfig* pclHeapConfig_);
+    bool Create(void* pvHeap_, HeapConfig* pclHeapConfig_);
 
     /**
      *  @brief Allocate
      *
      *  Allocate a blob of memory from the heap.  If no appropriately-sized
-     *  data block is available, will return nullptr.  Note, this API is thread-
-     *  safe, and interrupt safe.
+     *  data block is available, will return nullptr.  Note, this API is only
+     *  thread-safe, or interrupt safe, with an appropriate FixedHeapLock
+     *  policy selected.
      *
      *  @param uSize_ Size (in bytes) to allocate from the heap
      *
@@ -130,6 +315,21 @@ public:
      */
     void* Allocate(size_t uSize_);
 
+    /**
+     *  @brief AllocateFromBin
+     *
+     *  Allocate a block from a specific bin, or from the next-largest bin
+     *  with free blocks if it is exhausted.  Skips the size->bin lookup,
+     *  for callers that already know the bin for a given allocation size.
+     *  While the bin's own blocks last, this is a single pop under the
+     *  heap's lock; growing or spilling only happens once they run out.
+     *
+     *  @param u8Bin_ Index of the bin to allocate from
+     *
+     *  @return Pointer to a block of data allocated, or 0 on error.
+     */
+    void* AllocateFromBin(uint8_t u8Bin_);
+
     /**
      *  @brief Free
      *
@@ -138,12 +338,165 @@ public:
      *  memory at its originally-returned pointer, and not an address
      *  within an allocated blob (as supported by some allocators).
      *
+     *  In the default (headered) build, the owning heap is found from the
+     *  block's header, so Free() is static and needs no reference to the
+     *  heap.  With FIXED_HEAP_HEADERLESS set, the owning bin is found from
+     *  the block's address, so Free() must be called on the heap itself.
+     *  Calling it on a heap object (heap.Free(p)) works in either build.
+     *
      *  @param pvNode_ Pointer to the previously-allocated block of memory
      *
      */
+#if FIXED_HEAP_HEADERLESS
+    void Free(void* pvNode_);
+#else
     static void Free(void* pvNode_);
+#endif
+
+    /**
+     *  @brief GetUsableSize
+     *  Return the number of bytes usable in a block allocated from the
+     *  heap, which may be larger than the size requested.
+     *  @param pvNode_ Pointer to the previously-allocated block of memory
+     *  @return Usable size of the block, or 0 if it is not from this heap
+     */
+    size_t GetUsableSize(void* pvNode_);
+
+    /**
+     *  @brief SetPageProvider
+     *
+     *  Set the functions used to acquire and release pages of memory when
+     *  growing and shrinking the heap's bins.  When a bin with a non-zero
+     *  chunk limit runs out of blocks, a page is requested and carved into
+     *  blocks for that bin, rather than spilling the allocation over into a
+     *  larger bin.  Pages are returned once all of their blocks are freed.
+     *
+     *  @param pfAlloc_ Function used to allocate a page
+     *  @param pfFree_ Function used to free a previously-allocated page
+     */
+    void SetPageProvider(fixed_heap_alloc_page_function_t pfAlloc_, fixed_heap_free_page_function_t pfFree_);
+
+    /**
+     *  @brief SetBinChunkLimit
+     *
+     *  Set the maximum number of pages a bin may acquire from the page
+     *  provider.  Bins default to a limit of 0 (i.e. they do not grow).
+     *
+     *  @param u8Bin_ Index of the bin to configure
+     *  @param u8MaxChunks_ Maximum number of pages added to the bin
+     */
+    void SetBinChunkLimit(uint8_t u8Bin_, uint8_t u8MaxChunks_);
+
+    /**
+     *  @brief GetBinChunkCount
+     *
+     *  @param u8Bin_ Index of the bin to query
+     *  @return Number of pages currently added to the bin
+     */
+    uint8_t GetBinChunkCount(uint8_t u8Bin_) { return m_paclHeaps[u8Bin_].m_clHeap.m_u8Chunks; }
 
 private:
-    HeapConfig* m_paclHeaps; //!< Pointer to the configuration data used by the heap
+#if FIXED_HEAP_HEADERLESS
+    /**
+     *  @brief HeapForAddress
+     *
+     *  Find the heap a block belongs to from its address, using a binary
+     *  search of the bins' (contiguous, ascending) address ranges, and
+     *  falling back to searching the bins' chunks.
+     *
+     *  @param pvNode_ Pointer to a block allocated from the heap
+     *  @return Pointer to the heap, or nullptr if not from this heap
+     */
+    BlockHeap* HeapForAddress(void* pvNode_);
+#endif
+
+    /**
+     *  @brief AllocateFromBin
+     *
+     *  Allocate a block from a bin (or a larger bin), growing the bin first
+     *  if it is exhausted.
+     *
+     *  @param u8Bin_ Index of the bin to allocate from
+     *  @param pu8Bin_ [out] Index of the bin the block was allocated from
+     *  @return Pointer to a block of data allocated, or 0 on error.
+     */
+    void* AllocateFromBin(uint8_t u8Bin_, uint8_t* pu8Bin_);
+
+    /**
+     *  @brief AllocateFromBinLocked
+     *
+     *  Allocate a block from a bin (or a larger bin) with the heap's lock
+     *  held, without growing the bin.
+     *
+     *  @param u8Bin_ Index of the bin to allocate from
+     *  @param pu8Bin_ [out] Index of the bin the block was allocated from
+     *  @return Pointer to a block of data allocated, or 0 on error.
+     */
+    void* AllocateFromBinLocked(uint8_t u8Bin_, uint8_t* pu8Bin_);
+
+    /**
+     *  @brief CanGrowBin
+     *
+     *  @param u8Bin_ Index of the bin to check
+     *  @return true if the bin is exhausted, and may be grown with a page
+     *          from the page provider
+     */
+    bool CanGrowBin(uint8_t u8Bin_);
+
+    /**
+     *  @brief AddChunk
+     *
+     *  Add a chunk of blocks to a bin, carved from a page allocated from the
+     *  page provider.
+     *
+     *  @param u8Bin_ Index of the bin to grow
+     *  @param pvPage_ Page to carve the chunk from
+     *  @param u32PageSize_ Size of the page (in bytes)
+     *  @return true if the bin was grown, false if the page is too small to
+     *          hold any blocks
+     */
+    bool AddChunk(uint8_t u8Bin_, void* pvPage_, uint32_t u32PageSize_);
+
+    /**
+     *  @brief BlockFreed
+     *
+     *  Update the heap's state after a block has been returned to one of
+     *  its bins, removing the block's chunk from its bin if it is now
+     *  unused.
+     *
+     *  @param pclHeap_ Heap the block was returned to
+     *  @return Page to return to the page provider once the lock is
+     *          released, or nullptr
+     */
+    void* BlockFreed(BlockHeap* pclHeap_);
+
+    /**
+     *  @brief BinHasFree
+     *  @param u8Bin_ Index of the bin to check
+     *  @return true if the bin, or any of its chunks, have a free block
+     */
+    bool BinHasFree(uint8_t u8Bin_);
+
+    /**
+     *  @brief BinForSize
+     *
+     *  Find the smallest bin with a block size large enough to satisfy an
+     *  allocation, regardless of whether or not it has free blocks.
+     *
+     *  @param uSize_ Size (in bytes) of the allocation
+     *  @return Index of the bin, or FIXED_HEAP_NO_BIN if the size is too large
+     */
+    uint8_t BinForSize(size_t uSize_);
+
+    HeapConfig* m_paclHeaps;   //!< Pointer to the configuration data used by the heap
+    uint8_t     m_u8NumBins;   //!< Number of bins configured in the heap
+    uint8_t     m_u8LutShift;  //!< log2 of the size granule covered by each lookup table entry
+    uint32_t    m_u32NonEmpty; //!< Bitmap of bins with free blocks (bit n = bin n)
+
+    fixed_heap_alloc_page_function_t m_pfPageAlloc; //!< Page allocator used to grow bins
+    fixed_heap_free_page_function_t  m_pfPageFree;  //!< Page deallocator used to shrink bins
+
+    uint8_t m_au8SizeLut[FIXED_HEAP_LUT_ENTRIES + 1]; //!< Bin for sizes within the LUT range, by granule
+    uint8_t m_au8Log2Lut[(sizeof(size_t) * 8) + 1];   //!< First bin with blocks larger than 2^(n-1) bytes
 };
 } // namespace Mark3
@@ -0,0 +1,248 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file handle_pool.h
+
+    @brief Object pool addressed by generational handles, with objects kept
+           densely packed for iteration.
+*/
+#pragma once
+
+#include "mark3.h"
+
+//---------------------------------------------------------------------------
+/**
+    Use 64-bit handles (32-bit index and generation) instead of 32-bit
+    handles (16-bit index and generation).
+*/
+#ifndef HANDLE_POOL_64BIT
+#define HANDLE_POOL_64BIT (0)
+#endif
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+#if HANDLE_POOL_64BIT
+typedef uint64_t pool_handle_t;
+typedef uint32_t pool_index_t;
+typedef uint32_t pool_generation_t;
+#define HANDLE_POOL_INDEX_BITS (32)
+#else
+typedef uint32_t pool_handle_t;
+typedef uint16_t pool_index_t;
+typedef uint16_t pool_generation_t;
+#define HANDLE_POOL_INDEX_BITS (16)
+#endif
+
+#define HANDLE_POOL_INVALID_HANDLE ((pool_handle_t)0)
+#define HANDLE_POOL_NO_INDEX ((pool_index_t)-1)
+
+//---------------------------------------------------------------------------
+// Entry in a pool's handle table
+typedef struct {
+    pool_generation_t uGeneration; //!< Generation of the current (or next) handle to this slot
+    pool_index_t      uIndex;      //!< Dense index of the object, or next free slot
+} handle_pool_slot_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The HandlePool class
+ *
+ * Fixed-capacity pool of equal-sized objects, referred to by handles rather
+ * than pointers.  A handle combines the index of a slot in a handle table
+ * with the slot's generation, which is advanced each time an object is
+ * freed - so a handle to a freed object is detected as stale, even once the
+ * slot is reused.  Handles are resolved to objects in constant time.
+ *
+ * Objects are stored contiguously: freeing an object moves the last object
+ * in the pool into its place (updating the moved object's slot), so live
+ * objects always occupy the first GetCount() positions of the pool and can
+ * be iterated without skipping holes.  As a result, objects must be safe to
+ * relocate with a byte-wise copy, and pointers to objects are only valid
+ * until the next Free() - hold handles instead.
+ *
+ * The pool itself is not thread-safe.
+ */
+class HandlePool
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Initialize the pool prior to use.  Initialization takes constant time;
+     * slots are only set up as the pool first grows into them.
+     *
+     * @param pvObjects_ Storage for uCapacity_ objects, each u32ObjSize_ bytes
+     * @param pstSlots_ Storage for uCapacity_ handle table entries
+     * @param puSlotIndex_ Storage for uCapacity_ slot indexes (one per object)
+     * @param uCapacity_ Maximum number of objects in the pool (less than HANDLE_POOL_NO_INDEX)
+     * @param u32ObjSize_ Size of each object (the stride between objects)
+     */
+    void Init(void*               pvObjects_,
+              handle_pool_slot_t* pstSlots_,
+              pool_index_t*       puSlotIndex_,
+              pool_index_t        uCapacity_,
+              uint32_t            u32ObjSize_);
+
+    /**
+     * @brief Allocate
+     *
+     * Add an object to the end of the pool.  The object's contents are left
+     * uninitialized.
+     *
+     * @return Handle to the new object, or HANDLE_POOL_INVALID_HANDLE if the
+     *         pool is full.
+     */
+    pool_handle_t Allocate(void);
+
+    /**
+     * @brief Free
+     *
+     * Remove an object from the pool, moving the last object in the pool
+     * into the vacated position.
+     *
+     * @param uHandle_ Handle to the object to free
+     * @return true if the object was freed, false if the handle was stale
+     */
+    bool Free(pool_handle_t uHandle_);
+
+    /**
+     * @brief Get
+     *
+     * @param uHandle_ Handle to an object
+     * @return Pointer to the object, or nullptr if the handle is stale
+     */
+    void* Get(pool_handle_t uHandle_);
+
+    /**
+     * @brief IsValid
+     * @param uHandle_ Handle to an object
+     * @return true if the handle refers to an object in the pool
+     */
+    bool IsValid(pool_handle_t uHandle_) { return Get(uHandle_) != nullptr; }
+
+    /**
+     * @brief GetHandle
+     *
+     * @param uIndex_ Position of an object in the pool (less than GetCount())
+     * @return Handle to the object at that position
+     */
+    pool_handle_t GetHandle(pool_index_t uIndex_);
+
+    /**
+     * @brief GetObjects
+     * @return Pointer to the first object in the pool - the rest follow at
+     *         GetObjSize() byte intervals.
+     */
+    void* GetObjects(void) { return m_pvObjects; }
+
+    /**
+     * @brief GetObjSize
+     * @return Size of each object (the stride between objects)
+     */
+    uint32_t GetObjSize(void) { return m_u32ObjSize; }
+
+    /**
+     * @brief GetCount
+     * @return Number of objects in the pool
+     */
+    pool_index_t GetCount(void) { return m_uCount; }
+
+    /**
+     * @brief GetCapacity
+     * @return Maximum number of objects in the pool
+     */
+    pool_index_t GetCapacity(void) { return m_uCapacity; }
+
+private:
+    /**
+     * @brief GetSlot
+     * @return Slot the handle refers to, or nullptr if the handle is stale
+     */
+    handle_pool_slot_t* GetSlot(pool_handle_t uHandle_);
+
+    void* ObjectAt(pool_index_t uIndex_)
+    {
+        return reinterpret_cast<void*>((K_ADDR)m_pvObjects + ((K_ADDR)uIndex_ * m_u32ObjSize));
+    }
+
+    void*               m_pvObjects;
+    handle_pool_slot_t* m_pstSlots;
+    pool_index_t*       m_puSlotIndex; //!< Slot referring to each object
+    pool_index_t        m_uCapacity;
+    pool_index_t        m_uCount;
+    pool_index_t        m_uFreeSlot;   //!< Head of the list of recycled slots
+    pool_index_t        m_uUnusedSlot; //!< First slot never handed out
+    uint32_t            m_u32ObjSize;
+    bool                m_bWordCopy; //!< Objects can be moved a word at a time
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StaticHandlePool class
+ *
+ * Handle pool of a given object type, with its storage held within the pool
+ * object, and typed access to the objects.  Since objects are relocated when
+ * others are freed, T must be trivially copyable.
+ *
+ *     StaticHandlePool<Particle, 64> clParticles;
+ *
+ *     clParticles.Init();
+ *     auto uHandle = clParticles.Allocate();
+ *     clParticles.Get(uHandle)->Spawn();
+ *
+ *     for (auto* pclIt = clParticles.Begin(); pclIt != clParticles.End(); pclIt++) {
+ *         pclIt->Update();
+ *     }
+ */
+template <typename T, pool_index_t Capacity>
+class StaticHandlePool : public HandlePool
+{
+public:
+    static_assert(Capacity != 0, "Capacity must be non-zero");
+    static_assert(Capacity != HANDLE_POOL_NO_INDEX, "Capacity exceeds the range of the handle index");
+
+    /**
+     * @brief Init
+     *
+     * Initialize the pool prior to use.
+     */
+    void Init(void) { HandlePool::Init(m_au8Objects, m_astSlots, m_auSlotIndex, Capacity, sizeof(T)); }
+
+    /**
+     * @brief Get
+     *
+     * @param uHandle_ Handle to an object
+     * @return Pointer to the object, or nullptr if the handle is stale
+     */
+    T* Get(pool_handle_t uHandle_) { return static_cast<T*>(HandlePool::Get(uHandle_)); }
+
+    /**
+     * @brief Begin
+     * @return Pointer to the first object in the pool
+     */
+    T* Begin(void) { return reinterpret_cast<T*>(m_au8Objects); }
+
+    /**
+     * @brief End
+     * @return Pointer one past the last object in the pool
+     */
+    T* End(void) { return Begin() + GetCount(); }
+
+private:
+    alignas(T) uint8_t m_au8Objects[sizeof(T) * Capacity];
+    handle_pool_slot_t m_astSlots[Capacity];
+    pool_index_t       m_auSlotIndex[Capacity];
+};
+} // namespace Mark3
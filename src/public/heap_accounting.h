@@ -0,0 +1,230 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file heap_accounting.h
+
+    @brief Per-subsystem (tagged) memory accounting and quotas
+*/
+#pragma once
+
+#include "mark3.h"
+#include "heap_lock.h"
+#include "memory_resource.h"
+
+//---------------------------------------------------------------------------
+/**
+    Number of tags tracked by a HeapAccounting object (at most 32).  Valid
+    tags are 0 .. HEAP_ACCOUNTING_MAX_TAGS - 1.
+*/
+#ifndef HEAP_ACCOUNTING_MAX_TAGS
+#define HEAP_ACCOUNTING_MAX_TAGS (16)
+#endif
+
+// Tags over their soft quota are tracked in a 32-bit mask
+static_assert(HEAP_ACCOUNTING_MAX_TAGS <= 32, "HEAP_ACCOUNTING_MAX_TAGS must be at most 32");
+
+//---------------------------------------------------------------------------
+/**
+    Locking policy used by HeapAccounting objects (see heap_lock.h)
+*/
+#ifndef HEAP_ACCOUNTING_LOCK_POLICY
+#define HEAP_ACCOUNTING_LOCK_POLICY HEAP_LOCK_POLICY
+#endif
+
+//---------------------------------------------------------------------------
+#define HEAP_QUOTA_NONE (0)
+
+namespace Mark3
+{
+typedef HEAP_ACCOUNTING_LOCK_POLICY HeapAccountingLock;
+
+//---------------------------------------------------------------------------
+// Identifier of the subsystem an allocation is charged to
+typedef uint8_t heap_tag_t;
+
+//---------------------------------------------------------------------------
+// Function called when a tag's live bytes first exceed its soft quota
+typedef void (*heap_quota_function_t)(void* pvContext_, heap_tag_t uTag_, uint32_t u32LiveBytes_);
+
+//---------------------------------------------------------------------------
+// Statistics and quotas maintained for each tag
+typedef struct {
+    uint32_t u32LiveBytes;    //!< Bytes currently allocated
+    uint32_t u32LiveObjects;  //!< Objects currently allocated
+    uint32_t u32PeakBytes;    //!< Maximum number of bytes allocated at once
+    uint32_t u32SoftQuota;    //!< Soft limit on live bytes, or HEAP_QUOTA_NONE
+    uint32_t u32HardQuota;    //!< Hard limit on live bytes, or HEAP_QUOTA_NONE
+    uint32_t u32SoftOverruns; //!< Allocations made while over the soft quota
+    uint32_t u32Rejected;     //!< Allocations refused by the hard quota
+    uint32_t u32Failures;     //!< Allocations within quota that the allocator failed
+} heap_tag_stats_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The HeapAccounting class
+ *
+ * Tracks the memory held by each subsystem (identified by a tag), and
+ * optionally enforces a quota on each.  Allocations are charged to their
+ * tag before they are made, so a subsystem at its hard quota fails fast -
+ * without touching (or contending for) the allocator - and a runaway
+ * subsystem cannot exhaust memory shared with others.  Exceeding a soft
+ * quota is permitted, but is counted and reported through a callback, i.e.
+ * to trigger a shrinker or a warning.
+ *
+ * The accounting is independent of the allocator - TaggedResource charges
+ * allocations made through any MemoryResource, and allocations made
+ * directly from an allocator can be accounted with Charge()/Credit().
+ */
+class HeapAccounting : private HeapAccountingLock
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Clear all statistics and quotas, and the soft quota callback.
+     */
+    void Init(void);
+
+    /**
+     * @brief SetQuota
+     *
+     * Set the quotas for a tag.  Lowering a quota below the tag's current
+     * usage causes further allocations to fail (or overrun), but does not
+     * affect existing allocations.
+     *
+     * @param uTag_ Tag to set the quotas for
+     * @param u32SoftQuota_ Soft limit on live bytes, or HEAP_QUOTA_NONE
+     * @param u32HardQuota_ Hard limit on live bytes, or HEAP_QUOTA_NONE
+     */
+    void SetQuota(heap_tag_t uTag_, uint32_t u32SoftQuota_, uint32_t u32HardQuota_);
+
+    /**
+     * @brief SetSoftQuotaHandler
+     *
+     * Set the function called when an allocation takes a tag over its soft
+     * quota.  The function is called once per overrun (i.e. again only once
+     * the tag has dropped back under its quota), outside of the accounting
+     * lock, from the context making the allocation.
+     *
+     * @param pfHandler_ Function to call, or nullptr for none
+     * @param pvContext_ User-defined context passed to the function
+     */
+    void SetSoftQuotaHandler(heap_quota_function_t pfHandler_, void* pvContext_);
+
+    /**
+     * @brief Charge
+     *
+     * Charge an allocation to a tag, prior to making the allocation.
+     *
+     * @param uTag_ Tag to charge
+     * @param uSize_ Size of the allocation in bytes
+     * @return true if the allocation may proceed, false if it would exceed
+     *         the tag's hard quota (or the tag is invalid)
+     */
+    bool Charge(heap_tag_t uTag_, size_t uSize_);
+
+    /**
+     * @brief Credit
+     *
+     * Return a previously-charged allocation to its tag, once it has been
+     * freed.
+     *
+     * @param uTag_ Tag the allocation was charged to
+     * @param uSize_ Size of the allocation in bytes
+     */
+    void Credit(heap_tag_t uTag_, size_t uSize_);
+
+    /**
+     * @brief Cancel
+     *
+     * Return a charge for an allocation the allocator failed to make.
+     *
+     * @param uTag_ Tag the allocation was charged to
+     * @param uSize_ Size of the allocation in bytes
+     */
+    void Cancel(heap_tag_t uTag_, size_t uSize_);
+
+    /**
+     * @brief GetStats
+     *
+     * Take a consistent snapshot of a tag's statistics.
+     *
+     * @param uTag_ Tag to query
+     * @param pstStats_ [out] Statistics for the tag
+     * @return true on success, false if the tag is invalid
+     */
+    bool GetStats(heap_tag_t uTag_, heap_tag_stats_t* pstStats_);
+
+    /**
+     * @brief GetTotalLiveBytes
+     * @return Bytes currently allocated across all tags
+     */
+    uint32_t GetTotalLiveBytes(void);
+
+private:
+    /**
+     * @brief Release
+     *
+     * Remove an allocation's bytes from a tag's usage, with the accounting
+     * lock held.
+     *
+     * @param pstStats_ Statistics of the tag
+     * @param uSize_ Size of the allocation in bytes
+     */
+    void Release(heap_tag_stats_t* pstStats_, size_t uSize_);
+
+    heap_tag_stats_t      m_astTags[HEAP_ACCOUNTING_MAX_TAGS];
+    uint32_t              m_u32OverSoft;        //!< Bitmap of tags currently over their soft quota
+    heap_quota_function_t m_pfSoftQuotaHandler; //!< Function called on soft quota overruns
+    void*                 m_pvSoftQuotaContext; //!< Context passed to the soft quota handler
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The TaggedResource class
+ *
+ * Memory resource charging every allocation made through it to a tag,
+ * before passing it on to another resource.  Give each subsystem its own
+ * TaggedResource (sharing a HeapAccounting object, and the underlying
+ * resource), and the subsystem's usage is tracked and limited with no
+ * per-object overhead - the size passed back on free identifies the
+ * amount to credit.
+ */
+class TaggedResource : public MemoryResource
+{
+public:
+    /**
+     * @brief Init
+     *
+     * @param pclParent_ Resource to allocate from
+     * @param pclAccounting_ Accounting to charge allocations to
+     * @param uTag_ Tag to charge allocations to
+     */
+    void Init(MemoryResource* pclParent_, HeapAccounting* pclAccounting_, heap_tag_t uTag_);
+
+    /**
+     * @brief GetTag
+     * @return Tag allocations from this resource are charged to
+     */
+    heap_tag_t GetTag(void) const { return m_uTag; }
+
+private:
+    static void* ResourceAlloc(void* pvContext_, size_t uSize_);
+    static void  ResourceFree(void* pvContext_, void* pvData_, size_t uSize_);
+
+    MemoryResource* m_pclParent;
+    HeapAccounting* m_pclAccounting;
+    heap_tag_t      m_uTag;
+};
+} // namespace Mark3
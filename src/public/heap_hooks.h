@@ -0,0 +1,150 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file heap_hooks.h
+
+    @brief Profiler and trace hooks shared by the allocators
+*/
+#pragma once
+
+#include "kerneltypes.h"
+#include "heap_profiler.h"
+#include "heap_trace.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+/**
+ * @brief The HeapHooks class
+ *
+ * Reports an allocator's allocations and frees to a HeapProfiler (when
+ * HEAP_PROFILER_ENABLE is set) and a HeapTrace (when HEAP_TRACE_ENABLE is
+ * set).  Allocators inherit from this class, and call HookAllocate() and
+ * HookFree() from each allocation and free.  With both options disabled
+ * the class is empty, and the hooks compile away.
+ *
+ * The profiler is not thread-safe - allocators only call the hooks with
+ * their own lock held.
+ */
+class HeapHooks
+{
+public:
+#if HEAP_PROFILER_ENABLE
+    /**
+     * @brief SetProfiler
+     *
+     * Report all allocations and frees from this allocator to a profiler.
+     *
+     * @param pclProfiler_ Initialized profiler, or nullptr to stop profiling
+     */
+    void SetProfiler(HeapProfiler* pclProfiler_) { m_pclProfiler = pclProfiler_; }
+#endif
+
+#if HEAP_TRACE_ENABLE
+    /**
+     * @brief SetTrace
+     *
+     * Record all allocations and frees from this allocator to a trace.
+     *
+     * @param pclTrace_ Initialized trace, or nullptr to stop tracing
+     */
+    void SetTrace(HeapTrace* pclTrace_) { m_pclTrace = pclTrace_; }
+#endif
+
+protected:
+    /**
+     * @brief InitHooks
+     *
+     * Detach any profiler or trace.
+     */
+    void InitHooks(void)
+    {
+#if HEAP_PROFILER_ENABLE
+        m_pclProfiler = nullptr;
+#endif
+#if HEAP_TRACE_ENABLE
+        m_pclTrace = nullptr;
+#endif
+    }
+
+    /**
+     * @brief HasHooks
+     * @return true if a profiler or trace is attached
+     */
+    bool HasHooks(void)
+    {
+        auto bHooks = false;
+#if HEAP_PROFILER_ENABLE
+        bHooks |= (m_pclProfiler != nullptr);
+#endif
+#if HEAP_TRACE_ENABLE
+        bHooks |= (m_pclTrace != nullptr);
+#endif
+        return bHooks;
+    }
+
+    /**
+     * @brief HookAllocate
+     *
+     * @param uSize_ Size of the allocation requested
+     * @param pvData_ Pointer returned by the allocator, or nullptr on failure
+     * @param bSpilled_ true if the allocation was served from a larger size
+     *        class than the one best suited to it
+     */
+    void HookAllocate(size_t uSize_, void* pvData_, bool bSpilled_ = false)
+    {
+#if HEAP_PROFILER_ENABLE
+        if (m_pclProfiler) {
+            m_pclProfiler->RecordAllocate(uSize_, pvData_, bSpilled_);
+        }
+#endif
+#if HEAP_TRACE_ENABLE
+        if (m_pclTrace) {
+            m_pclTrace->RecordAllocate(uSize_, pvData_);
+        }
+#endif
+        (void)uSize_;
+        (void)pvData_;
+        (void)bSpilled_;
+    }
+
+    /**
+     * @brief HookFree
+     *
+     * @param pvData_ Allocation being freed
+     */
+    void HookFree(void* pvData_)
+    {
+#if HEAP_PROFILER_ENABLE
+        if (m_pclProfiler) {
+            m_pclProfiler->RecordFree(pvData_);
+        }
+#endif
+#if HEAP_TRACE_ENABLE
+        if (m_pclTrace) {
+            m_pclTrace->RecordFree(pvData_);
+        }
+#endif
+        (void)pvData_;
+    }
+
+private:
+#if HEAP_PROFILER_ENABLE
+    HeapProfiler* m_pclProfiler; //!< Profiler to report allocations to (or nullptr)
+#endif
+#if HEAP_TRACE_ENABLE
+    HeapTrace* m_pclTrace; //!< Trace to record allocations to (or nullptr)
+#endif
+};
+} // namespace Mark3
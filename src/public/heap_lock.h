@@ -0,0 +1,232 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file heap_lock.h
+
+    @brief Compile-time selectable locking policies for the heap allocators
+*/
+#pragma once
+
+#include "mark3.h"
+
+//---------------------------------------------------------------------------
+/**
+    Set this to "1" to make the HeapMutexLock policy available.  This policy
+    wraps a POSIX mutex, and is only intended for hosted builds (i.e. unit
+    tests or simulators).
+*/
+#ifndef HEAP_LOCK_PTHREAD_ENABLE
+#define HEAP_LOCK_PTHREAD_ENABLE (0)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Locking policy used by every allocator (Arena, FixedHeap, BlockHeap, Slab
+    and BitmapAllocator), unless overridden for a specific allocator class
+    (see ARENA_LOCK_POLICY, FIXED_HEAP_LOCK_POLICY, BLOCK_HEAP_LOCK_POLICY,
+    SLAB_LOCK_POLICY and BITMAP_ALLOCATOR_LOCK_POLICY).  Must name one of the
+    policy classes below, i.e. -DHEAP_LOCK_POLICY=HeapSpinLock.  Allocators
+    are unsynchronized by default.
+*/
+#ifndef HEAP_LOCK_POLICY
+#define HEAP_LOCK_POLICY HeapNullLock
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Upper limit on the number of relax instructions a HeapSpinLock waits for
+    between attempts to take the lock.  The wait doubles after each failed
+    attempt, up to this limit.
+*/
+#ifndef HEAP_SPIN_LOCK_MAX_BACKOFF
+#define HEAP_SPIN_LOCK_MAX_BACKOFF (64)
+#endif
+
+#if HEAP_LOCK_PTHREAD_ENABLE
+#include <pthread.h>
+#endif
+
+//---------------------------------------------------------------------------
+// Hint to the CPU that it is spinning on a lock
+#if defined(__i386__) || defined(__x86_64__)
+#define HEAP_LOCK_RELAX() __builtin_ia32_pause()
+#elif defined(__arm__) || defined(__aarch64__)
+#define HEAP_LOCK_RELAX() __asm__ volatile("yield" ::: "memory")
+#else
+#define HEAP_LOCK_RELAX() __asm__ volatile("" ::: "memory")
+#endif
+
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_4)
+#define HEAP_LOCK_NATIVE_ATOMICS (1)
+#else
+#define HEAP_LOCK_NATIVE_ATOMICS (0)
+#endif
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+/**
+ * @brief The HeapNullLock class
+ *
+ * Locking policy that does nothing, for allocators only ever used from a
+ * single context.  The policy has no state, so adds nothing to the size of
+ * the allocators using it.
+ */
+class HeapNullLock
+{
+public:
+    void Init(void) {}
+    void Lock(void) {}
+    bool TryLock(void) { return true; }
+    void Unlock(void) {}
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The HeapSpinLock class
+ *
+ * Test-and-test-and-set spinlock with exponential backoff, for allocators
+ * shared between threads running on multiple cores.  Waiters spin reading
+ * the lock (rather than repeatedly writing to it), and wait for longer after
+ * each failed attempt to reduce contention on the lock's cache line.
+ *
+ * On a single core, a thread spinning on a lock held by a lower-priority
+ * thread never gives the holder a chance to run - use HeapCriticalLock (or
+ * HeapNullLock with external locking) instead.
+ */
+class HeapSpinLock
+{
+public:
+    void Init(void) { m_u32Locked = 0; }
+
+    void Lock(void)
+    {
+        uint32_t u32Backoff = 1;
+        while (!TryLock()) {
+            do {
+                for (uint32_t i = 0; i < u32Backoff; i++) {
+                    HEAP_LOCK_RELAX();
+                }
+                if (u32Backoff < HEAP_SPIN_LOCK_MAX_BACKOFF) {
+                    u32Backoff <<= 1;
+                }
+            } while (IsLocked());
+        }
+    }
+
+    bool TryLock(void)
+    {
+#if HEAP_LOCK_NATIVE_ATOMICS
+        return __atomic_exchange_n(&m_u32Locked, 1, __ATOMIC_ACQUIRE) == 0;
+#else
+        CriticalGuard clGuard;
+        auto          u32Old = m_u32Locked;
+        m_u32Locked          = 1;
+        return u32Old == 0;
+#endif
+    }
+
+    void Unlock(void)
+    {
+#if HEAP_LOCK_NATIVE_ATOMICS
+        __atomic_store_n(&m_u32Locked, 0, __ATOMIC_RELEASE);
+#else
+        CriticalGuard clGuard;
+        m_u32Locked = 0;
+#endif
+    }
+
+private:
+    bool IsLocked(void)
+    {
+#if HEAP_LOCK_NATIVE_ATOMICS
+        return __atomic_load_n(&m_u32Locked, __ATOMIC_RELAXED) != 0;
+#else
+        return m_u32Locked != 0;
+#endif
+    }
+
+    volatile uint32_t m_u32Locked;
+};
+
+#if HEAP_LOCK_PTHREAD_ENABLE
+//---------------------------------------------------------------------------
+/**
+ * @brief The HeapMutexLock class
+ *
+ * Locking policy using a POSIX mutex, for hosted builds.  Waiters block in
+ * the OS rather than spinning.  The mutex lives as long as the lock object -
+ * it is statically initialized, kept when the allocator is re-initialized,
+ * and destroyed along with the allocator.  Allocator metadata placed within
+ * raw memory (i.e. the chunks of a growable FixedHeap) is constructed and
+ * destroyed in place for the same reason.
+ */
+class HeapMutexLock
+{
+public:
+    ~HeapMutexLock() { pthread_mutex_destroy(&m_stMutex); }
+
+    void Init(void) {}
+    void Lock(void) { pthread_mutex_lock(&m_stMutex); }
+    bool TryLock(void) { return pthread_mutex_trylock(&m_stMutex) == 0; }
+    void Unlock(void) { pthread_mutex_unlock(&m_stMutex); }
+
+private:
+    pthread_mutex_t m_stMutex = PTHREAD_MUTEX_INITIALIZER;
+};
+#endif
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The HeapCriticalLock class
+ *
+ * Locking policy that holds a kernel critical section for the duration of
+ * each allocator operation, making the allocator safe to use from threads
+ * and interrupts on a single core.  The allocators keep the work done under
+ * the lock short and bounded (i.e. page providers are called outside of the
+ * lock), to limit the impact on interrupt latency.
+ */
+class HeapCriticalLock
+{
+public:
+    void Init(void) {}
+    void Lock(void) { m_uStatus = CriticalSection::Enter(); }
+    bool TryLock(void)
+    {
+        Lock();
+        return true;
+    }
+    void Unlock(void) { CriticalSection::Exit(m_uStatus); }
+
+private:
+    K_WORD m_uStatus; //!< Interrupt state to restore on Unlock()
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The HeapLockGuard class
+ *
+ * Holds a lock for the lifetime of the guard object.
+ */
+template <typename Lock>
+class HeapLockGuard
+{
+public:
+    explicit HeapLockGuard(Lock* pclLock_) : m_pclLock(pclLock_) { m_pclLock->Lock(); }
+    ~HeapLockGuard() { m_pclLock->Unlock(); }
+
+private:
+    Lock* m_pclLock;
+};
+} // namespace Mark3
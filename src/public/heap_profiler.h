@@ -0,0 +1,217 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file heap_profiler.h
+
+    @brief Allocation-size profiler, used to derive heap configurations from
+           the allocation patterns of a real workload.
+*/
+#pragma once
+
+#include "kerneltypes.h"
+
+//---------------------------------------------------------------------------
+/**
+    Set this to "1" to allow Arena, FixedHeap, Slab and BitmapAllocator
+    objects to report their allocations to a HeapProfiler (see
+    HeapHooks::SetProfiler()).
+*/
+#ifndef HEAP_PROFILER_ENABLE
+#define HEAP_PROFILER_ENABLE (0)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Allocation sizes are recorded in buckets of HEAP_PROFILER_GRANULE bytes.
+    Sizes beyond the last bucket are recorded in the last bucket.
+*/
+#ifndef HEAP_PROFILER_GRANULE
+#define HEAP_PROFILER_GRANULE (8)
+#endif
+
+#ifndef HEAP_PROFILER_BUCKETS
+#define HEAP_PROFILER_BUCKETS (64)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Maximum number of live allocations tracked by the profiler.  Allocations
+    made while the table is full are counted, but are not included in the
+    live/peak statistics.
+*/
+#ifndef HEAP_PROFILER_MAX_LIVE
+#define HEAP_PROFILER_MAX_LIVE (128)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Maximum number of bins a generated heap configuration may contain
+*/
+#ifndef HEAP_PROFILER_MAX_BINS
+#define HEAP_PROFILER_MAX_BINS (16)
+#endif
+
+namespace Mark3
+{
+struct HeapConfig;
+
+//---------------------------------------------------------------------------
+// Output function used to emit generated configuration text
+typedef void (*heap_profiler_write_function_t)(void* pvContext_, const char* szText_);
+
+//---------------------------------------------------------------------------
+// Statistics recorded for each size bucket
+typedef struct {
+    uint32_t u32Allocs;   //!< Number of successful allocations
+    uint32_t u32Bytes;    //!< Total bytes requested by successful allocations
+    uint32_t u32Failures; //!< Number of allocations that failed
+    uint32_t u32Spills;   //!< Number of allocations served from a larger size class than ideal
+    uint16_t u16Live;     //!< Number of allocations currently live
+    uint16_t u16PeakLive; //!< Maximum number of concurrently live allocations
+    size_t   uMaxSize;    //!< Largest size requested
+} heap_profile_bucket_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The HeapProfiler class
+ *
+ * Records a histogram of allocation sizes, the peak number of concurrently
+ * live allocations of each size, and allocation failures/spills.  The
+ * recorded profile can then be used to generate a FixedHeap configuration
+ * with size classes chosen to minimize internal fragmentation, scaled to
+ * fit a memory budget, or a set of Arena list sizes.
+ */
+class HeapProfiler
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Clear all recorded statistics
+     */
+    void Init(void);
+
+    /**
+     * @brief RecordAllocate
+     *
+     * @param uSize_ Size of the allocation requested
+     * @param pvData_ Pointer returned by the allocator, or nullptr on failure
+     * @param bSpilled_ true if the allocation was served from a larger size
+     *        class than the one best suited to it
+     */
+    void RecordAllocate(size_t uSize_, void* pvData_, bool bSpilled_);
+
+    /**
+     * @brief RecordFree
+     *
+     * @param pvData_ Previously-recorded allocation being freed
+     */
+    void RecordFree(void* pvData_);
+
+    /**
+     * @brief GetBucket
+     *
+     * @param u8Bucket_ Index of the bucket to query
+     * @return Statistics recorded for the bucket
+     */
+    const heap_profile_bucket_t* GetBucket(uint8_t u8Bucket_) const { return &m_astBuckets[u8Bucket_]; }
+
+    /**
+     * @brief GetBucketForSize
+     *
+     * @param uSize_ Allocation size
+     * @return Index of the bucket used to record allocations of this size
+     */
+    static uint8_t GetBucketForSize(size_t uSize_);
+
+    /**
+     * @brief GetPeakLive
+     * @return Maximum number of concurrently live allocations (of any size)
+     */
+    uint32_t GetPeakLive(void) const { return m_u32PeakLive; }
+
+    /**
+     * @brief GetUntracked
+     * @return Number of allocations not tracked due to a full live table
+     */
+    uint32_t GetUntracked(void) const { return m_u32Untracked; }
+
+    /**
+     * @brief GenerateConfig
+     *
+     * Generate a FixedHeap configuration from the recorded profile.  Size
+     * classes are chosen to minimize the memory lost to internal
+     * fragmentation at peak usage, with each bin sized for the peak number
+     * of live allocations it serves.  If a budget is specified, block counts
+     * are scaled to fit within it - unless it can't hold even a single block
+     * in each bin.
+     *
+     * @param pclConfig_ Array to write the configuration to, at least
+     *        u8MaxBins_ + 1 entries long (the configuration is terminated by
+     *        an entry with a 0 block size).
+     * @param u8MaxBins_ Maximum number of bins to generate
+     * @param uBudget_ Memory budget for the heap (in bytes), or 0 for none
+     * @return Number of bins generated
+     */
+    uint8_t GenerateConfig(HeapConfig* pclConfig_, uint8_t u8MaxBins_, size_t uBudget_);
+
+    /**
+     * @brief GenerateArenaSizes
+     *
+     * Generate the size-list table for an Arena from the recorded profile,
+     * with list sizes placed so that each list serves a similar share of
+     * the recorded allocations.
+     *
+     * @param auSizes_ Array to write the list sizes to
+     * @param u8NumSizes_ Number of list sizes to generate
+     */
+    void GenerateArenaSizes(K_ADDR* auSizes_, uint8_t u8NumSizes_);
+
+    /**
+     * @brief WriteConfig
+     *
+     * Emit a FixedHeap configuration as the block size/count definitions
+     * used in system_heap_config.h.
+     *
+     * @param pclConfig_ Configuration to write, terminated by an entry with
+     *        a 0 block size
+     * @param pfWrite_ Function called to output each piece of text
+     * @param pvContext_ User-defined context passed to the output function
+     */
+    static void WriteConfig(const HeapConfig* pclConfig_, heap_profiler_write_function_t pfWrite_, void* pvContext_);
+
+private:
+    /**
+     * @brief SlotForData
+     *
+     * @param pvData_ Allocation to look up in the live table
+     * @return Index of the allocation's slot, or of the empty slot where it
+     *         would be inserted
+     */
+    uint16_t SlotForData(void* pvData_);
+
+    heap_profile_bucket_t m_astBuckets[HEAP_PROFILER_BUCKETS];
+
+    void*    m_apvLive[HEAP_PROFILER_MAX_LIVE];       //!< Open-addressed table of live allocations
+    uint8_t  m_au8LiveBucket[HEAP_PROFILER_MAX_LIVE]; //!< Bucket of each live allocation
+    uint16_t m_u16Live;                               //!< Number of tracked live allocations
+    uint32_t m_u32PeakLive;
+    uint32_t m_u32Untracked;
+
+    // Working data used while generating configurations
+    uint8_t  m_au8Used[HEAP_PROFILER_BUCKETS];                         //!< Indexes of buckets with allocations
+    uint8_t  m_au8Split[HEAP_PROFILER_MAX_BINS][HEAP_PROFILER_BUCKETS]; //!< First bucket of the last bin, by bin count
+    uint64_t m_au64Cost[2][HEAP_PROFILER_BUCKETS];                     //!< Minimum fragmentation, by last bucket
+};
+} // namespace Mark3
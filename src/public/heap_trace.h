@@ -0,0 +1,261 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file heap_trace.h
+
+    @brief Allocation trace capture, and replay of captured traces against
+           an arbitrary allocator.
+*/
+#pragma once
+
+#include "mark3.h"
+
+//---------------------------------------------------------------------------
+/**
+    Set this to "1" to allow Arena, FixedHeap, Slab and BitmapAllocator
+    objects to record their allocations to a HeapTrace (see
+    HeapHooks::SetTrace()).
+*/
+#ifndef HEAP_TRACE_ENABLE
+#define HEAP_TRACE_ENABLE (0)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Number of records buffered by each HeapTrace object.  The buffer is
+    split in two halves - one is filled while the other waits to be written
+    out by HeapTrace::Flush().  Each record takes 10 bytes plus the size of
+    a K_ADDR (i.e. 14 bytes with a 32-bit K_ADDR, 18 bytes with a 64-bit
+    one).
+*/
+#ifndef HEAP_TRACE_BUFFER_RECORDS
+#define HEAP_TRACE_BUFFER_RECORDS (64)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Maximum number of concurrently-live allocations tracked when replaying
+    a trace.
+*/
+#ifndef HEAP_REPLAY_MAX_LIVE
+#define HEAP_REPLAY_MAX_LIVE (1024)
+#endif
+
+//---------------------------------------------------------------------------
+#define HEAP_TRACE_OP_ALLOC (0)
+#define HEAP_TRACE_OP_FREE (1)
+
+#define HEAP_TRACE_NO_THREAD (0xFF)
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Binary trace record, as written to the trace output.  Packed, so its
+// size is 10 + sizeof(K_ADDR) bytes.
+typedef struct __attribute__((packed)) {
+    uint8_t  u8Op;         //!< HEAP_TRACE_OP_ALLOC or HEAP_TRACE_OP_FREE
+    uint8_t  u8Thread;     //!< ID of the calling thread, or HEAP_TRACE_NO_THREAD
+    uint32_t u32Size;      //!< Requested size (allocations only)
+    K_ADDR   adId;         //!< Identifies the allocation (its address) - 0 for failed allocations
+    uint32_t u32Timestamp; //!< Kernel tick count at the time of the operation
+} heap_trace_record_t;
+
+//---------------------------------------------------------------------------
+// Trace output function - called with each batch of records to write out
+typedef void (*heap_trace_flush_function_t)(void* pvContext_, const heap_trace_record_t* pastRecords_, uint16_t u16Count_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The HeapTrace class
+ *
+ * Captures a compact binary record of every allocation and free made by the
+ * allocators attached to it.  Records are buffered, and written out in
+ * batches through a user-supplied function (i.e. to a file, or a debug
+ * channel).  Records are added within a critical section, and never written
+ * out from within an allocator - once half of the buffer fills, further
+ * records are added to the other half until the owner (or a background
+ * thread) calls Flush().  Flush() must not be called with an allocator's
+ * lock held.  Records are dropped if both halves fill before Flush() is
+ * called.
+ */
+class HeapTrace
+{
+public:
+    /**
+     * @brief Init
+     *
+     * @param pfFlush_ Function called to write out batches of records
+     * @param pvContext_ User-defined context passed to the output function
+     */
+    void Init(heap_trace_flush_function_t pfFlush_, void* pvContext_);
+
+    /**
+     * @brief RecordAllocate
+     *
+     * @param uSize_ Size of the allocation requested
+     * @param pvData_ Pointer returned by the allocator, or nullptr on failure
+     */
+    void RecordAllocate(size_t uSize_, void* pvData_) { Record(HEAP_TRACE_OP_ALLOC, uSize_, pvData_); }
+
+    /**
+     * @brief RecordFree
+     *
+     * @param pvData_ Allocation being freed
+     */
+    void RecordFree(void* pvData_) { Record(HEAP_TRACE_OP_FREE, 0, pvData_); }
+
+    /**
+     * @brief Flush
+     *
+     * Write out any buffered records - first a half of the buffer filled
+     * since the last call, then any records in the active half.  Called
+     * periodically by the owner of the trace, or whenever IsFlushPending()
+     * returns true.
+     */
+    void Flush(void);
+
+    /**
+     * @brief IsFlushPending
+     * @return true if a full half of the buffer is waiting to be written out
+     */
+    bool IsFlushPending(void)
+    {
+        return (m_au16Count[0] == (HEAP_TRACE_BUFFER_RECORDS / 2)) || (m_au16Count[1] == (HEAP_TRACE_BUFFER_RECORDS / 2));
+    }
+
+    /**
+     * @brief GetDropped
+     * @return Number of records dropped due to a full buffer
+     */
+    uint32_t GetDropped(void) { return m_u32Dropped; }
+
+private:
+    /**
+     * @brief Record
+     *
+     * Add a record to the active half of the buffer, switching to the other
+     * half once it is full.  Full halves are left for Flush() to write out.
+     */
+    void Record(uint8_t u8Op_, size_t uSize_, void* pvData_);
+
+    /**
+     * @brief WriteHalf
+     *
+     * Write out the records buffered in one half of the buffer.
+     */
+    void WriteHalf(uint8_t u8Half_);
+
+    heap_trace_record_t m_astRecords[2][HEAP_TRACE_BUFFER_RECORDS / 2];
+    uint16_t            m_au16Count[2];   //!< Records buffered in each half
+    bool                m_abWriting[2];   //!< Whether each half is being written out
+    uint8_t             m_u8Active;       //!< Half currently being filled
+    uint32_t            m_u32Dropped;
+
+    heap_trace_flush_function_t m_pfFlush;
+    void*                       m_pvContext;
+};
+
+//---------------------------------------------------------------------------
+// Allocator interface used when replaying traces
+typedef void* (*heap_replay_alloc_function_t)(size_t uSize_);
+typedef void (*heap_replay_free_function_t)(void* pvData_);
+
+//---------------------------------------------------------------------------
+// Results of replaying a trace
+typedef struct {
+    uint32_t u32Ops;           //!< Number of operations replayed
+    uint32_t u32Failures;      //!< Number of allocations that failed
+    uint32_t u32Untracked;     //!< Allocations not tracked due to a full live table
+    uint32_t u32Ticks;         //!< Kernel ticks spent replaying the trace
+    size_t   uPeakLive;        //!< Peak number of requested bytes live at once
+    size_t   uPeakFootprint;   //!< Span of memory covered by all allocations
+    uint16_t u16Fragmentation; //!< Portion of the peak footprint not used by live data, in 1/1000ths
+} heap_replay_result_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The HeapReplay class
+ *
+ * Re-executes a captured trace against an allocator, reporting the time
+ * spent in the allocator, and the peak memory footprint and fragmentation
+ * that resulted.  Allocations are matched between trace and replay using
+ * the IDs recorded in the trace.  Failed allocations in the trace are
+ * replayed as an allocate, immediately followed by a free.
+ *
+ * The footprint is measured as the span of addresses covered by all
+ * allocations made during the replay, so is only meaningful for allocators
+ * that manage a single contiguous region of memory.
+ */
+class HeapReplay
+{
+public:
+    /**
+     * @brief Init
+     *
+     * @param pfAlloc_ Function used to allocate from the allocator under test
+     * @param pfFree_ Function used to free to the allocator under test
+     */
+    void Init(heap_replay_alloc_function_t pfAlloc_, heap_replay_free_function_t pfFree_);
+
+    /**
+     * @brief Replay
+     *
+     * Replay a batch of records from a trace.  May be called repeatedly to
+     * replay a trace in pieces.
+     *
+     * @param pastRecords_ Records to replay
+     * @param u32Count_ Number of records to replay
+     */
+    void Replay(const heap_trace_record_t* pastRecords_, uint32_t u32Count_);
+
+    /**
+     * @brief Finish
+     *
+     * Free any allocations still live at the end of the trace, and compute
+     * the final results.
+     *
+     * @return Results of the replay
+     */
+    const heap_replay_result_t* Finish(void);
+
+private:
+    /**
+     * @brief SlotForId
+     *
+     * @param adId_ ID of the allocation to look up in the live table
+     * @return Index of the allocation's slot, or of the empty slot where it
+     *         would be inserted
+     */
+    uint16_t SlotForId(K_ADDR adId_);
+
+    /**
+     * @brief FreeSlot
+     *
+     * Free the allocation in a slot of the live table, and remove it.
+     */
+    void FreeSlot(uint16_t u16Slot_);
+
+    K_ADDR   m_aadLiveId[HEAP_REPLAY_MAX_LIVE];
+    void*    m_apvLive[HEAP_REPLAY_MAX_LIVE];
+    size_t   m_auLiveSize[HEAP_REPLAY_MAX_LIVE];
+    uint16_t m_u16Live;
+    size_t   m_uLiveBytes;
+    K_ADDR   m_adLow;  //!< Lowest address of any allocation
+    K_ADDR   m_adHigh; //!< Highest end address of any allocation
+
+    heap_replay_alloc_function_t m_pfAlloc;
+    heap_replay_free_function_t  m_pfFree;
+    heap_replay_result_t         m_stResult;
+};
+} // namespace Mark3
@@ -38,12 +38,15 @@ See license.txt for more information
 #if (PTR_SIZE == 2)
 #define HEAP_COOKIE_FREE (0xCAFE)
 #define HEAP_COOKIE_ALLOCATED (0xDEAD)
+#define HEAP_COOKIE_MOVABLE (0xFACE)
 #elif (PTR_SIZE == 4)
 #define HEAP_COOKIE_FREE (0xCAFED00D)
 #define HEAP_COOKIE_ALLOCATED (0xDEADBEEF)
+#define HEAP_COOKIE_MOVABLE (0xFEEDFACE)
 #elif (PTR_SIZE == 8)
 #define HEAP_COOKIE_FREE (0xCAFED00DFEEDBABE)
 #define HEAP_COOKIE_ALLOCATED (0xDEADBEEFABACABB0)
+#define HEAP_COOKIE_MOVABLE (0xFEEDFACEB0BAF00D)
 #else
 #error PTR_SIZE invalid!
 #endif
@@ -0,0 +1,123 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file lockfree_block_heap.h
+    @brief Lock-free, interrupt-safe single-block-size heap
+*/
+#pragma once
+
+#include "kerneltypes.h"
+
+//---------------------------------------------------------------------------
+// The free-list head is a single word containing the index of the first free
+// block and an ABA-protection tag that changes on every update.  Use 32-bit
+// indices and tags where 8-byte compare-and-swap is available, and 16-bit
+// indices and tags otherwise.
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_8)
+#define LOCKFREE_INDEX_BITS (32)
+typedef uint64_t lockfree_head_t;
+#else
+#define LOCKFREE_INDEX_BITS (16)
+typedef uint32_t lockfree_head_t;
+#endif
+
+#define LOCKFREE_INDEX_MASK ((((lockfree_head_t)1) << LOCKFREE_INDEX_BITS) - 1)
+#define LOCKFREE_INDEX_NONE (LOCKFREE_INDEX_MASK)
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+/**
+ * @brief The LockFreeBlockHeap class
+ *
+ * Single-block-size heap, equivalent to BlockHeap, but safe to use
+ * concurrently from multiple threads and from interrupt (or signal) context
+ * without locks.
+ *
+ * Free blocks are kept on a Treiber stack, with the link to the next free
+ * block stored in the free block itself.  Blocks are identified by their
+ * index in the pool, which keeps the head index and its ABA-protection tag
+ * within a single word that can be updated with a single compare-and-swap.
+ * As a result, blocks carry no per-block metadata at all.
+ *
+ * On targets without native compare-and-swap support, updates are performed
+ * within a critical section instead, which remains interrupt-safe.
+ */
+class LockFreeBlockHeap
+{
+public:
+    /**
+     *  @brief Create
+     *
+     *  Create a lock-free heap in the blob of memory provided.  Will create
+     *  as many blocks as will fit in the uSize_ parameter.  Must be called
+     *  before the heap is shared between threads or interrupts.
+     *
+     *  @param pvHeap_ Pointer to the heap data to initialize
+     *  @param uSize_ Size of the heap range in bytes
+     *  @param uBlockSize_ Size of each heap block in bytes
+     *
+     *  @return Pointer to the end of the heap data
+     */
+    void* Create(void* pvHeap_, size_t uSize_, size_t uBlockSize_);
+
+    /**
+     *  @brief Allocate
+     *
+     *  Allocate a block of memory from this heap.  Lock-free.
+     *
+     *  @return pointer to a block of memory, or 0 on failure
+     */
+    void* Allocate();
+
+    /**
+     *  @brief Free
+     *
+     *  Free a previously allocated block of memory.  Lock-free.
+     *
+     *  @param pvData_ Pointer to a block of data previously allocated off
+     *         the heap.
+     */
+    void Free(void* pvData_);
+
+    /**
+     *  @brief IsFree
+     *
+     *  Returns the state of a heap - whether or not it has free elements.
+     *  When the heap is shared, the result is only a snapshot.
+     *
+     *  @return true if the heap is not full, false if the heap is full
+     */
+    bool IsFree() { return GetNumFree() != 0; }
+
+    /**
+     *  @brief GetNumFree
+     *  @return Number of blocks currently free in the heap
+     */
+    uint32_t GetNumFree();
+
+    /**
+     *  @brief GetNumBlocks
+     *  @return Total number of blocks managed by the heap
+     */
+    uint32_t GetNumBlocks() { return m_u32NumBlocks; }
+
+private:
+    K_ADDR                   m_uBase;        //!< Address of the first block
+    size_t                   m_uStride;      //!< Distance between blocks, in bytes
+    uint32_t                 m_u32NumBlocks; //!< Number of blocks in the heap
+    volatile uint32_t        m_u32NumFree;   //!< Number of blocks free in the heap
+    volatile lockfree_head_t m_uHead;        //!< Tagged index of the first free block
+};
+} // namespace Mark3
@@ -0,0 +1,265 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file memory_resource.h
+
+    @brief Polymorphic memory resources wrapping each of the heap allocators,
+           and a container allocator template built on them.
+*/
+#pragma once
+
+#include "mark3.h"
+#include "arena.h"
+#include "bitmap_allocator.h"
+#include "fixed_heap.h"
+#include "slab.h"
+
+//---------------------------------------------------------------------------
+/**
+    Largest alignment guaranteed by the underlying allocators.  Requests for
+    stricter alignment are over-allocated and aligned by the resource.
+*/
+#ifndef MEMORY_RESOURCE_NATURAL_ALIGN
+#define MEMORY_RESOURCE_NATURAL_ALIGN (sizeof(K_ADDR))
+#endif
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Memory resource callbacks - the size and alignment of an allocation are
+// passed back when it is freed.
+typedef void* (*memory_resource_alloc_function_t)(void* pvContext_, size_t uSize_);
+typedef void (*memory_resource_free_function_t)(void* pvContext_, void* pvData_, size_t uSize_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The MemoryResource class
+ *
+ * Type-erased interface to an allocator, modelled on std::pmr's
+ * memory_resource.  Objects holding a MemoryResource pointer can allocate
+ * from any of the heap implementations without knowing which one is in use.
+ * Allocations must be freed with the same size and alignment they were
+ * allocated with.  Allocation failures return nullptr.
+ */
+class MemoryResource
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Initialize the resource with a pair of allocator callbacks.
+     *
+     * @param pfAlloc_ Function allocating naturally-aligned memory
+     * @param pfFree_ Function freeing memory allocated with pfAlloc_
+     * @param pvContext_ Allocator-specific context passed to the callbacks
+     */
+    void Init(memory_resource_alloc_function_t pfAlloc_, memory_resource_free_function_t pfFree_, void* pvContext_);
+
+    /**
+     * @brief Allocate
+     *
+     * @param uSize_ Size of the allocation in bytes
+     * @param uAlign_ Required alignment (power of two)
+     * @return Pointer to the allocated memory, or nullptr on failure
+     */
+    void* Allocate(size_t uSize_, size_t uAlign_ = MEMORY_RESOURCE_NATURAL_ALIGN);
+
+    /**
+     * @brief Free
+     *
+     * @param pvData_ Memory previously returned by Allocate()
+     * @param uSize_ Size passed to Allocate()
+     * @param uAlign_ Alignment passed to Allocate()
+     */
+    void Free(void* pvData_, size_t uSize_, size_t uAlign_ = MEMORY_RESOURCE_NATURAL_ALIGN);
+
+    /**
+     * @brief IsEqual
+     *
+     * @param pclOther_ Resource to compare against
+     * @return true if memory allocated from one resource can be freed to the other
+     */
+    bool IsEqual(const MemoryResource* pclOther_) const { return this == pclOther_; }
+
+private:
+    memory_resource_alloc_function_t m_pfAlloc;
+    memory_resource_free_function_t  m_pfFree;
+    void*                            m_pvContext;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The ArenaResource class
+ *
+ * Memory resource allocating from an Arena.
+ */
+class ArenaResource : public MemoryResource
+{
+public:
+    /**
+     * @brief Init
+     * @param pclArena_ Initialized arena to allocate from
+     */
+    void Init(Arena* pclArena_);
+
+private:
+    static void* ResourceAlloc(void* pvContext_, size_t uSize_);
+    static void  ResourceFree(void* pvContext_, void* pvData_, size_t uSize_);
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The FixedHeapResource class
+ *
+ * Memory resource allocating from a FixedHeap.
+ */
+class FixedHeapResource : public MemoryResource
+{
+public:
+    /**
+     * @brief Init
+     * @param pclHeap_ Created heap to allocate from
+     */
+    void Init(FixedHeap* pclHeap_);
+
+private:
+    static void* ResourceAlloc(void* pvContext_, size_t uSize_);
+    static void  ResourceFree(void* pvContext_, void* pvData_, size_t uSize_);
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The SlabResource class
+ *
+ * Memory resource allocating from a set of slabs.  Each allocation comes
+ * from the first slab with objects large enough to hold it, so the slabs
+ * must be ordered by increasing object size.  Requests larger than the
+ * largest slab's objects fail.
+ */
+class SlabResource : public MemoryResource
+{
+public:
+    /**
+     * @brief Init
+     * @param paclSlabs_ Array of initialized slabs, in order of object size
+     * @param u8NumSlabs_ Number of slabs in the array
+     */
+    void Init(Slab* paclSlabs_, uint8_t u8NumSlabs_);
+
+private:
+    /**
+     * @brief SlabForSize
+     * @param uSize_ Size of the allocation
+     * @return Smallest slab able to hold the allocation, or nullptr
+     */
+    Slab* SlabForSize(size_t uSize_);
+
+    static void* ResourceAlloc(void* pvContext_, size_t uSize_);
+    static void  ResourceFree(void* pvContext_, void* pvData_, size_t uSize_);
+
+    Slab*   m_paclSlabs;
+    uint8_t m_u8NumSlabs;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The BitmapResource class
+ *
+ * Memory resource allocating from a BitmapAllocator.  Requests larger than
+ * the allocator's element size fail.
+ */
+class BitmapResource : public MemoryResource
+{
+public:
+    /**
+     * @brief Init
+     * @param pclAllocator_ Initialized allocator to allocate from
+     * @param u32ElementSize_ Element size the allocator was initialized with
+     */
+    void Init(BitmapAllocator* pclAllocator_, uint32_t u32ElementSize_);
+
+private:
+    static void* ResourceAlloc(void* pvContext_, size_t uSize_);
+    static void  ResourceFree(void* pvContext_, void* pvData_, size_t uSize_);
+
+    BitmapAllocator* m_pclAllocator;
+    uint32_t         m_u32ElementSize;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The Allocator class
+ *
+ * Allocator for typed objects, backed by a MemoryResource.  Meets the
+ * standard library's Allocator requirements (hence the lower-case member
+ * names), so containers can place their nodes on any of the heaps.  As the
+ * library is built without exceptions, allocation failures return nullptr.
+ */
+template <typename T>
+class Allocator
+{
+public:
+    typedef T value_type;
+
+    Allocator(MemoryResource* pclResource_) : m_pclResource(pclResource_) {}
+
+    template <typename U>
+    Allocator(const Allocator<U>& clOther_) : m_pclResource(clOther_.GetResource())
+    {
+    }
+
+    /**
+     * @brief allocate
+     * @param uCount_ Number of objects to allocate storage for
+     * @return Uninitialized storage for the objects, or nullptr on failure
+     */
+    T* allocate(size_t uCount_)
+    {
+        if (uCount_ > ((size_t)-1 / sizeof(T))) {
+            return nullptr;
+        }
+        return static_cast<T*>(m_pclResource->Allocate(uCount_ * sizeof(T), alignof(T)));
+    }
+
+    /**
+     * @brief deallocate
+     * @param pclData_ Storage returned by allocate()
+     * @param uCount_ Number of objects passed to allocate()
+     */
+    void deallocate(T* pclData_, size_t uCount_) { m_pclResource->Free(pclData_, uCount_ * sizeof(T), alignof(T)); }
+
+    /**
+     * @brief GetResource
+     * @return Memory resource backing this allocator
+     */
+    MemoryResource* GetResource() const { return m_pclResource; }
+
+private:
+    MemoryResource* m_pclResource;
+};
+
+//---------------------------------------------------------------------------
+template <typename T, typename U>
+bool operator==(const Allocator<T>& clLeft_, const Allocator<U>& clRight_)
+{
+    return clLeft_.GetResource()->IsEqual(clRight_.GetResource());
+}
+
+//---------------------------------------------------------------------------
+template <typename T, typename U>
+bool operator!=(const Allocator<T>& clLeft_, const Allocator<U>& clRight_)
+{
+    return !(clLeft_ == clRight_);
+}
+} // namespace Mark3
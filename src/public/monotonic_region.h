@@ -0,0 +1,175 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file monotonic_region.h
+
+    @brief Monotonic (bump-pointer) region allocator, with mark/release of
+           whole groups of allocations.
+*/
+#pragma once
+
+#include "mark3.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Page allocation functions, used to extend a region once its initial buffer
+// is exhausted
+typedef void* (*monotonic_region_alloc_page_function_t)(uint32_t* pu32PageSize_);
+typedef void (*monotonic_region_free_page_function_t)(void* pvPage_);
+
+//---------------------------------------------------------------------------
+// Header at the start of each page added to a region
+typedef struct RegionPage {
+    struct RegionPage* pstPrev; //!< Page added before this one (or nullptr)
+    uint32_t           u32Size; //!< Size of the page, including this header
+} monotonic_region_page_t;
+
+//---------------------------------------------------------------------------
+// Position within a region, returned by Mark() and consumed by Release()
+typedef struct {
+    monotonic_region_page_t* pstPage; //!< Page containing the position (nullptr = initial buffer)
+    K_ADDR                   adNext;  //!< Address of the next allocation
+} monotonic_region_mark_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The MonotonicRegion class
+ *
+ * Allocates by advancing a pointer through an initial buffer, then through
+ * pages requested from a page allocator as required.  Individual
+ * allocations are never freed - instead, Mark() records the current
+ * position in the region, and Release() discards every allocation made
+ * since in a single step, returning any pages added in the meantime.
+ * This suits per-request scratch data, which would otherwise have to be
+ * freed one block at a time.
+ *
+ * Marks must be released in the reverse order in which they were taken;
+ * releasing a mark invalidates any marks taken after it.  One released page
+ * is kept in reserve, so a region repeatedly marked and released across a
+ * page boundary does not hit the page allocator each time.
+ */
+class MonotonicRegion
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Initialize the region prior to use.
+     *
+     * @param pvBuffer_ Initial buffer used before any pages are allocated (may be nullptr)
+     * @param u32BufferSize_ Size of the initial buffer in bytes
+     * @param pfAlloc_ Function to allocate pages (may be nullptr for a fixed region)
+     * @param pfFree_ Function to free previously-allocated pages
+     */
+    void Init(void*                                  pvBuffer_,
+              uint32_t                               u32BufferSize_,
+              monotonic_region_alloc_page_function_t pfAlloc_,
+              monotonic_region_free_page_function_t  pfFree_);
+
+    /**
+     * @brief Allocate
+     *
+     * @param uSize_ Size of the allocation in bytes
+     * @return Pointer-aligned memory, or nullptr if the allocation does not
+     *         fit in the current page and no new page could be added.
+     */
+    void* Allocate(size_t uSize_);
+
+    /**
+     * @brief Mark
+     * @return The current position in the region, to pass to Release()
+     */
+    monotonic_region_mark_t Mark(void) { return { m_pstPage, m_adNext }; }
+
+    /**
+     * @brief Release
+     *
+     * Discard all allocations made since a mark was taken.
+     *
+     * @param stMark_ Mark previously returned by Mark()
+     */
+    void Release(monotonic_region_mark_t stMark_);
+
+    /**
+     * @brief Reset
+     *
+     * Discard all allocations, and return every page (including the reserve
+     * page) to the page allocator.
+     */
+    void Reset(void);
+
+    /**
+     * @brief GetPageCount
+     * @return Number of pages currently in use by the region
+     */
+    uint16_t GetPageCount(void) { return m_u16Pages; }
+
+private:
+    /**
+     * @brief AddPage
+     *
+     * Start allocating from a new page, large enough for an allocation.
+     *
+     * @param uSize_ Size of the allocation the page must hold
+     * @return true if a page was added
+     */
+    bool AddPage(size_t uSize_);
+
+    /**
+     * @brief ReleasePage
+     *
+     * Keep a page no longer in use in reserve, or free it.
+     */
+    void ReleasePage(monotonic_region_page_t* pstPage_);
+
+    K_ADDR m_adNext;        //!< Address of the next allocation
+    K_ADDR m_adLimit;       //!< End of the current page (or initial buffer)
+    K_ADDR m_adBufferStart; //!< First allocation address in the initial buffer
+    K_ADDR m_adBufferEnd;   //!< End of the initial buffer
+
+    monotonic_region_page_t* m_pstPage;  //!< Current page (nullptr = initial buffer)
+    monotonic_region_page_t* m_pstSpare; //!< Reserve page (or nullptr)
+    uint16_t                 m_u16Pages;
+
+    monotonic_region_alloc_page_function_t m_pfPageAlloc;
+    monotonic_region_free_page_function_t  m_pfPageFree;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The InlineMonotonicRegion class
+ *
+ * Monotonic region with its initial buffer stored in the object itself, so
+ * regions that stay within that size never touch the page allocator.
+ */
+template <size_t BufferSize>
+class InlineMonotonicRegion : public MonotonicRegion
+{
+public:
+    /**
+     * @brief Init
+     *
+     * @param pfAlloc_ Function to allocate pages (may be nullptr for a fixed region)
+     * @param pfFree_ Function to free previously-allocated pages
+     */
+    void Init(monotonic_region_alloc_page_function_t pfAlloc_, monotonic_region_free_page_function_t pfFree_)
+    {
+        MonotonicRegion::Init(m_auBuffer, sizeof(m_auBuffer), pfAlloc_, pfFree_);
+    }
+
+private:
+    K_ADDR m_auBuffer[(BufferSize + sizeof(K_ADDR) - 1) / sizeof(K_ADDR)];
+};
+} // namespace Mark3
@@ -0,0 +1,312 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file page_map.h
+
+    @brief Global map from memory pages to the allocators that own them,
+           used to free any block without knowing where it came from.
+*/
+#pragma once
+
+#include "mark3.h"
+#include "arena.h"
+#include "fixed_heap.h"
+#include "slab.h"
+#include "heap_lock.h"
+
+//---------------------------------------------------------------------------
+/**
+    Geometry of the page map's three-level radix tree.  Addresses are split
+    into (from the top) root, mid and leaf indexes and a page offset:
+
+        | root bits | PAGE_MAP_MID_BITS | PAGE_MAP_LEAF_BITS | PAGE_MAP_PAGE_SHIFT |
+
+    where the root level takes the remainder of PAGE_MAP_ADDRESS_BITS.  The
+    page size is the granularity at which memory is assigned to an owner -
+    regions registered with the map should be aligned to it, as a page can
+    only belong to one owner.  Addresses above PAGE_MAP_ADDRESS_BITS can't
+    be mapped.  The defaults suit each pointer size.
+*/
+#if (__SIZEOF_POINTER__ == 8)
+#ifndef PAGE_MAP_ADDRESS_BITS
+#define PAGE_MAP_ADDRESS_BITS (48)
+#endif
+#ifndef PAGE_MAP_PAGE_SHIFT
+#define PAGE_MAP_PAGE_SHIFT (8)
+#endif
+#ifndef PAGE_MAP_MID_BITS
+#define PAGE_MAP_MID_BITS (14)
+#endif
+#ifndef PAGE_MAP_LEAF_BITS
+#define PAGE_MAP_LEAF_BITS (12)
+#endif
+#elif (__SIZEOF_POINTER__ == 2)
+#ifndef PAGE_MAP_ADDRESS_BITS
+#define PAGE_MAP_ADDRESS_BITS (16)
+#endif
+#ifndef PAGE_MAP_PAGE_SHIFT
+#define PAGE_MAP_PAGE_SHIFT (6)
+#endif
+#ifndef PAGE_MAP_MID_BITS
+#define PAGE_MAP_MID_BITS (4)
+#endif
+#ifndef PAGE_MAP_LEAF_BITS
+#define PAGE_MAP_LEAF_BITS (4)
+#endif
+#else
+#ifndef PAGE_MAP_ADDRESS_BITS
+#define PAGE_MAP_ADDRESS_BITS (32)
+#endif
+#ifndef PAGE_MAP_PAGE_SHIFT
+#define PAGE_MAP_PAGE_SHIFT (8)
+#endif
+#ifndef PAGE_MAP_MID_BITS
+#define PAGE_MAP_MID_BITS (8)
+#endif
+#ifndef PAGE_MAP_LEAF_BITS
+#define PAGE_MAP_LEAF_BITS (8)
+#endif
+#endif
+
+#define PAGE_MAP_ROOT_BITS (PAGE_MAP_ADDRESS_BITS - PAGE_MAP_PAGE_SHIFT - PAGE_MAP_MID_BITS - PAGE_MAP_LEAF_BITS)
+#define PAGE_MAP_PAGE_SIZE ((K_ADDR)1 << PAGE_MAP_PAGE_SHIFT)
+
+#if (PAGE_MAP_ROOT_BITS < 1)
+#error "PAGE_MAP_ADDRESS_BITS is too small for the page map's geometry"
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Number of mid-level and leaf nodes available to the page map.  Nodes are
+    statically allocated, and are never released once in use.  Each leaf
+    maps 2^(PAGE_MAP_LEAF_BITS + PAGE_MAP_PAGE_SHIFT) bytes of address space,
+    and each mid-level node 2^PAGE_MAP_MID_BITS times as much.
+*/
+#ifndef PAGE_MAP_MAX_MID_NODES
+#define PAGE_MAP_MAX_MID_NODES (2)
+#endif
+
+#ifndef PAGE_MAP_MAX_LEAF_NODES
+#define PAGE_MAP_MAX_LEAF_NODES (4)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Locking policy serializing updates to the page map (see heap_lock.h).
+    Lookups never take the lock.
+*/
+#ifndef PAGE_MAP_LOCK_POLICY
+#define PAGE_MAP_LOCK_POLICY HEAP_LOCK_POLICY
+#endif
+
+namespace Mark3
+{
+typedef PAGE_MAP_LOCK_POLICY PageMapLock;
+
+//---------------------------------------------------------------------------
+// Owner callbacks, used to free blocks and query their size
+typedef void (*page_map_free_function_t)(void* pvOwner_, void* pvData_);
+typedef size_t (*page_map_size_function_t)(void* pvOwner_, void* pvData_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The PageMapRegion class
+ *
+ * Describes the owner of a set of pages in the page map.  The region object
+ * must remain valid for as long as any pages are registered to it.
+ */
+class PageMapRegion
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Initialize the region with a pair of owner callbacks.
+     *
+     * @param pfFree_ Function freeing a block to the owner
+     * @param pfUsableSize_ Function returning the usable size of a block
+     * @param pvOwner_ Allocator-specific context passed to the callbacks
+     */
+    void Init(page_map_free_function_t pfFree_, page_map_size_function_t pfUsableSize_, void* pvOwner_);
+
+    void   Free(void* pvData_) { m_pfFree(m_pvOwner, pvData_); }
+    size_t GetUsableSize(void* pvData_) { return m_pfUsableSize(m_pvOwner, pvData_); }
+    void*  GetOwner(void) { return m_pvOwner; }
+
+private:
+    page_map_free_function_t m_pfFree;
+    page_map_size_function_t m_pfUsableSize;
+    void*                    m_pvOwner;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The ArenaRegion class
+ *
+ * Page map region owned by an Arena.
+ */
+class ArenaRegion : public PageMapRegion
+{
+public:
+    /**
+     * @brief Init
+     * @param pclArena_ Arena owning the region
+     */
+    void Init(Arena* pclArena_);
+
+private:
+    static void   RegionFree(void* pvOwner_, void* pvData_);
+    static size_t RegionUsableSize(void* pvOwner_, void* pvData_);
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The FixedHeapRegion class
+ *
+ * Page map region owned by a FixedHeap.  Pages used to grow the heap's
+ * bins can be registered to the same region as they are handed out by the
+ * page provider.
+ */
+class FixedHeapRegion : public PageMapRegion
+{
+public:
+    /**
+     * @brief Init
+     * @param pclHeap_ FixedHeap owning the region
+     */
+    void Init(FixedHeap* pclHeap_);
+
+private:
+    static void   RegionFree(void* pvOwner_, void* pvData_);
+    static size_t RegionUsableSize(void* pvOwner_, void* pvData_);
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The SlabRegion class
+ *
+ * Page map region owned by a Slab.  Register the slab's pages as they are
+ * handed out by the page provider (and unregister them as they are
+ * returned), or register the whole pool if it is dedicated to the slab.
+ */
+class SlabRegion : public PageMapRegion
+{
+public:
+    /**
+     * @brief Init
+     * @param pclSlab_ Slab owning the region
+     */
+    void Init(Slab* pclSlab_);
+
+private:
+    static void   RegionFree(void* pvOwner_, void* pvData_);
+    static size_t RegionUsableSize(void* pvOwner_, void* pvData_);
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The PageMap class
+ *
+ * Global radix tree mapping page numbers to the regions (allocators) that
+ * own them.  Resolving the owner of a pointer takes three dependent loads,
+ * regardless of the number of allocators, and reads nothing from the block
+ * itself - so any block can be freed, or its size queried, through
+ * Mark3::Free() and Mark3::UsableSize() without the caller tracking which
+ * allocator it came from.
+ *
+ * Updates are serialized by the PageMapLock policy.  Lookups are lock-free,
+ * as tree nodes are published atomically and never released.
+ */
+class PageMap
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Clear the page map, releasing all of its nodes.  The map starts out
+     * empty, so this is only needed to reset it, and must not be called
+     * while other contexts are using the map.
+     */
+    static void Init(void);
+
+    /**
+     * @brief Register
+     *
+     * Assign a range of memory to a region.  Every page overlapping the
+     * range is assigned - pages already assigned to the same region are
+     * left as-is.
+     *
+     * @param pvStart_ Start of the range
+     * @param uSize_ Size of the range in bytes
+     * @param pclRegion_ Region owning the range
+     * @return true on success, false if a page in the range belongs to
+     *         another region, the range can't be mapped, or the map has run
+     *         out of nodes (nothing is assigned on failure)
+     */
+    static bool Register(void* pvStart_, size_t uSize_, PageMapRegion* pclRegion_);
+
+    /**
+     * @brief Unregister
+     *
+     * Remove the pages overlapping a range of memory from the map.
+     *
+     * @param pvStart_ Start of the range
+     * @param uSize_ Size of the range in bytes
+     */
+    static void Unregister(void* pvStart_, size_t uSize_);
+
+    /**
+     * @brief Lookup
+     *
+     * @param pvData_ Pointer to look up
+     * @return Region owning the page containing the pointer, or nullptr if
+     *         the page is not registered
+     */
+    static PageMapRegion* Lookup(void* pvData_);
+
+private:
+    /**
+     * @brief EntryForPage
+     *
+     * Find a page's entry in the tree, optionally creating any missing
+     * nodes on the path to it (which requires the lock to be held).
+     *
+     * @param uPage_ Page number
+     * @param bCreate_ true to create missing nodes
+     * @return Pointer to the page's entry, or nullptr
+     */
+    static PageMapRegion** EntryForPage(K_ADDR uPage_, bool bCreate_);
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief Free
+ *
+ * Free a block to the allocator owning it, as found in the page map.
+ * Blocks in unregistered pages (and nullptr) are ignored.
+ *
+ * @param pvData_ Block to free
+ */
+void Free(void* pvData_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief UsableSize
+ *
+ * @param pvData_ Block allocated from an allocator registered in the page map
+ * @return Number of bytes usable in the block, or 0 if the block is in an
+ *         unregistered page
+ */
+size_t UsableSize(void* pvData_);
+} // namespace Mark3
@@ -0,0 +1,220 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file sharded_arena.h
+
+    @brief Front end spreading allocations from multiple threads over a set
+           of independent arenas.
+*/
+#pragma once
+
+#include "mark3.h"
+#include "arena.h"
+
+//---------------------------------------------------------------------------
+/**
+    Maximum number of arenas managed by a ShardedArena (at most 32)
+*/
+#ifndef SHARDED_ARENA_MAX_ARENAS
+#define SHARDED_ARENA_MAX_ARENAS (8)
+#endif
+
+// Arenas are tracked in 32-bit masks while allocating
+static_assert(SHARDED_ARENA_MAX_ARENAS <= 32, "SHARDED_ARENA_MAX_ARENAS must be at most 32");
+
+//---------------------------------------------------------------------------
+/**
+    Number of thread assignment slots in a ShardedArena.  Threads are mapped
+    to slots by thread ID - threads whose IDs map to the same slot share an
+    arena assignment.
+*/
+#ifndef SHARDED_ARENA_THREAD_SLOTS
+#define SHARDED_ARENA_THREAD_SLOTS (32)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Number of consecutive allocations a thread finds its arena busy before
+    it is moved to the least-contended arena.
+*/
+#ifndef SHARDED_ARENA_REBALANCE_THRESHOLD
+#define SHARDED_ARENA_REBALANCE_THRESHOLD (4)
+#endif
+
+//---------------------------------------------------------------------------
+#define SHARDED_ARENA_UNASSIGNED (0xFF)
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+/**
+ * @brief The ShardedArena class
+ *
+ * Splits a blob of memory into a number of equal-sized, independent Arena
+ * objects, and spreads the allocations made by different threads across
+ * them, so threads allocating concurrently do not all contend for a single
+ * arena's lock.
+ *
+ * Each thread is assigned an arena on its first allocation - the arena
+ * with the least recorded contention, with ties broken round-robin.
+ * Allocations are first attempted from the thread's arena, then from the
+ * others, without waiting on any arena's lock; contention is recorded for
+ * each busy arena found along the way.  A thread that repeatedly finds its
+ * own arena busy is moved to the least-contended arena.  An arena that is
+ * out of memory is skipped in the same way, so one thread can still use
+ * the whole heap.
+ *
+ * Blocks can be freed from any thread - the owning arena is found from the
+ * block's address.
+ *
+ * The contention statistics and thread assignments are heuristics, and are
+ * updated without locking (individual updates may be lost).  Use an
+ * ArenaLock policy that supports TryLock() contention (i.e. HeapSpinLock)
+ * - with HeapNullLock, threads are simply distributed round-robin.
+ */
+class ShardedArena
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Initialize the sharded arena prior to use, dividing the memory blob
+     * evenly between the arenas.
+     *
+     * @param paclArenas_ Array of u8NumArenas_ (uninitialized) arena objects
+     * @param u8NumArenas_ Number of arenas (up to SHARDED_ARENA_MAX_ARENAS, at most 32).
+     *        With 0 arenas, every allocation fails.
+     * @param pvBuffer_ Pointer to the memory blob to divide between the arenas
+     * @param uSize_ Size of the memory blob in bytes
+     * @param auSizes_ Block size of each arena list (as for Arena::Init())
+     * @param u8NumSizes_ Number of arena lists
+     */
+    void Init(Arena*  paclArenas_,
+              uint8_t u8NumArenas_,
+              void*   pvBuffer_,
+              K_ADDR  uSize_,
+              K_ADDR* auSizes_,
+              uint8_t u8NumSizes_);
+
+    /**
+     * @brief Allocate
+     *
+     * Allocate a block of dynamic memory, preferring the calling thread's
+     * arena.
+     *
+     * @param usize_ Size of object to allocate (in bytes)
+     * @return pointer to a chunk of dynamic memory, or 0 if no arena can
+     *         satisfy the request.
+     */
+    void* Allocate(K_ADDR usize_);
+
+    /**
+     * @brief Free
+     *
+     * Return a block to the arena it was allocated from.  Pointers outside
+     * of the sharded arena are ignored.
+     *
+     * @param pvBlock_ Pointer to the block of memory to free
+     */
+    void Free(void* pvBlock_);
+
+    /**
+     * @brief SetThreadArena
+     *
+     * Pin the calling thread to a specific arena.  The thread may still be
+     * moved if its arena becomes contended.
+     *
+     * @param u8Arena_ Index of the arena
+     */
+    void SetThreadArena(uint8_t u8Arena_);
+
+    /**
+     * @brief GetThreadArena
+     * @return Index of the calling thread's arena, or SHARDED_ARENA_UNASSIGNED
+     *         if it has not allocated yet
+     */
+    uint8_t GetThreadArena(void);
+
+    /**
+     * @brief GetArenaIndex
+     *
+     * @param pvBlock_ Pointer to a block allocated from the sharded arena
+     * @return Index of the arena owning the block, or SHARDED_ARENA_UNASSIGNED
+     *         if the pointer is outside of the sharded arena
+     */
+    uint8_t GetArenaIndex(void* pvBlock_);
+
+    /**
+     * @brief GetArena
+     * @param u8Arena_ Index of an arena
+     * @return Pointer to the arena
+     */
+    Arena* GetArena(uint8_t u8Arena_) { return &m_paclArenas[u8Arena_]; }
+
+    /**
+     * @brief GetNumArenas
+     * @return Number of arenas managed by the sharded arena
+     */
+    uint8_t GetNumArenas(void) { return m_u8NumArenas; }
+
+    /**
+     * @brief GetContention
+     * @param u8Arena_ Index of an arena
+     * @return Recent contention recorded for the arena (decays over time)
+     */
+    uint8_t GetContention(uint8_t u8Arena_) { return Load(&m_au8Contention[u8Arena_]); }
+
+private:
+    /**
+     * @brief ThreadSlot
+     * @return Index of the calling thread's assignment slot
+     */
+    uint8_t ThreadSlot(void);
+
+    /**
+     * @brief LeastContended
+     *
+     * Find the arena with the least recorded contention, starting the
+     * search from the round-robin cursor so ties are spread evenly.
+     *
+     * @return Index of the arena
+     */
+    uint8_t LeastContended(void);
+
+    /**
+     * @brief RecordContention
+     *
+     * Record that an allocation found an arena busy, moving the calling
+     * thread to another arena if its own arena is repeatedly busy.
+     *
+     * @param u8Slot_ Calling thread's assignment slot
+     * @param u8Arena_ Index of the busy arena
+     * @param bOwn_ true if the busy arena is the thread's own arena
+     */
+    void RecordContention(uint8_t u8Slot_, uint8_t u8Arena_, bool bOwn_);
+
+    static uint8_t Load(uint8_t* pu8Value_) { return __atomic_load_n(pu8Value_, __ATOMIC_RELAXED); }
+    static void    Store(uint8_t* pu8Value_, uint8_t u8Value_) { __atomic_store_n(pu8Value_, u8Value_, __ATOMIC_RELAXED); }
+
+    Arena*  m_paclArenas;  //!< Arenas the memory is divided between
+    uint8_t m_u8NumArenas; //!< Number of arenas
+    uint8_t m_u8NextArena; //!< Round-robin cursor used to break ties when assigning arenas
+    K_ADDR  m_adBase;      //!< Start of the first arena's memory
+    K_ADDR  m_uShardSize;  //!< Size of each arena's memory
+
+    uint8_t m_au8Contention[SHARDED_ARENA_MAX_ARENAS];    //!< Saturating count of busy arena encounters
+    uint8_t m_au8ThreadArena[SHARDED_ARENA_THREAD_SLOTS]; //!< Arena assigned to each thread slot
+    uint8_t m_au8BusyStreak[SHARDED_ARENA_THREAD_SLOTS];  //!< Consecutive allocations finding the slot's arena busy
+};
+} // namespace Mark3
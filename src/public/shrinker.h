@@ -0,0 +1,170 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file shrinker.h
+    @brief Registry of allocators holding cached memory that can be reclaimed
+           on demand.
+*/
+#pragma once
+
+#include "mark3.h"
+#include "heap_lock.h"
+
+//---------------------------------------------------------------------------
+/**
+    Locking policy serializing access to the shrinker registry (see
+    heap_lock.h).  Shrinker callbacks are never called with the lock held.
+*/
+#ifndef SHRINKER_LOCK_POLICY
+#define SHRINKER_LOCK_POLICY HEAP_LOCK_POLICY
+#endif
+
+namespace Mark3
+{
+typedef SHRINKER_LOCK_POLICY ShrinkerLock;
+
+//---------------------------------------------------------------------------
+// Shrinker callbacks - report the number of reclaimable bytes, and release
+// (at least) the requested number of bytes, returning the number released.
+typedef K_ADDR (*shrinker_count_function_t)(void* pvContext_);
+typedef K_ADDR (*shrinker_scan_function_t)(void* pvContext_, K_ADDR uBytes_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The Shrinker class
+ *
+ * Object registered by an allocator that caches memory it does not strictly
+ * need (i.e. empty slab pages).  The registry uses the object's callbacks to
+ * query and release that memory when the system is under memory pressure.
+ */
+class Shrinker : public LinkListNode
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Initialize the shrinker prior to registration.
+     *
+     * @param pfCount_ Function returning the number of reclaimable bytes
+     * @param pfScan_ Function releasing cached memory
+     * @param pvContext_ Allocator-specific context passed to the callbacks
+     */
+    void Init(shrinker_count_function_t pfCount_, shrinker_scan_function_t pfScan_, void* pvContext_);
+
+    /**
+     * @brief Count
+     * @return Number of bytes that can currently be reclaimed
+     */
+    K_ADDR Count(void) { return m_pfCount(m_pvContext); }
+
+    /**
+     * @brief Scan
+     *
+     * Release cached memory back to its source.
+     *
+     * @param uBytes_ Number of bytes requested
+     * @return Number of bytes actually released
+     */
+    K_ADDR Scan(K_ADDR uBytes_) { return m_pfScan(m_pvContext, uBytes_); }
+
+    /**
+     * @brief IsRegistered
+     * @return true if the shrinker is currently in the registry
+     */
+    bool IsRegistered(void) { return m_bRegistered; }
+
+private:
+    friend class ShrinkerRegistry;
+
+    shrinker_count_function_t m_pfCount;
+    shrinker_scan_function_t  m_pfScan;
+    void*                     m_pvContext;
+    bool                      m_bRegistered;
+    uint8_t                   m_u8Pins; //!< Number of registry walks currently calling this shrinker
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The ShrinkerRegistry class
+ *
+ * Global list of shrinkers.  ReclaimMemory() walks the registered shrinkers,
+ * asking each to release cached memory until the request is satisfied,
+ * allowing a system to drop caches under memory pressure instead of failing
+ * allocations.
+ *
+ * The registry is synchronized using the ShrinkerLock policy, which is only
+ * held while the list is updated or stepped - never while a shrinker's
+ * callbacks run.  A shrinker unregistered while its callbacks are running
+ * stays listed (but is no longer called) until they return, so its context
+ * must remain valid until then.
+ */
+class ShrinkerRegistry
+{
+public:
+    /**
+     * @brief Register
+     * @param pclShrinker_ Initialized shrinker to add to the registry
+     */
+    static void Register(Shrinker* pclShrinker_);
+
+    /**
+     * @brief Unregister
+     * @param pclShrinker_ Previously-registered shrinker to remove
+     */
+    static void Unregister(Shrinker* pclShrinker_);
+
+    /**
+     * @brief GetReclaimable
+     * @return Total number of bytes all registered shrinkers can release
+     */
+    static K_ADDR GetReclaimable(void);
+
+    /**
+     * @brief ReclaimMemory
+     *
+     * Release cached memory from the registered shrinkers until at least
+     * uBytes_ bytes have been freed, or nothing more can be reclaimed.
+     *
+     * @param uBytes_ Number of bytes to reclaim
+     * @return Number of bytes actually reclaimed
+     */
+    static K_ADDR ReclaimMemory(K_ADDR uBytes_);
+
+private:
+    /**
+     * @brief PinNext
+     *
+     * Find the next registered shrinker, and pin it so that it stays in the
+     * list while its callbacks are called without the registry's lock.
+     *
+     * @param pclShrinker_ Currently-pinned shrinker to unpin and step past,
+     *        or nullptr to start from the head of the list
+     * @return Pinned shrinker, or nullptr at the end of the list
+     */
+    static Shrinker* PinNext(Shrinker* pclShrinker_);
+
+    /**
+     * @brief UnpinLocked
+     *
+     * Release a pin taken by PinNext(), with the registry's lock held.  The
+     * shrinker is removed from the list if it was unregistered while pinned.
+     *
+     * @param pclShrinker_ Pinned shrinker
+     */
+    static void UnpinLocked(Shrinker* pclShrinker_);
+
+    static DoubleLinkList m_clShrinkerList;
+    static ShrinkerLock   m_clLock; //!< Statically initialized - the registry has no Init()
+};
+} // namespace Mark3
@@ -19,8 +19,32 @@ See license.txt for more information
 #pragma once
 
 #include "bitmap_allocator.h"
+#include "shrinker.h"
 #include "mark3.h"
 
+//---------------------------------------------------------------------------
+/**
+    Largest page order (slab size of 2^order base pages) a slab will use
+    when selecting its page order automatically.
+*/
+#define SLAB_MAX_ORDER (4)
+
+//---------------------------------------------------------------------------
+/**
+    Objects of at least (base page size / SLAB_OFFPAGE_DIVISOR) bytes are
+    considered "large", and have their page metadata stored off-page when a
+    descriptor slab is provided.
+*/
+#define SLAB_OFFPAGE_DIVISOR (8)
+
+//---------------------------------------------------------------------------
+/**
+    Locking policy used by Slab objects (see heap_lock.h)
+*/
+#ifndef SLAB_LOCK_POLICY
+#define SLAB_LOCK_POLICY HEAP_LOCK_POLICY
+#endif
+
 namespace Mark3
 {
 //---------------------------------------------------------------------------
@@ -28,6 +52,13 @@ namespace Mark3
 typedef void* (*slab_alloc_page_function_t)(uint32_t* pu32PageSize_);
 typedef void (*slab_free_page_function_t)(void* pvPage_);
 
+//---------------------------------------------------------------------------
+// Multi-page allocation functions - allocate/free 2^order contiguous base pages
+typedef void* (*slab_alloc_pages_function_t)(uint8_t u8Order_, uint32_t* pu32Size_);
+typedef void (*slab_free_pages_function_t)(void* pvPages_, uint8_t u8Order_);
+
+typedef SLAB_LOCK_POLICY SlabLock;
+
 //---------------------------------------------------------------------------
 /**
  * @brief The SlabPage class
@@ -38,6 +69,10 @@ typedef void (*slab_free_page_function_t)(void* pvPage_);
  *
  * Lists of slab pages can be chained together as necessary in order to fulfill
  * the allocation requirements of the system for allocations of a given size.
+ *
+ * Slab pages are not synchronized themselves - they are only accessed with
+ * the owning Slab's lock held.  Their bitmap allocator carries no lock, so
+ * the page metadata is the same size under every locking policy.
  */
 class SlabPage : public LinkListNode
 {
@@ -53,6 +88,26 @@ public:
      */
     void InitPage(uint32_t u32PageSize_, uint32_t u32ObjSize_);
 
+    /**
+     * @brief InitPage
+     *
+     * Initialize this object as an off-page descriptor for a separately
+     * allocated page of memory.  The allocation bitmap is stored in the
+     * descriptor immediately following this object, leaving the whole page
+     * for allocations.
+     *
+     * @param pvPage_ Page of memory managed by this descriptor
+     * @param u32PageSize_ Size of the page (in bytes)
+     * @param u32ObjSize_ Size of individual allocations from this page (in bytes)
+     */
+    void InitPage(void* pvPage_, uint32_t u32PageSize_, uint32_t u32ObjSize_);
+
+    /**
+     * @brief GetPage
+     * @return Pointer to the page of memory managed by this object
+     */
+    void* GetPage(void) { return m_pvPage; }
+
     /**
      * @brief Alloc
      *
@@ -88,7 +143,8 @@ public:
     bool IsFull(void);
 
 private:
-    BitmapAllocator m_clAllocator;
+    BitmapAllocatorCore m_clAllocator;
+    void*               m_pvPage;
 };
 
 //---------------------------------------------------------------------------
@@ -98,8 +154,16 @@ private:
  * This class manages lists of slab pages - blocks of memory, each of which
  * is managed by a bitmap allocator object.  Individual pages are dynamically
  * allocated and freed as required to dynamically adapt to the system.
+ *
+ * The slab is synchronized using the SlabLock policy.  Pages are allocated
+ * from, and released to, the page allocator without holding the lock.
+ *
+ * Threads other than the slab's owner can return objects with FreeRemote(),
+ * which pushes the object onto a lock-free list rather than taking the
+ * slab's lock.  The owner collects the whole list with a single atomic
+ * exchange when it runs out of free objects, or on CollectRemoteFrees().
  */
-class Slab
+class Slab : private SlabLock, public HeapHooks
 {
 public:
     /**
@@ -113,6 +177,34 @@ public:
      */
     void Init(uint32_t u32ObjSize_, slab_alloc_page_function_t pfAlloc_, slab_free_page_function_t pfFree_);
 
+    /**
+     * @brief Init
+     *
+     * Initialize a slab allocator that builds its slabs from 2^order
+     * contiguous base pages.  The smallest order that keeps the memory lost
+     * to metadata and unused space under the specified percentage is
+     * selected automatically, allowing objects close to, or larger than, the
+     * base page size to be allocated efficiently.
+     *
+     * If a descriptor slab is provided, large objects have their page
+     * metadata allocated from it rather than from the start of each page.
+     * The descriptor slab must allocate objects of at least
+     * GetDescriptorSize() bytes.
+     *
+     * @param u32ObjSize_ Size of elements allocated
+     * @param u32BasePageSize_ Size of an order-0 page (in bytes)
+     * @param u8MaxWastePct_ Maximum percentage of each slab not used for objects
+     * @param pfAlloc_ Function to allocate 2^order pages
+     * @param pfFree_ Function to free previously-allocated pages
+     * @param pclDescSlab_ Optional slab used to allocate off-page metadata
+     */
+    void Init(uint32_t                    u32ObjSize_,
+              uint32_t                    u32BasePageSize_,
+              uint8_t                     u8MaxWastePct_,
+              slab_alloc_pages_function_t pfAlloc_,
+              slab_free_pages_function_t  pfFree_,
+              Slab*                       pclDescSlab_ = nullptr);
+
     /**
      * @brief Alloc
      *
@@ -132,30 +224,165 @@ public:
      */
     void Free(void* pvObj_);
 
+    /**
+     * @brief FreeRemote
+     *
+     * Free a previously allocated element from a thread (or interrupt) that
+     * does not own the slab, without taking the slab's lock.  The object is
+     * queued, and returned to its page (and reported to any profiler or
+     * trace) once the owner collects the queue.  Objects smaller than a
+     * pointer can't be queued, and are freed with Free() instead.
+     *
+     * @param pvObj_ Pointer to the object allocated from the slab
+     */
+    void FreeRemote(void* pvObj_);
+
+    /**
+     * @brief CollectRemoteFrees
+     *
+     * Return all objects queued by FreeRemote() to their pages.  This is
+     * done automatically when the slab runs out of free objects, and before
+     * shrinking the slab.
+     */
+    void CollectRemoteFrees(void);
+
     uint32_t GetObjSize() { return m_u32ObjSize; }
 
     uint32_t GetFullPageCount();
 
     uint32_t GetFreePageCount();
 
+    /**
+     * @brief GetEmptyPageCount
+     * @return Number of empty pages held in the slab's page cache
+     */
+    uint32_t GetEmptyPageCount() { return m_u32EmptyCount; }
+
+    /**
+     * @brief SetPageCacheLimit
+     *
+     * Set the number of empty pages the slab keeps cached instead of
+     * returning them to the page allocator, avoiding page alloc/free churn
+     * when usage oscillates around a page boundary.  While caching is
+     * enabled, the slab registers a shrinker, allowing the cached pages to
+     * be reclaimed via ShrinkerRegistry::ReclaimMemory().
+     *
+     * Caching is disabled by default; set the limit back to 0 (releasing
+     * all cached pages) before re-initializing a caching slab.
+     *
+     * @param u32Pages_ Maximum number of empty pages to cache
+     */
+    void SetPageCacheLimit(uint32_t u32Pages_);
+
+    /**
+     * @brief Shrink
+     *
+     * Return cached empty pages to the page allocator.
+     *
+     * @param uBytes_ Number of bytes to release
+     * @return Number of bytes actually released
+     */
+    K_ADDR Shrink(K_ADDR uBytes_);
+
+    /**
+     * @brief GetPageOrder
+     * @return Order of the pages used by this slab (slab size is 2^order base pages)
+     */
+    uint8_t GetPageOrder() { return m_u8Order; }
+
+    /**
+     * @brief IsOffPage
+     * @return true if page metadata is stored off-page, in a descriptor slab
+     */
+    bool IsOffPage() { return m_pclDescSlab != nullptr; }
+
+    /**
+     * @brief GetDescriptorSize
+     * @return Object size required of a descriptor slab used to store
+     *         off-page metadata
+     */
+    static uint32_t GetDescriptorSize(void);
+
 private:
+    /**
+     * @brief SelectOrder
+     *
+     * Find the smallest page order that keeps the waste in each slab below
+     * the requested percentage.  If no order satisfies the requirement, the
+     * order with the least waste is used.
+     *
+     * @param u32BasePageSize_ Size of an order-0 page (in bytes)
+     * @param u8MaxWastePct_ Maximum percentage of each slab not used for objects
+     * @param bOffPage_ true if page metadata is stored off-page
+     * @return Selected page order
+     */
+    uint8_t SelectOrder(uint32_t u32BasePageSize_, uint8_t u8MaxWastePct_, bool bOffPage_);
+
+    /**
+     * @brief AllocLocked
+     *
+     * Allocate an element from the pages already held by the slab (including
+     * cached empty pages), with the slab's lock held.
+     *
+     * @return nullptr if the slab has no free elements, data-pointer otherwise.
+     */
+    void* AllocLocked(void);
+
+    /**
+     * @brief FreeLocked
+     *
+     * Free an element with the slab's lock held.
+     *
+     * @param pvObj_ Pointer to the object allocated from the slab
+     * @param pclRelease_ List to add pages to release once the lock is
+     *        dropped, or nullptr to leave empty pages on the free list
+     * @return true if the object was freed, false if it was already free
+     */
+    bool FreeLocked(void* pvObj_, DoubleLinkList* pclRelease_);
+
+    /**
+     * @brief CollectRemoteFreesLocked
+     *
+     * Take the queue of remotely-freed objects, and free each of them, with
+     * the slab's lock held.
+     *
+     * @param pclRelease_ List to add pages to release once the lock is
+     *        dropped, or nullptr to leave empty pages on the free list
+     */
+    void CollectRemoteFreesLocked(DoubleLinkList* pclRelease_);
+
     /**
      * @brief AllocSlabPage
      *
-     * Allocate a new page to be managed by the slab allocator
+     * Allocate and initialize a new page to be managed by the slab
+     * allocator.  Called without the slab's lock held.
      *
+     * @param pu32PageSize_ [out] Size of the page allocated
      * @return Newly-allocated slab page, or nullptr if out-of-memory
      */
-    SlabPage* AllocSlabPage(void);
+    SlabPage* AllocSlabPage(uint32_t* pu32PageSize_);
 
     /**
      * @brief FreeSlabPage
      *
-     * Free a previously allocated page of slab memory
+     * Remove an empty page from the free list, holding on to it in the page
+     * cache if there is room.  Called with the slab's lock held.
      *
-     * @param pclPage_ Pointer to the page of memory to be freed
+     * @param pclPage_ Pointer to the empty page
+     * @return true if the page was cached, false if it must be released
      */
-    void FreeSlabPage(SlabPage* pclPage_);
+    bool FreeSlabPage(SlabPage* pclPage_);
+
+    /**
+     * @brief TakeEmptyPage
+     *
+     * Remove a page from the page cache, with the slab's lock held.
+     *
+     * @param u32Keep_ Number of pages to leave in the cache
+     * @return Page removed from the cache, or nullptr if the cache holds
+     *         u32Keep_ pages or fewer
+     */
+    SlabPage* TakeEmptyPage(uint32_t u32Keep_);
 
     /**
      * @brief MoveToFull
@@ -177,12 +404,48 @@ private:
      */
     void MoveToFree(SlabPage* pclPage_);
 
+    /**
+     * @brief ReleaseSlabPage
+     *
+     * Return a page of slab memory (and its descriptor) to its source.
+     * Called without the slab's lock held.
+     *
+     * @param pclPage_ Pointer to the page of memory to be released
+     */
+    void ReleaseSlabPage(SlabPage* pclPage_);
+
+    /**
+     * @brief ReleaseSlabPages
+     *
+     * Release every page on a list, as built by FreeLocked().
+     *
+     * @param pclRelease_ List of pages to release
+     */
+    void ReleaseSlabPages(DoubleLinkList* pclRelease_);
+
+    // Shrinker callbacks
+    static K_ADDR ShrinkerCount(void* pvContext_);
+    static K_ADDR ShrinkerScan(void* pvContext_, K_ADDR uBytes_);
+
     uint32_t m_u32ObjSize;
+    uint32_t m_u32PageSize;
+    uint8_t  m_u8Order;
 
     DoubleLinkList m_clFreeList;
     DoubleLinkList m_clFullList;
+    DoubleLinkList m_clEmptyList;
+
+    uint32_t m_u32EmptyCount;
+    uint32_t m_u32CacheLimit;
+    Shrinker m_clShrinker;
+
+    void* volatile m_pvRemoteFree; //!< Objects queued by FreeRemote(), linked through their data
+
+    slab_alloc_page_function_t  m_pfSlabAlloc;
+    slab_free_page_function_t   m_pfSlabFree;
+    slab_alloc_pages_function_t m_pfPagesAlloc;
+    slab_free_pages_function_t  m_pfPagesFree;
 
-    slab_alloc_page_function_t m_pfSlabAlloc;
-    slab_free_page_function_t  m_pfSlabFree;
+    Slab* m_pclDescSlab;
 };
 } // namespace Mark3
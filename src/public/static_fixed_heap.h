@@ -0,0 +1,186 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file static_fixed_heap.h
+
+    @brief Fixed-block-size heap configured at compile time.
+
+    Example:
+
+        StaticFixedHeap<Bin<16, 8>, Bin<32, 4>, Bin<128, 2>> clHeap;
+
+        clHeap.Create();
+        auto* pvSmall = clHeap.Allocate<12>();  // Direct from the 16-byte bin
+        auto* pvAny   = clHeap.Allocate(u32Size);
+ */
+#pragma once
+
+#include "kerneltypes.h"
+#include "fixed_heap.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+/**
+ *  Compile-time description of a single bin in a StaticFixedHeap
+ *
+ *  @tparam Size Size of each block in the bin (in bytes)
+ *  @tparam Count Number of blocks in the bin
+ */
+template <size_t Size, size_t Count>
+struct Bin {
+    static_assert(Size != 0, "Bin block size must be non-zero");
+    static_assert(Count != 0, "Bin block count must be non-zero");
+
+    static constexpr size_t uBlockSize  = Size;
+    static constexpr size_t uBlockCount = Count;
+};
+
+//---------------------------------------------------------------------------
+// Total heap memory required to back a list of bins
+template <typename... Bins>
+struct StaticHeapSize {
+    static constexpr size_t value = 0;
+};
+
+template <typename First, typename... Rest>
+struct StaticHeapSize<First, Rest...> {
+    static constexpr size_t value
+        = (BlockHeap::GetBlockStride(First::uBlockSize) * First::uBlockCount) + StaticHeapSize<Rest...>::value;
+};
+
+//---------------------------------------------------------------------------
+// Whether or not a list of bins is sorted by strictly-increasing block size
+template <typename... Bins>
+struct StaticHeapSorted {
+    static constexpr bool value = true;
+};
+
+template <typename First, typename Second, typename... Rest>
+struct StaticHeapSorted<First, Second, Rest...> {
+    static constexpr bool value
+        = (First::uBlockSize < Second::uBlockSize) && StaticHeapSorted<Second, Rest...>::value;
+};
+
+//---------------------------------------------------------------------------
+// Index of the first bin (starting from Index) large enough for Size bytes
+template <size_t Size, uint8_t Index, typename... Bins>
+struct StaticHeapBinFor {
+    static constexpr uint8_t value = FIXED_HEAP_NO_BIN;
+};
+
+template <size_t Size, uint8_t Index, typename First, typename... Rest>
+struct StaticHeapBinFor<Size, Index, First, Rest...> {
+    static constexpr uint8_t value
+        = (Size <= First::uBlockSize) ? Index : StaticHeapBinFor<Size, Index + 1, Rest...>::value;
+};
+
+//---------------------------------------------------------------------------
+/**
+ *  Fixed-size-block heap allocator, with its bins and backing storage
+ *  defined at compile time.
+ *
+ *  The storage for the heap is computed exactly from the bin sizes/counts,
+ *  and the bin to use for allocations of a constant size is resolved at
+ *  compile time, leaving only the pop from that bin at runtime.
+ *
+ *  @tparam Bins List of Bin<Size, Count> types, from smallest to largest
+ */
+template <typename... Bins>
+class StaticFixedHeap
+{
+public:
+    static_assert(sizeof...(Bins) != 0, "At least one bin must be specified");
+    static_assert(sizeof...(Bins) <= FIXED_HEAP_MAX_BINS, "Too many bins");
+    static_assert(StaticHeapSorted<Bins...>::value, "Bins must be sorted by increasing block size");
+
+    /**
+     *  @brief Create
+     *
+     *  Initialize the heap prior to use.
+     */
+    void Create()
+    {
+        for (size_t i = 0; i < sizeof...(Bins); i++) {
+            m_aclConfig[i].m_uBlockSize  = s_auBlockSizes[i];
+            m_aclConfig[i].m_uBlockCount = s_auBlockCounts[i];
+        }
+        m_aclConfig[sizeof...(Bins)].m_uBlockSize = 0;
+        m_clHeap.Create(m_awStorage, m_aclConfig);
+    }
+
+    /**
+     *  @brief Allocate
+     *
+     *  Allocate a block of a size known at compile time.  The bin is
+     *  selected at compile time, and larger bins are only searched if it is
+     *  exhausted.
+     *
+     *  @tparam Size Size (in bytes) to allocate from the heap
+     *  @return Pointer to a block of data allocated, or 0 on error.
+     */
+    template <size_t Size>
+    void* Allocate()
+    {
+        static_assert(StaticHeapBinFor<Size, 0, Bins...>::value != FIXED_HEAP_NO_BIN,
+                      "Allocation is larger than the largest bin");
+        return m_clHeap.AllocateFromBin(StaticHeapBinFor<Size, 0, Bins...>::value);
+    }
+
+    /**
+     *  @brief Allocate
+     *
+     *  Allocate a block of a size only known at runtime.
+     *
+     *  @param uSize_ Size (in bytes) to allocate from the heap
+     *  @return Pointer to a block of data allocated, or 0 on error.
+     */
+    void* Allocate(size_t uSize_) { return m_clHeap.Allocate(uSize_); }
+
+    /**
+     *  @brief Free
+     *
+     *  Free a block previously allocated from this heap.
+     *
+     *  @param pvNode_ Pointer to the previously-allocated block of memory
+     */
+    void Free(void* pvNode_) { m_clHeap.Free(pvNode_); }
+
+    /**
+     *  @brief GetStorageSize
+     *  @return Size (in bytes) of the memory backing the heap's blocks
+     */
+    static constexpr size_t GetStorageSize() { return StaticHeapSize<Bins...>::value; }
+
+    /**
+     *  @brief GetBinCount
+     *  @return Number of bins in the heap
+     */
+    static constexpr size_t GetBinCount() { return sizeof...(Bins); }
+
+private:
+    static constexpr size_t s_auBlockSizes[]  = { Bins::uBlockSize... };
+    static constexpr size_t s_auBlockCounts[] = { Bins::uBlockCount... };
+
+    HeapConfig m_aclConfig[sizeof...(Bins) + 1];
+    FixedHeap  m_clHeap;
+    K_WORD     m_awStorage[(StaticHeapSize<Bins...>::value + sizeof(K_WORD) - 1) / sizeof(K_WORD)];
+};
+
+template <typename... Bins>
+constexpr size_t StaticFixedHeap<Bins...>::s_auBlockSizes[];
+
+template <typename... Bins>
+constexpr size_t StaticFixedHeap<Bins...>::s_auBlockCounts[];
+} // namespace Mark3
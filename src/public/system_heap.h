@@ -0,0 +1,128 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file system_heap.h
+
+    @brief General-purpose system heap, built from a fixed-block heap for
+           small allocations and an arena for everything else.
+*/
+#pragma once
+
+#include "kerneltypes.h"
+#include "system_heap_config.h"
+
+#include <stddef.h>
+
+#if USE_SYSTEM_HEAP
+
+//---------------------------------------------------------------------------
+/**
+    Alignment of every block returned by the system heap - the alignment
+    malloc() must provide (that of max_align_t), or the default alignment of
+    operator new, whichever is larger.
+*/
+#if defined(__STDCPP_DEFAULT_NEW_ALIGNMENT__)
+#define SYSTEM_HEAP_DEFAULT_ALIGN ((alignof(max_align_t) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) ? alignof(max_align_t) : __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+#else
+#define SYSTEM_HEAP_DEFAULT_ALIGN (alignof(max_align_t))
+#endif
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+/**
+ * @brief The SystemHeap class
+ *
+ * Global malloc/free-style heap.  Allocations that fit in one of the block
+ * sizes defined in system_heap_config.h are served from a FixedHeap, with
+ * larger (or over-aligned) allocations served from an Arena.  All memory is
+ * statically allocated, sized by the values in system_heap_config.h.  Every
+ * block is aligned to at least SYSTEM_HEAP_DEFAULT_ALIGN bytes.
+ *
+ * The heap is initialized automatically on first use, and all operations
+ * are performed within a critical section, so the heap can be shared
+ * between threads.
+ *
+ * When enabled in system_heap_config.h, the standard C allocation functions
+ * and the global C++ operator new/delete are routed to this heap.
+ */
+class SystemHeap
+{
+public:
+    /**
+     * @brief Init
+     *
+     * Initialize the system heap.  Called automatically on first use, but
+     * may be called explicitly during startup for deterministic timing.
+     */
+    static void Init(void);
+
+    /**
+     * @brief Allocate
+     *
+     * @param uSize_ Size of the object to allocate (in bytes)
+     * @return Pointer to the allocated memory (aligned to
+     *         SYSTEM_HEAP_DEFAULT_ALIGN), or nullptr on exhaustion
+     */
+    static void* Allocate(size_t uSize_);
+
+    /**
+     * @brief AllocateAligned
+     *
+     * @param uAlign_ Required alignment of the allocation - a power of two
+     * @param uSize_ Size of the object to allocate (in bytes)
+     * @return Pointer to the allocated memory, or nullptr on exhaustion or
+     *         an invalid alignment
+     */
+    static void* AllocateAligned(size_t uAlign_, size_t uSize_);
+
+    /**
+     * @brief Reallocate
+     *
+     * Resize an allocation, moving its contents if necessary.
+     *
+     * @param pvData_ Previously-allocated object, or nullptr to allocate
+     * @param uSize_ New size of the object (in bytes)
+     * @return Pointer to the resized object, or nullptr on exhaustion (in
+     *         which case the original object is left untouched)
+     */
+    static void* Reallocate(void* pvData_, size_t uSize_);
+
+    /**
+     * @brief Free
+     *
+     * @param pvData_ Previously-allocated object to free, or nullptr
+     */
+    static void Free(void* pvData_);
+
+    /**
+     * @brief GetUsableSize
+     *
+     * @param pvData_ Previously-allocated object
+     * @return Number of bytes usable in the object, which may be larger
+     *         than the size originally requested
+     */
+    static size_t GetUsableSize(void* pvData_);
+
+private:
+    static bool IsFixedBlock(void* pvData_);
+    static void* AllocateLocked(size_t uSize_);
+    static void FreeLocked(void* pvData_);
+    static size_t GetUsableSizeLocked(void* pvData_);
+
+    static bool m_bInitialized;
+};
+} // namespace Mark3
+
+#endif // USE_SYSTEM_HEAP
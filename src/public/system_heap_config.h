@@ -66,3 +66,47 @@ See license.txt for more information
 #define HEAP_BLOCK_COUNT_8 ((uint16_t)1)
 #define HEAP_BLOCK_COUNT_9 ((uint16_t)1)
 #define HEAP_BLOCK_COUNT_10 ((uint16_t)1)
+
+//---------------------------------------------------------------------------
+/**
+    Size (in bytes) of the arena used to fulfill system heap allocations
+    larger than the largest fixed block size, or with alignment requirements
+    greater than SYSTEM_HEAP_DEFAULT_ALIGN (see system_heap.h).
+*/
+#ifndef SYSTEM_HEAP_ARENA_SIZE
+#define SYSTEM_HEAP_ARENA_SIZE (4096)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Define the size-lists used by the system heap's arena - the smallest
+    list holds blocks of at least SYSTEM_HEAP_ARENA_MIN_SIZE bytes, with
+    each subsequent list doubling in size.
+*/
+#ifndef SYSTEM_HEAP_ARENA_MIN_SIZE
+#define SYSTEM_HEAP_ARENA_MIN_SIZE (32)
+#endif
+
+#ifndef SYSTEM_HEAP_ARENA_NUM_SIZES
+#define SYSTEM_HEAP_ARENA_NUM_SIZES (6)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Set this to "1" to have the system heap provide the standard C library
+    allocation functions (malloc, free, calloc, realloc, posix_memalign,
+    aligned_alloc and malloc_usable_size), replacing the toolchain's own.
+*/
+#ifndef SYSTEM_HEAP_REPLACE_MALLOC
+#define SYSTEM_HEAP_REPLACE_MALLOC (0)
+#endif
+
+//---------------------------------------------------------------------------
+/**
+    Set this to "1" to have the system heap provide the global C++ operator
+    new/delete functions.  As exceptions are not supported, operator new
+    traps if the system heap is exhausted.
+*/
+#ifndef SYSTEM_HEAP_REPLACE_NEW
+#define SYSTEM_HEAP_REPLACE_NEW (0)
+#endif
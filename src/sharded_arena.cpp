@@ -0,0 +1,206 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+
+    @file   sharded_arena.cpp
+
+    @brief  Front end spreading allocations from multiple threads over a set
+            of independent arenas.
+*/
+
+#include <stdint.h>
+#include "mark3.h"
+#include "sharded_arena.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+void ShardedArena::Init(Arena*  paclArenas_,
+                        uint8_t u8NumArenas_,
+                        void*   pvBuffer_,
+                        K_ADDR  uSize_,
+                        K_ADDR* auSizes_,
+                        uint8_t u8NumSizes_)
+{
+    if (u8NumArenas_ > SHARDED_ARENA_MAX_ARENAS) {
+        u8NumArenas_ = SHARDED_ARENA_MAX_ARENAS;
+    }
+
+    m_paclArenas  = paclArenas_;
+    m_u8NumArenas = u8NumArenas_;
+    m_u8NextArena = 0;
+    m_adBase      = reinterpret_cast<K_ADDR>(pvBuffer_);
+
+    // Each arena gets an equal, word-aligned share of the buffer, so the
+    // owner of a block can be computed from its address.  Without any
+    // arenas there is nothing to share the buffer between, and every
+    // allocation fails.
+    m_uShardSize = 0;
+    if (u8NumArenas_ != 0) {
+        m_uShardSize = (uSize_ / u8NumArenas_) & ~(sizeof(K_WORD) - 1);
+    }
+
+    for (uint8_t i = 0; i < m_u8NumArenas; i++) {
+        auto* pvShard = reinterpret_cast<void*>(m_adBase + (i * m_uShardSize));
+        m_paclArenas[i].Init(pvShard, m_uShardSize, auSizes_, u8NumSizes_);
+        m_au8Contention[i] = 0;
+    }
+
+    for (uint8_t i = 0; i < SHARDED_ARENA_THREAD_SLOTS; i++) {
+        m_au8ThreadArena[i] = SHARDED_ARENA_UNASSIGNED;
+        m_au8BusyStreak[i]  = 0;
+    }
+}
+
+//---------------------------------------------------------------------------
+void* ShardedArena::Allocate(K_ADDR usize_)
+{
+    if (m_u8NumArenas == 0) {
+        return nullptr;
+    }
+
+    auto u8Slot  = ThreadSlot();
+    auto u8Arena = Load(&m_au8ThreadArena[u8Slot]);
+    if (u8Arena == SHARDED_ARENA_UNASSIGNED) {
+        u8Arena = LeastContended();
+        Store(&m_au8ThreadArena[u8Slot], u8Arena);
+    }
+
+    // Try each arena in turn - starting with the thread's own - without
+    // waiting on any of their locks.
+    uint32_t u32Busy = 0;
+    for (uint8_t i = 0; i < m_u8NumArenas; i++) {
+        auto  u8Index = static_cast<uint8_t>((u8Arena + i) % m_u8NumArenas);
+        auto  bBusy   = false;
+        auto* pvData  = m_paclArenas[u8Index].TryAllocate(usize_, &bBusy);
+        if (bBusy) {
+            RecordContention(u8Slot, u8Index, (i == 0));
+            u32Busy |= (1UL << u8Index);
+        } else if (pvData != nullptr) {
+            if (i == 0) {
+                Store(&m_au8BusyStreak[u8Slot], 0);
+            }
+            return pvData;
+        }
+    }
+
+    // Every arena was either busy or exhausted - wait on the busy ones.
+    for (uint8_t i = 0; i < m_u8NumArenas; i++) {
+        auto u8Index = static_cast<uint8_t>((u8Arena + i) % m_u8NumArenas);
+        if ((u32Busy & (1UL << u8Index)) != 0) {
+            auto* pvData = m_paclArenas[u8Index].Allocate(usize_);
+            if (pvData != nullptr) {
+                return pvData;
+            }
+        }
+    }
+    return nullptr;
+}
+
+//---------------------------------------------------------------------------
+void ShardedArena::Free(void* pvBlock_)
+{
+    auto u8Arena = GetArenaIndex(pvBlock_);
+    if (u8Arena == SHARDED_ARENA_UNASSIGNED) {
+        return;
+    }
+    m_paclArenas[u8Arena].Free(pvBlock_);
+}
+
+//---------------------------------------------------------------------------
+void ShardedArena::SetThreadArena(uint8_t u8Arena_)
+{
+    if (u8Arena_ >= m_u8NumArenas) {
+        return;
+    }
+    auto u8Slot = ThreadSlot();
+    Store(&m_au8ThreadArena[u8Slot], u8Arena_);
+    Store(&m_au8BusyStreak[u8Slot], 0);
+}
+
+//---------------------------------------------------------------------------
+uint8_t ShardedArena::GetThreadArena(void)
+{
+    return Load(&m_au8ThreadArena[ThreadSlot()]);
+}
+
+//---------------------------------------------------------------------------
+uint8_t ShardedArena::GetArenaIndex(void* pvBlock_)
+{
+    auto adBlock = reinterpret_cast<K_ADDR>(pvBlock_);
+    if ((adBlock < m_adBase) || (m_uShardSize == 0)) {
+        return SHARDED_ARENA_UNASSIGNED;
+    }
+    auto uIndex = (adBlock - m_adBase) / m_uShardSize;
+    if (uIndex >= m_u8NumArenas) {
+        return SHARDED_ARENA_UNASSIGNED;
+    }
+    return static_cast<uint8_t>(uIndex);
+}
+
+//---------------------------------------------------------------------------
+uint8_t ShardedArena::ThreadSlot(void)
+{
+    auto* pclThread = Scheduler::GetCurrentThread();
+    if (pclThread == nullptr) {
+        return 0;
+    }
+    return static_cast<uint8_t>(pclThread->GetID() % SHARDED_ARENA_THREAD_SLOTS);
+}
+
+//---------------------------------------------------------------------------
+uint8_t ShardedArena::LeastContended(void)
+{
+    auto u8Start = Load(&m_u8NextArena);
+    Store(&m_u8NextArena, static_cast<uint8_t>((u8Start + 1) % m_u8NumArenas));
+
+    auto u8Best      = u8Start;
+    auto u8BestCount = Load(&m_au8Contention[u8Start]);
+    for (uint8_t i = 1; i < m_u8NumArenas; i++) {
+        auto u8Index = static_cast<uint8_t>((u8Start + i) % m_u8NumArenas);
+        auto u8Count = Load(&m_au8Contention[u8Index]);
+        if (u8Count < u8BestCount) {
+            u8Best      = u8Index;
+            u8BestCount = u8Count;
+        }
+    }
+    return u8Best;
+}
+
+//---------------------------------------------------------------------------
+void ShardedArena::RecordContention(uint8_t u8Slot_, uint8_t u8Arena_, bool bOwn_)
+{
+    auto u8Count = Load(&m_au8Contention[u8Arena_]);
+    if (u8Count < 0xFF) {
+        Store(&m_au8Contention[u8Arena_], static_cast<uint8_t>(u8Count + 1));
+    }
+    if (!bOwn_) {
+        return;
+    }
+
+    auto u8Streak = static_cast<uint8_t>(Load(&m_au8BusyStreak[u8Slot_]) + 1);
+    if (u8Streak < SHARDED_ARENA_REBALANCE_THRESHOLD) {
+        Store(&m_au8BusyStreak[u8Slot_], u8Streak);
+        return;
+    }
+
+    // The thread's arena is persistently contended - move it to the quietest
+    // arena, and age the statistics so old contention doesn't pin decisions.
+    Store(&m_au8BusyStreak[u8Slot_], 0);
+    Store(&m_au8ThreadArena[u8Slot_], LeastContended());
+    for (uint8_t i = 0; i < m_u8NumArenas; i++) {
+        Store(&m_au8Contention[i], static_cast<uint8_t>(Load(&m_au8Contention[i]) >> 1));
+    }
+}
+} // namespace Mark3
@@ -0,0 +1,134 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file shrinker.cpp
+    @brief Registry of allocators holding cached memory that can be reclaimed
+           on demand.
+*/
+
+#include "shrinker.h"
+
+namespace Mark3
+{
+DoubleLinkList ShrinkerRegistry::m_clShrinkerList;
+ShrinkerLock   ShrinkerRegistry::m_clLock;
+
+//---------------------------------------------------------------------------
+void Shrinker::Init(shrinker_count_function_t pfCount_, shrinker_scan_function_t pfScan_, void* pvContext_)
+{
+    LinkListNode::ClearNode();
+    m_pfCount     = pfCount_;
+    m_pfScan      = pfScan_;
+    m_pvContext   = pvContext_;
+    m_bRegistered = false;
+    m_u8Pins      = 0;
+}
+
+//---------------------------------------------------------------------------
+void ShrinkerRegistry::Register(Shrinker* pclShrinker_)
+{
+    HeapLockGuard<ShrinkerLock> clGuard(&m_clLock);
+    if (pclShrinker_->m_bRegistered) {
+        return;
+    }
+    // A pinned shrinker is still listed, even if it was unregistered
+    if (!pclShrinker_->m_u8Pins) {
+        m_clShrinkerList.Add(pclShrinker_);
+    }
+    pclShrinker_->m_bRegistered = true;
+}
+
+//---------------------------------------------------------------------------
+void ShrinkerRegistry::Unregister(Shrinker* pclShrinker_)
+{
+    HeapLockGuard<ShrinkerLock> clGuard(&m_clLock);
+    if (!pclShrinker_->m_bRegistered) {
+        return;
+    }
+    // A pinned shrinker is removed once the last pin is released
+    if (!pclShrinker_->m_u8Pins) {
+        m_clShrinkerList.Remove(pclShrinker_);
+    }
+    pclShrinker_->m_bRegistered = false;
+}
+
+//---------------------------------------------------------------------------
+K_ADDR ShrinkerRegistry::GetReclaimable(void)
+{
+    K_ADDR uTotal      = 0;
+    auto*  pclShrinker = PinNext(nullptr);
+    while (pclShrinker) {
+        uTotal += pclShrinker->Count();
+        pclShrinker = PinNext(pclShrinker);
+    }
+    return uTotal;
+}
+
+//---------------------------------------------------------------------------
+K_ADDR ShrinkerRegistry::ReclaimMemory(K_ADDR uBytes_)
+{
+    K_ADDR uFreed = 0;
+    if (!uBytes_) {
+        return uFreed;
+    }
+
+    auto* pclShrinker = PinNext(nullptr);
+    while (pclShrinker) {
+        // Skip over shrinkers with nothing cached
+        if (pclShrinker->Count()) {
+            uFreed += pclShrinker->Scan(uBytes_ - uFreed);
+        }
+        if (uFreed >= uBytes_) {
+            HeapLockGuard<ShrinkerLock> clGuard(&m_clLock);
+            UnpinLocked(pclShrinker);
+            break;
+        }
+        pclShrinker = PinNext(pclShrinker);
+    }
+    return uFreed;
+}
+
+//---------------------------------------------------------------------------
+Shrinker* ShrinkerRegistry::PinNext(Shrinker* pclShrinker_)
+{
+    HeapLockGuard<ShrinkerLock> clGuard(&m_clLock);
+
+    // Pinned shrinkers stay listed, so the link to the next is still valid
+    Shrinker* pclNext;
+    if (pclShrinker_) {
+        pclNext = static_cast<Shrinker*>(pclShrinker_->GetNext());
+        UnpinLocked(pclShrinker_);
+    } else {
+        pclNext = static_cast<Shrinker*>(m_clShrinkerList.GetHead());
+    }
+
+    // Step over shrinkers waiting to be removed
+    while (pclNext && !pclNext->m_bRegistered) {
+        pclNext = static_cast<Shrinker*>(pclNext->GetNext());
+    }
+    if (pclNext) {
+        pclNext->m_u8Pins++;
+    }
+    return pclNext;
+}
+
+//---------------------------------------------------------------------------
+void ShrinkerRegistry::UnpinLocked(Shrinker* pclShrinker_)
+{
+    pclShrinker_->m_u8Pins--;
+    if (!pclShrinker_->m_u8Pins && !pclShrinker_->m_bRegistered) {
+        m_clShrinkerList.Remove(pclShrinker_);
+    }
+}
+} // namespace Mark3
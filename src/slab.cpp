@@ -19,16 +19,70 @@ See license.txt for more information
 #include "slab.h"
 #include "mark3.h"
 
+#if (defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_4) && (__SIZEOF_POINTER__ == 4))                                        \
+    || (defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_8) && (__SIZEOF_POINTER__ == 8))
+#define SLAB_NATIVE_CAS (1)
+#else
+#define SLAB_NATIVE_CAS (0)
+#endif
+
 namespace Mark3
 {
+namespace
+{
+//---------------------------------------------------------------------------
+// Push an object onto a remote-free queue.  The queue is only ever emptied
+// as a whole, so a simple compare-and-swap loop is free of ABA problems.
+inline void PushRemoteFree(void* volatile* ppvHead_, void* pvObj_)
+{
+#if SLAB_NATIVE_CAS
+    auto* pvHead = __atomic_load_n(ppvHead_, __ATOMIC_RELAXED);
+    do {
+        *static_cast<void**>(pvObj_) = pvHead;
+    } while (!__atomic_compare_exchange_n(ppvHead_, &pvHead, pvObj_, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+#else
+    CriticalGuard clGuard;
+    *static_cast<void**>(pvObj_) = *ppvHead_;
+    *ppvHead_                    = pvObj_;
+#endif
+}
+
+//---------------------------------------------------------------------------
+// Take every object from a remote-free queue, leaving it empty
+inline void* TakeRemoteFrees(void* volatile* ppvHead_)
+{
+#if SLAB_NATIVE_CAS
+    if (__atomic_load_n(ppvHead_, __ATOMIC_RELAXED) == nullptr) {
+        return nullptr;
+    }
+    return __atomic_exchange_n(ppvHead_, nullptr, __ATOMIC_ACQUIRE);
+#else
+    CriticalGuard clGuard;
+    auto*         pvHead = *ppvHead_;
+    *ppvHead_            = nullptr;
+    return pvHead;
+#endif
+}
+} // anonymous namespace
+
 //---------------------------------------------------------------------------
 void SlabPage::InitPage(uint32_t u32PageSize_, uint32_t u32ObjSize_)
 {
     LinkListNode::ClearNode();
+    m_pvPage      = this;
     auto* pvBlock = reinterpret_cast<void*>((K_ADDR)this + sizeof(SlabPage));
     m_clAllocator.Init(pvBlock, u32PageSize_ - sizeof(SlabPage), u32ObjSize_);
 }
 
+//---------------------------------------------------------------------------
+void SlabPage::InitPage(void* pvPage_, uint32_t u32PageSize_, uint32_t u32ObjSize_)
+{
+    LinkListNode::ClearNode();
+    m_pvPage      = pvPage_;
+    auto* pu32Map = reinterpret_cast<uint32_t*>((K_ADDR)this + sizeof(SlabPage));
+    m_clAllocator.Init(pvPage_, u32PageSize_, u32ObjSize_, pu32Map);
+}
+
 //---------------------------------------------------------------------------
 void* SlabPage::Alloc(void* pvTag_)
 {
@@ -56,23 +110,148 @@ bool SlabPage::IsFull(void)
 //---------------------------------------------------------------------------
 void Slab::Init(uint32_t u32ObjSize_, slab_alloc_page_function_t pfAlloc_, slab_free_page_function_t pfFree_)
 {
-    m_pfSlabAlloc = pfAlloc_;
-    m_pfSlabFree  = pfFree_;
-    m_u32ObjSize  = u32ObjSize_;
+    m_pfSlabAlloc  = pfAlloc_;
+    m_pfSlabFree   = pfFree_;
+    m_pfPagesAlloc = nullptr;
+    m_pfPagesFree  = nullptr;
+    m_pclDescSlab  = nullptr;
+    m_u32ObjSize   = u32ObjSize_;
+    m_u32PageSize  = 0;
+    m_u8Order      = 0;
+    InitHooks();
     m_clFreeList.Init();
     m_clFullList.Init();
+    m_clEmptyList.Init();
+
+    m_u32EmptyCount = 0;
+    m_u32CacheLimit = 0;
+    m_pvRemoteFree  = nullptr;
+    m_clShrinker.Init(ShrinkerCount, ShrinkerScan, this);
+    SlabLock::Init();
+}
+
+//---------------------------------------------------------------------------
+void Slab::Init(uint32_t                    u32ObjSize_,
+                uint32_t                    u32BasePageSize_,
+                uint8_t                     u8MaxWastePct_,
+                slab_alloc_pages_function_t pfAlloc_,
+                slab_free_pages_function_t  pfFree_,
+                Slab*                       pclDescSlab_)
+{
+    Init(u32ObjSize_, nullptr, nullptr);
+    m_pfPagesAlloc = pfAlloc_;
+    m_pfPagesFree  = pfFree_;
+
+    // Only large objects benefit from moving the metadata off-page
+    if ((pclDescSlab_ != nullptr) && (u32ObjSize_ >= (u32BasePageSize_ / SLAB_OFFPAGE_DIVISOR))
+        && (pclDescSlab_->GetObjSize() >= GetDescriptorSize())) {
+        m_pclDescSlab = pclDescSlab_;
+    }
+
+    m_u8Order = SelectOrder(u32BasePageSize_, u8MaxWastePct_, m_pclDescSlab != nullptr);
+}
+
+//---------------------------------------------------------------------------
+uint8_t Slab::SelectOrder(uint32_t u32BasePageSize_, uint8_t u8MaxWastePct_, bool bOffPage_)
+{
+    uint8_t  u8BestOrder  = SLAB_MAX_ORDER;
+    uint32_t u32BestWaste = 0;
+    uint32_t u32BestSize  = 0;
+
+    for (uint8_t u8Order = 0; u8Order <= SLAB_MAX_ORDER; u8Order++) {
+        auto u32SlabSize  = u32BasePageSize_ << u8Order;
+        if (!bOffPage_ && (u32SlabSize <= sizeof(SlabPage))) {
+            // Too small to even hold the on-page metadata
+            continue;
+        }
+        auto u32BlockSize = bOffPage_ ? u32SlabSize : (u32SlabSize - sizeof(SlabPage));
+        auto u32NumObjs   = BitmapAllocatorCore::GetCapacity(u32BlockSize, m_u32ObjSize, !bOffPage_);
+        if (!u32NumObjs) {
+            continue;
+        }
+
+        // Anything in the slab that isn't user data (metadata, slack) is waste
+        auto u32Waste = u32SlabSize - (u32NumObjs * m_u32ObjSize);
+        if ((u32Waste * 100) <= (u32SlabSize * u8MaxWastePct_)) {
+            return u8Order;
+        }
+
+        // Track the least-wasteful order in case none meet the requirement
+        // (compare waste ratios using cross-multiplication)
+        if (!u32BestSize || ((uint64_t)u32Waste * u32BestSize < (uint64_t)u32BestWaste * u32SlabSize)) {
+            u8BestOrder  = u8Order;
+            u32BestWaste = u32Waste;
+            u32BestSize  = u32SlabSize;
+        }
+
+        // Larger slabs can't track any more objects - they only add waste
+        if (u32NumObjs == BITMAP_ALLOCATOR_MAX_ELEMENTS) {
+            break;
+        }
+    }
+    return u8BestOrder;
+}
+
+//---------------------------------------------------------------------------
+uint32_t Slab::GetDescriptorSize(void)
+{
+    // Off-page slabs hold at most (SLAB_OFFPAGE_DIVISOR << SLAB_MAX_ORDER)
+    // objects, and never more than a bitmap can track
+    uint32_t u32MaxObjs = (SLAB_OFFPAGE_DIVISOR << SLAB_MAX_ORDER);
+    if (u32MaxObjs > BITMAP_ALLOCATOR_MAX_ELEMENTS) {
+        u32MaxObjs = BITMAP_ALLOCATOR_MAX_ELEMENTS;
+    }
+    return sizeof(SlabPage) + BitmapAllocatorCore::GetMapSize(u32MaxObjs);
 }
 
 //---------------------------------------------------------------------------
 void* Slab::Alloc(void)
+{
+    void* pvRC;
+    {
+        HeapLockGuard<SlabLock> clGuard(this);
+        pvRC = AllocLocked();
+
+        // Reclaim objects freed by other threads before asking for a new
+        // page - keeping any pages they empty, as one is needed anyway
+        if (!pvRC) {
+            CollectRemoteFreesLocked(nullptr);
+            pvRC = AllocLocked();
+        }
+    }
+
+    // Out of pages - request a new one without holding the lock
+    if (!pvRC) {
+        uint32_t u32PageSize;
+        auto*    pclPage = AllocSlabPage(&u32PageSize);
+        if (pclPage) {
+            HeapLockGuard<SlabLock> clGuard(this);
+            m_u32PageSize = u32PageSize;
+            m_clFreeList.Add(pclPage);
+            pvRC = AllocLocked();
+        }
+    }
+    if (HasHooks()) {
+        HeapLockGuard<SlabLock> clGuard(this);
+        HookAllocate(m_u32ObjSize, pvRC);
+    }
+    return pvRC;
+}
+
+//---------------------------------------------------------------------------
+void* Slab::AllocLocked(void)
 {
     // Allocate from free page list
     auto* pclCurr = reinterpret_cast<SlabPage*>(m_clFreeList.GetHead());
     if (!pclCurr) {
-        pclCurr = AllocSlabPage();
+        // Reuse a cached empty page before requesting a new one
+        pclCurr = reinterpret_cast<SlabPage*>(m_clEmptyList.GetHead());
         if (!pclCurr) {
             return nullptr;
         }
+        m_clEmptyList.Remove(pclCurr);
+        m_u32EmptyCount--;
+        m_clFreeList.Add(pclCurr);
     }
     void* pvRC = pclCurr->Alloc(pclCurr);
     if (pclCurr->IsFull()) {
@@ -88,10 +267,25 @@ void Slab::Free(void* pvObj_)
         return;
     }
 
+    DoubleLinkList clRelease;
+    clRelease.Init();
+    {
+        HeapLockGuard<SlabLock> clGuard(this);
+        if (!FreeLocked(pvObj_, &clRelease)) {
+            return;
+        }
+        HookFree(pvObj_);
+    }
+    ReleaseSlabPages(&clRelease);
+}
+
+//---------------------------------------------------------------------------
+bool Slab::FreeLocked(void* pvObj_, DoubleLinkList* pclRelease_)
+{
     // Get page from object data
     auto* pstObj_ = reinterpret_cast<bitmap_alloc_t*>((K_ADDR)pvObj_ - (sizeof(bitmap_alloc_t) - sizeof(K_WORD)));
     if (pstObj_->pvTag == nullptr) {
-        return;
+        return false;
     }
 
     auto* pclPage = reinterpret_cast<SlabPage*>(pstObj_->pvTag);
@@ -101,31 +295,92 @@ void Slab::Free(void* pvObj_)
 
     pclPage->Free(pvObj_);
 
-    if (pclPage->IsEmpty()) {
-        FreeSlabPage(pclPage);
+    // Clear the tag before the page (and the object with it) can be released
+    pstObj_->pvTag = nullptr;
+
+    if (pclPage->IsEmpty() && (pclRelease_ != nullptr) && !FreeSlabPage(pclPage)) {
+        pclRelease_->Add(pclPage);
     }
+    return true;
+}
 
-    pstObj_->pvTag = nullptr;
+//---------------------------------------------------------------------------
+void Slab::FreeRemote(void* pvObj_)
+{
+    if (!pvObj_) {
+        return;
+    }
+
+    // The queue is linked through the objects' data
+    if (m_u32ObjSize < sizeof(void*)) {
+        Free(pvObj_);
+        return;
+    }
+    PushRemoteFree(&m_pvRemoteFree, pvObj_);
+}
+
+//---------------------------------------------------------------------------
+void Slab::CollectRemoteFrees(void)
+{
+    DoubleLinkList clRelease;
+    clRelease.Init();
+    {
+        HeapLockGuard<SlabLock> clGuard(this);
+        CollectRemoteFreesLocked(&clRelease);
+    }
+    ReleaseSlabPages(&clRelease);
 }
 
 //---------------------------------------------------------------------------
-SlabPage* Slab::AllocSlabPage(void)
+void Slab::CollectRemoteFreesLocked(DoubleLinkList* pclRelease_)
+{
+    auto* pvObj = TakeRemoteFrees(&m_pvRemoteFree);
+    while (pvObj) {
+        auto* pvNext = *static_cast<void**>(pvObj);
+        if (FreeLocked(pvObj, pclRelease_)) {
+            HookFree(pvObj);
+        }
+        pvObj = pvNext;
+    }
+}
+
+//---------------------------------------------------------------------------
+SlabPage* Slab::AllocSlabPage(uint32_t* pu32PageSize_)
 {
     uint32_t u32PageSize;
-    auto*    pclNewPage = reinterpret_cast<SlabPage*>(m_pfSlabAlloc(&u32PageSize));
-    if (!pclNewPage) {
+    void*    pvPage;
+    if (m_pfPagesAlloc) {
+        pvPage = m_pfPagesAlloc(m_u8Order, &u32PageSize);
+    } else {
+        pvPage = m_pfSlabAlloc(&u32PageSize);
+    }
+    if (!pvPage) {
         return nullptr;
     }
 
-    pclNewPage->InitPage(u32PageSize, m_u32ObjSize);
+    SlabPage* pclNewPage;
+    if (m_pclDescSlab) {
+        // Page metadata lives in a descriptor allocated from another slab
+        pclNewPage = reinterpret_cast<SlabPage*>(m_pclDescSlab->Alloc());
+        if (!pclNewPage) {
+            m_pfPagesFree(pvPage, m_u8Order);
+            return nullptr;
+        }
+        pclNewPage->InitPage(pvPage, u32PageSize, m_u32ObjSize);
+    } else {
+        pclNewPage = reinterpret_cast<SlabPage*>(pvPage);
+        pclNewPage->InitPage(u32PageSize, m_u32ObjSize);
+    }
 
-    m_clFreeList.Add(pclNewPage);
+    *pu32PageSize_ = u32PageSize;
     return pclNewPage;
 }
 
 //---------------------------------------------------------------------------
 uint32_t Slab::GetFullPageCount()
 {
+    HeapLockGuard<SlabLock> clGuard(this);
+
     uint32_t count = 0;
     auto*    node  = m_clFullList.GetHead();
     while (node) {
@@ -138,6 +393,8 @@ uint32_t Slab::GetFullPageCount()
 //---------------------------------------------------------------------------
 uint32_t Slab::GetFreePageCount()
 {
+    HeapLockGuard<SlabLock> clGuard(this);
+
     uint32_t count = 0;
     auto*    node  = m_clFreeList.GetHead();
     while (node) {
@@ -148,10 +405,121 @@ uint32_t Slab::GetFreePageCount()
 }
 
 //---------------------------------------------------------------------------
-void Slab::FreeSlabPage(SlabPage* pclPage_)
+bool Slab::FreeSlabPage(SlabPage* pclPage_)
 {
     m_clFreeList.Remove(pclPage_);
-    m_pfSlabFree(pclPage_);
+
+    if (m_u32EmptyCount < m_u32CacheLimit) {
+        m_clEmptyList.Add(pclPage_);
+        m_u32EmptyCount++;
+        return true;
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+SlabPage* Slab::TakeEmptyPage(uint32_t u32Keep_)
+{
+    if (m_u32EmptyCount <= u32Keep_) {
+        return nullptr;
+    }
+    auto* pclPage = reinterpret_cast<SlabPage*>(m_clEmptyList.GetHead());
+    m_clEmptyList.Remove(pclPage);
+    m_u32EmptyCount--;
+    return pclPage;
+}
+
+//---------------------------------------------------------------------------
+void Slab::ReleaseSlabPage(SlabPage* pclPage_)
+{
+    auto* pvPage = pclPage_->GetPage();
+    if (m_pclDescSlab) {
+        m_pclDescSlab->Free(pclPage_);
+    }
+
+    if (m_pfPagesFree) {
+        m_pfPagesFree(pvPage, m_u8Order);
+    } else {
+        m_pfSlabFree(pvPage);
+    }
+}
+
+//---------------------------------------------------------------------------
+void Slab::ReleaseSlabPages(DoubleLinkList* pclRelease_)
+{
+    auto* pclPage = reinterpret_cast<SlabPage*>(pclRelease_->GetHead());
+    while (pclPage) {
+        // The list node lives in the page, so unlink it before releasing
+        auto* pclNext = reinterpret_cast<SlabPage*>(pclPage->GetNext());
+        pclRelease_->Remove(pclPage);
+        ReleaseSlabPage(pclPage);
+        pclPage = pclNext;
+    }
+}
+
+//---------------------------------------------------------------------------
+void Slab::SetPageCacheLimit(uint32_t u32Pages_)
+{
+    {
+        HeapLockGuard<SlabLock> clGuard(this);
+        m_u32CacheLimit = u32Pages_;
+    }
+
+    // Trim the cache down to the new limit, one page at a time
+    while (true) {
+        SlabPage* pclPage;
+        {
+            HeapLockGuard<SlabLock> clGuard(this);
+            pclPage = TakeEmptyPage(m_u32CacheLimit);
+        }
+        if (!pclPage) {
+            break;
+        }
+        ReleaseSlabPage(pclPage);
+    }
+
+    if (u32Pages_) {
+        ShrinkerRegistry::Register(&m_clShrinker);
+    } else {
+        ShrinkerRegistry::Unregister(&m_clShrinker);
+    }
+}
+
+//---------------------------------------------------------------------------
+K_ADDR Slab::Shrink(K_ADDR uBytes_)
+{
+    // Pages emptied by remote frees can then be reclaimed too
+    CollectRemoteFrees();
+
+    K_ADDR uFreed = 0;
+    while (uFreed < uBytes_) {
+        SlabPage* pclPage;
+        {
+            HeapLockGuard<SlabLock> clGuard(this);
+            pclPage = TakeEmptyPage(0);
+            if (!pclPage) {
+                break;
+            }
+            uFreed += m_u32PageSize;
+        }
+        ReleaseSlabPage(pclPage);
+    }
+    return uFreed;
+}
+
+//---------------------------------------------------------------------------
+K_ADDR Slab::ShrinkerCount(void* pvContext_)
+{
+    auto* pclSlab = static_cast<Slab*>(pvContext_);
+
+    HeapLockGuard<SlabLock> clGuard(pclSlab);
+    return (K_ADDR)pclSlab->m_u32EmptyCount * pclSlab->m_u32PageSize;
+}
+
+//---------------------------------------------------------------------------
+K_ADDR Slab::ShrinkerScan(void* pvContext_, K_ADDR uBytes_)
+{
+    return static_cast<Slab*>(pvContext_)->Shrink(uBytes_);
 }
 
 //---------------------------------------------------------------------------
@@ -0,0 +1,455 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+=========================================================================== */
+/**
+    @file system_heap.cpp
+
+    @brief General-purpose system heap, built from a fixed-block heap for
+           small allocations and an arena for everything else.
+
+    Small allocations are routed to a FixedHeap configured from the block
+    sizes/counts in system_heap_config.h.  Allocations too large for the
+    fixed-block heap (or that exhaust it), and allocations requiring more
+    than SYSTEM_HEAP_DEFAULT_ALIGN alignment, are routed to an Arena.
+    Ownership of a block is determined from its address, as each heap is
+    backed by its own statically-allocated buffer.
+
+    Both heaps keep every block aligned to SYSTEM_HEAP_DEFAULT_ALIGN: block
+    sizes are padded so that each block, including the metadata in front of
+    it, spans a whole number of alignment units, and each heap's storage is
+    offset so that the first block's data is aligned.
+
+    Over-aligned allocations are carved from a larger arena allocation, with
+    a small header placed immediately in front of the aligned block, holding
+    the address of the underlying allocation and a cookie identifying it as
+    an aligned block.
+*/
+
+#include "mark3.h"
+#include "system_heap.h"
+
+#if USE_SYSTEM_HEAP
+
+#include "fixed_heap.h"
+#include "arena.h"
+
+#if SYSTEM_HEAP_REPLACE_MALLOC
+#include <errno.h>
+#endif
+
+//---------------------------------------------------------------------------
+// Tag identifying an over-aligned arena block.  The word in front of a
+// regular arena block's data is the block's (pointer-aligned) left-sibling
+// pointer, which can never have its low bit set.
+#define SYSTEM_HEAP_ALIGNED_COOKIE ((K_ADDR)0xA11C0DE5)
+
+namespace Mark3
+{
+namespace
+{
+//---------------------------------------------------------------------------
+// Metadata preceding an over-aligned block
+typedef struct {
+    void*  pvRaw;   //!< Address of the underlying arena allocation
+    K_ADDR uCookie; //!< SYSTEM_HEAP_ALIGNED_COOKIE
+} system_heap_aligned_t;
+
+//---------------------------------------------------------------------------
+constexpr uint16_t s_au16BlockSizes[] = { HEAP_BLOCK_SIZE_1, HEAP_BLOCK_SIZE_2, HEAP_BLOCK_SIZE_3, HEAP_BLOCK_SIZE_4,
+                                          HEAP_BLOCK_SIZE_5, HEAP_BLOCK_SIZE_6, HEAP_BLOCK_SIZE_7, HEAP_BLOCK_SIZE_8,
+                                          HEAP_BLOCK_SIZE_9, HEAP_BLOCK_SIZE_10 };
+
+constexpr uint16_t s_au16BlockCounts[] = { HEAP_BLOCK_COUNT_1, HEAP_BLOCK_COUNT_2, HEAP_BLOCK_COUNT_3, HEAP_BLOCK_COUNT_4,
+                                           HEAP_BLOCK_COUNT_5, HEAP_BLOCK_COUNT_6, HEAP_BLOCK_COUNT_7, HEAP_BLOCK_COUNT_8,
+                                           HEAP_BLOCK_COUNT_9, HEAP_BLOCK_COUNT_10 };
+
+static_assert((HEAP_NUM_SIZES > 0) && (HEAP_NUM_SIZES <= (sizeof(s_au16BlockSizes) / sizeof(uint16_t))),
+              "Invalid number of system heap block sizes");
+
+//---------------------------------------------------------------------------
+constexpr size_t AlignUp(size_t uSize_)
+{
+    return (uSize_ + (SYSTEM_HEAP_DEFAULT_ALIGN - 1)) & ~(size_t)(SYSTEM_HEAP_DEFAULT_ALIGN - 1);
+}
+
+//---------------------------------------------------------------------------
+// Block size used for a bin, padded so that its blocks (and their metadata)
+// span a whole number of alignment units.
+constexpr uint16_t FixedBlockSize(uint8_t u8Bin_)
+{
+    return (uint16_t)(AlignUp(BLOCK_HEAP_NODE_SIZE + s_au16BlockSizes[u8Bin_]) - BLOCK_HEAP_NODE_SIZE);
+}
+
+//---------------------------------------------------------------------------
+// Memory required to back the first (HEAP_NUM_SIZES - u8Bin_) bins
+constexpr size_t FixedStorageSize(uint8_t u8Bin_)
+{
+    return (u8Bin_ == HEAP_NUM_SIZES)
+               ? 0
+               : (BlockHeap::GetBlockStride(FixedBlockSize(u8Bin_)) * s_au16BlockCounts[u8Bin_])
+                     + FixedStorageSize(u8Bin_ + 1);
+}
+
+//---------------------------------------------------------------------------
+// Arena data size padded so that the block (and its header) spans a whole
+// number of alignment units.
+constexpr K_ADDR ArenaBlockSize(size_t uSize_)
+{
+    return AlignUp(uSize_ + sizeof(HeapBlock)) - sizeof(HeapBlock);
+}
+
+//---------------------------------------------------------------------------
+// Offsets into each heap's (aligned) storage that align the first block's data
+constexpr size_t s_uFixedPad = AlignUp(BLOCK_HEAP_NODE_SIZE) - BLOCK_HEAP_NODE_SIZE;
+constexpr size_t s_uArenaPad = AlignUp((sizeof(ArenaList) * SYSTEM_HEAP_ARENA_NUM_SIZES) + sizeof(HeapBlock))
+                               - ((sizeof(ArenaList) * SYSTEM_HEAP_ARENA_NUM_SIZES) + sizeof(HeapBlock));
+
+//---------------------------------------------------------------------------
+HeapConfig s_aclFixedConfig[HEAP_NUM_SIZES + 1];
+FixedHeap  s_clFixedHeap;
+alignas(SYSTEM_HEAP_DEFAULT_ALIGN) K_WORD
+    s_awFixedStorage[(s_uFixedPad + FixedStorageSize(0) + sizeof(K_WORD) - 1) / sizeof(K_WORD)];
+
+Arena s_clArena;
+alignas(SYSTEM_HEAP_DEFAULT_ALIGN) K_WORD s_awArenaStorage[SYSTEM_HEAP_ARENA_SIZE / sizeof(K_WORD)];
+
+//---------------------------------------------------------------------------
+// Allocate from the arena, padding the request so the blocks on either side
+// of it stay aligned.  Requests below the smallest list size are padded from
+// that size, as the arena would otherwise round them up itself, unpadded.
+void* ArenaAllocate(size_t uSize_)
+{
+    if (uSize_ > (SIZE_MAX - sizeof(HeapBlock) - SYSTEM_HEAP_DEFAULT_ALIGN)) {
+        return nullptr;
+    }
+    if (uSize_ < SYSTEM_HEAP_ARENA_MIN_SIZE) {
+        uSize_ = SYSTEM_HEAP_ARENA_MIN_SIZE;
+    }
+    return s_clArena.Allocate(ArenaBlockSize(uSize_));
+}
+} // anonymous namespace
+
+bool SystemHeap::m_bInitialized = false;
+
+//---------------------------------------------------------------------------
+void SystemHeap::Init(void)
+{
+    CriticalGuard clGuard;
+    if (m_bInitialized) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < HEAP_NUM_SIZES; i++) {
+        s_aclFixedConfig[i].m_uBlockSize  = FixedBlockSize(i);
+        s_aclFixedConfig[i].m_uBlockCount = s_au16BlockCounts[i];
+    }
+    s_aclFixedConfig[HEAP_NUM_SIZES].m_uBlockSize = 0;
+    s_clFixedHeap.Create(reinterpret_cast<uint8_t*>(s_awFixedStorage) + s_uFixedPad, s_aclFixedConfig);
+
+    K_ADDR auArenaSizes[SYSTEM_HEAP_ARENA_NUM_SIZES];
+    for (uint8_t i = 0; i < SYSTEM_HEAP_ARENA_NUM_SIZES; i++) {
+        auArenaSizes[i] = ArenaBlockSize((K_ADDR)SYSTEM_HEAP_ARENA_MIN_SIZE << i);
+    }
+    s_clArena.Init(reinterpret_cast<uint8_t*>(s_awArenaStorage) + s_uArenaPad,
+                   sizeof(s_awArenaStorage) - s_uArenaPad,
+                   auArenaSizes,
+                   SYSTEM_HEAP_ARENA_NUM_SIZES);
+
+    m_bInitialized = true;
+}
+
+//---------------------------------------------------------------------------
+void* SystemHeap::Allocate(size_t uSize_)
+{
+    CriticalGuard clGuard;
+    if (!m_bInitialized) {
+        Init();
+    }
+    return AllocateLocked(uSize_);
+}
+
+//---------------------------------------------------------------------------
+void* SystemHeap::AllocateAligned(size_t uAlign_, size_t uSize_)
+{
+    if (!uAlign_ || (uAlign_ & (uAlign_ - 1))) {
+        return nullptr;
+    }
+
+    // All blocks meet the default alignment
+    if (uAlign_ <= SYSTEM_HEAP_DEFAULT_ALIGN) {
+        return Allocate(uSize_);
+    }
+
+    CriticalGuard clGuard;
+    if (!m_bInitialized) {
+        Init();
+    }
+
+    auto uRawSize = uSize_ + uAlign_ + sizeof(system_heap_aligned_t);
+    if (uRawSize < uSize_) {
+        return nullptr;
+    }
+    auto* pvRaw = ArenaAllocate(uRawSize);
+    if (pvRaw == nullptr) {
+        return nullptr;
+    }
+
+    // Leave room for the aligned-block header in front of the aligned block
+    auto adAligned = ((K_ADDR)pvRaw + sizeof(system_heap_aligned_t) + (uAlign_ - 1)) & ~(K_ADDR)(uAlign_ - 1);
+    auto* pstAligned    = reinterpret_cast<system_heap_aligned_t*>(adAligned - sizeof(system_heap_aligned_t));
+    pstAligned->pvRaw   = pvRaw;
+    pstAligned->uCookie = SYSTEM_HEAP_ALIGNED_COOKIE;
+    return reinterpret_cast<void*>(adAligned);
+}
+
+//---------------------------------------------------------------------------
+void* SystemHeap::Reallocate(void* pvData_, size_t uSize_)
+{
+    if (pvData_ == nullptr) {
+        return Allocate(uSize_);
+    }
+    if (uSize_ == 0) {
+        Free(pvData_);
+        return nullptr;
+    }
+
+    CriticalGuard clGuard;
+
+    // Objects are never shrunk in-place
+    auto uOldSize = GetUsableSizeLocked(pvData_);
+    if (uSize_ <= uOldSize) {
+        return pvData_;
+    }
+
+    auto* pvNew = AllocateLocked(uSize_);
+    if (pvNew == nullptr) {
+        return nullptr;
+    }
+
+    auto* pu8Src = static_cast<uint8_t*>(pvData_);
+    auto* pu8Dst = static_cast<uint8_t*>(pvNew);
+    for (size_t i = 0; i < uOldSize; i++) { pu8Dst[i] = pu8Src[i]; }
+
+    FreeLocked(pvData_);
+    return pvNew;
+}
+
+//---------------------------------------------------------------------------
+void SystemHeap::Free(void* pvData_)
+{
+    if (pvData_ == nullptr) {
+        return;
+    }
+    CriticalGuard clGuard;
+    FreeLocked(pvData_);
+}
+
+//---------------------------------------------------------------------------
+size_t SystemHeap::GetUsableSize(void* pvData_)
+{
+    if (pvData_ == nullptr) {
+        return 0;
+    }
+    CriticalGuard clGuard;
+    return GetUsableSizeLocked(pvData_);
+}
+
+//---------------------------------------------------------------------------
+bool SystemHeap::IsFixedBlock(void* pvData_)
+{
+    auto adData = reinterpret_cast<K_ADDR>(pvData_);
+    return (adData >= reinterpret_cast<K_ADDR>(s_awFixedStorage))
+        && (adData < (reinterpret_cast<K_ADDR>(s_awFixedStorage) + sizeof(s_awFixedStorage)));
+}
+
+//---------------------------------------------------------------------------
+void* SystemHeap::AllocateLocked(size_t uSize_)
+{
+    // Fall back to the arena when the object is too large for the
+    // fixed-block heap, or all suitable bins are exhausted.
+    auto* pvRet = s_clFixedHeap.Allocate(uSize_);
+    if (pvRet == nullptr) {
+        pvRet = ArenaAllocate(uSize_);
+    }
+    return pvRet;
+}
+
+//---------------------------------------------------------------------------
+void SystemHeap::FreeLocked(void* pvData_)
+{
+    if (IsFixedBlock(pvData_)) {
+        s_clFixedHeap.Free(pvData_);
+        return;
+    }
+
+    auto* pstAligned = reinterpret_cast<system_heap_aligned_t*>((K_ADDR)pvData_ - sizeof(system_heap_aligned_t));
+    if (pstAligned->uCookie == SYSTEM_HEAP_ALIGNED_COOKIE) {
+        // Clear the cookie, so stale pointers to the block aren't mistaken
+        // for aligned blocks once the memory is reused.
+        pstAligned->uCookie = 0;
+        s_clArena.Free(pstAligned->pvRaw);
+        return;
+    }
+    s_clArena.Free(pvData_);
+}
+
+//---------------------------------------------------------------------------
+size_t SystemHeap::GetUsableSizeLocked(void* pvData_)
+{
+    if (IsFixedBlock(pvData_)) {
+        for (uint8_t i = 0; i < HEAP_NUM_SIZES; i++) {
+            if (s_aclFixedConfig[i].m_clHeap.Contains(pvData_)) {
+                return s_aclFixedConfig[i].m_uBlockSize;
+            }
+        }
+        return 0;
+    }
+
+    auto* pstAligned = reinterpret_cast<system_heap_aligned_t*>((K_ADDR)pvData_ - sizeof(system_heap_aligned_t));
+    auto* pvRaw      = pvData_;
+    if (pstAligned->uCookie == SYSTEM_HEAP_ALIGNED_COOKIE) {
+        pvRaw = pstAligned->pvRaw;
+    }
+    auto* pclBlock = reinterpret_cast<HeapBlock*>((K_ADDR)pvRaw - sizeof(HeapBlock));
+    return pclBlock->GetDataSize() - ((K_ADDR)pvData_ - (K_ADDR)pvRaw);
+}
+} // namespace Mark3
+
+//---------------------------------------------------------------------------
+#if SYSTEM_HEAP_REPLACE_MALLOC
+// Match the exception specification of the C library's own declarations
+#if defined(__THROW)
+#define SYSTEM_HEAP_NOTHROW __THROW
+#else
+#define SYSTEM_HEAP_NOTHROW
+#endif
+
+extern "C" {
+//---------------------------------------------------------------------------
+void* malloc(size_t uSize_) SYSTEM_HEAP_NOTHROW
+{
+    return Mark3::SystemHeap::Allocate(uSize_);
+}
+
+//---------------------------------------------------------------------------
+void free(void* pvData_) SYSTEM_HEAP_NOTHROW
+{
+    Mark3::SystemHeap::Free(pvData_);
+}
+
+//---------------------------------------------------------------------------
+void* calloc(size_t uCount_, size_t uSize_) SYSTEM_HEAP_NOTHROW
+{
+    auto uTotal = uCount_ * uSize_;
+    if (uSize_ && ((uTotal / uSize_) != uCount_)) {
+        return nullptr;
+    }
+
+    auto* pu8Data = static_cast<uint8_t*>(Mark3::SystemHeap::Allocate(uTotal));
+    if (pu8Data != nullptr) {
+        for (size_t i = 0; i < uTotal; i++) { pu8Data[i] = 0; }
+    }
+    return pu8Data;
+}
+
+//---------------------------------------------------------------------------
+void* realloc(void* pvData_, size_t uSize_) SYSTEM_HEAP_NOTHROW
+{
+    return Mark3::SystemHeap::Reallocate(pvData_, uSize_);
+}
+
+//---------------------------------------------------------------------------
+int posix_memalign(void** ppvData_, size_t uAlign_, size_t uSize_) SYSTEM_HEAP_NOTHROW
+{
+    if (!uAlign_ || (uAlign_ & (uAlign_ - 1)) || (uAlign_ % sizeof(void*))) {
+        return EINVAL;
+    }
+    auto* pvData = Mark3::SystemHeap::AllocateAligned(uAlign_, uSize_);
+    if (pvData == nullptr) {
+        return ENOMEM;
+    }
+    *ppvData_ = pvData;
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+void* aligned_alloc(size_t uAlign_, size_t uSize_) SYSTEM_HEAP_NOTHROW
+{
+    return Mark3::SystemHeap::AllocateAligned(uAlign_, uSize_);
+}
+
+//---------------------------------------------------------------------------
+size_t malloc_usable_size(void* pvData_) SYSTEM_HEAP_NOTHROW
+{
+    return Mark3::SystemHeap::GetUsableSize(pvData_);
+}
+} // extern "C"
+#endif // SYSTEM_HEAP_REPLACE_MALLOC
+
+//---------------------------------------------------------------------------
+#if SYSTEM_HEAP_REPLACE_NEW
+namespace
+{
+//---------------------------------------------------------------------------
+// Mark3 is built without exceptions, and operator new may not return nullptr
+// - so allocation failures are fatal.
+void* AllocateOrTrap(size_t uSize_)
+{
+    auto* pvData = Mark3::SystemHeap::Allocate(uSize_);
+    if (pvData == nullptr) {
+        __builtin_trap();
+    }
+    return pvData;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+void* operator new(size_t uSize_)
+{
+    return AllocateOrTrap(uSize_);
+}
+
+//---------------------------------------------------------------------------
+void* operator new[](size_t uSize_)
+{
+    return AllocateOrTrap(uSize_);
+}
+
+//---------------------------------------------------------------------------
+void operator delete(void* pvData_) noexcept
+{
+    Mark3::SystemHeap::Free(pvData_);
+}
+
+//---------------------------------------------------------------------------
+void operator delete[](void* pvData_) noexcept
+{
+    Mark3::SystemHeap::Free(pvData_);
+}
+
+#if defined(__cpp_sized_deallocation)
+//---------------------------------------------------------------------------
+void operator delete(void* pvData_, size_t /*uSize_*/) noexcept
+{
+    Mark3::SystemHeap::Free(pvData_);
+}
+
+//---------------------------------------------------------------------------
+void operator delete[](void* pvData_, size_t /*uSize_*/) noexcept
+{
+    Mark3::SystemHeap::Free(pvData_);
+}
+#endif
+#endif // SYSTEM_HEAP_REPLACE_NEW
+
+#endif // USE_SYSTEM_HEAP
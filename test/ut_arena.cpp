@@ -36,6 +36,24 @@ K_ADDR m_awHeapSize[] = { 16, 24, 40, 64, 104, 168, SMALL_HEAP_MAX_ALLOC_SIZE };
 
 Arena m_clArena;
 
+StaticHandlePool<arena_movable_t, TOTAL_ALLOCATIONS> m_clHandles;
+pool_handle_t                                        auHandles[TOTAL_ALLOCATIONS];
+
+// Index of the largest list with a free block
+int LargestFreeList(Arena* pclArena_)
+{
+    int iLargest = -1;
+    for (int i = 0; i < pclArena_->GetListCount(); i++) {
+        uint32_t u32BlockSize;
+        uint32_t u32BlockCount;
+        pclArena_->GetListInfo(i, &u32BlockSize, &u32BlockCount);
+        if (u32BlockCount != 0) {
+            iLargest = i;
+        }
+    }
+    return iLargest;
+}
+
 } // anonymous namespace
 
 class IUT {
@@ -224,6 +242,121 @@ TEST(ut_arena_alloc_patterns_pass)
     }
 }
 
+//---------------------------------------------------------------------------
+TEST(ut_arena_movable_pin_pass)
+{
+    auto* iut = IUT::build();
+    EXPECT_TRUE(iut->AllocateMovable(16) == HANDLE_POOL_INVALID_HANDLE);
+
+    m_clHandles.Init();
+    iut->SetMovableHandles(&m_clHandles);
+    auto startMem = IUT::getMemFree();
+
+    auto  uHandle = iut->AllocateMovable(16);
+    auto* pvData  = iut->Pin(uHandle);
+    EXPECT_TRUE(pvData != nullptr);
+    MemUtil::SetMemory(pvData, 0x5A, 16);
+
+    // Pins nest, and return the same location while held
+    EXPECT_TRUE(iut->Pin(uHandle) == pvData);
+    iut->Unpin(uHandle);
+    iut->Unpin(uHandle);
+
+    iut->FreeMovable(uHandle);
+    EXPECT_TRUE(iut->Pin(uHandle) == nullptr);
+    EXPECT_EQUALS(startMem, IUT::getMemFree());
+    EXPECT_TRUE(iut->AllocateMovable(SMALL_HEAP_MAX_ALLOC_SIZE) == HANDLE_POOL_INVALID_HANDLE);
+    EXPECT_TRUE(m_clHandles.GetCount() == 0);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_arena_movable_compact_pass)
+{
+    auto* iut = IUT::build();
+    m_clHandles.Init();
+    iut->SetMovableHandles(&m_clHandles);
+    auto startMem = IUT::getMemFree();
+
+    // Fill the arena, tagging each allocation with its index
+    uint32_t count = 0;
+    while (count < TOTAL_ALLOCATIONS) {
+        auHandles[count] = iut->AllocateMovable(8);
+        if (auHandles[count] == HANDLE_POOL_INVALID_HANDLE) {
+            break;
+        }
+        MemUtil::SetMemory(iut->Pin(auHandles[count]), count, 8);
+        iut->Unpin(auHandles[count]);
+        count++;
+    }
+
+    // Punch holes throughout, pinning one of the survivors in place
+    for (uint32_t i = 0; i < count; i += 2) {
+        iut->FreeMovable(auHandles[i]);
+    }
+    auto* pvPinned = iut->Pin(auHandles[count / 2 | 1]);
+    auto  iBefore  = LargestFreeList(iut);
+
+    // A pass of compaction merges the holes, after which nothing moves
+    K_ADDR uMoved = 0;
+    while (auto uStep = iut->Compact(SMALL_HEAP_TOTAL_SIZE * 2)) {
+        uMoved += uStep;
+    }
+    EXPECT_TRUE(uMoved != 0);
+    EXPECT_TRUE(LargestFreeList(iut) > iBefore);
+    EXPECT_TRUE(iut->Pin(auHandles[count / 2 | 1]) == pvPinned);
+    iut->Unpin(auHandles[count / 2 | 1]);
+    iut->Unpin(auHandles[count / 2 | 1]);
+
+    // Moved allocations keep their contents
+    for (uint32_t i = 1; i < count; i += 2) {
+        auto* pu8Data = static_cast<uint8_t*>(iut->Pin(auHandles[i]));
+        EXPECT_TRUE((pu8Data[0] == (uint8_t)i) && (pu8Data[7] == (uint8_t)i));
+        iut->Unpin(auHandles[i]);
+    }
+    for (uint32_t i = 1; i < count; i += 2) {
+        iut->FreeMovable(auHandles[i]);
+    }
+    EXPECT_EQUALS(startMem, IUT::getMemFree());
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_arena_movable_compact_bounded_pass)
+{
+    K_ADDR auMoved[2]   = {};
+    K_ADDR uLargestStep = 0;
+    for (int iPass = 0; iPass < 2; iPass++) {
+        auto* iut = IUT::build();
+        m_clHandles.Init();
+        iut->SetMovableHandles(&m_clHandles);
+        for (int i = 0; i < 4; i++) {
+            auHandles[i] = iut->AllocateMovable(8);
+        }
+        iut->FreeMovable(auHandles[0]);
+
+        if (iPass == 0) {
+            auMoved[0] = iut->Compact(SMALL_HEAP_TOTAL_SIZE * 2);
+            continue;
+        }
+
+        // A zero budget does no work
+        EXPECT_TRUE(iut->Compact(0) == 0);
+
+        // A minimal budget visits or moves one block per step, resuming
+        // where the last step left off
+        for (int i = 0; i < TOTAL_ALLOCATIONS; i++) {
+            auto uStep = iut->Compact(1);
+            if (uStep > uLargestStep) {
+                uLargestStep = uStep;
+            }
+            auMoved[1] += uStep;
+        }
+        EXPECT_TRUE(iut->Compact(SMALL_HEAP_TOTAL_SIZE * 2) == 0);
+    }
+    EXPECT_TRUE(auMoved[0] != 0);
+    EXPECT_EQUALS(auMoved[0], auMoved[1]);
+    EXPECT_TRUE(uLargestStep < auMoved[1]);
+}
+
 //---------------------------------------------------------------------------
 //===========================================================================
 // Test Whitelist Goes Here
@@ -238,5 +371,8 @@ TEST_CASE(ut_arena_middle_free_pass),
 TEST_CASE(ut_arena_max_free_pass),
 TEST_CASE(ut_arena_exhaust_alloc_pass),
 TEST_CASE(ut_arena_alloc_patterns_pass),
+TEST_CASE(ut_arena_movable_pin_pass),
+TEST_CASE(ut_arena_movable_compact_pass),
+TEST_CASE(ut_arena_movable_compact_bounded_pass),
 TEST_CASE_END
 } // namespace mark3
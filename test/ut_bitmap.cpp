@@ -23,6 +23,11 @@ using namespace Mark3;
 namespace {
 K_WORD awBitmapData[DEFAULT_BITMAP_SIZE/sizeof(K_WORD)];
 uint8_t* pAllocs[DEFAULT_BITMAP_SIZE/DEFAULT_ALLOC_SIZE];
+
+#define LAZY_BLOCK_SIZE (4096)
+#define LAZY_MAP_WORDS (4)
+K_WORD awLazyData[LAZY_BLOCK_SIZE/sizeof(K_WORD)];
+uint32_t au32LazyMap[LAZY_MAP_WORDS];
 } // anonymous namespace
 
 namespace Mark3
@@ -204,6 +209,57 @@ TEST(ut_bitmap_alloc_patterns_pass)
     }
 }
 
+//---------------------------------------------------------------------------
+TEST(ut_bitmap_lazy_init_pass)
+{
+    // Initializing the allocator must not walk the bitmap - words are only
+    // touched as the elements they track are first allocated.
+    BitmapAllocator clBitmap;
+    MemUtil::SetMemory(au32LazyMap, 0xA5, sizeof(au32LazyMap));
+    clBitmap.Init(awLazyData, sizeof(awLazyData), DEFAULT_ALLOC_SIZE, au32LazyMap);
+
+    auto u32Capacity = clBitmap.GetNumFree();
+    EXPECT_TRUE(u32Capacity > UINT32_BITS);
+    EXPECT_TRUE(clBitmap.GetMapSize(u32Capacity) <= sizeof(au32LazyMap));
+
+    auto* pvAlloc = clBitmap.Allocate(nullptr);
+    EXPECT_TRUE(pvAlloc != nullptr);
+    for (int i = 1; i < LAZY_MAP_WORDS; i++) {
+        EXPECT_TRUE(au32LazyMap[i] == 0xA5A5A5A5);
+    }
+
+    // Freed elements are reused before new ones are carved from the block
+    clBitmap.Free(pvAlloc);
+    EXPECT_TRUE(clBitmap.Allocate(nullptr) == pvAlloc);
+    clBitmap.Free(pvAlloc);
+
+    // Every element can still be allocated, freed and reallocated
+    for (int l = 0; l < 2; l++) {
+        for (uint32_t i = 0; i < u32Capacity; i++) {
+            EXPECT_TRUE(clBitmap.Allocate(nullptr) != nullptr);
+        }
+        EXPECT_TRUE(clBitmap.Allocate(nullptr) == nullptr);
+        EXPECT_TRUE(clBitmap.IsFull());
+
+        for (uint32_t i = 0; i < u32Capacity; i++) {
+            auto* pstAlloc = reinterpret_cast<bitmap_alloc_t*>(
+                (K_ADDR)awLazyData + (i * (DEFAULT_ALLOC_SIZE + sizeof(bitmap_alloc_t) - sizeof(K_WORD))));
+            clBitmap.Free(pstAlloc->data);
+        }
+        EXPECT_TRUE(clBitmap.IsEmpty());
+    }
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_bitmap_capacity_limit_pass)
+{
+    // The first level bitmap tracks at most 32 words of 32 elements, no
+    // matter how large the block is
+    EXPECT_TRUE(BitmapAllocator::GetCapacity(0x100000, DEFAULT_ALLOC_SIZE, true) == BITMAP_ALLOCATOR_MAX_ELEMENTS);
+    EXPECT_TRUE(BitmapAllocator::GetCapacity(0x100000, DEFAULT_ALLOC_SIZE, false) == BITMAP_ALLOCATOR_MAX_ELEMENTS);
+    EXPECT_TRUE(BitmapAllocator::GetCapacity(LAZY_BLOCK_SIZE, DEFAULT_ALLOC_SIZE, false) < BITMAP_ALLOCATOR_MAX_ELEMENTS);
+}
+
 //---------------------------------------------------------------------------
 //===========================================================================
 // Test Whitelist Goes Here
@@ -216,5 +272,7 @@ TEST_CASE(ut_bitmap_is_empty_pass),
 TEST_CASE(ut_bitmap_double_free_handled),
 TEST_CASE(ut_bitmap_block_write_pass),
 TEST_CASE(ut_bitmap_alloc_patterns_pass),
+TEST_CASE(ut_bitmap_lazy_init_pass),
+TEST_CASE(ut_bitmap_capacity_limit_pass),
 TEST_CASE_END
 } // namespace mark3
@@ -0,0 +1,187 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "buddy_allocator.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+#define MIN_BLOCK_SIZE (32)
+#define NUM_ORDERS (6)
+#define TOP_BLOCK_SIZE (MIN_BLOCK_SIZE << (NUM_ORDERS - 1))
+#define TOP_BLOCK_COUNT (4)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+// Room for the top-order blocks, plus the bitmaps and one spare small block
+alignas(TOP_BLOCK_SIZE) uint8_t au8Mem[(TOP_BLOCK_SIZE * TOP_BLOCK_COUNT) + 64];
+
+BuddyAllocator clBuddy;
+
+typedef BuddyPageSource<&clBuddy, 3> PageSource;
+
+bool IsAligned(void* pvBlock_, K_ADDR uSize_)
+{
+    return ((K_ADDR)pvBlock_ & (uSize_ - 1)) == 0;
+}
+} // anonymous namespace
+
+//===========================================================================
+// Define Test Cases Here
+//===========================================================================
+TEST(ut_buddy_init_pass)
+{
+    clBuddy.Init(au8Mem, sizeof(au8Mem), MIN_BLOCK_SIZE, NUM_ORDERS);
+
+    // The range is tiled by the largest blocks that fit around the bitmaps
+    EXPECT_TRUE(clBuddy.GetBlockSize(NUM_ORDERS - 1) == TOP_BLOCK_SIZE);
+    EXPECT_TRUE(clBuddy.GetFreeBlockCount(NUM_ORDERS - 1) == TOP_BLOCK_COUNT);
+    EXPECT_TRUE(clBuddy.GetFreeBlockCount(0) == 1);
+    EXPECT_TRUE(clBuddy.GetFreeBytes() == (TOP_BLOCK_SIZE * TOP_BLOCK_COUNT) + MIN_BLOCK_SIZE);
+
+    EXPECT_TRUE(clBuddy.GetOrderForSize(1) == 0);
+    EXPECT_TRUE(clBuddy.GetOrderForSize(MIN_BLOCK_SIZE + 1) == 1);
+    EXPECT_TRUE(clBuddy.GetOrderForSize(TOP_BLOCK_SIZE) == NUM_ORDERS - 1);
+    EXPECT_TRUE(clBuddy.GetOrderForSize(TOP_BLOCK_SIZE + 1) == BUDDY_NO_ORDER);
+    EXPECT_TRUE(clBuddy.Allocate(NUM_ORDERS) == nullptr);
+}
+
+//===========================================================================
+TEST(ut_buddy_split_merge_pass)
+{
+    clBuddy.Init(au8Mem, sizeof(au8Mem), MIN_BLOCK_SIZE, NUM_ORDERS);
+    auto uFree = clBuddy.GetFreeBytes();
+
+    // The spare small block is used first, then a top-order block is split
+    auto* pvSpare = clBuddy.Allocate(0);
+    auto* pvSmall = clBuddy.Allocate(0);
+    EXPECT_TRUE(pvSpare != nullptr);
+    EXPECT_TRUE(pvSmall != nullptr);
+    EXPECT_TRUE(clBuddy.GetFreeBlockCount(NUM_ORDERS - 1) == TOP_BLOCK_COUNT - 1);
+    for (uint8_t i = 0; i < NUM_ORDERS - 1; i++) {
+        EXPECT_TRUE(clBuddy.GetFreeBlockCount(i) == 1);
+    }
+
+    // Each block is aligned to its size, and the split halves are used
+    // before splitting anything else
+    void* apvBlocks[NUM_ORDERS - 1];
+    for (uint8_t i = 0; i < NUM_ORDERS - 1; i++) {
+        apvBlocks[i] = clBuddy.Allocate(i);
+        EXPECT_TRUE(apvBlocks[i] != nullptr);
+        EXPECT_TRUE(IsAligned(apvBlocks[i], clBuddy.GetBlockSize(i)));
+        MemUtil::SetMemory(apvBlocks[i], 0x5A, clBuddy.GetBlockSize(i));
+    }
+    EXPECT_TRUE(clBuddy.GetFreeBlockCount(NUM_ORDERS - 1) == TOP_BLOCK_COUNT - 1);
+    EXPECT_TRUE(clBuddy.GetFreeBytes() == uFree - TOP_BLOCK_SIZE - MIN_BLOCK_SIZE);
+
+    // Freeing in any order merges everything back into the top-order block
+    clBuddy.Free(apvBlocks[2], 2);
+    clBuddy.Free(pvSmall, 0);
+    clBuddy.Free(apvBlocks[4], 4);
+    clBuddy.Free(apvBlocks[0], 0);
+    clBuddy.Free(apvBlocks[3], 3);
+    EXPECT_TRUE(clBuddy.GetFreeBlockCount(NUM_ORDERS - 1) == TOP_BLOCK_COUNT - 1);
+    clBuddy.Free(apvBlocks[1], 1);
+    EXPECT_TRUE(clBuddy.GetFreeBlockCount(NUM_ORDERS - 1) == TOP_BLOCK_COUNT);
+    for (uint8_t i = 0; i < NUM_ORDERS - 1; i++) {
+        EXPECT_TRUE(clBuddy.GetFreeBlockCount(i) == 0);
+    }
+
+    // The spare block has no buddy to merge with
+    clBuddy.Free(pvSpare, 0);
+    EXPECT_TRUE(clBuddy.GetFreeBlockCount(0) == 1);
+    EXPECT_TRUE(clBuddy.GetFreeBytes() == uFree);
+}
+
+//===========================================================================
+TEST(ut_buddy_unaligned_exhaust_pass)
+{
+    // Blocks stay naturally aligned when the memory itself isn't
+    clBuddy.Init(&au8Mem[8], sizeof(au8Mem) - 8, MIN_BLOCK_SIZE, NUM_ORDERS);
+    auto uFree = clBuddy.GetFreeBytes();
+    EXPECT_TRUE(uFree > 0);
+    EXPECT_TRUE(clBuddy.GetFreeBlockCount(NUM_ORDERS - 1) == TOP_BLOCK_COUNT - 1);
+
+    void*    apvBlocks[(sizeof(au8Mem) / MIN_BLOCK_SIZE)];
+    uint32_t u32Count = 0;
+    while (true) {
+        auto* pvBlock = clBuddy.Allocate(0);
+        if (pvBlock == nullptr) {
+            break;
+        }
+        EXPECT_TRUE(IsAligned(pvBlock, MIN_BLOCK_SIZE));
+        EXPECT_TRUE(((K_ADDR)pvBlock >= (K_ADDR)&au8Mem[8]));
+        EXPECT_TRUE(((K_ADDR)pvBlock + MIN_BLOCK_SIZE) <= ((K_ADDR)au8Mem + sizeof(au8Mem)));
+        apvBlocks[u32Count++] = pvBlock;
+    }
+    EXPECT_TRUE((u32Count * MIN_BLOCK_SIZE) == uFree);
+    EXPECT_TRUE(clBuddy.GetFreeBytes() == 0);
+
+    // Free every other block first, so no merges occur until the second pass
+    for (uint32_t i = 0; i < u32Count; i += 2) {
+        clBuddy.Free(apvBlocks[i], 0);
+    }
+    EXPECT_TRUE(clBuddy.GetFreeBlockCount(NUM_ORDERS - 1) == 0);
+    for (uint32_t i = 1; i < u32Count; i += 2) {
+        clBuddy.Free(apvBlocks[i], 0);
+    }
+    EXPECT_TRUE(clBuddy.GetFreeBytes() == uFree);
+    EXPECT_TRUE(clBuddy.GetFreeBlockCount(NUM_ORDERS - 1) == TOP_BLOCK_COUNT - 1);
+}
+
+//===========================================================================
+TEST(ut_buddy_slab_pages_pass)
+{
+    clBuddy.Init(au8Mem, sizeof(au8Mem), MIN_BLOCK_SIZE, NUM_ORDERS);
+    auto uFree     = clBuddy.GetFreeBytes();
+    auto u32PageSz = PageSource::GetPageSize();
+    EXPECT_TRUE(u32PageSz == (MIN_BLOCK_SIZE << 3));
+
+    // Single-page slab, with its pages aligned to the page size
+    Slab clSlab;
+    clSlab.Init(24, PageSource::AllocPage, PageSource::FreePage);
+    auto* pvObj = clSlab.Alloc();
+    EXPECT_TRUE(pvObj != nullptr);
+    EXPECT_TRUE(clBuddy.GetFreeBytes() == uFree - u32PageSz);
+    clSlab.Free(pvObj);
+    EXPECT_TRUE(clBuddy.GetFreeBytes() == uFree);
+
+    // Multi-page slab, built from higher-order blocks
+    Slab clLargeSlab;
+    clLargeSlab.Init(200, u32PageSz, 25, PageSource::AllocPages, PageSource::FreePages);
+    auto u8Order = clLargeSlab.GetPageOrder();
+    EXPECT_TRUE(u8Order > 0);
+    pvObj = clLargeSlab.Alloc();
+    EXPECT_TRUE(pvObj != nullptr);
+    EXPECT_TRUE(clBuddy.GetFreeBytes() == uFree - (u32PageSz << u8Order));
+    clLargeSlab.Free(pvObj);
+    EXPECT_TRUE(clBuddy.GetFreeBytes() == uFree);
+    EXPECT_TRUE(clBuddy.GetFreeBlockCount(NUM_ORDERS - 1) == TOP_BLOCK_COUNT);
+}
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_buddy_init_pass),
+TEST_CASE(ut_buddy_split_merge_pass),
+TEST_CASE(ut_buddy_unaligned_exhaust_pass),
+TEST_CASE(ut_buddy_slab_pages_pass),
+TEST_CASE_END
+} // namespace mark3
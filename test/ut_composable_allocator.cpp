@@ -0,0 +1,195 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "composable_allocator.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+#define SLAB_PAGE_SIZE (256)
+#define SLAB_PAGE_COUNT (8)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+K_WORD awArenaMem[2048 / sizeof(K_WORD)];
+K_ADDR auArenaSizes[] = { 16, 32, 64, 128, 256 };
+
+K_WORD     awFixedMem[256];
+HeapConfig aclFixedConfig[] = {
+    { .m_uBlockSize = 16, .m_uBlockCount = 4 },
+    { .m_uBlockSize = 64, .m_uBlockCount = 2 },
+    { .m_uBlockSize = 0 },
+};
+
+K_WORD          awPageMem[(SLAB_PAGE_SIZE * SLAB_PAGE_COUNT) / sizeof(K_WORD)];
+BitmapAllocator clPageAllocator;
+
+void* AllocPage(uint32_t* pu32PageSize_)
+{
+    *pu32PageSize_ = SLAB_PAGE_SIZE;
+    return clPageAllocator.Allocate(nullptr);
+}
+
+void FreePage(void* pvPage_)
+{
+    clPageAllocator.Free(pvPage_);
+}
+
+typedef Segregator<64, FixedHeapPolicy, ArenaPolicy> SegregatedHeap;
+typedef Fallback<FixedHeapPolicy, ArenaPolicy>       FallbackHeap;
+typedef Bucketizer<SlabPolicy, 0, 64, 16>            SlabBuckets;
+
+SegregatedHeap clSegregated;
+FallbackHeap   clFallback;
+SlabBuckets    clBuckets;
+
+Segregator<64, Fallback<SlabBuckets, FixedHeapPolicy>, ArenaPolicy> clComposite;
+
+void InitBuckets(SlabBuckets* pclBuckets_)
+{
+    clPageAllocator.Init(awPageMem, sizeof(awPageMem), SLAB_PAGE_SIZE);
+    for (size_t i = 0; i < SlabBuckets::uBucketCount; i++) {
+        pclBuckets_->GetBucket(i).Init(SlabBuckets::GetBucketSize(i), AllocPage, FreePage, awPageMem, sizeof(awPageMem));
+    }
+}
+} // anonymous namespace
+
+//===========================================================================
+// Define Test Cases Here
+//===========================================================================
+TEST(ut_compose_segregator_pass)
+{
+    clSegregated.GetSmall().Init(awFixedMem, aclFixedConfig);
+    clSegregated.GetLarge().Init(awArenaMem, sizeof(awArenaMem), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+
+    // Requests are split at the threshold, at runtime or compile time
+    auto* pvSmall  = clSegregated.Allocate(64);
+    auto* pvLarge  = clSegregated.Allocate(65);
+    auto* pvStatic = clSegregated.Allocate<128>();
+    EXPECT_TRUE(clSegregated.GetSmall().Owns(pvSmall));
+    EXPECT_TRUE(clSegregated.GetLarge().Owns(pvLarge));
+    EXPECT_TRUE(clSegregated.GetLarge().Owns(pvStatic));
+    EXPECT_TRUE(clSegregated.Owns(pvSmall) && clSegregated.Owns(pvLarge));
+    EXPECT_TRUE(!clSegregated.Owns(awPageMem));
+
+    clSegregated.Free(pvSmall, 64);
+    clSegregated.Free(pvLarge, 65);
+    clSegregated.Free(pvStatic, 128);
+
+    // Both 64-byte blocks are free again
+    pvSmall = clSegregated.Allocate<64>();
+    EXPECT_TRUE(pvSmall != nullptr);
+    EXPECT_TRUE(clSegregated.Allocate(64) != nullptr);
+    EXPECT_TRUE(clSegregated.Allocate(64) == nullptr);
+}
+
+//===========================================================================
+TEST(ut_compose_fallback_pass)
+{
+    clFallback.GetPrimary().Init(awFixedMem, aclFixedConfig);
+    clFallback.GetSecondary().Init(awArenaMem, sizeof(awArenaMem), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+
+    // Exhaust the primary's 16-byte blocks (and larger), then spill over
+    void* apvAllocs[8];
+    for (int i = 0; i < 8; i++) {
+        apvAllocs[i] = clFallback.Allocate(16);
+        EXPECT_TRUE(apvAllocs[i] != nullptr);
+        MemUtil::SetMemory(apvAllocs[i], i, 16);
+    }
+    EXPECT_TRUE(clFallback.GetPrimary().Owns(apvAllocs[5]));
+    EXPECT_TRUE(clFallback.GetSecondary().Owns(apvAllocs[6]));
+    EXPECT_TRUE(clFallback.GetSecondary().Owns(clFallback.Allocate<200>()));
+
+    // Frees are routed by ownership
+    for (int i = 0; i < 8; i++) {
+        clFallback.Free(apvAllocs[i], 16);
+    }
+    for (int i = 0; i < 6; i++) {
+        EXPECT_TRUE(clFallback.GetPrimary().Owns(clFallback.Allocate(16)));
+    }
+}
+
+//===========================================================================
+TEST(ut_compose_bucketizer_pass)
+{
+    InitBuckets(&clBuckets);
+    EXPECT_TRUE(SlabBuckets::uBucketCount == 4);
+    EXPECT_TRUE(SlabBuckets::BucketForSize(1) == 0);
+    EXPECT_TRUE(SlabBuckets::BucketForSize(16) == 0);
+    EXPECT_TRUE(SlabBuckets::BucketForSize(17) == 1);
+    EXPECT_TRUE(SlabBuckets::BucketForSize(64) == 3);
+
+    // Each size lands in the slab for its bucket
+    auto* pvTiny  = clBuckets.Allocate(4);
+    auto* pvMid   = clBuckets.Allocate<40>();
+    auto* pvLarge = clBuckets.Allocate(64);
+    EXPECT_TRUE(clBuckets.GetBucket(0).GetSlab()->GetFreePageCount() == 1);
+    EXPECT_TRUE(clBuckets.GetBucket(1).GetSlab()->GetFreePageCount() == 0);
+    EXPECT_TRUE(clBuckets.GetBucket(2).GetSlab()->GetFreePageCount() == 1);
+    EXPECT_TRUE(clBuckets.GetBucket(3).GetSlab()->GetFreePageCount() == 1);
+    EXPECT_TRUE(clBuckets.Owns(pvTiny) && clBuckets.Owns(pvMid) && clBuckets.Owns(pvLarge));
+
+    EXPECT_TRUE(clBuckets.Allocate(65) == nullptr);
+    EXPECT_TRUE(clBuckets.Allocate<65>() == nullptr);
+
+    clBuckets.Free(pvTiny, 4);
+    clBuckets.Free(pvMid, 40);
+    clBuckets.Free(pvLarge, 64);
+    for (size_t i = 0; i < SlabBuckets::uBucketCount; i++) {
+        EXPECT_TRUE(clBuckets.GetBucket(i).GetSlab()->GetFreePageCount() == 0);
+    }
+}
+
+//===========================================================================
+TEST(ut_compose_nested_pass)
+{
+    InitBuckets(&clComposite.GetSmall().GetPrimary());
+    clComposite.GetSmall().GetSecondary().Init(awFixedMem, aclFixedConfig);
+    clComposite.GetLarge().Init(awArenaMem, sizeof(awArenaMem), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+
+    // Run the slabs out of pages, so small requests fall back to the fixed heap
+    void*    apvAllocs[SLAB_PAGE_COUNT * 16];
+    uint32_t u32Count = 0;
+    while (u32Count < (sizeof(apvAllocs) / sizeof(void*))) {
+        apvAllocs[u32Count] = clComposite.Allocate<48>();
+        if (!clComposite.GetSmall().GetPrimary().Owns(apvAllocs[u32Count])) {
+            break;
+        }
+        u32Count++;
+    }
+    EXPECT_TRUE(clComposite.GetSmall().GetSecondary().Owns(apvAllocs[u32Count]));
+    EXPECT_TRUE(clComposite.GetLarge().Owns(clComposite.Allocate(100)));
+
+    clComposite.Free(apvAllocs[u32Count], 48);
+    for (uint32_t i = 0; i < u32Count; i++) {
+        clComposite.Free(apvAllocs[i], 48);
+    }
+    EXPECT_TRUE(clPageAllocator.IsEmpty());
+}
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_compose_segregator_pass),
+TEST_CASE(ut_compose_fallback_pass),
+TEST_CASE(ut_compose_bucketizer_pass),
+TEST_CASE(ut_compose_nested_pass),
+TEST_CASE_END
+} // namespace mark3
@@ -70,6 +70,56 @@ HeapConfig clHeapConfig[] = {
 };
 
 FixedHeap clHeap;
+
+// Irregular, widely-spaced block sizes exercise both the direct and log2
+// size-class lookups
+#define LARGE_BLOCK_COUNT (2)
+size_t auLargeSizes[] = { 12, 100, 300, 1000 };
+K_WORD awLargeHeap[((12 + 100 + 300 + 1000) + (4 * BLOCK_OVERHEAD)) * LARGE_BLOCK_COUNT / sizeof(K_WORD) + 1];
+HeapConfig clLargeHeapConfig[] = {
+    { .m_uBlockSize = 12, .m_uBlockCount = LARGE_BLOCK_COUNT },
+    { .m_uBlockSize = 100, .m_uBlockCount = LARGE_BLOCK_COUNT },
+    { .m_uBlockSize = 300, .m_uBlockCount = LARGE_BLOCK_COUNT },
+    { .m_uBlockSize = 1000, .m_uBlockCount = LARGE_BLOCK_COUNT },
+    { .m_uBlockSize = 0},
+};
+FixedHeap clLargeHeap;
+
+HeapConfig clTooManyBinsConfig[FIXED_HEAP_MAX_BINS + 2];
+
+#define GROW_PAGE_SIZE (256)
+#define GROW_PAGE_COUNT (2)
+K_WORD awGrowPages[GROW_PAGE_COUNT][GROW_PAGE_SIZE / sizeof(K_WORD)];
+bool abGrowPageUsed[GROW_PAGE_COUNT];
+void* apvGrowAllocs[GROW_PAGE_SIZE / sizeof(void*)];
+
+void* AllocGrowPage(uint32_t* pu32PageSize_)
+{
+    for (int i = 0; i < GROW_PAGE_COUNT; i++) {
+        if (!abGrowPageUsed[i]) {
+            abGrowPageUsed[i] = true;
+            *pu32PageSize_    = GROW_PAGE_SIZE;
+            return awGrowPages[i];
+        }
+    }
+    return nullptr;
+}
+
+void FreeGrowPage(void* pvPage_)
+{
+    for (int i = 0; i < GROW_PAGE_COUNT; i++) {
+        if (pvPage_ == awGrowPages[i]) {
+            abGrowPageUsed[i] = false;
+        }
+    }
+}
+
+bool IsInGrowPages(void* pvData_)
+{
+    auto adData = reinterpret_cast<K_ADDR>(pvData_);
+    return (adData >= reinterpret_cast<K_ADDR>(awGrowPages))
+        && (adData < reinterpret_cast<K_ADDR>(awGrowPages) + sizeof(awGrowPages));
+}
 } // anonymous namespace
 
 namespace Mark3 {
@@ -80,6 +130,10 @@ public:
         clHeap.Create(awHeap, clHeapConfig);
         return &clHeap;
     }
+    static FixedHeap* buildLarge() {
+        clLargeHeap.Create(awLargeHeap, clLargeHeapConfig);
+        return &clLargeHeap;
+    }
 };
 
 //---------------------------------------------------------------------------
@@ -262,6 +316,171 @@ TEST(ut_fixed_alloc_patterns_pass)
 }
 
 //---------------------------------------------------------------------------
+TEST(ut_fixed_size_class_pass)
+{
+    // For each bin, exhaust it using the smallest and largest sizes it is
+    // the best fit for - once it's exhausted (along with all larger bins),
+    // the same size must fail, while the next-smaller size still succeeds.
+    for (int bin = sizeof(auLargeSizes) / sizeof(size_t) - 1; bin >= 0; bin--) {
+        auto iut = IUT::buildLarge();
+        size_t lowest = (bin == 0) ? 1 : auLargeSizes[bin - 1] + 1;
+
+        // Exhaust every larger bin first
+        for (int i = sizeof(auLargeSizes) / sizeof(size_t) - 1; i > bin; i--) {
+            for (int j = 0; j < LARGE_BLOCK_COUNT; j++) {
+                EXPECT_TRUE(iut->Allocate(auLargeSizes[i]) != nullptr);
+            }
+        }
+
+        EXPECT_TRUE(iut->Allocate(lowest) != nullptr);
+        EXPECT_TRUE(iut->Allocate(auLargeSizes[bin]) != nullptr);
+        EXPECT_TRUE(iut->Allocate(lowest) == nullptr);
+        EXPECT_TRUE(iut->Allocate(auLargeSizes[bin]) == nullptr);
+        if (bin != 0) {
+            EXPECT_TRUE(iut->Allocate(lowest - 1) != nullptr);
+        }
+    }
+
+    auto iut = IUT::buildLarge();
+    EXPECT_TRUE(iut->Allocate(1001) == nullptr);
+    EXPECT_TRUE(iut->Allocate((size_t)-1) == nullptr);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_fixed_free_restores_bin_pass)
+{
+    auto iut = IUT::buildLarge();
+
+    // Exhaust the largest bin, free one block, and verify it is used again
+    void* pvAllocs[LARGE_BLOCK_COUNT];
+    for (int i = 0; i < LARGE_BLOCK_COUNT; i++) {
+        pvAllocs[i] = iut->Allocate(1000);
+        EXPECT_TRUE(pvAllocs[i] != nullptr);
+    }
+    EXPECT_TRUE(iut->Allocate(1000) == nullptr);
+
+    iut->Free(pvAllocs[0]);
+    EXPECT_TRUE(iut->Allocate(1000) == pvAllocs[0]);
+    EXPECT_TRUE(iut->Allocate(1000) == nullptr);
+
+#if !FIXED_HEAP_HEADERLESS
+    // Blocks with headers can be freed without a reference to their heap
+    FixedHeap::Free(pvAllocs[0]);
+    EXPECT_TRUE(iut->Allocate(1000) == pvAllocs[0]);
+#endif
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_fixed_block_contains_pass)
+{
+    auto iut = IUT::build();
+
+    // Blocks belong to exactly one bin, and only at their start address
+    auto* pu8Alloc = reinterpret_cast<uint8_t*>(iut->Allocate(BLOCK4_SIZE));
+    EXPECT_TRUE(clHeapConfig[4].m_clHeap.Contains(pu8Alloc));
+    EXPECT_FALSE(clHeapConfig[3].m_clHeap.Contains(pu8Alloc));
+    EXPECT_FALSE(clHeapConfig[4].m_clHeap.Contains(pu8Alloc + 1));
+
+    pu8Alloc = reinterpret_cast<uint8_t*>(iut->Allocate(BLOCK0_SIZE));
+    EXPECT_TRUE(clHeapConfig[0].m_clHeap.Contains(pu8Alloc));
+    EXPECT_FALSE(clHeapConfig[1].m_clHeap.Contains(pu8Alloc));
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_fixed_lazy_init_pass)
+{
+    // Creating the heap must not touch the heap memory, and blocks are only
+    // initialized as they are first handed out.
+    MemUtil::SetMemory(awHeap, 0xA5, sizeof(awHeap));
+    auto iut = IUT::build();
+    EXPECT_TRUE(reinterpret_cast<uint8_t*>(awHeap)[0] == 0xA5);
+
+    auto* pvBlock = iut->Allocate(BLOCK4_SIZE);
+    EXPECT_TRUE(pvBlock != nullptr);
+    EXPECT_TRUE(reinterpret_cast<uint8_t*>(awHeap)[0] == 0xA5);
+
+    // Freed blocks are reused before any untouched blocks are carved out
+    iut->Free(pvBlock);
+    EXPECT_TRUE(iut->Allocate(BLOCK4_SIZE) == pvBlock);
+    EXPECT_TRUE(iut->Allocate(BLOCK4_SIZE) != pvBlock);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_fixed_grow_bin_pass)
+{
+    auto iut = IUT::build();
+    iut->SetPageProvider(AllocGrowPage, FreeGrowPage);
+    iut->SetBinChunkLimit(0, 1);
+
+    // Exhaust the smallest bin's own blocks
+    for (int i = 0; i < BLOCK0_COUNT; i++) {
+        pvAllocs[i] = reinterpret_cast<uint8_t*>(iut->Allocate(BLOCK0_SIZE));
+        EXPECT_FALSE(IsInGrowPages(pvAllocs[i]));
+    }
+
+    // The bin grows by a page, instead of spilling into the next bin
+    int iGrown = 0;
+    while (true) {
+        auto* pvAlloc = reinterpret_cast<uint8_t*>(iut->Allocate(BLOCK0_SIZE));
+        if (!IsInGrowPages(pvAlloc)) {
+            // Over the bin's chunk limit - spilled into the next bin
+            EXPECT_TRUE(pvAlloc != nullptr);
+            EXPECT_TRUE(abGrowPageUsed[0] && !abGrowPageUsed[1]);
+            iut->Free(pvAlloc);
+            break;
+        }
+        apvGrowAllocs[iGrown++] = pvAlloc;
+    }
+    EXPECT_TRUE(iGrown > 0);
+    EXPECT_TRUE(iut->GetBinChunkCount(0) == 1);
+
+    // Bins without a chunk limit never grow
+    for (int i = 0; i < BLOCK4_COUNT; i++) {
+        EXPECT_FALSE(IsInGrowPages(iut->Allocate(BLOCK4_SIZE)));
+    }
+    EXPECT_TRUE(iut->Allocate(BLOCK4_SIZE) == nullptr);
+
+    // The page is kept until all of its blocks are freed
+    for (int i = 0; i < iGrown; i++) {
+        EXPECT_TRUE(abGrowPageUsed[0]);
+        iut->Free(apvGrowAllocs[i]);
+    }
+    EXPECT_FALSE(abGrowPageUsed[0]);
+    EXPECT_TRUE(iut->GetBinChunkCount(0) == 0);
+
+    // The bin's own blocks are still allocated, so it will grow again
+    auto* pvRegrown = iut->Allocate(BLOCK0_SIZE);
+    EXPECT_TRUE(IsInGrowPages(pvRegrown));
+    for (int i = 0; i < BLOCK0_COUNT; i++) {
+        iut->Free(pvAllocs[i]);
+    }
+    EXPECT_FALSE(IsInGrowPages(iut->Allocate(BLOCK0_SIZE)));
+
+    // Freeing the last block from the grown chunk returns its page
+    EXPECT_TRUE(abGrowPageUsed[0]);
+    iut->Free(pvRegrown);
+    EXPECT_FALSE(abGrowPageUsed[0] || abGrowPageUsed[1]);
+    EXPECT_TRUE(iut->GetBinChunkCount(0) == 0);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_fixed_too_many_bins_fail)
+{
+    for (int i = 0; i <= FIXED_HEAP_MAX_BINS; i++) {
+        clTooManyBinsConfig[i].m_uBlockSize  = sizeof(K_WORD) * (i + 1);
+        clTooManyBinsConfig[i].m_uBlockCount = 1;
+    }
+    clTooManyBinsConfig[FIXED_HEAP_MAX_BINS + 1].m_uBlockSize = 0;
+
+    // Bins are never silently dropped - the heap is left empty instead
+    FixedHeap clTooManyBins;
+    EXPECT_FALSE(clTooManyBins.Create(awHeap, clTooManyBinsConfig));
+    EXPECT_TRUE(clTooManyBins.Allocate(sizeof(K_WORD)) == nullptr);
+
+    clTooManyBinsConfig[FIXED_HEAP_MAX_BINS].m_uBlockSize = 0;
+    EXPECT_TRUE(clTooManyBins.Create(awHeap, clTooManyBinsConfig));
+    EXPECT_TRUE(clTooManyBins.Allocate(sizeof(K_WORD)) != nullptr);
+}
 
 //===========================================================================
 // Test Whitelist Goes Here
@@ -273,5 +492,11 @@ TEST_CASE(ut_fixed_exhaust_large_pass),
 TEST_CASE(ut_fixed_exhaust_exact_pass),
 TEST_CASE(ut_fixed_alloc_free_pass),
 TEST_CASE(ut_fixed_alloc_patterns_pass),
+TEST_CASE(ut_fixed_size_class_pass),
+TEST_CASE(ut_fixed_free_restores_bin_pass),
+TEST_CASE(ut_fixed_block_contains_pass),
+TEST_CASE(ut_fixed_lazy_init_pass),
+TEST_CASE(ut_fixed_grow_bin_pass),
+TEST_CASE(ut_fixed_too_many_bins_fail),
 TEST_CASE_END
 } // namespace mark3
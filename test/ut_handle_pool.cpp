@@ -0,0 +1,165 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "handle_pool.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+#define POOL_CAPACITY (8)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+typedef struct {
+    uint32_t u32Id;
+    uint16_t u16Value;
+} test_object_t;
+
+StaticHandlePool<test_object_t, POOL_CAPACITY> clPool;
+
+// Odd-sized objects, moved byte-by-byte
+uint8_t            au8RawObjects[POOL_CAPACITY * 3];
+handle_pool_slot_t astRawSlots[POOL_CAPACITY];
+pool_index_t       auRawSlotIndex[POOL_CAPACITY];
+HandlePool         clRawPool;
+
+// Sum of the ids of all objects, visited by dense iteration
+uint32_t SumIds()
+{
+    uint32_t u32Sum = 0;
+    for (auto* pstIt = clPool.Begin(); pstIt != clPool.End(); pstIt++) {
+        u32Sum += pstIt->u32Id;
+    }
+    return u32Sum;
+}
+} // anonymous namespace
+
+//===========================================================================
+// Define Test Cases Here
+//===========================================================================
+TEST(ut_handle_pool_alloc_free_pass)
+{
+    clPool.Init();
+    EXPECT_TRUE(clPool.GetCount() == 0);
+    EXPECT_TRUE(clPool.Get(HANDLE_POOL_INVALID_HANDLE) == nullptr);
+
+    pool_handle_t auHandles[POOL_CAPACITY];
+    for (uint32_t i = 0; i < POOL_CAPACITY; i++) {
+        auHandles[i] = clPool.Allocate();
+        EXPECT_TRUE(auHandles[i] != HANDLE_POOL_INVALID_HANDLE);
+        clPool.Get(auHandles[i])->u32Id = i + 1;
+    }
+    EXPECT_TRUE(clPool.Allocate() == HANDLE_POOL_INVALID_HANDLE);
+    EXPECT_TRUE(clPool.GetCount() == POOL_CAPACITY);
+
+    for (uint32_t i = 0; i < POOL_CAPACITY; i++) {
+        EXPECT_TRUE(clPool.Get(auHandles[i])->u32Id == i + 1);
+    }
+
+    // Freed handles are rejected, and freeing twice fails
+    EXPECT_TRUE(clPool.Free(auHandles[3]));
+    EXPECT_TRUE(!clPool.IsValid(auHandles[3]));
+    EXPECT_TRUE(!clPool.Free(auHandles[3]));
+    EXPECT_TRUE(clPool.GetCount() == POOL_CAPACITY - 1);
+}
+
+//===========================================================================
+TEST(ut_handle_pool_dense_pass)
+{
+    clPool.Init();
+    pool_handle_t auHandles[POOL_CAPACITY];
+    for (uint32_t i = 0; i < POOL_CAPACITY; i++) {
+        auHandles[i]                    = clPool.Allocate();
+        clPool.Get(auHandles[i])->u32Id = i + 1;
+    }
+    EXPECT_TRUE(SumIds() == 36);
+
+    // Freeing from the middle keeps the objects packed, and handles to the
+    // moved objects still resolve
+    clPool.Free(auHandles[0]);
+    clPool.Free(auHandles[5]);
+    EXPECT_TRUE(clPool.GetCount() == POOL_CAPACITY - 2);
+    EXPECT_TRUE(SumIds() == 36 - 1 - 6);
+    for (uint32_t i = 0; i < POOL_CAPACITY; i++) {
+        if ((i != 0) && (i != 5)) {
+            EXPECT_TRUE(clPool.Get(auHandles[i])->u32Id == i + 1);
+        }
+    }
+
+    // Each position maps back to the handle of the object stored there
+    for (pool_index_t i = 0; i < clPool.GetCount(); i++) {
+        EXPECT_TRUE(clPool.Get(clPool.GetHandle(i)) == clPool.Begin() + i);
+    }
+    EXPECT_TRUE(clPool.GetHandle(clPool.GetCount()) == HANDLE_POOL_INVALID_HANDLE);
+}
+
+//===========================================================================
+TEST(ut_handle_pool_generation_pass)
+{
+    clPool.Init();
+    auto uFirst = clPool.Allocate();
+    clPool.Free(uFirst);
+
+    // The slot is reused, but the old handle stays stale
+    auto uSecond = clPool.Allocate();
+    EXPECT_TRUE(uSecond != uFirst);
+    EXPECT_TRUE(clPool.Get(uFirst) == nullptr);
+    EXPECT_TRUE(clPool.Get(uSecond) != nullptr);
+
+    // Generations wrap without producing an invalid handle
+    auto bValid = true;
+    for (uint32_t i = 0; i < 70000; i++) {
+        clPool.Free(uSecond);
+        uSecond = clPool.Allocate();
+        bValid  = bValid && (uSecond != HANDLE_POOL_INVALID_HANDLE) && clPool.IsValid(uSecond);
+    }
+    EXPECT_TRUE(bValid);
+    EXPECT_TRUE(clPool.GetCount() == 1);
+}
+
+//===========================================================================
+TEST(ut_handle_pool_untyped_pass)
+{
+    clRawPool.Init(au8RawObjects, astRawSlots, auRawSlotIndex, POOL_CAPACITY, 3);
+
+    pool_handle_t auHandles[4];
+    for (uint8_t i = 0; i < 4; i++) {
+        auHandles[i] = clRawPool.Allocate();
+        MemUtil::SetMemory(clRawPool.Get(auHandles[i]), i, 3);
+    }
+    clRawPool.Free(auHandles[1]);
+
+    // The last object now sits in the freed position
+    auto* pu8Moved = static_cast<uint8_t*>(clRawPool.Get(auHandles[3]));
+    EXPECT_TRUE(pu8Moved == &au8RawObjects[3]);
+    EXPECT_TRUE((pu8Moved[0] == 3) && (pu8Moved[1] == 3) && (pu8Moved[2] == 3));
+    EXPECT_TRUE(clRawPool.GetObjects() == au8RawObjects);
+    EXPECT_TRUE(clRawPool.GetCount() == 3);
+}
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_handle_pool_alloc_free_pass),
+TEST_CASE(ut_handle_pool_dense_pass),
+TEST_CASE(ut_handle_pool_generation_pass),
+TEST_CASE(ut_handle_pool_untyped_pass),
+TEST_CASE_END
+} // namespace mark3
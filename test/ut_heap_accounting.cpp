@@ -0,0 +1,173 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "heap_accounting.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+#define TAG_NETWORK (0)
+#define TAG_CONTROL (1)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+K_WORD awArenaMem[2048 / sizeof(K_WORD)];
+K_ADDR auArenaSizes[] = { 16, 32, 64, 128, 256 };
+
+Arena          clArena;
+ArenaResource  clArenaResource;
+HeapAccounting clAccounting;
+TaggedResource clNetwork;
+TaggedResource clControl;
+
+heap_tag_t uOverrunTag;
+uint32_t   u32OverrunBytes;
+uint32_t   u32OverrunCount;
+
+void OnSoftQuota(void* pvContext_, heap_tag_t uTag_, uint32_t u32LiveBytes_)
+{
+    uOverrunTag     = uTag_;
+    u32OverrunBytes = u32LiveBytes_;
+    (*static_cast<uint32_t*>(pvContext_))++;
+}
+
+void InitAccounting()
+{
+    clArena.Init(awArenaMem, sizeof(awArenaMem), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+    clArenaResource.Init(&clArena);
+    clAccounting.Init();
+    clNetwork.Init(&clArenaResource, &clAccounting, TAG_NETWORK);
+    clControl.Init(&clArenaResource, &clAccounting, TAG_CONTROL);
+}
+} // anonymous namespace
+
+//===========================================================================
+// Define Test Cases Here
+//===========================================================================
+TEST(ut_heap_accounting_stats_pass)
+{
+    InitAccounting();
+    heap_tag_stats_t stStats;
+
+    auto* pvFirst  = clNetwork.Allocate(100);
+    auto* pvSecond = clNetwork.Allocate(20);
+    auto* pvOther  = clControl.Allocate(8);
+    EXPECT_TRUE((pvFirst != nullptr) && (pvSecond != nullptr) && (pvOther != nullptr));
+
+    EXPECT_TRUE(clAccounting.GetStats(TAG_NETWORK, &stStats));
+    EXPECT_TRUE(stStats.u32LiveBytes == 120);
+    EXPECT_TRUE(stStats.u32LiveObjects == 2);
+    EXPECT_TRUE(stStats.u32PeakBytes == 120);
+    EXPECT_TRUE(clAccounting.GetTotalLiveBytes() == 128);
+
+    // Frees are credited back, the peak is retained
+    clNetwork.Free(pvFirst, 100);
+    clAccounting.GetStats(TAG_NETWORK, &stStats);
+    EXPECT_TRUE(stStats.u32LiveBytes == 20);
+    EXPECT_TRUE(stStats.u32LiveObjects == 1);
+    EXPECT_TRUE(stStats.u32PeakBytes == 120);
+
+    clNetwork.Free(pvSecond, 20);
+    clControl.Free(pvOther, 8);
+    EXPECT_TRUE(clAccounting.GetTotalLiveBytes() == 0);
+    EXPECT_TRUE(!clAccounting.GetStats(HEAP_ACCOUNTING_MAX_TAGS, &stStats));
+}
+
+//===========================================================================
+TEST(ut_heap_accounting_hard_quota_pass)
+{
+    InitAccounting();
+    clAccounting.SetQuota(TAG_NETWORK, HEAP_QUOTA_NONE, 256);
+    heap_tag_stats_t stStats;
+
+    // The runaway subsystem is cut off at its quota...
+    uint32_t u32Count = 0;
+    while (clNetwork.Allocate(64) != nullptr) {
+        u32Count++;
+    }
+    EXPECT_TRUE(u32Count == 4);
+    clAccounting.GetStats(TAG_NETWORK, &stStats);
+    EXPECT_TRUE(stStats.u32LiveBytes == 256);
+    EXPECT_TRUE(stStats.u32Rejected == 1);
+    EXPECT_TRUE(stStats.u32Failures == 0);
+
+    // ... while the others can still allocate from the shared arena
+    EXPECT_TRUE(clControl.Allocate(256) != nullptr);
+}
+
+//===========================================================================
+TEST(ut_heap_accounting_soft_quota_pass)
+{
+    InitAccounting();
+    clAccounting.SetQuota(TAG_CONTROL, 64, HEAP_QUOTA_NONE);
+    clAccounting.SetSoftQuotaHandler(OnSoftQuota, &u32OverrunCount);
+    u32OverrunCount = 0;
+    heap_tag_stats_t stStats;
+
+    // Overruns are allowed, but only reported once per overrun
+    void* apvAllocs[4];
+    for (uint8_t i = 0; i < 4; i++) {
+        apvAllocs[i] = clControl.Allocate(32);
+        EXPECT_TRUE(apvAllocs[i] != nullptr);
+    }
+    EXPECT_TRUE(u32OverrunCount == 1);
+    EXPECT_TRUE(uOverrunTag == TAG_CONTROL);
+    EXPECT_TRUE(u32OverrunBytes == 96);
+    clAccounting.GetStats(TAG_CONTROL, &stStats);
+    EXPECT_TRUE(stStats.u32SoftOverruns == 2);
+
+    // Dropping back under the quota re-arms the handler
+    clControl.Free(apvAllocs[3], 32);
+    clControl.Free(apvAllocs[2], 32);
+    EXPECT_TRUE(u32OverrunCount == 1);
+    apvAllocs[2] = clControl.Allocate(32);
+    EXPECT_TRUE(u32OverrunCount == 2);
+}
+
+//===========================================================================
+TEST(ut_heap_accounting_failure_pass)
+{
+    InitAccounting();
+    heap_tag_stats_t stStats;
+
+    // A request the allocator can't satisfy is not left charged to the tag
+    EXPECT_TRUE(clNetwork.Allocate(1024) == nullptr);
+    clAccounting.GetStats(TAG_NETWORK, &stStats);
+    EXPECT_TRUE(stStats.u32LiveBytes == 0);
+    EXPECT_TRUE(stStats.u32LiveObjects == 0);
+    EXPECT_TRUE(stStats.u32Failures == 1);
+    EXPECT_TRUE(stStats.u32Rejected == 0);
+
+    // Direct accounting of allocations made outside a resource
+    EXPECT_TRUE(clAccounting.Charge(TAG_CONTROL, 48));
+    EXPECT_TRUE(!clAccounting.Charge(HEAP_ACCOUNTING_MAX_TAGS, 48));
+    clAccounting.Credit(TAG_CONTROL, 48);
+    EXPECT_TRUE(clAccounting.GetTotalLiveBytes() == 0);
+}
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_heap_accounting_stats_pass),
+TEST_CASE(ut_heap_accounting_hard_quota_pass),
+TEST_CASE(ut_heap_accounting_soft_quota_pass),
+TEST_CASE(ut_heap_accounting_failure_pass),
+TEST_CASE_END
+} // namespace mark3
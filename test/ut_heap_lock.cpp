@@ -0,0 +1,144 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "heap_lock.h"
+#include "arena.h"
+#include "slab.h"
+#include "ut_platform.h"
+
+#define SLAB_PAGE_SIZE (256)
+#define SLAB_PAGE_COUNT (4)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+HeapSpinLock     clSpinLock;
+HeapNullLock     clNullLock;
+HeapCriticalLock clCriticalLock;
+
+K_WORD awArenaMem[1024 / sizeof(K_WORD)];
+K_ADDR auArenaSizes[] = { 16, 32, 64, 128 };
+
+K_WORD          awPageMem[(SLAB_PAGE_SIZE * SLAB_PAGE_COUNT) / sizeof(K_WORD)];
+BitmapAllocator clPageAllocator;
+Slab            clSlab;
+
+void* AllocPage(uint32_t* pu32PageSize_)
+{
+    *pu32PageSize_ = SLAB_PAGE_SIZE;
+    return clPageAllocator.Allocate(nullptr);
+}
+
+void FreePage(void* pvPage_)
+{
+    clPageAllocator.Free(pvPage_);
+}
+} // anonymous namespace
+
+//===========================================================================
+// Define Test Cases Here
+//===========================================================================
+TEST(ut_heap_lock_spin_pass)
+{
+    clSpinLock.Init();
+    EXPECT_TRUE(clSpinLock.TryLock());
+    EXPECT_TRUE(!clSpinLock.TryLock());
+    clSpinLock.Unlock();
+
+    clSpinLock.Lock();
+    EXPECT_TRUE(!clSpinLock.TryLock());
+    clSpinLock.Unlock();
+    EXPECT_TRUE(clSpinLock.TryLock());
+    clSpinLock.Unlock();
+}
+
+//===========================================================================
+TEST(ut_heap_lock_guard_pass)
+{
+    clSpinLock.Init();
+    {
+        HeapLockGuard<HeapSpinLock> clGuard(&clSpinLock);
+        EXPECT_TRUE(!clSpinLock.TryLock());
+    }
+    EXPECT_TRUE(clSpinLock.TryLock());
+    clSpinLock.Unlock();
+
+    // Policies without exclusive ownership never report contention
+    {
+        HeapLockGuard<HeapNullLock> clGuard(&clNullLock);
+        EXPECT_TRUE(clNullLock.TryLock());
+    }
+    clCriticalLock.Init();
+    {
+        HeapLockGuard<HeapCriticalLock> clGuard(&clCriticalLock);
+        EXPECT_TRUE(clCriticalLock.TryLock());
+        clCriticalLock.Unlock();
+    }
+}
+
+//===========================================================================
+TEST(ut_heap_lock_allocators_pass)
+{
+    // The allocators release their locks on every path, so operations
+    // can be repeated (including ones that fail, or call out to the page
+    // allocator) without deadlocking.  This test is built against each
+    // locking policy (see the ut_heap_lock_* targets).
+    Arena clArena;
+    clArena.Init(awArenaMem, sizeof(awArenaMem), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+    void* pvArena = clArena.Allocate(32);
+    EXPECT_TRUE(pvArena != nullptr);
+    EXPECT_TRUE(clArena.Allocate(4096) == nullptr);
+    clArena.Free(pvArena);
+    clArena.Free(pvArena);
+    EXPECT_TRUE(clArena.Allocate(32) == pvArena);
+
+    clPageAllocator.Init(awPageMem, sizeof(awPageMem), SLAB_PAGE_SIZE);
+    clSlab.Init(32, AllocPage, FreePage);
+    clSlab.SetPageCacheLimit(1);
+
+    void*    apvObjs[SLAB_PAGE_COUNT * (SLAB_PAGE_SIZE / 32)];
+    uint32_t u32Count = 0;
+    while (u32Count < (sizeof(apvObjs) / sizeof(void*))) {
+        apvObjs[u32Count] = clSlab.Alloc();
+        if (apvObjs[u32Count] == nullptr) {
+            break;
+        }
+        u32Count++;
+    }
+    EXPECT_TRUE(u32Count != 0);
+    EXPECT_TRUE(clSlab.Alloc() == nullptr);
+
+    for (uint32_t i = 0; i < u32Count; i++) {
+        clSlab.Free(apvObjs[i]);
+    }
+    EXPECT_TRUE(clSlab.GetEmptyPageCount() == 1);
+    EXPECT_TRUE(clSlab.Shrink(SLAB_PAGE_SIZE) == SLAB_PAGE_SIZE);
+    EXPECT_TRUE(clPageAllocator.IsEmpty());
+    clSlab.SetPageCacheLimit(0);
+}
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_heap_lock_spin_pass),
+TEST_CASE(ut_heap_lock_guard_pass),
+TEST_CASE(ut_heap_lock_allocators_pass),
+TEST_CASE_END
+} // namespace mark3
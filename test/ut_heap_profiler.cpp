@@ -0,0 +1,278 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "heap_profiler.h"
+#include "fixed_heap.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+// Addresses recorded by the profiler are never dereferenced
+#define FAKE_ALLOC(x) (reinterpret_cast<void*>((K_ADDR)(0x1000 + ((x) * sizeof(void*)))))
+
+#define SMALL_SIZE (10)
+#define SMALL_COUNT (5)
+#define MEDIUM_SIZE (30)
+#define MEDIUM_COUNT (3)
+#define LARGE_SIZE (200)
+#define LARGE_COUNT (1)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+HeapProfiler clProfiler;
+HeapConfig aclConfig[HEAP_PROFILER_MAX_BINS + 1];
+
+char acOutput[1024];
+size_t uOutputLen;
+
+void WriteOutput(void* /*pvContext_*/, const char* szText_)
+{
+    while (*szText_ && (uOutputLen < (sizeof(acOutput) - 1))) {
+        acOutput[uOutputLen++] = *szText_++;
+    }
+    acOutput[uOutputLen] = '\0';
+}
+
+bool OutputContains(const char* szText_)
+{
+    size_t uLen = 0;
+    while (szText_[uLen]) {
+        uLen++;
+    }
+    for (size_t i = 0; (i + uLen) <= uOutputLen; i++) {
+        if (MemUtil::CompareMemory(&acOutput[i], szText_, uLen)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Record a workload with 3 distinct sizes, all live at once
+void RecordWorkload()
+{
+    clProfiler.Init();
+    int iAlloc = 0;
+    for (int i = 0; i < SMALL_COUNT; i++) {
+        clProfiler.RecordAllocate(SMALL_SIZE, FAKE_ALLOC(iAlloc++), false);
+    }
+    for (int i = 0; i < MEDIUM_COUNT; i++) {
+        clProfiler.RecordAllocate(MEDIUM_SIZE, FAKE_ALLOC(iAlloc++), false);
+    }
+    for (int i = 0; i < LARGE_COUNT; i++) {
+        clProfiler.RecordAllocate(LARGE_SIZE, FAKE_ALLOC(iAlloc++), false);
+    }
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_profiler_histogram_pass)
+{
+    clProfiler.Init();
+
+    clProfiler.RecordAllocate(SMALL_SIZE, FAKE_ALLOC(0), false);
+    clProfiler.RecordAllocate(SMALL_SIZE - 1, FAKE_ALLOC(1), true);
+    clProfiler.RecordAllocate(SMALL_SIZE, nullptr, false);
+    clProfiler.RecordFree(FAKE_ALLOC(0));
+    clProfiler.RecordAllocate(SMALL_SIZE, FAKE_ALLOC(2), false);
+
+    auto* pstStats = clProfiler.GetBucket(HeapProfiler::GetBucketForSize(SMALL_SIZE));
+    EXPECT_TRUE(pstStats->u32Allocs == 3);
+    EXPECT_TRUE(pstStats->u32Bytes == ((SMALL_SIZE * 3) - 1));
+    EXPECT_TRUE(pstStats->u32Failures == 1);
+    EXPECT_TRUE(pstStats->u32Spills == 1);
+    EXPECT_TRUE(pstStats->u16Live == 2);
+    EXPECT_TRUE(pstStats->u16PeakLive == 2);
+    EXPECT_TRUE(pstStats->uMaxSize == SMALL_SIZE);
+
+    // Freeing untracked pointers has no effect
+    clProfiler.RecordFree(FAKE_ALLOC(3));
+    clProfiler.RecordFree(nullptr);
+    EXPECT_TRUE(pstStats->u16Live == 2);
+
+    // Oversized requests land in the last bucket
+    EXPECT_TRUE(HeapProfiler::GetBucketForSize((size_t)-1) == (HEAP_PROFILER_BUCKETS - 1));
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_profiler_live_table_pass)
+{
+    // Addresses that all hash to the same slot, wrapping around the table
+    clProfiler.Init();
+    for (int i = 0; i < 8; i++) {
+        clProfiler.RecordAllocate(SMALL_SIZE, FAKE_ALLOC((i * HEAP_PROFILER_MAX_LIVE) - 4), false);
+    }
+
+    // Removing from the middle of the probe sequence keeps the rest reachable
+    for (int i = 0; i < 8; i += 2) {
+        clProfiler.RecordFree(FAKE_ALLOC((i * HEAP_PROFILER_MAX_LIVE) - 4));
+    }
+    auto* pstStats = clProfiler.GetBucket(HeapProfiler::GetBucketForSize(SMALL_SIZE));
+    EXPECT_TRUE(pstStats->u16Live == 4);
+    for (int i = 1; i < 8; i += 2) {
+        clProfiler.RecordFree(FAKE_ALLOC((i * HEAP_PROFILER_MAX_LIVE) - 4));
+    }
+    EXPECT_TRUE(pstStats->u16Live == 0);
+    EXPECT_TRUE(pstStats->u16PeakLive == 8);
+
+    // The table is bounded - excess allocations are counted as untracked
+    for (int i = 0; i < HEAP_PROFILER_MAX_LIVE; i++) {
+        clProfiler.RecordAllocate(SMALL_SIZE, FAKE_ALLOC(i), false);
+    }
+    EXPECT_TRUE(clProfiler.GetUntracked() == 1);
+    EXPECT_TRUE(clProfiler.GetPeakLive() == (HEAP_PROFILER_MAX_LIVE - 1));
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_profiler_generate_config_pass)
+{
+    RecordWorkload();
+
+    // One bin per size
+    EXPECT_TRUE(clProfiler.GenerateConfig(aclConfig, 3, 0) == 3);
+    EXPECT_TRUE(aclConfig[0].m_uBlockSize >= SMALL_SIZE);
+    EXPECT_TRUE(aclConfig[0].m_uBlockSize < MEDIUM_SIZE);
+    EXPECT_TRUE(aclConfig[0].m_uBlockCount == SMALL_COUNT);
+    EXPECT_TRUE(aclConfig[1].m_uBlockSize >= MEDIUM_SIZE);
+    EXPECT_TRUE(aclConfig[1].m_uBlockSize < LARGE_SIZE);
+    EXPECT_TRUE(aclConfig[1].m_uBlockCount == MEDIUM_COUNT);
+    EXPECT_TRUE(aclConfig[2].m_uBlockSize == LARGE_SIZE);
+    EXPECT_TRUE(aclConfig[2].m_uBlockCount == LARGE_COUNT);
+    EXPECT_TRUE(aclConfig[3].m_uBlockSize == 0);
+
+    // With two bins, merging the small and medium sizes wastes the least
+    EXPECT_TRUE(clProfiler.GenerateConfig(aclConfig, 2, 0) == 2);
+    EXPECT_TRUE(aclConfig[0].m_uBlockSize >= MEDIUM_SIZE);
+    EXPECT_TRUE(aclConfig[0].m_uBlockSize < LARGE_SIZE);
+    EXPECT_TRUE(aclConfig[0].m_uBlockCount == (SMALL_COUNT + MEDIUM_COUNT));
+    EXPECT_TRUE(aclConfig[1].m_uBlockSize == LARGE_SIZE);
+    EXPECT_TRUE(aclConfig[2].m_uBlockSize == 0);
+
+    // Block counts scale to fill the budget
+    size_t uTotal = 0;
+    for (int i = 0; i < 2; i++) {
+        uTotal += BlockHeap::GetBlockStride(aclConfig[i].m_uBlockSize) * aclConfig[i].m_uBlockCount;
+    }
+    clProfiler.GenerateConfig(aclConfig, 2, uTotal * 2);
+    EXPECT_TRUE(aclConfig[0].m_uBlockCount == ((SMALL_COUNT + MEDIUM_COUNT) * 2));
+    EXPECT_TRUE(aclConfig[1].m_uBlockCount == (LARGE_COUNT * 2));
+
+    // Rounding small counts up to a single block never breaks the budget,
+    // as long as the budget can hold one block per bin
+    uTotal      = 0;
+    size_t uMin = 0;
+    clProfiler.GenerateConfig(aclConfig, 3, 0);
+    for (int i = 0; i < 3; i++) {
+        uTotal += BlockHeap::GetBlockStride(aclConfig[i].m_uBlockSize) * aclConfig[i].m_uBlockCount;
+        uMin += BlockHeap::GetBlockStride(aclConfig[i].m_uBlockSize);
+    }
+    for (size_t uBudget = uMin; uBudget <= uTotal; uBudget += sizeof(void*)) {
+        clProfiler.GenerateConfig(aclConfig, 3, uBudget);
+        size_t uUsed = 0;
+        for (int i = 0; i < 3; i++) {
+            EXPECT_TRUE(aclConfig[i].m_uBlockCount != 0);
+            uUsed += BlockHeap::GetBlockStride(aclConfig[i].m_uBlockSize) * aclConfig[i].m_uBlockCount;
+        }
+        EXPECT_TRUE(uUsed <= uBudget);
+    }
+
+    // Nothing recorded, nothing generated
+    clProfiler.Init();
+    EXPECT_TRUE(clProfiler.GenerateConfig(aclConfig, 2, 0) == 0);
+    EXPECT_TRUE(aclConfig[0].m_uBlockSize == 0);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_profiler_arena_sizes_pass)
+{
+    RecordWorkload();
+
+    K_ADDR auSizes[4];
+    clProfiler.GenerateArenaSizes(auSizes, 4);
+    EXPECT_TRUE(auSizes[0] >= SMALL_SIZE);
+    for (int i = 1; i < 4; i++) {
+        EXPECT_TRUE(auSizes[i] > auSizes[i - 1]);
+    }
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_profiler_write_config_pass)
+{
+    RecordWorkload();
+    clProfiler.GenerateConfig(aclConfig, 3, 0);
+
+    uOutputLen = 0;
+    HeapProfiler::WriteConfig(aclConfig, WriteOutput, nullptr);
+    EXPECT_TRUE(OutputContains("#define HEAP_NUM_SIZES (3)\n"));
+    EXPECT_TRUE(OutputContains("#define HEAP_BLOCK_SIZE_3 ((uint16_t)200)\n"));
+    EXPECT_TRUE(OutputContains("#define HEAP_BLOCK_COUNT_1 ((uint16_t)5)\n"));
+    EXPECT_TRUE(OutputContains("#define HEAP_BLOCK_COUNT_10 ((uint16_t)0)\n"));
+}
+
+#if HEAP_PROFILER_ENABLE
+namespace {
+K_WORD awHeap[256];
+HeapConfig aclHeapConfig[] = {
+    { .m_uBlockSize = 16, .m_uBlockCount = 2 },
+    { .m_uBlockSize = 64, .m_uBlockCount = 2 },
+    { .m_uBlockSize = 0 },
+};
+FixedHeap clHeap;
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_profiler_fixed_heap_pass)
+{
+    clProfiler.Init();
+    clHeap.Create(awHeap, aclHeapConfig);
+    clHeap.SetProfiler(&clProfiler);
+
+    // Two allocations fit the small bin, the third spills, then failures
+    void* apvAllocs[4];
+    for (auto& pvAlloc : apvAllocs) {
+        pvAlloc = clHeap.Allocate(SMALL_SIZE);
+    }
+    EXPECT_TRUE(clHeap.Allocate(LARGE_SIZE) == nullptr);
+
+    auto* pstStats = clProfiler.GetBucket(HeapProfiler::GetBucketForSize(SMALL_SIZE));
+    EXPECT_TRUE(pstStats->u32Allocs == 4);
+    EXPECT_TRUE(pstStats->u32Spills == 2);
+    EXPECT_TRUE(pstStats->u16PeakLive == 4);
+    EXPECT_TRUE(clProfiler.GetBucket(HeapProfiler::GetBucketForSize(LARGE_SIZE))->u32Failures == 1);
+
+    for (auto& pvAlloc : apvAllocs) {
+        clHeap.Free(pvAlloc);
+    }
+    EXPECT_TRUE(pstStats->u16Live == 0);
+}
+#endif
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_profiler_histogram_pass),
+TEST_CASE(ut_profiler_live_table_pass),
+TEST_CASE(ut_profiler_generate_config_pass),
+TEST_CASE(ut_profiler_arena_sizes_pass),
+TEST_CASE(ut_profiler_write_config_pass),
+#if HEAP_PROFILER_ENABLE
+TEST_CASE(ut_profiler_fixed_heap_pass),
+#endif
+TEST_CASE_END
+} // namespace mark3
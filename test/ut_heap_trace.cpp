@@ -0,0 +1,273 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "heap_trace.h"
+#include "arena.h"
+#include "fixed_heap.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+// Addresses recorded by the trace are never dereferenced
+#define FAKE_ALLOC(x) (reinterpret_cast<void*>((K_ADDR)(0x1000 + ((x) * sizeof(void*)))))
+#define FAKE_ID(x) ((K_ADDR)(0x1000 + ((x) * sizeof(void*))))
+
+#define MAX_CAPTURED (256)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+HeapTrace  clTrace;
+HeapReplay clReplay;
+
+heap_trace_record_t astCaptured[MAX_CAPTURED];
+uint32_t            u32Captured;
+uint16_t            u16Flushes;
+
+void CaptureRecords(void* /*pvContext_*/, const heap_trace_record_t* pastRecords_, uint16_t u16Count_)
+{
+    for (uint16_t i = 0; (i < u16Count_) && (u32Captured < MAX_CAPTURED); i++) {
+        astCaptured[u32Captured++] = pastRecords_[i];
+    }
+    u16Flushes++;
+}
+
+void StartCapture()
+{
+    u32Captured = 0;
+    u16Flushes  = 0;
+    clTrace.Init(CaptureRecords, nullptr);
+}
+
+K_WORD awArenaMem[2048 / sizeof(K_WORD)];
+K_ADDR auArenaSizes[] = { 16, 32, 64, 128, 256 };
+Arena  clArena;
+
+void* ArenaAlloc(size_t uSize_)
+{
+    return clArena.Allocate(uSize_);
+}
+
+void ArenaFree(void* pvData_)
+{
+    clArena.Free(pvData_);
+}
+
+K_WORD     awFixedMem[256];
+HeapConfig aclFixedConfig[] = {
+    { .m_uBlockSize = 16, .m_uBlockCount = 4 },
+    { .m_uBlockSize = 64, .m_uBlockCount = 2 },
+    { .m_uBlockSize = 0 },
+};
+FixedHeap clFixed;
+
+void* FixedAlloc(size_t uSize_)
+{
+    return clFixed.Allocate(uSize_);
+}
+
+void FixedFree(void* pvData_)
+{
+    clFixed.Free(pvData_);
+}
+
+void SetRecord(heap_trace_record_t* pstRecord_, uint8_t u8Op_, uint32_t u32Size_, K_ADDR adId_)
+{
+    pstRecord_->u8Op         = u8Op_;
+    pstRecord_->u8Thread     = HEAP_TRACE_NO_THREAD;
+    pstRecord_->u32Size      = u32Size_;
+    pstRecord_->adId         = adId_;
+    pstRecord_->u32Timestamp = 0;
+}
+} // anonymous namespace
+
+//===========================================================================
+// Define Test Cases Here
+//===========================================================================
+TEST(ut_trace_capture_pass)
+{
+    StartCapture();
+
+    // Records are never written out while recording - only by Flush()
+    for (int i = 0; i < (HEAP_TRACE_BUFFER_RECORDS / 2) - 1; i++) {
+        clTrace.RecordAllocate(i + 1, FAKE_ALLOC(i));
+    }
+    EXPECT_FALSE(clTrace.IsFlushPending());
+    clTrace.RecordFree(FAKE_ALLOC(0));
+    EXPECT_TRUE(clTrace.IsFlushPending());
+    clTrace.RecordAllocate(100, nullptr);
+    EXPECT_TRUE(u16Flushes == 0);
+    EXPECT_TRUE(u32Captured == 0);
+
+    // The full half is written out before the partial one
+    clTrace.Flush();
+    EXPECT_TRUE(u16Flushes == 2);
+    EXPECT_TRUE(u32Captured == ((HEAP_TRACE_BUFFER_RECORDS / 2) + 1));
+    EXPECT_FALSE(clTrace.IsFlushPending());
+    clTrace.Flush();
+    EXPECT_TRUE(u16Flushes == 2);
+    EXPECT_TRUE(clTrace.GetDropped() == 0);
+
+    // Records are written out in order
+    EXPECT_TRUE(astCaptured[0].u8Op == HEAP_TRACE_OP_ALLOC);
+    EXPECT_TRUE(astCaptured[0].u32Size == 1);
+    EXPECT_TRUE(astCaptured[0].adId == FAKE_ID(0));
+    EXPECT_TRUE(astCaptured[(HEAP_TRACE_BUFFER_RECORDS / 2) - 1].u8Op == HEAP_TRACE_OP_FREE);
+    EXPECT_TRUE(astCaptured[(HEAP_TRACE_BUFFER_RECORDS / 2) - 1].adId == FAKE_ID(0));
+
+    // Failed allocations are recorded with an ID of 0
+    EXPECT_TRUE(astCaptured[HEAP_TRACE_BUFFER_RECORDS / 2].u32Size == 100);
+    EXPECT_TRUE(astCaptured[HEAP_TRACE_BUFFER_RECORDS / 2].adId == 0);
+}
+
+//===========================================================================
+TEST(ut_trace_drop_until_flush_pass)
+{
+    StartCapture();
+
+    // Records are dropped once both halves fill, until Flush() is called
+    for (int i = 0; i < HEAP_TRACE_BUFFER_RECORDS + 2; i++) {
+        clTrace.RecordAllocate(i + 1, FAKE_ALLOC(i));
+    }
+    EXPECT_TRUE(u16Flushes == 0);
+    EXPECT_TRUE(clTrace.GetDropped() == 2);
+
+    clTrace.Flush();
+    EXPECT_TRUE(u16Flushes == 2);
+    EXPECT_TRUE(u32Captured == HEAP_TRACE_BUFFER_RECORDS);
+    EXPECT_TRUE(astCaptured[HEAP_TRACE_BUFFER_RECORDS - 1].u32Size == HEAP_TRACE_BUFFER_RECORDS);
+
+    clTrace.RecordFree(FAKE_ALLOC(0));
+    EXPECT_TRUE(clTrace.GetDropped() == 2);
+}
+
+//===========================================================================
+TEST(ut_trace_replay_arena_pass)
+{
+    heap_trace_record_t astTrace[6];
+    SetRecord(&astTrace[0], HEAP_TRACE_OP_ALLOC, 100, FAKE_ID(0));
+    SetRecord(&astTrace[1], HEAP_TRACE_OP_ALLOC, 60, FAKE_ID(1));
+    SetRecord(&astTrace[2], HEAP_TRACE_OP_FREE, 0, FAKE_ID(0));
+    SetRecord(&astTrace[3], HEAP_TRACE_OP_ALLOC, 20, FAKE_ID(2));
+    SetRecord(&astTrace[4], HEAP_TRACE_OP_FREE, 0, FAKE_ID(7));
+    SetRecord(&astTrace[5], HEAP_TRACE_OP_ALLOC, 4000, 0);
+
+    clArena.Init(awArenaMem, sizeof(awArenaMem), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+    clReplay.Init(ArenaAlloc, ArenaFree);
+
+    uint32_t au32Counts[sizeof(auArenaSizes) / sizeof(K_ADDR)];
+    uint32_t u32BlockSize;
+    for (uint8_t i = 0; i < clArena.GetListCount(); i++) {
+        clArena.GetListInfo(i, &u32BlockSize, &au32Counts[i]);
+    }
+
+    // Replay in two pieces - the results span both
+    clReplay.Replay(&astTrace[0], 3);
+    clReplay.Replay(&astTrace[3], 3);
+    auto* pstResult = clReplay.Finish();
+
+    EXPECT_TRUE(pstResult->u32Ops == 6);
+    EXPECT_TRUE(pstResult->u32Failures == 1);
+    EXPECT_TRUE(pstResult->u32Untracked == 0);
+    EXPECT_TRUE(pstResult->uPeakLive == 160);
+    EXPECT_TRUE(pstResult->uPeakFootprint >= 160);
+    EXPECT_TRUE(pstResult->uPeakFootprint < sizeof(awArenaMem));
+    EXPECT_TRUE(pstResult->u16Fragmentation < 1000);
+
+    // Everything still live at the end of the trace has been freed, leaving
+    // the arena as it was before the replay.
+    for (uint8_t i = 0; i < clArena.GetListCount(); i++) {
+        uint32_t u32Count;
+        clArena.GetListInfo(i, &u32BlockSize, &u32Count);
+        EXPECT_TRUE(u32Count == au32Counts[i]);
+    }
+}
+
+//===========================================================================
+TEST(ut_trace_replay_reused_id_pass)
+{
+    // A reused ID with no free in between (i.e. a dropped record) releases
+    // the previous allocation instead of leaking it.
+    heap_trace_record_t astTrace[8];
+    for (int i = 0; i < 8; i++) {
+        SetRecord(&astTrace[i], HEAP_TRACE_OP_ALLOC, 16, FAKE_ID(0));
+    }
+
+    clFixed.Create(awFixedMem, aclFixedConfig);
+    clReplay.Init(FixedAlloc, FixedFree);
+    clReplay.Replay(astTrace, 8);
+    auto* pstResult = clReplay.Finish();
+
+    EXPECT_TRUE(pstResult->u32Ops == 8);
+    EXPECT_TRUE(pstResult->u32Failures == 0);
+    EXPECT_TRUE(pstResult->uPeakLive == 16);
+}
+
+#if HEAP_TRACE_ENABLE
+//===========================================================================
+TEST(ut_trace_fixed_heap_pass)
+{
+    StartCapture();
+    clFixed.Create(awFixedMem, aclFixedConfig);
+    clFixed.SetTrace(&clTrace);
+
+    void* apvAllocs[4];
+    for (int i = 0; i < 4; i++) {
+        apvAllocs[i] = clFixed.Allocate(10 + i);
+    }
+    EXPECT_TRUE(clFixed.Allocate(200) == nullptr);
+    clFixed.Free(apvAllocs[1]);
+    clFixed.Free(apvAllocs[3]);
+    clTrace.Flush();
+
+    EXPECT_TRUE(u32Captured == 7);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(astCaptured[i].u8Op == HEAP_TRACE_OP_ALLOC);
+        EXPECT_TRUE(astCaptured[i].u32Size == (uint32_t)(10 + i));
+        EXPECT_TRUE(astCaptured[i].adId == reinterpret_cast<K_ADDR>(apvAllocs[i]));
+    }
+    EXPECT_TRUE(astCaptured[4].adId == 0);
+    EXPECT_TRUE(astCaptured[5].u8Op == HEAP_TRACE_OP_FREE);
+    EXPECT_TRUE(astCaptured[5].adId == reinterpret_cast<K_ADDR>(apvAllocs[1]));
+    EXPECT_TRUE(astCaptured[6].adId == reinterpret_cast<K_ADDR>(apvAllocs[3]));
+
+    // Replay the captured trace against an arena
+    clFixed.SetTrace(nullptr);
+    clArena.Init(awArenaMem, sizeof(awArenaMem), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+    clReplay.Init(ArenaAlloc, ArenaFree);
+    clReplay.Replay(astCaptured, u32Captured);
+    auto* pstResult = clReplay.Finish();
+    EXPECT_TRUE(pstResult->u32Ops == 7);
+    EXPECT_TRUE(pstResult->u32Failures == 0);
+    EXPECT_TRUE(pstResult->uPeakLive == (10 + 11 + 12 + 13));
+}
+#endif
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_trace_capture_pass),
+TEST_CASE(ut_trace_drop_until_flush_pass),
+TEST_CASE(ut_trace_replay_arena_pass),
+TEST_CASE(ut_trace_replay_reused_id_pass),
+#if HEAP_TRACE_ENABLE
+TEST_CASE(ut_trace_fixed_heap_pass),
+#endif
+TEST_CASE_END
+} // namespace mark3
@@ -0,0 +1,187 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "lockfree_block_heap.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+#define BLOCK_SIZE (16)
+#define BLOCK_COUNT (64)
+
+#define STRESS_THREADS (4)
+#define STRESS_STACK_SIZE (384)
+#define STRESS_ITERATIONS (2000)
+#define STRESS_BATCH (24)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+K_WORD awHeap[(BLOCK_SIZE * BLOCK_COUNT) / sizeof(K_WORD)];
+uint8_t* pvAllocs[BLOCK_COUNT];
+
+LockFreeBlockHeap clHeap;
+
+Thread clStressThreads[STRESS_THREADS];
+K_WORD awStressStacks[STRESS_THREADS][STRESS_STACK_SIZE / sizeof(K_WORD)];
+Semaphore clStressDone;
+uint32_t au32StressErrors[STRESS_THREADS];
+
+//---------------------------------------------------------------------------
+void StressWorker(void* pvArg_)
+{
+    auto  u8Id = static_cast<uint8_t>(reinterpret_cast<K_ADDR>(pvArg_));
+    void* apvBlocks[STRESS_BATCH];
+
+    for (int i = 0; i < STRESS_ITERATIONS; i++) {
+        // Grab a batch of blocks, stamp them with this thread's ID, make
+        // sure no other context touched them, then give them back.
+        int count = 0;
+        while (count < STRESS_BATCH) {
+            apvBlocks[count] = clHeap.Allocate();
+            if (!apvBlocks[count]) {
+                break;
+            }
+            MemUtil::SetMemory(apvBlocks[count], u8Id, BLOCK_SIZE);
+            count++;
+        }
+        Thread::Yield();
+        for (int j = 0; j < count; j++) {
+            auto* pu8Block = static_cast<uint8_t*>(apvBlocks[j]);
+            for (int k = 0; k < BLOCK_SIZE; k++) {
+                if (pu8Block[k] != u8Id) {
+                    au32StressErrors[u8Id]++;
+                    break;
+                }
+            }
+            clHeap.Free(apvBlocks[j]);
+        }
+    }
+    clStressDone.Post();
+    Scheduler::GetCurrentThread()->Exit();
+}
+} // anonymous namespace
+
+class IUT {
+public:
+    static LockFreeBlockHeap* build() {
+        clHeap.Create(awHeap, sizeof(awHeap), BLOCK_SIZE);
+        return &clHeap;
+    }
+};
+
+//---------------------------------------------------------------------------
+TEST(ut_lockfree_create_pass)
+{
+    auto* iut = IUT::build();
+
+    EXPECT_EQUALS(iut->GetNumBlocks(), BLOCK_COUNT);
+    EXPECT_EQUALS(iut->GetNumFree(), BLOCK_COUNT);
+    EXPECT_TRUE(iut->IsFree());
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_lockfree_exhaust_pass)
+{
+    auto* iut = IUT::build();
+
+    for (int j = 0; j < 3; j++) {
+        for (int i = 0; i < BLOCK_COUNT; i++) {
+            pvAllocs[i] = reinterpret_cast<uint8_t*>(iut->Allocate());
+            EXPECT_TRUE(pvAllocs[i] != nullptr);
+            if (!pvAllocs[i]) {
+                return;
+            }
+            // Every block must lie within the heap's memory
+            EXPECT_TRUE(pvAllocs[i] >= reinterpret_cast<uint8_t*>(awHeap));
+            EXPECT_TRUE((pvAllocs[i] + BLOCK_SIZE) <= reinterpret_cast<uint8_t*>(awHeap) + sizeof(awHeap));
+            MemUtil::SetMemory(pvAllocs[i], 0xFF, BLOCK_SIZE);
+        }
+        EXPECT_TRUE(iut->Allocate() == nullptr);
+        EXPECT_FALSE(iut->IsFree());
+
+        for (int i = 0; i < BLOCK_COUNT; i++) {
+            iut->Free(pvAllocs[i]);
+        }
+        EXPECT_EQUALS(iut->GetNumFree(), BLOCK_COUNT);
+    }
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_lockfree_lifo_pass)
+{
+    auto* iut = IUT::build();
+
+    auto* pvFirst  = iut->Allocate();
+    auto* pvSecond = iut->Allocate();
+    EXPECT_TRUE(pvFirst != pvSecond);
+
+    // Most-recently freed blocks are reused first
+    iut->Free(pvFirst);
+    iut->Free(pvSecond);
+    EXPECT_TRUE(iut->Allocate() == pvSecond);
+    EXPECT_TRUE(iut->Allocate() == pvFirst);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_lockfree_stress_pass)
+{
+    auto* iut = IUT::build();
+
+    // Hammer the heap from multiple threads at once.  Batches are sized so
+    // the heap is regularly exhausted, exercising the empty-list path too.
+    clStressDone.Init(0, STRESS_THREADS);
+    for (int i = 0; i < STRESS_THREADS; i++) {
+        au32StressErrors[i] = 0;
+        clStressThreads[i].Init(awStressStacks[i],
+                                sizeof(awStressStacks[i]),
+                                1,
+                                StressWorker,
+                                reinterpret_cast<void*>(static_cast<K_ADDR>(i)));
+        clStressThreads[i].Start();
+    }
+    for (int i = 0; i < STRESS_THREADS; i++) {
+        clStressDone.Pend();
+    }
+
+    for (int i = 0; i < STRESS_THREADS; i++) {
+        EXPECT_EQUALS(au32StressErrors[i], 0);
+    }
+
+    // Every block made it back to the heap, exactly once
+    EXPECT_EQUALS(iut->GetNumFree(), BLOCK_COUNT);
+    for (int i = 0; i < BLOCK_COUNT; i++) {
+        pvAllocs[i] = reinterpret_cast<uint8_t*>(iut->Allocate());
+        EXPECT_TRUE(pvAllocs[i] != nullptr);
+        for (int j = 0; j < i; j++) {
+            EXPECT_TRUE(pvAllocs[i] != pvAllocs[j]);
+        }
+    }
+    EXPECT_TRUE(iut->Allocate() == nullptr);
+}
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_lockfree_create_pass),
+TEST_CASE(ut_lockfree_exhaust_pass),
+TEST_CASE(ut_lockfree_lifo_pass),
+TEST_CASE(ut_lockfree_stress_pass),
+TEST_CASE_END
+} // namespace mark3
@@ -0,0 +1,206 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "memory_resource.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+#define SLAB_PAGE_SIZE (256)
+#define SLAB_PAGE_COUNT (8)
+#define BITMAP_ELEMENT_SIZE (24)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+K_WORD awArenaMem[2048 / sizeof(K_WORD)];
+K_ADDR auArenaSizes[] = { 16, 32, 64, 128, 256 };
+Arena  clArena;
+
+K_WORD     awFixedMem[256];
+HeapConfig aclFixedConfig[] = {
+    { .m_uBlockSize = 16, .m_uBlockCount = 4 },
+    { .m_uBlockSize = 128, .m_uBlockCount = 2 },
+    { .m_uBlockSize = 0 },
+};
+FixedHeap clFixed;
+
+K_WORD          awPageMem[(SLAB_PAGE_SIZE * SLAB_PAGE_COUNT) / sizeof(K_WORD)];
+BitmapAllocator clPageAllocator;
+Slab            aclSlabs[2];
+
+K_WORD          awBitmapMem[512 / sizeof(K_WORD)];
+BitmapAllocator clBitmap;
+
+void* AllocPage(uint32_t* pu32PageSize_)
+{
+    *pu32PageSize_ = SLAB_PAGE_SIZE;
+    return clPageAllocator.Allocate(nullptr);
+}
+
+void FreePage(void* pvPage_)
+{
+    clPageAllocator.Free(pvPage_);
+}
+
+typedef struct {
+    uint32_t u32Key;
+    uint8_t  au8Value[20];
+} test_node_t;
+
+struct alignas(64) test_aligned_t {
+    uint8_t au8Data[64];
+};
+
+// Exercise a resource with a mix of sizes and alignments, checking each
+// allocation is usable and returned to the resource
+bool CheckResource(MemoryResource* pclResource_, size_t uMaxSize_)
+{
+    void*  apvAllocs[3];
+    size_t auSizes[3] = { 8, uMaxSize_ / 2, uMaxSize_ };
+    for (int i = 0; i < 3; i++) {
+        apvAllocs[i] = pclResource_->Allocate(auSizes[i]);
+        if (apvAllocs[i] == nullptr) {
+            return false;
+        }
+        MemUtil::SetMemory(apvAllocs[i], i, auSizes[i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        pclResource_->Free(apvAllocs[i], auSizes[i]);
+    }
+    return true;
+}
+} // anonymous namespace
+
+//===========================================================================
+// Define Test Cases Here
+//===========================================================================
+TEST(ut_resource_arena_pass)
+{
+    clArena.Init(awArenaMem, sizeof(awArenaMem), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+    ArenaResource clResource;
+    clResource.Init(&clArena);
+
+    EXPECT_TRUE(CheckResource(&clResource, 256));
+    EXPECT_TRUE(clResource.Allocate(4096) == nullptr);
+    EXPECT_TRUE(clResource.IsEqual(&clResource));
+
+    // Over-aligned allocations are padded and aligned by the resource
+    auto* pvAligned = clResource.Allocate(100, 64);
+    EXPECT_TRUE(pvAligned != nullptr);
+    EXPECT_TRUE(((K_ADDR)pvAligned & 63) == 0);
+    clResource.Free(pvAligned, 100, 64);
+}
+
+//===========================================================================
+TEST(ut_resource_fixed_heap_pass)
+{
+    clFixed.Create(awFixedMem, aclFixedConfig);
+    FixedHeapResource clResource;
+    clResource.Init(&clFixed);
+
+    EXPECT_TRUE(CheckResource(&clResource, 128));
+    EXPECT_TRUE(clResource.Allocate(200) == nullptr);
+
+    // Only two large blocks exist - both must be free again
+    auto* pvFirst  = clResource.Allocate(128);
+    auto* pvSecond = clResource.Allocate(128);
+    EXPECT_TRUE(pvFirst != nullptr);
+    EXPECT_TRUE(pvSecond != nullptr);
+    clResource.Free(pvFirst, 128);
+    clResource.Free(pvSecond, 128);
+}
+
+//===========================================================================
+TEST(ut_resource_slab_set_pass)
+{
+    clPageAllocator.Init(awPageMem, sizeof(awPageMem), SLAB_PAGE_SIZE);
+    aclSlabs[0].Init(16, AllocPage, FreePage);
+    aclSlabs[1].Init(64, AllocPage, FreePage);
+    SlabResource clResource;
+    clResource.Init(aclSlabs, 2);
+
+    // Each request is served by the smallest slab that fits it
+    auto* pvSmall = clResource.Allocate(12);
+    auto* pvLarge = clResource.Allocate(40);
+    EXPECT_TRUE(pvSmall != nullptr);
+    EXPECT_TRUE(pvLarge != nullptr);
+    EXPECT_TRUE(aclSlabs[0].GetFreePageCount() == 1);
+    EXPECT_TRUE(aclSlabs[1].GetFreePageCount() == 1);
+    EXPECT_TRUE(clResource.Allocate(65) == nullptr);
+
+    clResource.Free(pvSmall, 12);
+    clResource.Free(pvLarge, 40);
+    EXPECT_TRUE(aclSlabs[0].GetFreePageCount() == 0);
+    EXPECT_TRUE(aclSlabs[1].GetFreePageCount() == 0);
+    EXPECT_TRUE(CheckResource(&clResource, 64));
+}
+
+//===========================================================================
+TEST(ut_resource_bitmap_pass)
+{
+    clBitmap.Init(awBitmapMem, sizeof(awBitmapMem), BITMAP_ELEMENT_SIZE);
+    BitmapResource clResource;
+    clResource.Init(&clBitmap, BITMAP_ELEMENT_SIZE);
+
+    auto u32Free = clBitmap.GetNumFree();
+    EXPECT_TRUE(CheckResource(&clResource, BITMAP_ELEMENT_SIZE));
+    EXPECT_TRUE(clBitmap.GetNumFree() == u32Free);
+    EXPECT_TRUE(clResource.Allocate(BITMAP_ELEMENT_SIZE + 1) == nullptr);
+}
+
+//===========================================================================
+TEST(ut_resource_allocator_pass)
+{
+    clArena.Init(awArenaMem, sizeof(awArenaMem), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+    ArenaResource clResource;
+    clResource.Init(&clArena);
+    ArenaResource clOtherResource;
+    clOtherResource.Init(&clArena);
+
+    Allocator<test_node_t> clNodeAlloc(&clResource);
+    auto*                  pstNodes = clNodeAlloc.allocate(4);
+    EXPECT_TRUE(pstNodes != nullptr);
+    for (uint32_t i = 0; i < 4; i++) {
+        pstNodes[i].u32Key = i;
+    }
+    clNodeAlloc.deallocate(pstNodes, 4);
+
+    // Rebound allocators share the resource, and honour alignment
+    Allocator<test_aligned_t> clAlignedAlloc(clNodeAlloc);
+    EXPECT_TRUE(clAlignedAlloc == clNodeAlloc);
+    auto* pstAligned = clAlignedAlloc.allocate(1);
+    EXPECT_TRUE(pstAligned != nullptr);
+    EXPECT_TRUE(((K_ADDR)pstAligned % alignof(test_aligned_t)) == 0);
+    clAlignedAlloc.deallocate(pstAligned, 1);
+
+    EXPECT_TRUE(clNodeAlloc != Allocator<test_node_t>(&clOtherResource));
+    EXPECT_TRUE(clNodeAlloc.allocate((size_t)-1 / 2) == nullptr);
+}
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_resource_arena_pass),
+TEST_CASE(ut_resource_fixed_heap_pass),
+TEST_CASE(ut_resource_slab_set_pass),
+TEST_CASE(ut_resource_bitmap_pass),
+TEST_CASE(ut_resource_allocator_pass),
+TEST_CASE_END
+} // namespace mark3
@@ -0,0 +1,180 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "monotonic_region.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+#define PAGE_SIZE (256)
+#define PAGE_COUNT (4)
+#define INLINE_SIZE (64)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+K_WORD   awPageMem[(PAGE_SIZE * PAGE_COUNT) / sizeof(K_WORD)];
+bool     abPageUsed[PAGE_COUNT];
+uint16_t u16PageAllocs;
+
+void* AllocPage(uint32_t* pu32PageSize_)
+{
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        if (!abPageUsed[i]) {
+            abPageUsed[i]  = true;
+            *pu32PageSize_ = PAGE_SIZE;
+            u16PageAllocs++;
+            return reinterpret_cast<void*>((K_ADDR)awPageMem + (i * PAGE_SIZE));
+        }
+    }
+    return nullptr;
+}
+
+void FreePage(void* pvPage_)
+{
+    abPageUsed[((K_ADDR)pvPage_ - (K_ADDR)awPageMem) / PAGE_SIZE] = false;
+}
+
+uint16_t PagesInUse()
+{
+    uint16_t u16Count = 0;
+    for (auto bUsed : abPageUsed) {
+        u16Count += bUsed ? 1 : 0;
+    }
+    return u16Count;
+}
+
+void ResetPages()
+{
+    for (auto& bUsed : abPageUsed) {
+        bUsed = false;
+    }
+    u16PageAllocs = 0;
+}
+
+bool InInlineBuffer(void* pvData_, void* pvRegion_)
+{
+    auto adRegion = (K_ADDR)pvRegion_;
+    return ((K_ADDR)pvData_ >= adRegion) && ((K_ADDR)pvData_ < (adRegion + sizeof(InlineMonotonicRegion<INLINE_SIZE>)));
+}
+
+InlineMonotonicRegion<INLINE_SIZE> clRegion;
+} // anonymous namespace
+
+//===========================================================================
+// Define Test Cases Here
+//===========================================================================
+TEST(ut_region_inline_buffer_pass)
+{
+    ResetPages();
+    clRegion.Init(AllocPage, FreePage);
+
+    // Small requests are served from the inline buffer, pointer-aligned
+    void* apvAllocs[4];
+    for (int i = 0; i < 4; i++) {
+        apvAllocs[i] = clRegion.Allocate(i + 1);
+        EXPECT_TRUE(apvAllocs[i] != nullptr);
+        EXPECT_TRUE(InInlineBuffer(apvAllocs[i], &clRegion));
+        EXPECT_TRUE(((K_ADDR)apvAllocs[i] & (sizeof(K_ADDR) - 1)) == 0);
+        MemUtil::SetMemory(apvAllocs[i], 0xA5, i + 1);
+    }
+    for (int i = 1; i < 4; i++) {
+        EXPECT_TRUE(apvAllocs[i] > apvAllocs[i - 1]);
+    }
+    EXPECT_TRUE(u16PageAllocs == 0);
+    EXPECT_TRUE(clRegion.GetPageCount() == 0);
+}
+
+//===========================================================================
+TEST(ut_region_mark_release_pass)
+{
+    ResetPages();
+    clRegion.Init(AllocPage, FreePage);
+    clRegion.Allocate(16);
+
+    // Overflow the inline buffer into two pages
+    auto  stMark  = clRegion.Mark();
+    auto* pvFirst = clRegion.Allocate(32);
+    for (int i = 0; i < 12; i++) {
+        EXPECT_TRUE(clRegion.Allocate(32) != nullptr);
+    }
+    EXPECT_TRUE(clRegion.GetPageCount() == 2);
+    EXPECT_TRUE(PagesInUse() == 2);
+
+    // Releasing returns to the mark, keeping one page in reserve
+    clRegion.Release(stMark);
+    EXPECT_TRUE(clRegion.GetPageCount() == 0);
+    EXPECT_TRUE(PagesInUse() == 1);
+    EXPECT_TRUE(clRegion.Allocate(32) == pvFirst);
+
+    // The reserve page is reused before requesting new pages
+    auto u16Allocs = u16PageAllocs;
+    EXPECT_TRUE(clRegion.Allocate(64) != nullptr);
+    EXPECT_TRUE(clRegion.GetPageCount() == 1);
+    EXPECT_TRUE(u16PageAllocs == u16Allocs);
+
+    // Nested marks within a page
+    auto  stOuter = clRegion.Mark();
+    auto* pvOuter = clRegion.Allocate(8);
+    auto  stInner = clRegion.Mark();
+    clRegion.Allocate(100);
+    clRegion.Release(stInner);
+    clRegion.Allocate(8);
+    clRegion.Release(stOuter);
+    EXPECT_TRUE(clRegion.Allocate(8) == pvOuter);
+
+    clRegion.Reset();
+    EXPECT_TRUE(PagesInUse() == 0);
+    EXPECT_TRUE(clRegion.GetPageCount() == 0);
+}
+
+//===========================================================================
+TEST(ut_region_exhaust_pass)
+{
+    ResetPages();
+    clRegion.Init(AllocPage, FreePage);
+
+    // Requests larger than a page can't be satisfied
+    EXPECT_TRUE(clRegion.Allocate(PAGE_SIZE) == nullptr);
+    EXPECT_TRUE(PagesInUse() == 0);
+
+    // Run the page allocator dry
+    while (clRegion.Allocate(PAGE_SIZE / 2) != nullptr) {}
+    EXPECT_TRUE(clRegion.GetPageCount() == PAGE_COUNT);
+    clRegion.Reset();
+    EXPECT_TRUE(PagesInUse() == 0);
+
+    // A region without a page allocator is limited to its buffer
+    K_ADDR          auBuffer[8];
+    MonotonicRegion clFixed;
+    clFixed.Init(auBuffer, sizeof(auBuffer), nullptr, nullptr);
+    EXPECT_TRUE(clFixed.Allocate(sizeof(auBuffer)) == auBuffer);
+    EXPECT_TRUE(clFixed.Allocate(1) == nullptr);
+    clFixed.Reset();
+    EXPECT_TRUE(clFixed.Allocate(1) == auBuffer);
+}
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_region_inline_buffer_pass),
+TEST_CASE(ut_region_mark_release_pass),
+TEST_CASE(ut_region_exhaust_pass),
+TEST_CASE_END
+} // namespace mark3
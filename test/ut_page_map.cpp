@@ -0,0 +1,191 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "page_map.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+#define SLAB_PAGE_COUNT (4)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+alignas(PAGE_MAP_PAGE_SIZE) K_WORD awArenaMem[(PAGE_MAP_PAGE_SIZE * 8) / sizeof(K_WORD)];
+K_ADDR auArenaSizes[] = { 16, 32, 64, 128, 256 };
+
+alignas(PAGE_MAP_PAGE_SIZE) K_WORD awFixedMem[(PAGE_MAP_PAGE_SIZE * 4) / sizeof(K_WORD)];
+HeapConfig aclFixedConfig[] = {
+    { .m_uBlockSize = 16, .m_uBlockCount = 4 },
+    { .m_uBlockSize = 64, .m_uBlockCount = 2 },
+    { .m_uBlockSize = 0 },
+};
+
+// Page provider handing out page-map-aligned slab pages
+alignas(PAGE_MAP_PAGE_SIZE) uint8_t au8PageMem[SLAB_PAGE_COUNT][PAGE_MAP_PAGE_SIZE];
+bool       abPageUsed[SLAB_PAGE_COUNT];
+SlabRegion clSlabRegion;
+
+void* AllocPage(uint32_t* pu32PageSize_)
+{
+    for (uint8_t i = 0; i < SLAB_PAGE_COUNT; i++) {
+        if (!abPageUsed[i]) {
+            abPageUsed[i]  = true;
+            *pu32PageSize_ = PAGE_MAP_PAGE_SIZE;
+            PageMap::Register(au8PageMem[i], PAGE_MAP_PAGE_SIZE, &clSlabRegion);
+            return au8PageMem[i];
+        }
+    }
+    return nullptr;
+}
+
+void FreePage(void* pvPage_)
+{
+    PageMap::Unregister(pvPage_, PAGE_MAP_PAGE_SIZE);
+    abPageUsed[(static_cast<uint8_t*>(pvPage_) - au8PageMem[0]) / PAGE_MAP_PAGE_SIZE] = false;
+}
+
+Arena           clArena;
+FixedHeap       clFixedHeap;
+Slab            clSlab;
+ArenaRegion     clArenaRegion;
+FixedHeapRegion clFixedRegion;
+
+void InitAllocators()
+{
+    PageMap::Init();
+    clArena.Init(awArenaMem, sizeof(awArenaMem), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+    clFixedHeap.Create(awFixedMem, aclFixedConfig);
+    for (uint8_t i = 0; i < SLAB_PAGE_COUNT; i++) {
+        abPageUsed[i] = false;
+    }
+    clSlab.Init(24, AllocPage, FreePage);
+
+    clArenaRegion.Init(&clArena);
+    clFixedRegion.Init(&clFixedHeap);
+    clSlabRegion.Init(&clSlab);
+    EXPECT_TRUE(PageMap::Register(awArenaMem, sizeof(awArenaMem), &clArenaRegion));
+    EXPECT_TRUE(PageMap::Register(awFixedMem, sizeof(awFixedMem), &clFixedRegion));
+}
+} // anonymous namespace
+
+//===========================================================================
+// Define Test Cases Here
+//===========================================================================
+TEST(ut_page_map_dispatch_pass)
+{
+    InitAllocators();
+
+    auto* pvArena = clArena.Allocate(100);
+    auto* pvFixed = clFixedHeap.Allocate(10);
+    auto* pvSlab  = clSlab.Alloc();
+    EXPECT_TRUE(PageMap::Lookup(pvArena) == &clArenaRegion);
+    EXPECT_TRUE(PageMap::Lookup(pvFixed) == &clFixedRegion);
+    EXPECT_TRUE(PageMap::Lookup(pvSlab) == &clSlabRegion);
+    EXPECT_TRUE(clSlabRegion.GetOwner() == &clSlab);
+
+    // Sizes come from the owning allocator
+    EXPECT_TRUE(UsableSize(pvArena) >= 100);
+    EXPECT_TRUE(UsableSize(pvFixed) >= 16);
+    EXPECT_TRUE(UsableSize(pvFixed) < 64);
+    EXPECT_TRUE(UsableSize(pvSlab) == 24);
+
+    // Blocks go back to their owners - the slab's page is released
+    Free(pvArena);
+    Free(pvFixed);
+    Free(pvSlab);
+    EXPECT_TRUE(clSlab.GetFreePageCount() == 0);
+    EXPECT_TRUE(!abPageUsed[0]);
+    EXPECT_TRUE(PageMap::Lookup(pvSlab) == nullptr);
+
+    void* apvFixed[4];
+    for (uint8_t i = 0; i < 4; i++) {
+        apvFixed[i] = clFixedHeap.Allocate(16);
+        EXPECT_TRUE(apvFixed[i] != nullptr);
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        Free(apvFixed[i]);
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        EXPECT_TRUE(UsableSize(clFixedHeap.Allocate(16)) < 64);
+    }
+}
+
+//===========================================================================
+TEST(ut_page_map_register_pass)
+{
+    InitAllocators();
+
+    // Pages can't be claimed by two owners - a conflicting registration
+    // assigns nothing
+    auto* pvOverlap = &awFixedMem[0] - (PAGE_MAP_PAGE_SIZE / sizeof(K_WORD));
+    EXPECT_TRUE(!PageMap::Register(pvOverlap, PAGE_MAP_PAGE_SIZE * 2, &clSlabRegion));
+    EXPECT_TRUE(PageMap::Lookup(awFixedMem) == &clFixedRegion);
+    EXPECT_TRUE(PageMap::Register(awFixedMem, PAGE_MAP_PAGE_SIZE, &clFixedRegion));
+    EXPECT_TRUE(!PageMap::Register(awFixedMem, 0, &clFixedRegion));
+
+    // Unregistered memory is ignored
+    PageMap::Unregister(awFixedMem, sizeof(awFixedMem));
+    auto* pvFixed = clFixedHeap.Allocate(10);
+    EXPECT_TRUE(PageMap::Lookup(pvFixed) == nullptr);
+    EXPECT_TRUE(UsableSize(pvFixed) == 0);
+    Free(pvFixed);
+    Free(nullptr);
+    EXPECT_TRUE(UsableSize(nullptr) == 0);
+
+    K_WORD uLocal;
+    EXPECT_TRUE(PageMap::Lookup(&uLocal) == nullptr);
+}
+
+//===========================================================================
+TEST(ut_page_map_slab_pages_pass)
+{
+    InitAllocators();
+
+    // Pages are registered as the slab grows, and unregistered as it shrinks
+    void*    apvAllocs[SLAB_PAGE_COUNT * (PAGE_MAP_PAGE_SIZE / 24)];
+    uint32_t u32Count = 0;
+    while (u32Count < (sizeof(apvAllocs) / sizeof(void*))) {
+        apvAllocs[u32Count] = clSlab.Alloc();
+        if (apvAllocs[u32Count] == nullptr) {
+            break;
+        }
+        u32Count++;
+    }
+    EXPECT_TRUE(u32Count > SLAB_PAGE_COUNT);
+    for (uint8_t i = 0; i < SLAB_PAGE_COUNT; i++) {
+        EXPECT_TRUE(PageMap::Lookup(au8PageMem[i]) == &clSlabRegion);
+    }
+    for (uint32_t i = 0; i < u32Count; i++) {
+        EXPECT_TRUE(UsableSize(apvAllocs[i]) == 24);
+        Free(apvAllocs[i]);
+    }
+    for (uint8_t i = 0; i < SLAB_PAGE_COUNT; i++) {
+        EXPECT_TRUE(PageMap::Lookup(au8PageMem[i]) == nullptr);
+    }
+}
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_page_map_dispatch_pass),
+TEST_CASE(ut_page_map_register_pass),
+TEST_CASE(ut_page_map_slab_pages_pass),
+TEST_CASE_END
+} // namespace mark3
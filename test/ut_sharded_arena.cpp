@@ -0,0 +1,157 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "sharded_arena.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+#define NUM_ARENAS (4)
+#define ARENA_MEM_SIZE (NUM_ARENAS * 512)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+K_WORD awArenaMem[ARENA_MEM_SIZE / sizeof(K_WORD)];
+K_ADDR auArenaSizes[] = { 16, 32, 64, 128 };
+
+Arena        aclArenas[NUM_ARENAS];
+ShardedArena clSharded;
+
+void InitSharded()
+{
+    clSharded.Init(aclArenas, NUM_ARENAS, awArenaMem, sizeof(awArenaMem), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+}
+} // anonymous namespace
+
+//===========================================================================
+// Define Test Cases Here
+//===========================================================================
+TEST(ut_sharded_arena_assign_pass)
+{
+    InitSharded();
+    EXPECT_TRUE(clSharded.GetNumArenas() == NUM_ARENAS);
+    EXPECT_TRUE(clSharded.GetThreadArena() == SHARDED_ARENA_UNASSIGNED);
+
+    // The thread is assigned an arena on its first allocation, and sticks to it
+    auto* pvFirst = clSharded.Allocate(32);
+    EXPECT_TRUE(pvFirst != nullptr);
+    EXPECT_TRUE(clSharded.GetThreadArena() == 0);
+    EXPECT_TRUE(clSharded.GetArenaIndex(pvFirst) == 0);
+    EXPECT_TRUE(clSharded.GetArenaIndex(clSharded.Allocate(100)) == 0);
+
+    // Pinning to an arena
+    clSharded.SetThreadArena(2);
+    EXPECT_TRUE(clSharded.GetThreadArena() == 2);
+    EXPECT_TRUE(clSharded.GetArenaIndex(clSharded.Allocate(16)) == 2);
+    clSharded.SetThreadArena(NUM_ARENAS);
+    EXPECT_TRUE(clSharded.GetThreadArena() == 2);
+}
+
+//===========================================================================
+TEST(ut_sharded_arena_fallback_pass)
+{
+    InitSharded();
+    clSharded.SetThreadArena(1);
+
+    // Exhaust the thread's arena - allocations spill over into the next one
+    void*    apvAllocs[ARENA_MEM_SIZE / 32];
+    uint32_t u32Count = 0;
+    while (u32Count < (sizeof(apvAllocs) / sizeof(void*))) {
+        apvAllocs[u32Count] = clSharded.Allocate(32);
+        if (apvAllocs[u32Count] == nullptr) {
+            break;
+        }
+        MemUtil::SetMemory(apvAllocs[u32Count], 0xAA, 32);
+        u32Count++;
+    }
+    EXPECT_TRUE(u32Count > 0);
+    EXPECT_TRUE(clSharded.GetArenaIndex(apvAllocs[0]) == 1);
+    EXPECT_TRUE(clSharded.GetArenaIndex(apvAllocs[u32Count - 1]) == 0);
+
+    // Exhaustion isn't contention - the thread keeps its arena
+    EXPECT_TRUE(clSharded.GetThreadArena() == 1);
+    for (uint8_t i = 0; i < NUM_ARENAS; i++) {
+        EXPECT_TRUE(clSharded.GetContention(i) == 0);
+    }
+}
+
+//===========================================================================
+TEST(ut_sharded_arena_free_pass)
+{
+    InitSharded();
+
+    // Fill each arena in turn
+    void*    apvAllocs[ARENA_MEM_SIZE / 128];
+    uint32_t au32Counts[NUM_ARENAS];
+    uint32_t u32Total = 0;
+    for (uint8_t i = 0; i < NUM_ARENAS; i++) {
+        clSharded.SetThreadArena(i);
+        au32Counts[i] = 0;
+        while (true) {
+            auto* pvData = clSharded.Allocate(128);
+            if (clSharded.GetArenaIndex(pvData) != i) {
+                clSharded.Free(pvData);
+                break;
+            }
+            apvAllocs[u32Total++] = pvData;
+            au32Counts[i]++;
+        }
+        EXPECT_TRUE(au32Counts[i] > 0);
+    }
+
+    // Blocks are returned to their owners, regardless of the thread's arena
+    clSharded.SetThreadArena(0);
+    for (uint32_t i = 0; i < u32Total; i++) {
+        clSharded.Free(apvAllocs[i]);
+    }
+    for (uint8_t i = 0; i < NUM_ARENAS; i++) {
+        clSharded.SetThreadArena(i);
+        for (uint32_t j = 0; j < au32Counts[i]; j++) {
+            EXPECT_TRUE(clSharded.GetArenaIndex(clSharded.Allocate(128)) == i);
+        }
+    }
+
+    // Foreign pointers are ignored
+    K_WORD uForeign;
+    EXPECT_TRUE(clSharded.GetArenaIndex(&uForeign) == SHARDED_ARENA_UNASSIGNED);
+    clSharded.Free(&uForeign);
+}
+
+//===========================================================================
+TEST(ut_sharded_arena_no_arenas_fail)
+{
+    // A sharded arena without any arenas fails every request
+    clSharded.Init(aclArenas, 0, awArenaMem, sizeof(awArenaMem), auArenaSizes, sizeof(auArenaSizes) / sizeof(K_ADDR));
+    EXPECT_TRUE(clSharded.GetNumArenas() == 0);
+    EXPECT_TRUE(clSharded.Allocate(32) == nullptr);
+    EXPECT_TRUE(clSharded.GetThreadArena() == SHARDED_ARENA_UNASSIGNED);
+    EXPECT_TRUE(clSharded.GetArenaIndex(awArenaMem) == SHARDED_ARENA_UNASSIGNED);
+    clSharded.Free(awArenaMem);
+}
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_sharded_arena_assign_pass),
+TEST_CASE(ut_sharded_arena_fallback_pass),
+TEST_CASE(ut_sharded_arena_free_pass),
+TEST_CASE(ut_sharded_arena_no_arenas_fail),
+TEST_CASE_END
+} // namespace mark3
@@ -13,7 +13,9 @@ See license.txt for more information
 ===========================================================================*/
 #include "mark3.h"
 #include "slab.h"
+#include "shrinker.h"
 #include "bitmap_allocator.h"
+#include "memutil.h"
 #include "ut_platform.h"
 
 namespace Mark3 {
@@ -22,6 +24,12 @@ namespace Mark3 {
 #define DEFAULT_SLAB_COUNT (8)
 #define DEFAULT_ALLOC_SIZE  (16)
 
+#define ORDER_BASE_PAGE_SIZE (256)
+#define ORDER_MAX_SLAB_SIZE (1024)
+#define ORDER_SLAB_COUNT (4)
+#define ORDER_MAX_WASTE_PCT (25)
+#define ORDER_LARGE_OBJ_SIZE (ORDER_BASE_PAGE_SIZE + 34)
+
 extern "C" {
 void __cxa_guard_acquire() {};
 void __cxa_guard_release() {};
@@ -32,6 +40,11 @@ K_WORD awSlabMem[(DEFAULT_SLAB_COUNT * DEFAULT_SLAB_SIZE) / sizeof(K_WORD)];
 uint8_t* pAllocs[(DEFAULT_SLAB_COUNT * DEFAULT_SLAB_SIZE)/ DEFAULT_ALLOC_SIZE];
 Slab clSlab;
 static BitmapAllocator clAllocator;
+
+K_WORD awOrderMem[((ORDER_SLAB_COUNT + 1) * ORDER_MAX_SLAB_SIZE) / sizeof(K_WORD)];
+Slab clOrderSlab;
+Slab clDescSlab;
+static BitmapAllocator clOrderAllocator;
 } // anonymous namespace
 
 class IUT {
@@ -54,10 +67,46 @@ public:
         return &clSlab;
     }
 
-    static int getCapacity() {
+    static Slab* buildOrder(uint32_t u32ObjSize_, bool bOffPage_) {
+        build();
+        clOrderAllocator.Init(awOrderMem, sizeof(awOrderMem), ORDER_MAX_SLAB_SIZE);
+
+        static auto allocPages = [](uint8_t u8Order_, uint32_t* pu32Size_) {
+            if ((ORDER_BASE_PAGE_SIZE << u8Order_) > ORDER_MAX_SLAB_SIZE) {
+                return (void*)nullptr;
+            }
+            *pu32Size_ = ORDER_BASE_PAGE_SIZE << u8Order_;
+            return clOrderAllocator.Allocate(nullptr);
+        };
+
+        static auto freePages = [](void* pvPages_, uint8_t u8Order_) {
+            clOrderAllocator.Free(pvPages_);
+        };
+
+        static auto allocDescPage = [](uint32_t* pu32PageSize_) {
+            *pu32PageSize_ = DEFAULT_SLAB_SIZE;
+            return clAllocator.Allocate(nullptr);
+        };
+
+        static auto freeDescPage = [](void* pvPage_) {
+            clAllocator.Free(pvPage_);
+        };
+
+        // Descriptors for off-page metadata come from a regular slab
+        clDescSlab.Init(Slab::GetDescriptorSize(), allocDescPage, freeDescPage);
+        clOrderSlab.Init(u32ObjSize_,
+                         ORDER_BASE_PAGE_SIZE,
+                         ORDER_MAX_WASTE_PCT,
+                         allocPages,
+                         freePages,
+                         bOffPage_ ? &clDescSlab : nullptr);
+        return &clOrderSlab;
+    }
+
+    static int getCapacity(Slab* pclSlab_ = &clSlab) {
         int capacity = 0;
         while (1) {
-            pAllocs[capacity] = reinterpret_cast<uint8_t*>(clSlab.Alloc());
+            pAllocs[capacity] = reinterpret_cast<uint8_t*>(pclSlab_->Alloc());
             if (!pAllocs[capacity]) {
                 break;
             }
@@ -65,7 +114,7 @@ public:
         }
 
         for (int i = 0; i < capacity; i++) {
-            clSlab.Free(pAllocs[i]);
+            pclSlab_->Free(pAllocs[i]);
             pAllocs[i] = nullptr;
         }
         return capacity;
@@ -204,6 +253,248 @@ TEST(ut_slab_alloc_free_pass)
     }
 }
 
+//---------------------------------------------------------------------------
+TEST(ut_slab_order_select_pass)
+{
+    // An object close to the base page size can't be allocated efficiently
+    // from a single page - expect a higher-order slab to be selected.
+    auto* iut = IUT::buildOrder(ORDER_BASE_PAGE_SIZE - 56, false);
+
+    EXPECT_TRUE(iut->GetPageOrder() != 0);
+    EXPECT_FALSE(iut->IsOffPage());
+
+    auto capacity = IUT::getCapacity(iut);
+    EXPECT_TRUE(capacity >= ORDER_SLAB_COUNT);
+    EXPECT_TRUE(iut->GetFreePageCount() == 0);
+    EXPECT_TRUE(iut->GetFullPageCount() == 0);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_slab_order_tiny_page_pass)
+{
+    // Base pages smaller than the on-page metadata must be skipped, not
+    // treated as holding an enormous number of objects
+    Slab clTinySlab;
+    clTinySlab.Init(DEFAULT_ALLOC_SIZE,
+                    DEFAULT_ALLOC_SIZE,
+                    ORDER_MAX_WASTE_PCT,
+                    [](uint8_t, uint32_t*) { return (void*)nullptr; },
+                    [](void*, uint8_t) {},
+                    nullptr);
+    EXPECT_TRUE(((size_t)DEFAULT_ALLOC_SIZE << clTinySlab.GetPageOrder()) > sizeof(SlabPage));
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_slab_large_object_pass)
+{
+    // Objects larger than a base page must still be allocable
+    auto* iut = IUT::buildOrder(ORDER_LARGE_OBJ_SIZE, false);
+    EXPECT_TRUE(iut->GetPageOrder() > 1);
+
+    auto capacity = IUT::getCapacity(iut);
+    EXPECT_TRUE(capacity != 0);
+
+    for (int j = 0; j < 3; j++) {
+        for (int i = 0; i < capacity; i++) {
+            pAllocs[i] = reinterpret_cast<uint8_t*>(iut->Alloc());
+            EXPECT_TRUE(pAllocs[i] != nullptr);
+            if (!pAllocs[i]) {
+                return;
+            }
+            MemUtil::SetMemory(pAllocs[i], (uint8_t)i, ORDER_LARGE_OBJ_SIZE);
+        }
+        EXPECT_TRUE(iut->Alloc() == nullptr);
+        for (int i = 0; i < capacity; i++) {
+            iut->Free(pAllocs[i]);
+        }
+        EXPECT_TRUE(iut->GetFreePageCount() == 0);
+        EXPECT_TRUE(iut->GetFullPageCount() == 0);
+    }
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_slab_offpage_pass)
+{
+    // Moving the page metadata off-page leaves at least as much room for
+    // objects as keeping it on-page.
+    auto* onPage = IUT::buildOrder(ORDER_BASE_PAGE_SIZE - 32, false);
+    auto onPageCapacity = IUT::getCapacity(onPage);
+
+    auto* iut = IUT::buildOrder(ORDER_BASE_PAGE_SIZE - 32, true);
+    EXPECT_TRUE(iut->IsOffPage());
+
+    auto capacity = IUT::getCapacity(iut);
+    EXPECT_TRUE(capacity >= onPageCapacity);
+
+    for (int i = 0; i < capacity; i++) {
+        pAllocs[i] = reinterpret_cast<uint8_t*>(iut->Alloc());
+        EXPECT_TRUE(pAllocs[i] != nullptr);
+        if (!pAllocs[i]) {
+            return;
+        }
+        MemUtil::SetMemory(pAllocs[i], 0xFF, ORDER_BASE_PAGE_SIZE - 32);
+    }
+
+    // Every in-use page holds a descriptor from the descriptor slab
+    EXPECT_TRUE((clDescSlab.GetFreePageCount() + clDescSlab.GetFullPageCount()) != 0);
+
+    for (int i = 0; i < capacity; i++) {
+        iut->Free(pAllocs[i]);
+    }
+    EXPECT_TRUE(iut->GetFreePageCount() == 0);
+    EXPECT_TRUE(iut->GetFullPageCount() == 0);
+    EXPECT_TRUE(clDescSlab.GetFreePageCount() == 0);
+    EXPECT_TRUE(clDescSlab.GetFullPageCount() == 0);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_slab_page_cache_shrink_pass)
+{
+    auto* iut = IUT::build();
+    auto capacity = IUT::getCapacity();
+
+    iut->SetPageCacheLimit(2);
+
+    for (int i = 0; i < capacity; i++) {
+        pAllocs[i] = reinterpret_cast<uint8_t*>(iut->Alloc());
+    }
+    for (int i = 0; i < capacity; i++) {
+        iut->Free(pAllocs[i]);
+    }
+
+    // Up to the cache limit, empty pages are kept rather than released
+    EXPECT_TRUE(iut->GetFreePageCount() == 0);
+    EXPECT_TRUE(iut->GetFullPageCount() == 0);
+    EXPECT_TRUE(iut->GetEmptyPageCount() == 2);
+    EXPECT_TRUE(ShrinkerRegistry::GetReclaimable() == (2 * DEFAULT_SLAB_SIZE));
+
+    // Cached pages are reused before new pages are requested
+    pAllocs[0] = reinterpret_cast<uint8_t*>(iut->Alloc());
+    EXPECT_TRUE(iut->GetEmptyPageCount() == 1);
+    iut->Free(pAllocs[0]);
+    EXPECT_TRUE(iut->GetEmptyPageCount() == 2);
+
+    // Reclaim one page at a time, then everything that's left
+    EXPECT_TRUE(ShrinkerRegistry::ReclaimMemory(1) == DEFAULT_SLAB_SIZE);
+    EXPECT_TRUE(iut->GetEmptyPageCount() == 1);
+    EXPECT_TRUE(ShrinkerRegistry::ReclaimMemory(DEFAULT_SLAB_SIZE * DEFAULT_SLAB_COUNT) == DEFAULT_SLAB_SIZE);
+    EXPECT_TRUE(iut->GetEmptyPageCount() == 0);
+    EXPECT_TRUE(ShrinkerRegistry::ReclaimMemory(DEFAULT_SLAB_SIZE) == 0);
+
+    // All pages were returned - the whole slab capacity is available again
+    EXPECT_TRUE(IUT::getCapacity() == capacity);
+
+    iut->SetPageCacheLimit(0);
+    EXPECT_TRUE(iut->GetEmptyPageCount() == 0);
+    EXPECT_TRUE(ShrinkerRegistry::GetReclaimable() == 0);
+}
+
+//---------------------------------------------------------------------------
+namespace
+{
+Shrinker aclShrinkers[2];
+K_ADDR   auShrinkerScans[2];
+
+K_ADDR UnregisteringCount(void* pvContext_)
+{
+    return 1;
+}
+
+K_ADDR UnregisteringScan(void* pvContext_, K_ADDR uBytes_)
+{
+    // Shrinkers may leave the registry from within their own callbacks
+    auto uIndex = reinterpret_cast<K_ADDR>(pvContext_);
+    auShrinkerScans[uIndex]++;
+    ShrinkerRegistry::Unregister(&aclShrinkers[uIndex]);
+    return 1;
+}
+} // anonymous namespace
+
+TEST(ut_slab_shrinker_unregister_pass)
+{
+    for (K_ADDR i = 0; i < 2; i++) {
+        aclShrinkers[i].Init(UnregisteringCount, UnregisteringScan, reinterpret_cast<void*>(i));
+        auShrinkerScans[i] = 0;
+        ShrinkerRegistry::Register(&aclShrinkers[i]);
+    }
+    EXPECT_TRUE(ShrinkerRegistry::GetReclaimable() == 2);
+
+    // The walk continues past a shrinker that unregistered itself
+    EXPECT_TRUE(ShrinkerRegistry::ReclaimMemory(2) == 2);
+    EXPECT_TRUE((auShrinkerScans[0] == 1) && (auShrinkerScans[1] == 1));
+    EXPECT_TRUE(!aclShrinkers[0].IsRegistered() && !aclShrinkers[1].IsRegistered());
+    EXPECT_TRUE(ShrinkerRegistry::GetReclaimable() == 0);
+    EXPECT_TRUE(ShrinkerRegistry::ReclaimMemory(2) == 0);
+
+    // ...and can be registered again
+    ShrinkerRegistry::Register(&aclShrinkers[0]);
+    EXPECT_TRUE(ShrinkerRegistry::GetReclaimable() == 1);
+    EXPECT_TRUE(ShrinkerRegistry::ReclaimMemory(1) == 1);
+    EXPECT_TRUE(ShrinkerRegistry::GetReclaimable() == 0);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_slab_remote_free_pass)
+{
+    auto* iut = IUT::build();
+    auto capacity = IUT::getCapacity();
+
+    for (int i = 0; i < capacity; i++) {
+        pAllocs[i] = reinterpret_cast<uint8_t*>(iut->Alloc());
+    }
+    auto fullPages = iut->GetFullPageCount();
+
+    // Remotely-freed objects stay queued until the owner collects them
+    for (int i = 0; i < capacity; i++) {
+        iut->FreeRemote(pAllocs[i]);
+    }
+    EXPECT_TRUE(iut->GetFullPageCount() == fullPages);
+    EXPECT_TRUE(iut->GetFreePageCount() == 0);
+
+    // Running out of objects collects the queue, reusing the pages in place
+    // of new ones (the page allocator is exhausted)
+    EXPECT_TRUE(clAllocator.IsFull());
+    for (int i = 0; i < capacity; i++) {
+        pAllocs[i] = reinterpret_cast<uint8_t*>(iut->Alloc());
+        EXPECT_TRUE(pAllocs[i] != nullptr);
+    }
+    EXPECT_TRUE(iut->Alloc() == nullptr);
+
+    for (int i = 0; i < capacity; i++) {
+        iut->Free(pAllocs[i]);
+    }
+    EXPECT_TRUE(IUT::getCapacity() == capacity);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_slab_remote_collect_pass)
+{
+    auto* iut = IUT::build();
+    auto capacity = IUT::getCapacity();
+
+    for (int i = 0; i < capacity; i++) {
+        pAllocs[i] = reinterpret_cast<uint8_t*>(iut->Alloc());
+    }
+
+    // Mix local and remote frees - collecting the queue releases every page
+    for (int i = 0; i < capacity; i++) {
+        if (i & 1) {
+            iut->FreeRemote(pAllocs[i]);
+        } else {
+            iut->Free(pAllocs[i]);
+        }
+    }
+    EXPECT_TRUE(!clAllocator.IsEmpty());
+    iut->CollectRemoteFrees();
+    EXPECT_TRUE(iut->GetFullPageCount() == 0);
+    EXPECT_TRUE(iut->GetFreePageCount() == 0);
+    EXPECT_TRUE(clAllocator.IsEmpty());
+
+    // Collecting an empty queue does nothing
+    iut->CollectRemoteFrees();
+    EXPECT_TRUE(IUT::getCapacity() == capacity);
+}
+
 //---------------------------------------------------------------------------
 //===========================================================================
 // Test Whitelist Goes Here
@@ -214,5 +505,13 @@ TEST_CASE(ut_slab_get_obj_size_pass),
 TEST_CASE(ut_slab_page_count_pass),
 TEST_CASE(ut_slab_double_free_pass),
 TEST_CASE(ut_slab_alloc_free_pass),
+TEST_CASE(ut_slab_order_select_pass),
+TEST_CASE(ut_slab_order_tiny_page_pass),
+TEST_CASE(ut_slab_large_object_pass),
+TEST_CASE(ut_slab_offpage_pass),
+TEST_CASE(ut_slab_page_cache_shrink_pass),
+TEST_CASE(ut_slab_shrinker_unregister_pass),
+TEST_CASE(ut_slab_remote_free_pass),
+TEST_CASE(ut_slab_remote_collect_pass),
 TEST_CASE_END
 } // namespace mark3
@@ -0,0 +1,124 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "static_fixed_heap.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+#define BLOCK0_SIZE (8)
+#define BLOCK0_COUNT (4)
+#define BLOCK1_SIZE (24)
+#define BLOCK1_COUNT (3)
+#define BLOCK2_SIZE (100)
+#define BLOCK2_COUNT (2)
+
+#define TOTAL_ALLOCATIONS (BLOCK0_COUNT + BLOCK1_COUNT + BLOCK2_COUNT)
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace {
+typedef StaticFixedHeap<Bin<BLOCK0_SIZE, BLOCK0_COUNT>, Bin<BLOCK1_SIZE, BLOCK1_COUNT>, Bin<BLOCK2_SIZE, BLOCK2_COUNT>>
+    TestHeap;
+
+// Bin selection and storage sizing are resolved at compile-time
+static_assert(StaticHeapBinFor<1, 0, Bin<8, 1>, Bin<24, 1>>::value == 0, "");
+static_assert(StaticHeapBinFor<8, 0, Bin<8, 1>, Bin<24, 1>>::value == 0, "");
+static_assert(StaticHeapBinFor<9, 0, Bin<8, 1>, Bin<24, 1>>::value == 1, "");
+static_assert(StaticHeapBinFor<25, 0, Bin<8, 1>, Bin<24, 1>>::value == FIXED_HEAP_NO_BIN, "");
+static_assert(StaticHeapSorted<Bin<8, 1>, Bin<24, 1>>::value, "");
+static_assert(!StaticHeapSorted<Bin<24, 1>, Bin<8, 1>>::value, "");
+static_assert(TestHeap::GetStorageSize()
+                  == (BlockHeap::GetBlockStride(BLOCK0_SIZE) * BLOCK0_COUNT)
+                         + (BlockHeap::GetBlockStride(BLOCK1_SIZE) * BLOCK1_COUNT)
+                         + (BlockHeap::GetBlockStride(BLOCK2_SIZE) * BLOCK2_COUNT),
+              "");
+
+TestHeap clHeap;
+void* apvAllocs[TOTAL_ALLOCATIONS];
+} // anonymous namespace
+
+class IUT {
+public:
+    static TestHeap* build() {
+        clHeap.Create();
+        return &clHeap;
+    }
+};
+
+//---------------------------------------------------------------------------
+TEST(ut_static_heap_exhaust_pass)
+{
+    auto* iut = IUT::build();
+
+    // Every block in every bin is available, and no more
+    for (int i = 0; i < TOTAL_ALLOCATIONS; i++) {
+        apvAllocs[i] = iut->Allocate<1>();
+        EXPECT_TRUE(apvAllocs[i] != nullptr);
+    }
+    EXPECT_TRUE(iut->Allocate<1>() == nullptr);
+    EXPECT_TRUE(iut->Allocate(1) == nullptr);
+
+    for (int i = 0; i < TOTAL_ALLOCATIONS; i++) {
+        iut->Free(apvAllocs[i]);
+    }
+    for (int i = 0; i < TOTAL_ALLOCATIONS; i++) {
+        apvAllocs[i] = iut->Allocate(1);
+        EXPECT_TRUE(apvAllocs[i] != nullptr);
+    }
+    EXPECT_TRUE(iut->Allocate(1) == nullptr);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_static_heap_bin_select_pass)
+{
+    auto* iut = IUT::build();
+
+    // Exhaust the middle bin with compile-time sized allocations, then
+    // verify it spills over to the largest bin.
+    for (int i = 0; i < BLOCK1_COUNT; i++) {
+        apvAllocs[i] = iut->Allocate<BLOCK1_SIZE>();
+        EXPECT_TRUE(apvAllocs[i] != nullptr);
+        MemUtil::SetMemory(apvAllocs[i], 0xFF, BLOCK1_SIZE);
+    }
+    for (int i = 0; i < BLOCK2_COUNT; i++) {
+        EXPECT_TRUE(iut->Allocate<BLOCK0_SIZE + 1>() != nullptr);
+    }
+    EXPECT_TRUE(iut->Allocate<BLOCK0_SIZE + 1>() == nullptr);
+
+    // The smallest bin is untouched
+    for (int i = 0; i < BLOCK0_COUNT; i++) {
+        EXPECT_TRUE(iut->Allocate<BLOCK0_SIZE>() != nullptr);
+    }
+    EXPECT_TRUE(iut->Allocate<BLOCK0_SIZE>() == nullptr);
+
+    // Freed blocks return to their bin, for both compile-time and runtime sizes
+    iut->Free(apvAllocs[0]);
+    EXPECT_TRUE(iut->Allocate<BLOCK1_SIZE>() == apvAllocs[0]);
+    iut->Free(apvAllocs[1]);
+    EXPECT_TRUE(iut->Allocate(BLOCK1_SIZE) == apvAllocs[1]);
+}
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_static_heap_exhaust_pass),
+TEST_CASE(ut_static_heap_bin_select_pass),
+TEST_CASE_END
+} // namespace mark3
@@ -0,0 +1,277 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2012 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+#include "mark3.h"
+#include "system_heap.h"
+#include "ut_platform.h"
+#include "memutil.h"
+
+#if SYSTEM_HEAP_REPLACE_MALLOC
+#include <stdlib.h>
+#include <errno.h>
+#endif
+
+#define LARGE_ALLOC_SIZE (HEAP_BLOCK_SIZE_10 + 100)
+#define ALIGNED_ALLOC_ALIGN (64)
+
+// Alignment guaranteed by operator new
+#if defined(__STDCPP_DEFAULT_NEW_ALIGNMENT__)
+#define NEW_ALIGN (__STDCPP_DEFAULT_NEW_ALIGNMENT__)
+#else
+#define NEW_ALIGN (alignof(max_align_t))
+#endif
+
+namespace Mark3 {
+
+extern "C" {
+void __cxa_guard_acquire() {};
+void __cxa_guard_release() {};
+}
+
+namespace
+{
+//---------------------------------------------------------------------------
+// Check alignment through a volatile, so the compiler can't fold the check
+// based on what it assumes about the standard allocation functions.
+bool IsAligned(void* pvData_, size_t uAlign_)
+{
+    volatile K_ADDR adData = reinterpret_cast<K_ADDR>(pvData_);
+    return (adData & (uAlign_ - 1)) == 0;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_system_heap_small_large_pass)
+{
+    SystemHeap::Init();
+
+    // Small objects fit in a fixed-size block, large objects in the arena
+    auto* pvSmall = SystemHeap::Allocate(HEAP_BLOCK_SIZE_1 - 1);
+    EXPECT_TRUE(pvSmall != nullptr);
+    EXPECT_TRUE(SystemHeap::GetUsableSize(pvSmall) >= HEAP_BLOCK_SIZE_1);
+
+    auto* pvLarge = SystemHeap::Allocate(LARGE_ALLOC_SIZE);
+    EXPECT_TRUE(pvLarge != nullptr);
+    EXPECT_TRUE(SystemHeap::GetUsableSize(pvLarge) >= LARGE_ALLOC_SIZE);
+    MemUtil::SetMemory(pvLarge, 0xFF, LARGE_ALLOC_SIZE);
+
+    SystemHeap::Free(pvSmall);
+    SystemHeap::Free(pvLarge);
+    SystemHeap::Free(nullptr);
+
+    // Memory is reused once freed
+    EXPECT_TRUE(SystemHeap::Allocate(HEAP_BLOCK_SIZE_1) == pvSmall);
+    EXPECT_TRUE(SystemHeap::Allocate(LARGE_ALLOC_SIZE) == pvLarge);
+    SystemHeap::Free(pvSmall);
+    SystemHeap::Free(pvLarge);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_system_heap_fixed_spill_pass)
+{
+    // Once the fixed-size blocks are exhausted, allocations come from the
+    // arena instead of failing.
+    void* apvAllocs[HEAP_BLOCK_COUNT_1 + HEAP_BLOCK_COUNT_2 + HEAP_BLOCK_COUNT_3 + 1];
+    for (auto& pvAlloc : apvAllocs) {
+        pvAlloc = SystemHeap::Allocate(1);
+        EXPECT_TRUE(pvAlloc != nullptr);
+    }
+    for (auto& pvAlloc : apvAllocs) {
+        SystemHeap::Free(pvAlloc);
+    }
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_system_heap_default_align_pass)
+{
+    // Every block meets the default alignment, whether it's served from a
+    // fixed-size bin or the arena.
+    void* apvAllocs[HEAP_BLOCK_COUNT_1 + HEAP_BLOCK_COUNT_2 + HEAP_BLOCK_COUNT_3 + 8];
+    size_t uSize = 1;
+    for (auto& pvAlloc : apvAllocs) {
+        pvAlloc = SystemHeap::Allocate(uSize);
+        EXPECT_TRUE(pvAlloc != nullptr);
+        EXPECT_TRUE(IsAligned(pvAlloc, SYSTEM_HEAP_DEFAULT_ALIGN));
+        uSize = (uSize * 5) % 128;
+    }
+
+    // Freeing and reallocating keeps blocks aligned
+    for (int i = 0; i < 4; i++) {
+        SystemHeap::Free(apvAllocs[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        apvAllocs[i] = SystemHeap::Allocate((i * 13) + 1);
+        EXPECT_TRUE(apvAllocs[i] != nullptr);
+        EXPECT_TRUE(IsAligned(apvAllocs[i], SYSTEM_HEAP_DEFAULT_ALIGN));
+    }
+    for (auto& pvAlloc : apvAllocs) {
+        SystemHeap::Free(pvAlloc);
+    }
+
+    auto* pvAligned = SystemHeap::AllocateAligned(SYSTEM_HEAP_DEFAULT_ALIGN * 2, 1);
+    EXPECT_TRUE(pvAligned != nullptr);
+    EXPECT_TRUE(IsAligned(pvAligned, SYSTEM_HEAP_DEFAULT_ALIGN * 2));
+    SystemHeap::Free(pvAligned);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_system_heap_aligned_pass)
+{
+    void* apvAllocs[4];
+    for (auto& pvAlloc : apvAllocs) {
+        pvAlloc = SystemHeap::AllocateAligned(ALIGNED_ALLOC_ALIGN, 10);
+        EXPECT_TRUE(pvAlloc != nullptr);
+        EXPECT_TRUE(((K_ADDR)pvAlloc & (ALIGNED_ALLOC_ALIGN - 1)) == 0);
+        EXPECT_TRUE(SystemHeap::GetUsableSize(pvAlloc) >= 10);
+        MemUtil::SetMemory(pvAlloc, 0xFF, 10);
+    }
+    for (auto& pvAlloc : apvAllocs) {
+        SystemHeap::Free(pvAlloc);
+    }
+
+    EXPECT_TRUE(SystemHeap::AllocateAligned(3, 10) == nullptr);
+    EXPECT_TRUE(SystemHeap::AllocateAligned(0, 10) == nullptr);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_system_heap_realloc_pass)
+{
+    auto* pu8Data = static_cast<uint8_t*>(SystemHeap::Reallocate(nullptr, HEAP_BLOCK_SIZE_1));
+    EXPECT_TRUE(pu8Data != nullptr);
+    for (uint8_t i = 0; i < HEAP_BLOCK_SIZE_1; i++) { pu8Data[i] = i; }
+
+    // Shrinking, or growing within the usable size, keeps the object in place
+    EXPECT_TRUE(SystemHeap::Reallocate(pu8Data, 1) == pu8Data);
+
+    // Growing moves the object, and keeps its contents
+    pu8Data = static_cast<uint8_t*>(SystemHeap::Reallocate(pu8Data, LARGE_ALLOC_SIZE));
+    EXPECT_TRUE(pu8Data != nullptr);
+    EXPECT_TRUE(SystemHeap::GetUsableSize(pu8Data) >= LARGE_ALLOC_SIZE);
+    for (uint8_t i = 0; i < HEAP_BLOCK_SIZE_1; i++) { EXPECT_TRUE(pu8Data[i] == i); }
+
+    EXPECT_TRUE(SystemHeap::Reallocate(pu8Data, 0) == nullptr);
+}
+
+#if SYSTEM_HEAP_REPLACE_MALLOC
+//---------------------------------------------------------------------------
+TEST(ut_system_heap_replace_malloc_pass)
+{
+    // The C library allocation functions are served from the system heap
+    auto* pvData = malloc(HEAP_BLOCK_SIZE_1 - 1);
+    EXPECT_TRUE(pvData != nullptr);
+    EXPECT_TRUE(SystemHeap::GetUsableSize(pvData) >= (HEAP_BLOCK_SIZE_1 - 1));
+    SystemHeap::Free(pvData);
+
+    auto* pu8Data = static_cast<uint8_t*>(calloc(2, HEAP_BLOCK_SIZE_1));
+    EXPECT_TRUE(pu8Data != nullptr);
+    for (uint8_t i = 0; i < (2 * HEAP_BLOCK_SIZE_1); i++) { EXPECT_TRUE(pu8Data[i] == 0); }
+    free(pu8Data);
+
+    // malloc() blocks are aligned for any fundamental type
+    for (size_t i = 1; i <= LARGE_ALLOC_SIZE; i += 37) {
+        pvData = malloc(i);
+        EXPECT_TRUE(pvData != nullptr);
+        EXPECT_TRUE(IsAligned(pvData, alignof(max_align_t)));
+        EXPECT_TRUE(SystemHeap::GetUsableSize(pvData) >= i);
+        free(pvData);
+    }
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_system_heap_replace_realloc_pass)
+{
+    auto* pu8Data = static_cast<uint8_t*>(realloc(nullptr, HEAP_BLOCK_SIZE_1));
+    EXPECT_TRUE(pu8Data != nullptr);
+    EXPECT_TRUE(SystemHeap::GetUsableSize(pu8Data) >= HEAP_BLOCK_SIZE_1);
+    for (uint8_t i = 0; i < HEAP_BLOCK_SIZE_1; i++) { pu8Data[i] = i; }
+
+    // Growing moves the object, keeping its contents and alignment
+    pu8Data = static_cast<uint8_t*>(realloc(pu8Data, LARGE_ALLOC_SIZE));
+    EXPECT_TRUE(pu8Data != nullptr);
+    EXPECT_TRUE(IsAligned(pu8Data, alignof(max_align_t)));
+    EXPECT_TRUE(SystemHeap::GetUsableSize(pu8Data) >= LARGE_ALLOC_SIZE);
+    for (uint8_t i = 0; i < HEAP_BLOCK_SIZE_1; i++) { EXPECT_TRUE(pu8Data[i] == i); }
+    free(pu8Data);
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_system_heap_replace_memalign_pass)
+{
+    void* pvData = nullptr;
+    EXPECT_TRUE(posix_memalign(&pvData, ALIGNED_ALLOC_ALIGN, 10) == 0);
+    EXPECT_TRUE(pvData != nullptr);
+    EXPECT_TRUE(IsAligned(pvData, ALIGNED_ALLOC_ALIGN));
+    EXPECT_TRUE(SystemHeap::GetUsableSize(pvData) >= 10);
+    free(pvData);
+
+    // The alignment must be a power of two, and a multiple of the pointer size
+    EXPECT_TRUE(posix_memalign(&pvData, 3 * sizeof(void*), 10) == EINVAL);
+    EXPECT_TRUE(posix_memalign(&pvData, sizeof(void*) / 2, 10) == EINVAL);
+
+    pvData = aligned_alloc(ALIGNED_ALLOC_ALIGN, ALIGNED_ALLOC_ALIGN);
+    EXPECT_TRUE(pvData != nullptr);
+    EXPECT_TRUE(IsAligned(pvData, ALIGNED_ALLOC_ALIGN));
+    EXPECT_TRUE(SystemHeap::GetUsableSize(pvData) >= ALIGNED_ALLOC_ALIGN);
+    free(pvData);
+
+    // Alignments up to the default are met by regular blocks
+    pvData = aligned_alloc(sizeof(void*), sizeof(void*));
+    EXPECT_TRUE(pvData != nullptr);
+    EXPECT_TRUE(IsAligned(pvData, alignof(max_align_t)));
+    free(pvData);
+}
+#endif
+
+#if SYSTEM_HEAP_REPLACE_NEW
+//---------------------------------------------------------------------------
+TEST(ut_system_heap_replace_new_pass)
+{
+    auto* pu32Data = new uint32_t[4];
+    EXPECT_TRUE(pu32Data != nullptr);
+    EXPECT_TRUE(SystemHeap::GetUsableSize(pu32Data) >= (4 * sizeof(uint32_t)));
+    delete[] pu32Data;
+
+    auto* pu32Value = new uint32_t(42);
+    EXPECT_TRUE(*pu32Value == 42);
+    EXPECT_TRUE(SystemHeap::GetUsableSize(pu32Value) >= sizeof(uint32_t));
+    delete pu32Value;
+
+    // new blocks meet the default alignment for new
+    for (size_t i = 1; i <= LARGE_ALLOC_SIZE; i += 37) {
+        auto* pu8Data = new uint8_t[i];
+        EXPECT_TRUE(IsAligned(pu8Data, NEW_ALIGN));
+        EXPECT_TRUE(SystemHeap::GetUsableSize(pu8Data) >= i);
+        delete[] pu8Data;
+    }
+}
+#endif
+
+//===========================================================================
+// Test Whitelist Goes Here
+//===========================================================================
+TEST_CASE_START
+TEST_CASE(ut_system_heap_small_large_pass),
+TEST_CASE(ut_system_heap_fixed_spill_pass),
+TEST_CASE(ut_system_heap_default_align_pass),
+TEST_CASE(ut_system_heap_aligned_pass),
+TEST_CASE(ut_system_heap_realloc_pass),
+#if SYSTEM_HEAP_REPLACE_MALLOC
+TEST_CASE(ut_system_heap_replace_malloc_pass),
+TEST_CASE(ut_system_heap_replace_realloc_pass),
+TEST_CASE(ut_system_heap_replace_memalign_pass),
+#endif
+#if SYSTEM_HEAP_REPLACE_NEW
+TEST_CASE(ut_system_heap_replace_new_pass),
+#endif
+TEST_CASE_END
+} // namespace mark3